@@ -0,0 +1,287 @@
+/** @file dlo_bmp.c
+ *
+ *  @brief Copies Windows BMP files to a device straight from a memory mapping of the file.
+ *
+ *  The file is mapped read-only and its headers are parsed where they lie, so the pixels
+ *  are never read into a buffer of our own: the normal bitmap copy reads them out of the
+ *  mapping (and hence out of the page cache, which is shared by every process showing the
+ *  same file). Only a paletted file's palette is converted, into a table on the stack.
+ *
+ *  Uncompressed 8 bpp (paletted), 16 bpp (555, or 565 given as bit fields), 24 bpp and
+ *  32 bpp files are understood, stored either bottom-up or top-down.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dlo_defs.h"
+#include "dlo_bmp.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+/** The first two bytes of a BMP file ("BM", read as a little-endian number). */
+#define BMP_MAGIC (0x4D42)
+
+/** Size of the file header which comes before the bitmap header (bytes). */
+#define BMP_FILE_HDR_SZ (14u)
+
+/** Size of the smallest bitmap header we understand, a BITMAPINFOHEADER (bytes). */
+#define BMP_INFO_HDR_SZ (40u)
+
+/** Compression type for pixels which aren't compressed. */
+#define BMP_BI_RGB (0u)
+
+/** Compression type for uncompressed pixels whose layout is given by colour bit masks. */
+#define BMP_BI_BITFIELDS (3u)
+
+/** Number of entries in a full palette. */
+#define BMP_PAL_ENTRIES (256u)
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Read a little-endian 16 bit number from the file (which may not be aligned).
+ *
+ *  @param  ptr  Pointer to the number.
+ *
+ *  @return  The number.
+ */
+static uint32_t rd16(const uint8_t * const ptr);
+
+
+/** Read a little-endian 32 bit number from the file (which may not be aligned).
+ *
+ *  @param  ptr  Pointer to the number.
+ *
+ *  @return  The number.
+ */
+static uint32_t rd32(const uint8_t * const ptr);
+
+
+/** Work out the pixel format of a 16 or 32 bpp file from its compression type and colour masks.
+ *
+ *  @param  map   Pointer to the start of the file.
+ *  @param  bpp   Bits per pixel.
+ *  @param  comp  Compression type.
+ *  @param  fmt   Pointer to the pixel format (filled in).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t masks_to_fmt(const uint8_t * const map, const uint32_t bpp, const uint32_t comp, dlo_pixfmt_t * const fmt);
+
+
+/** Copy the mapped file to the device, once its headers have been checked.
+ *
+ *  @param  uid        Unique ID of the device.
+ *  @param  flags      Flags word for the copy.
+ *  @param  map        Pointer to the start of the file.
+ *  @param  size       Size of the file (bytes).
+ *  @param  dest_view  Pointer to the destination viewport (or NULL).
+ *  @param  dest_pos   Pointer to the destination position (or NULL).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t copy_mapped(const dlo_dev_t uid, dlo_bmpflags_t flags, const uint8_t * const map, const size_t size,
+                                 const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+dlo_retcode_t dlo_bmp_copy_file(const dlo_dev_t uid, const dlo_bmpflags_t flags, const char * const path,
+                                const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  struct stat   info;
+  void         *map;
+  dlo_retcode_t err;
+  int           fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return dlo_err_open;
+  if (fstat(fd, &info) < 0)
+  {
+    (void) close(fd);
+    return dlo_err_open;
+  }
+  if (info.st_size < (off_t)(BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ))
+  {
+    (void) close(fd);
+    return dlo_err_bad_fmt;
+  }
+
+  /* The mapping stays valid after the file is closed */
+  map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  (void) close(fd);
+  if (map == MAP_FAILED)
+    return dlo_err_memory;
+
+  err = copy_mapped(uid, flags, (const uint8_t *)map, (size_t)info.st_size, dest_view, dest_pos);
+  (void) munmap(map, (size_t)info.st_size);
+
+  return err;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static uint32_t rd16(const uint8_t * const ptr)
+{
+  return ptr[0] | (ptr[1] << 8);
+}
+
+
+static uint32_t rd32(const uint8_t * const ptr)
+{
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+
+static dlo_retcode_t masks_to_fmt(const uint8_t * const map, const uint32_t bpp, const uint32_t comp, dlo_pixfmt_t * const fmt)
+{
+  uint32_t red, grn, blu;
+
+  if (comp == BMP_BI_RGB)
+  {
+    *fmt = bpp == 16 ? dlo_pixfmt_srgb1555 : dlo_pixfmt_argb8888;
+    return dlo_ok;
+  }
+  if (comp != BMP_BI_BITFIELDS)
+    return dlo_err_bad_fmt;
+
+  /* The masks follow a BITMAPINFOHEADER, and are the next fields of any larger header */
+  red = rd32(map + BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ);
+  grn = rd32(map + BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ + 4);
+  blu = rd32(map + BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ + 8);
+
+  if (bpp == 16 && red == 0xF800 && grn == 0x07E0 && blu == 0x001F)
+    *fmt = dlo_pixfmt_rgb565;
+  else if (bpp == 16 && red == 0x7C00 && grn == 0x03E0 && blu == 0x001F)
+    *fmt = dlo_pixfmt_srgb1555;
+  else if (bpp == 32 && red == 0xFF0000 && grn == 0xFF00 && blu == 0xFF)
+    *fmt = dlo_pixfmt_argb8888;
+  else
+    return dlo_err_bad_fmt;
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t copy_mapped(const dlo_dev_t uid, dlo_bmpflags_t flags, const uint8_t * const map, const size_t size,
+                                 const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  dlo_col32_t pal[BMP_PAL_ENTRIES];
+  dlo_fbuf_t  fbuf;
+  dlo_dot_t   pos;
+  uint32_t    pix_off  = rd32(map + 10);
+  uint32_t    hdr_sz   = rd32(map + 14);
+  int32_t     width    = (int32_t)rd32(map + 18);
+  int32_t     height   = (int32_t)rd32(map + 22);
+  uint32_t    bpp      = rd16(map + 28);
+  uint32_t    comp     = rd32(map + 30);
+  uint32_t    ncols    = rd32(map + 46);
+  bool        top_down = height < 0;
+  uint32_t    rows     = top_down ? -(uint32_t)height : (uint32_t)height;
+  uint32_t    row_sz;
+  uint32_t    bypp;
+  uint32_t    y;
+
+  if (rd16(map) != BMP_MAGIC || hdr_sz < BMP_INFO_HDR_SZ || rd16(map + 26) != 1)
+    return dlo_err_bad_fmt;
+
+  /* The bitmap header must end before the pixels start (so later sums can't wrap) */
+  if (pix_off < BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ || hdr_sz > pix_off - BMP_FILE_HDR_SZ)
+    return dlo_err_bad_fmt;
+  if (bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32)
+    return dlo_err_bad_fmt;
+  if (width <= 0 || width > UINT16_MAX || rows == 0 || rows > UINT16_MAX)
+    return dlo_err_bad_fmt;
+
+  /* Rows are padded to a four byte boundary, and must all lie inside the file */
+  row_sz = (((uint32_t)width * bpp + 31) / 32) * 4;
+  if (pix_off > size || (size - pix_off) / row_sz < rows)
+    return dlo_err_bad_fmt;
+
+  dlo_memset(&fbuf, 0, sizeof(fbuf));
+  switch (bpp)
+  {
+    case 8:
+    {
+      const uint8_t *src = map + BMP_FILE_HDR_SZ + hdr_sz;
+      uint32_t       i;
+
+      /* The palette's entries are blue, green, red, unused; unlisted entries are black */
+      if (!ncols)
+        ncols = BMP_PAL_ENTRIES;
+      if (comp != BMP_BI_RGB || ncols > BMP_PAL_ENTRIES || BMP_FILE_HDR_SZ + hdr_sz + (4 * ncols) > pix_off)
+        return dlo_err_bad_fmt;
+      for (i = 0; i < BMP_PAL_ENTRIES; i++, src += 4)
+        pal[i] = i < ncols ? DLO_RGB(src[2], src[1], src[0]) : 0;
+      fbuf.fmt = dlo_pixfmt_lut8;
+      fbuf.lut = pal;
+      break;
+    }
+    case 16:
+    case 32:
+      if (comp == BMP_BI_BITFIELDS && BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ + 12 > pix_off)
+        return dlo_err_bad_fmt;
+      ERR(masks_to_fmt(map, bpp, comp, &fbuf.fmt));
+      break;
+
+    default:
+      if (comp != BMP_BI_RGB)
+        return dlo_err_bad_fmt;
+      fbuf.fmt = dlo_pixfmt_rgb888;
+      break;
+  }
+  bypp        = bpp / 8;
+  fbuf.width  = (uint16_t)width;
+  fbuf.base   = (void *)(map + pix_off);
+
+  /* Bottom-up files are the usual kind: flip them unless the caller asks for a flip */
+  if (!top_down)
+    flags.v_flip = !flags.v_flip;
+
+  /* Usually the padded rows are a whole number of pixels apart, and one copy does it all */
+  if (row_sz % bypp == 0)
+  {
+    fbuf.height = (uint16_t)rows;
+    fbuf.stride = row_sz / bypp;
+    return dlo_copy_host_bmp(uid, flags, &fbuf, dest_view, dest_pos);
+  }
+
+  /* Otherwise copy a row at a time, straight from where each row lies */
+  pos.x       = dest_pos ? dest_pos->x : 0;
+  fbuf.height = 1;
+  fbuf.stride = fbuf.width;
+  for (y = 0; y < rows; y++)
+  {
+    pos.y     = (dest_pos ? dest_pos->y : 0) + (int32_t)(flags.v_flip ? rows - 1 - y : y);
+    fbuf.base = (void *)(map + pix_off + ((size_t)row_sz * y));
+    ERR(dlo_copy_host_bmp(uid, flags, &fbuf, dest_view, &pos));
+  }
+  return dlo_ok;
+}
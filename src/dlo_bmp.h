@@ -0,0 +1,46 @@
+/** @file dlo_bmp.h
+ *
+ *  @brief Header file for copying Windows BMP files to a device.
+ *
+ *  This file defines the API between the public calls and the code which maps a BMP file
+ *  into memory and hands its pixels, where they lie, to the normal bitmap copy.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_BMP_H
+#define DLO_BMP_H         /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Map a BMP file into memory and copy it to a device.
+ *
+ *  @param  uid        Unique ID of the device.
+ *  @param  flags      Flags word for the copy.
+ *  @param  path       Path of the BMP file.
+ *  @param  dest_view  Pointer to the destination viewport (or NULL).
+ *  @param  dest_pos   Pointer to the destination position (or NULL).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_bmp_copy_file(const dlo_dev_t uid, const dlo_bmpflags_t flags, const char * const path,
+                                       const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
+
+
+#endif
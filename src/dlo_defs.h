@@ -97,6 +97,9 @@
 /** If a called function (cmd) returns an error code, return the error code from the calling function. */
 #define ERR(cmd) do { dlo_retcode_t __err = (cmd); if (__err != dlo_ok) return __err; } while(0)
 
+/** Test whether a return code means the call succeeded (perhaps with a warning), rather than failed. */
+#define SUCCEEDED(err) ((err) == dlo_ok || ((err) >= dlo_warn_dl160_mode && (err) < dlo_user_example))
+
 /** If a usb_ function call returns an error code, return an error and store the code in the @a usberr global. */
 #define UERR(cmd) do { usberr = (cmd); if (usberr < 0) return usb_error_grab(); } while (0)
 
@@ -133,8 +136,16 @@
 /** Default buffer size for sending commands to the device. */
 #define BUF_SIZE (64*1024u)
 
-/** Threshold (bytes away from being full) for flushing the command buffer before adding any more commands to it. */
-#define BUF_HIGH_WATER_MARK (1*1024u)
+/** Number of blocks in the write queue of a non-blocking device at which drawing calls start
+ *  to return @a dlo_err_would_block (until the link has been measured).
+ */
+#define QUEUE_DEPTH (4u)
+
+/** Smallest transfer size (and command buffer size) that a device can be given. */
+#define XFER_MIN (4*1024u)
+
+/** Size of each block of commands in a command segment (a whole block must fit in an empty command buffer, however small it's tuned). */
+#define SEG_BLOCK_SIZE XFER_MIN
 
 /** A 16 bits per pixel colour number (not normally used outside libdlo). */
 typedef uint16_t dlo_col16_t;
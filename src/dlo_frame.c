@@ -0,0 +1,304 @@
+/** @file dlo_frame.c
+ *
+ *  @brief Implements the timed submission of video frames.
+ *
+ *  Each device has a queue of frames in presentation time order. A frame is sent when
+ *  there is just enough time left before its presentation time to send it, going by how
+ *  long recent frames have taken. Any frame which couldn't finish arriving before the
+ *  next frame is due is dropped instead, since it would be replaced on the screen straight
+ *  away. For the last frame in the queue, the next frame is assumed to follow at the same
+ *  interval as the frames before it.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "dlo_defs.h"
+#include "dlo_frame.h"
+#include "dlo_usb.h"
+#include "dlo_rt.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+/** Time (microseconds) to allow on top of the estimated time to send a frame, for jitter.
+ */
+#define FRAME_LEAD (1000u)
+
+/** A frame which finishes arriving this long (microseconds) after its presentation time is late.
+ */
+#define FRAME_LATE (2000u)
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Estimate how long it will take to send a frame.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  frame  Pointer to the frame.
+ *
+ *  @return  Time in microseconds.
+ */
+static uint32_t frame_estimate(const dlo_device_t * const dev, const dlo_frame_t * const frame);
+
+
+/** Send a frame to the device.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  frame  Pointer to the frame.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t frame_send(dlo_device_t * const dev, const dlo_frame_t * const frame);
+
+
+/** Unlink the first frame from the queue and keep its block for reuse (or free it).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+static void frame_pop(dlo_device_t * const dev);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+uint64_t dlo_frame_now(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t)ts.tv_sec * 1000000u) + (ts.tv_nsec / 1000u);
+}
+
+
+dlo_retcode_t dlo_frame_submit(dlo_device_t * const dev, const dlo_bmpflags_t flags,
+                               const dlo_fbuf_t * const fbuf,
+                               const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos,
+                               const uint64_t pts)
+{
+  uint32_t      bypp  = FORMAT_TO_BYTES_PER_PIXEL(fbuf->fmt);
+  size_t        row   = (size_t)bypp * fbuf->width;
+  size_t        plane = row * fbuf->height;
+  size_t        size  = fbuf->fmt == dlo_pixfmt_native ? plane + ((size_t)fbuf->width * fbuf->height) : plane;
+  dlo_frame_t **prev  = &dev->frames;
+  dlo_frame_t  *frame;
+  uint8_t      *src;
+  uint8_t      *dest;
+  uint32_t      y;
+
+  /* Reuse the spare block if it's big enough */
+  frame = dev->fspare;
+  if (frame && frame->size >= size)
+    dev->fspare = NULL;
+  else
+  {
+    frame = (dlo_frame_t *)dlo_malloc(sizeof(dlo_frame_t) + size);
+    NERR(frame);
+    frame->size = size;
+  }
+
+  /* Copy the pixels, closing up any gap between the rows */
+  src  = (uint8_t *)fbuf->base;
+  dest = (uint8_t *)(frame + 1);
+  for (y = 0; y < fbuf->height; y++)
+  {
+    dlo_memcpy(dest, src, row);
+    src  += (size_t)bypp * fbuf->stride;
+    dest += row;
+  }
+
+  /* Native bitmaps have a second plane, at one byte per pixel */
+  if (fbuf->fmt == dlo_pixfmt_native)
+  {
+    src = (uint8_t *)fbuf->base8;
+    for (y = 0; y < fbuf->height; y++)
+    {
+      dlo_memcpy(dest, src, fbuf->width);
+      src  += fbuf->stride;
+      dest += fbuf->width;
+    }
+  }
+  frame->pts         = pts;
+  frame->flags       = flags;
+  frame->fbuf        = *fbuf;
+  frame->fbuf.base   = frame + 1;
+  frame->fbuf.base8  = (uint8_t *)(frame + 1) + plane;
+  frame->fbuf.stride = fbuf->width;
+  frame->use_view    = dest_view != NULL;
+  if (dest_view)
+    frame->view      = *dest_view;
+  frame->pos.x       = dest_pos ? dest_pos->x : 0;
+  frame->pos.y       = dest_pos ? dest_pos->y : 0;
+
+  /* Insert the frame in presentation time order (after any others for the same time) */
+  while (*prev && (*prev)->pts <= pts)
+    prev = &(*prev)->next;
+  frame->next = *prev;
+  *prev       = frame;
+
+  /* Note the interval between frames, to give the last frame in the queue a deadline */
+  if (pts > dev->frame_pts)
+  {
+    if (dev->frame_pts)
+      dev->frame_gap = (uint32_t)(pts - dev->frame_pts);
+    dev->frame_pts = pts;
+  }
+  dev->fstats.submitted += 1;
+  dev->fstats.queued    += 1;
+
+  return dlo_frame_pump(dev);
+}
+
+
+dlo_retcode_t dlo_frame_pump(dlo_device_t * const dev)
+{
+  uint64_t now = dlo_frame_now();
+
+  while (dev->frames)
+  {
+    dlo_frame_t  *frame = dev->frames;
+    uint32_t      est   = frame_estimate(dev, frame);
+    uint64_t      limit = frame->next ? frame->next->pts : frame->pts + dev->frame_gap;
+    dlo_retcode_t err;
+
+    /* Not time to start sending it yet */
+    if (now + est + FRAME_LEAD < frame->pts)
+      break;
+
+    /* If it couldn't arrive before the next frame is due, the next frame replaces it */
+    if ((frame->next || dev->frame_gap) && now + est > limit)
+    {
+      dev->fstats.dropped += 1;
+      frame_pop(dev);
+      continue;
+    }
+
+    /* A non-blocking device may not have room in its write queue yet */
+    if (dlo_usb_would_block(dev))
+      break;
+
+    err = frame_send(dev, frame);
+    frame_pop(dev);
+    if (err != dlo_ok)
+    {
+      dev->fstats.dropped += 1;
+      return err;
+    }
+    now = dlo_frame_now();
+  }
+  return dlo_ok;
+}
+
+
+int32_t dlo_frame_timeout(const dlo_device_t * const dev)
+{
+  const dlo_frame_t *frame = dev->frames;
+  uint64_t           due;
+
+  if (!frame)
+    return -1;
+
+  /* Round up, so that the frame is due when the caller comes back */
+  due = dlo_frame_now() + frame_estimate(dev, frame) + FRAME_LEAD;
+  if (due >= frame->pts)
+    return 0;
+
+  return (int32_t)((frame->pts - due + 999u) / 1000u);
+}
+
+
+void dlo_frame_free(dlo_device_t * const dev)
+{
+  while (dev->frames)
+  {
+    dev->fstats.dropped += 1;
+    frame_pop(dev);
+  }
+  if (dev->fspare)
+    dlo_free(dev->fspare);
+  dev->fspare = NULL;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static uint32_t frame_estimate(const dlo_device_t * const dev, const dlo_frame_t * const frame)
+{
+  /* Until a frame has been sent, assume every pixel goes as raw 24 bpp */
+  if (dev->frame_us)
+    return dev->frame_us;
+
+  return dlo_usb_link_time(dev, (uint64_t)frame->fbuf.width * frame->fbuf.height * 3u);
+}
+
+
+static dlo_retcode_t frame_send(dlo_device_t * const dev, const dlo_frame_t * const frame)
+{
+  uint64_t      start = dlo_frame_now();
+  dlo_fence_t   fence = dlo_usb_fence(dev);
+  dlo_retcode_t err;
+  uint64_t      end;
+
+  err = dlo_copy_host_bmp((dlo_dev_t)dev, frame->flags, &frame->fbuf, frame->use_view ? &frame->view : NULL, &frame->pos);
+  if (err == dlo_ok)
+    err = dlo_usb_write(dev);
+  if (err != dlo_ok)
+    return err;
+
+  /* A non-blocking device has only queued the commands, so allow for the link sending them */
+  end = dlo_frame_now();
+  if (dev->nonblock)
+    end += dlo_usb_link_time(dev, dlo_usb_fence(dev) - fence);
+
+  /* Keep a running average of how long frames take */
+  dev->frame_us = dev->frame_us ? (uint32_t)(((3u * (uint64_t)dev->frame_us) + (end - start)) / 4u) : (uint32_t)(end - start);
+
+  dev->fstats.shown += 1;
+  if (end > frame->pts + FRAME_LATE)
+    dev->fstats.late += 1;
+  dlo_rt_jitter(dev->rtstats.frame_jitter, end, frame->pts);
+
+  return dlo_ok;
+}
+
+
+static void frame_pop(dlo_device_t * const dev)
+{
+  dlo_frame_t *frame = dev->frames;
+
+  dev->frames         = frame->next;
+  dev->fstats.queued -= 1;
+
+  /* Keep the biggest block, as frames are usually all the same size */
+  if (dev->fspare && dev->fspare->size >= frame->size)
+    dlo_free(frame);
+  else
+  {
+    if (dev->fspare)
+      dlo_free(dev->fspare);
+    dev->fspare = frame;
+  }
+}
+
+
+/* End of file -------------------------------------------------------------------------*/
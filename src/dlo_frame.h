@@ -0,0 +1,81 @@
+/** @file dlo_frame.h
+ *
+ *  @brief Header file for the timed submission of video frames.
+ *
+ *  This file defines the API between libdlo.c and the per-device queue of video frames
+ *  which are waiting for their presentation times.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_FRAME_H
+#define DLO_FRAME_H       /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Return the current time on the clock used for presentation times.
+ *
+ *  @return  Time in microseconds.
+ */
+extern uint64_t dlo_frame_now(void);
+
+
+/** Add a copy of a frame to the queue of the specified device, then send any frames which are due.
+ *
+ *  @param  dev        Pointer to @a dlo_device_t structure.
+ *  @param  flags      Flags word indicating special behaviour.
+ *  @param  fbuf       Pointer to the frame.
+ *  @param  dest_view  Viewport to copy the frame into (or NULL for the current screen).
+ *  @param  dest_pos   Position within the viewport of the frame's top-left corner (or NULL).
+ *  @param  pts        Presentation time (microseconds).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_frame_submit(dlo_device_t * const dev, const dlo_bmpflags_t flags,
+                                      const dlo_fbuf_t * const fbuf,
+                                      const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos,
+                                      const uint64_t pts);
+
+
+/** Send the frames which are due on the specified device, dropping any which are too late.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_frame_pump(dlo_device_t * const dev);
+
+
+/** Return how long until the next frame on the specified device is due to be sent.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Time in milliseconds (or -1 if there are no frames queued).
+ */
+extern int32_t dlo_frame_timeout(const dlo_device_t * const dev);
+
+
+/** Throw away the frame queue of the specified device (the frames count as dropped).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_frame_free(dlo_device_t * const dev);
+
+
+#endif
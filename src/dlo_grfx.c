@@ -24,6 +24,10 @@
 #include "dlo_defs.h"
 #include "dlo_grfx.h"
 #include "dlo_usb.h"
+#include "dlo_pool.h"
+#include "dlo_seg.h"
+#include "dlo_frame.h"
+#include "dlo_rt.h"
 
 
 /* File-scope defines ------------------------------------------------------------------*/
@@ -32,9 +36,27 @@
 /** Maximum number of pixels that can be supplied to a raw write command. */
 #define RAW_MAX_PIXELS (256)
 
+/** Maximum number of pixels in a batch of raw write commands built after one check for room (both planes fit in the smallest transfer). */
+#define RAW_BATCH_PIXELS (4 * RAW_MAX_PIXELS)
+
+/** Number of bytes taken by raw write commands for @a pix pixels of @a bypp bytes each. */
+#define RAW_CMD_BYTES(pix, bypp) ((6 * (((pix) + RAW_MAX_PIXELS - 1) / RAW_MAX_PIXELS)) + ((bypp) * (pix)))
+
 /** Maximum number of pixels that will fit into the scrape buffer. */
 #define SCRAPE_MAX_PIXELS (2048)
 
+/** Number of pixel rows in each task handed to the encoder pool. */
+#define BAND_ROWS (16)
+
+/** Number of unchanged pixels in a row after which it is cheaper to start a new raw write command than to resend them. */
+#define DAMAGE_MIN_GAP (4)
+
+/** Number of entries the repair list starts with (it doubles in size each time it fills up). */
+#define REPAIR_MIN_ENTRIES (64)
+
+/** Number of entries the repair list of a real-time device is given when it's claimed. */
+#define REPAIR_RT_ENTRIES (1024)
+
 /** Return red/green/blue component of a 16 bpp colour number (565). */
 #define DLO_RGB16(red, grn, blu) (uint16_t)(((((red) & 0xF8) << 8) | (((grn) & 0xFC) << 3) | (((blu) >> 3))) & 0xFFFF)
 
@@ -45,123 +67,116 @@
 /* File-scope inline functions ---------------------------------------------------------*/
 
 
-/** Build a "plot horizontal line" command in a buffer.
+/** Build a "plot horizontal line" command at a point in the command buffer.
  *
- *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  The caller must already have made room for the command (see @c reserve()).
+ *
+ *  @param  ptr     Pointer to where the command goes.
  *  @param  base    Destination address in device for start of line.
  *  @param  remain  Line length.
  *  @param  col     Colour of point to plot.
  *
- *  @return  Return code, zero for no error.
+ *  @return  Pointer to the byte following the command.
  */
-inline dlo_retcode_t cmd_hline16(dlo_device_t * const dev, const dlo_ptr_t base, const uint32_t remain, const dlo_col16_t col)
+inline char *put_hline16(char *ptr, const dlo_ptr_t base, const uint32_t remain, const dlo_col16_t col)
 {
-  if (dev->bufend - dev->bufptr < 9)
-    return dlo_err_buf_full;
-
-  *(dev->bufptr)++ = WRITE_RL16[0];
-  *(dev->bufptr)++ = WRITE_RL16[1];
-  *(dev->bufptr)++ = (char)(base >> 16);
-  *(dev->bufptr)++ = (char)(base >> 8);
-  *(dev->bufptr)++ = (char)base;
-  *(dev->bufptr)++ = (char)remain;
-  *(dev->bufptr)++ = (char)remain;
-  *(dev->bufptr)++ = (char)(col >> 8);
-  *(dev->bufptr)++ = (char)col;
-
-  return dlo_ok;
+  ptr[0] = WRITE_RL16[0];
+  ptr[1] = WRITE_RL16[1];
+  ptr[2] = (char)(base >> 16);
+  ptr[3] = (char)(base >> 8);
+  ptr[4] = (char)base;
+  ptr[5] = (char)remain;
+  ptr[6] = (char)remain;
+  ptr[7] = (char)(col >> 8);
+  ptr[8] = (char)col;
+
+  return ptr + 9;
 }
 
 
-
-/** Build a "plot horizontal line" command in a buffer for fine detail colour space.
+/** Build a "plot horizontal line" command at a point in the command buffer for fine detail colour space.
  *
- *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  The caller must already have made room for the command (see @c reserve()).
+ *
+ *  @param  ptr     Pointer to where the command goes.
  *  @param  base    Destination address in device for start of line.
  *  @param  remain  Line length.
  *  @param  col     Colour of point to plot.
  *
- *  @return  Return code, zero for no error.
+ *  @return  Pointer to the byte following the command.
  */
-inline dlo_retcode_t cmd_hline8(dlo_device_t * const dev, const dlo_ptr_t base, const uint32_t remain, const dlo_col8_t col)
+inline char *put_hline8(char *ptr, const dlo_ptr_t base, const uint32_t remain, const dlo_col8_t col)
 {
-  if (dev->bufend - dev->bufptr < 8)
-    return dlo_err_buf_full;
-
-  *(dev->bufptr)++ = WRITE_RL8[0];
-  *(dev->bufptr)++ = WRITE_RL8[1];
-  *(dev->bufptr)++ = (char)(base >> 16);
-  *(dev->bufptr)++ = (char)(base >> 8);
-  *(dev->bufptr)++ = (char)base;
-  *(dev->bufptr)++ = (char)remain;
-  *(dev->bufptr)++ = (char)remain;
-  *(dev->bufptr)++ = (char)col;
-
-  return dlo_ok;
+  ptr[0] = WRITE_RL8[0];
+  ptr[1] = WRITE_RL8[1];
+  ptr[2] = (char)(base >> 16);
+  ptr[3] = (char)(base >> 8);
+  ptr[4] = (char)base;
+  ptr[5] = (char)remain;
+  ptr[6] = (char)remain;
+  ptr[7] = (char)col;
+
+  return ptr + 8;
 }
 
 
-/** Build a "copy horizontal line" command in a buffer.
+/** Build a "copy horizontal line" command at a point in the command buffer.
  *
- *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  The caller must already have made room for the command (see @c reserve()).
+ *
+ *  @param  ptr   Pointer to where the command goes.
+ *  @param  cmd   Pointer to the command code (@a WRITE_COPY16 or @a WRITE_COPY8).
  *  @param  src   Source address in device for start of copy.
  *  @param  len   Copy length.
  *  @param  dest  Destination address in device for copy.
  *
- *  @return  Return code, zero for no error.
+ *  @return  Pointer to the byte following the command.
  */
-inline dlo_retcode_t cmd_copy16(dlo_device_t * const dev, const dlo_ptr_t src, const uint32_t len, const dlo_ptr_t dest)
+inline char *put_copy(char *ptr, const char * const cmd, const dlo_ptr_t src, const uint32_t len, const dlo_ptr_t dest)
 {
-  if (dev->bufend - dev->bufptr < 9)
-    return dlo_err_buf_full;
-
-  *(dev->bufptr)++ = WRITE_COPY16[0];
-  *(dev->bufptr)++ = WRITE_COPY16[1];
-  *(dev->bufptr)++ = (char)(dest >> 16);
-  *(dev->bufptr)++ = (char)(dest >> 8);
-  *(dev->bufptr)++ = (char)dest;
-  *(dev->bufptr)++ = len == 256 ? '\0' : (char)len;
-  *(dev->bufptr)++ = (char)(src >> 16);
-  *(dev->bufptr)++ = (char)(src >> 8);
-  *(dev->bufptr)++ = (char)src;
-
-  return dlo_ok;
+  ptr[0] = cmd[0];
+  ptr[1] = cmd[1];
+  ptr[2] = (char)(dest >> 16);
+  ptr[3] = (char)(dest >> 8);
+  ptr[4] = (char)dest;
+  ptr[5] = len == 256 ? '\0' : (char)len;
+  ptr[6] = (char)(src >> 16);
+  ptr[7] = (char)(src >> 8);
+  ptr[8] = (char)src;
+
+  return ptr + 9;
 }
 
 
-/** Build a "copy horizontal line" command in a buffer for fine detail colour space.
+/** Build the header of a "write raw pixels" command at a point in the command buffer.
  *
- *  @param  dev   Pointer to @a dlo_device_t structure.
- *  @param  src   Source address in device for start of copy.
- *  @param  len   Copy length.
- *  @param  dest  Destination address in device for copy.
+ *  The caller must already have made room for the command and its pixels (see @c reserve()).
  *
- *  @return  Return code, zero for no error.
+ *  @param  ptr   Pointer to where the command goes.
+ *  @param  cmd   Pointer to the command code (@a WRITE_RAW16 or @a WRITE_RAW8).
+ *  @param  base  Destination address in device for the first pixel.
+ *  @param  pix   Number of pixels which follow (1 to @a RAW_MAX_PIXELS).
+ *
+ *  @return  Pointer to the byte following the header, where the pixels go.
  */
-inline dlo_retcode_t cmd_copy8(dlo_device_t * const dev, const dlo_ptr_t src, const uint32_t len, const dlo_ptr_t dest)
+inline char *put_raw(char *ptr, const char * const cmd, const dlo_ptr_t base, const uint32_t pix)
 {
-  if (dev->bufend - dev->bufptr < 9)
-    return dlo_err_buf_full;
-
-  *(dev->bufptr)++ = WRITE_COPY8[0];
-  *(dev->bufptr)++ = WRITE_COPY8[1];
-  *(dev->bufptr)++ = (char)(dest >> 16);
-  *(dev->bufptr)++ = (char)(dest >> 8);
-  *(dev->bufptr)++ = (char)dest;
-  *(dev->bufptr)++ = len == 256 ? '\0' : (char)len;
-  *(dev->bufptr)++ = (char)(src >> 16);
-  *(dev->bufptr)++ = (char)(src >> 8);
-  *(dev->bufptr)++ = (char)src;
-
-  return dlo_ok;
+  ptr[0] = cmd[0];
+  ptr[1] = cmd[1];
+  ptr[2] = (char)(base >> 16);
+  ptr[3] = (char)(base >> 8);
+  ptr[4] = (char)base;
+  ptr[5] = (char)pix;
+
+  return ptr + 6;
 }
 
 
 /* Ensure the inline functions get compiled somewhere in case they cannot be inlined */
-extern dlo_retcode_t cmd_hline16(dlo_device_t * const dev, const dlo_ptr_t base, const uint32_t remain, const dlo_col16_t col);
-extern dlo_retcode_t cmd_hline8( dlo_device_t * const dev, const dlo_ptr_t base, const uint32_t remain, const dlo_col8_t  col);
-extern dlo_retcode_t cmd_copy16( dlo_device_t * const dev, const dlo_ptr_t src,  const uint32_t len,    const dlo_ptr_t   dest);
-extern dlo_retcode_t cmd_copy8(  dlo_device_t * const dev, const dlo_ptr_t src,  const uint32_t len,    const dlo_ptr_t   dest);
+extern char *put_hline16(char *ptr, const dlo_ptr_t base, const uint32_t remain, const dlo_col16_t col);
+extern char *put_hline8( char *ptr, const dlo_ptr_t base, const uint32_t remain, const dlo_col8_t  col);
+extern char *put_copy(   char *ptr, const char * const cmd, const dlo_ptr_t src, const uint32_t len, const dlo_ptr_t dest);
+extern char *put_raw(    char *ptr, const char * const cmd, const dlo_ptr_t base, const uint32_t pix);
 
 
 /* File-scope types --------------------------------------------------------------------*/
@@ -170,11 +185,44 @@ extern dlo_retcode_t cmd_copy8(  dlo_device_t * const dev, const dlo_ptr_t src,
 /** Function pointer for functions to convert a pixel into a colour number.
  *
  *  @param  ptr   Pointer to pixel.
+ *  @param  lut   Look-up table for 8 bpp pixels.
  *  @param  swap  Flag to indicate red and blue components need to be swapped.
  *
  *  @return  Colour number for read pixel.
  */
-typedef dlo_col32_t (*read_pixel_t) (const uint8_t * const ptr, const bool swap);
+typedef dlo_col32_t (*read_pixel_t) (const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap);
+
+
+/** Function pointer for functions to convert a colour number into a pixel.
+ *
+ *  @param  ptr   Pointer to pixel.
+ *  @param  col   Colour number to write.
+ *  @param  swap  Flag to indicate red and blue components need to be swapped.
+ */
+typedef void (*write_pixel_t) (uint8_t * const ptr, const dlo_col32_t col, const bool swap);
+
+
+/** A band of rows of a host bitmap for a pool worker to convert into the internal colour format.
+ */
+typedef struct band_s
+{
+  dlo_task_t         task;         /**< The task (must be the first member). */
+  dlo_device_t      *dev;          /**< Pointer to @a dlo_device_t structure. */
+  read_pixel_t       rdpx;         /**< Pointer to the pixel reading function. */
+  const dlo_col32_t *lut;          /**< Look-up table for 8 bpp source pixels. */
+  uint32_t           bypp;         /**< Bytes per pixel of the source pixels. */
+  bool               swap;         /**< Flag: swap the red/blue component order. */
+  bool               blend;        /**< Flag: blend the source pixels over the shadow. */
+  const uint8_t     *src;          /**< First source row of the band. */
+  int32_t            src_step;     /**< Bytes from one source row to the next (negative if flipping). */
+  dlo_ptr_t          base16;       /**< Destination of the first row's 16 bpp pixel data. */
+  dlo_ptr_t          base8;        /**< Destination of the first row's 8 bpp pixel data. */
+  uint32_t           stride;       /**< Pixels from one destination row to the next. */
+  uint32_t           width;        /**< Width of the band (pixels). */
+  uint32_t           rows;         /**< Height of the band (pixels). */
+  dlo_col16_t       *out16;        /**< Where to put the 16 bpp components (@a rows * @a width). */
+  dlo_col8_t        *out8;         /**< Where to put the 8 bpp components (@a rows * @a width). */
+} band_t;                          /**< A struct @a band_s. */
 
 
 /* File-scope variables ----------------------------------------------------------------*/
@@ -185,14 +233,14 @@ typedef dlo_col32_t (*read_pixel_t) (const uint8_t * const ptr, const bool swap)
 static read_pixel_t fmt_to_fn[DLO_PIXFMT_MAX];
 
 
-/** Standard look-up table for converting 8 bpp pixels in bgr323 format into colour numbers.
+/** Look-up table of pixel writing function pointers for a specified pixel format.
  */
-static dlo_col32_t lut8bpp[256];
+static write_pixel_t fmt_to_wr[DLO_PIXFMT_MAX];
 
 
-/** Look-up table to use when reading 8 bpp pixels - required by @c read_pixel_323().
+/** Standard look-up table for converting 8 bpp pixels in bgr323 format into colour numbers.
  */
-static dlo_col32_t *lut = lut8bpp;
+static dlo_col32_t lut8bpp[256];
 
 
 /* External-scope variables ------------------------------------------------------------*/
@@ -201,6 +249,19 @@ static dlo_col32_t *lut = lut8bpp;
 /* File-scope function declarations ----------------------------------------------------*/
 
 
+/** Make sure there is room in the command buffer for a run of commands, flushing it if not.
+ *
+ *  Callers check for room once, for the worst case size of everything they are about to
+ *  build, and then write the commands straight into the buffer.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *  @param  len  Number of bytes needed (no more than @a XFER_MIN, the smallest the buffer is ever tuned to).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t reserve(dlo_device_t * const dev, const size_t len);
+
+
 /** Plot a section of horizontal line in the specified colour at 24 bpp.
  *
  *  @param  dev     Pointer to @a dlo_device_t structure.
@@ -232,17 +293,130 @@ static dlo_retcode_t copy_24bpp(dlo_device_t * const dev, dlo_ptr_t src_base16,
  *
  *  @param  dev          Pointer to @a dlo_device_t structure.
  *  @param  rdpx         Pointer to the pixel reading function.
+ *  @param  lut          Look-up table for 8 bpp source pixels.
  *  @param  bypp         Bytes per pixel of the source pixels.
  *  @param  swap         Flag: swap the red/blue component order.
+ *  @param  blend        Flag: blend 32 bpp source pixels over the shadow using their alpha.
  *  @param  src_base     Base address of the source.
  *  @param  dest_base16  Base address of destination 16 bpp pixel data.
  *  @param  dest_base8   Base address of destination 8 bpp pixel data.
  *  @param  width        Width of the scrape (pixels).
  *
  *  @return  Return code, zero for no error.
+ *
+ *  If @a blend is set, the caller must have checked that the shadow is valid for the
+ *  whole of the destination.
+ */
+static dlo_retcode_t scrape_24bpp(dlo_device_t * const dev, const read_pixel_t rdpx, const dlo_col32_t * const lut,
+                                   const uint32_t bypp, const bool swap, const bool blend, const uint8_t *src_base,
+                                   dlo_ptr_t dest_base16, dlo_ptr_t dest_base8, const uint32_t width);
+
+
+/** Convert a horizontal line of host-resident pixels into the internal colour format.
+ *
+ *  @param  dev          Pointer to @a dlo_device_t structure.
+ *  @param  rdpx         Pointer to the pixel reading function.
+ *  @param  lut          Look-up table for 8 bpp source pixels.
+ *  @param  bypp         Bytes per pixel of the source pixels.
+ *  @param  swap         Flag: swap the red/blue component order.
+ *  @param  blend        Flag: blend 32 bpp source pixels over the shadow using their alpha.
+ *  @param  src_base     Base address of the source.
+ *  @param  dest_base16  Base address of destination 16 bpp pixel data.
+ *  @param  dest_base8   Base address of destination 8 bpp pixel data.
+ *  @param  width        Width of the line (pixels).
+ *  @param  stripe16     Where to put the 16 bpp components.
+ *  @param  stripe8      Where to put the 8 bpp components.
+ *
+ *  This only reads from the device structure (and the shadow), so pool workers can call it
+ *  for different lines at the same time.
+ */
+static void convert_24bpp(const dlo_device_t * const dev, const read_pixel_t rdpx, const dlo_col32_t * const lut,
+                          const uint32_t bypp, const bool swap, const bool blend, const uint8_t *src_base,
+                          const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8,
+                          const uint32_t width, dlo_col16_t * const stripe16, dlo_col8_t * const stripe8);
+
+
+/** Send a converted horizontal line of pixels, skipping the spans the device already has.
+ *
+ *  @param  dev          Pointer to @a dlo_device_t structure.
+ *  @param  dest_base16  Base address of destination 16 bpp pixel data.
+ *  @param  dest_base8   Base address of destination 8 bpp pixel data.
+ *  @param  width        Width of the line (pixels).
+ *  @param  stripe16     The 16 bpp components.
+ *  @param  stripe8      The 8 bpp components.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t send_24bpp(dlo_device_t * const dev, const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8, const uint32_t width,
+                                const dlo_col16_t * const stripe16, const dlo_col8_t * const stripe8);
+
+
+/** Send part of a converted horizontal line of pixels, according to the policy of the region it's in.
+ *
+ *  @param  dev          Pointer to @a dlo_device_t structure.
+ *  @param  dest_base16  Base address of destination 16 bpp pixel data.
+ *  @param  dest_base8   Base address of destination 8 bpp pixel data.
+ *  @param  width        Width of the span (pixels).
+ *  @param  stripe16     The 16 bpp components.
+ *  @param  stripe8      The 8 bpp components.
+ *  @param  rgn          Pointer to the region the span lies in (or NULL if none).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t send_span(dlo_device_t * const dev, const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8, const uint32_t width,
+                               const dlo_col16_t * const stripe16, const dlo_col8_t * const stripe8, dlo_region_t * const rgn);
+
+
+/** Find the part of a horizontal line of pixels which lies in a region.
+ *
+ *  @param  rgn     Pointer to the region.
+ *  @param  base16  Base address of the line's 16 bpp pixel data.
+ *  @param  width   Width of the line (pixels).
+ *  @param  start   Pointer to the first pixel of the line in the region (filled in).
+ *  @param  stop    Pointer to the pixel after the last one in the region (filled in).
+ *
+ *  @return  true if some of the line lies in the region, else false.
+ */
+static bool region_span(const dlo_region_t * const rgn, const dlo_ptr_t base16, const uint32_t width,
+                        uint32_t * const start, uint32_t * const stop);
+
+
+/** Scrape a host bitmap into the device, with the encoder pool converting bands of rows in parallel.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  rdpx   Pointer to the pixel reading function.
+ *  @param  lut    Look-up table for 8 bpp source pixels.
+ *  @param  bypp   Bytes per pixel of the source pixels.
+ *  @param  swap   Flag: swap the red/blue component order.
+ *  @param  flags  Flags word indicating special behaviour.
+ *  @param  fbuf   Pointer to the bitmap.
+ *  @param  area   Pointer to the destination area.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The bands are sent in order as they become ready, so the commands are exactly those
+ *  that scraping one row at a time would produce.
+ */
+static dlo_retcode_t scrape_bands(dlo_device_t * const dev, const read_pixel_t rdpx, const dlo_col32_t * const lut,
+                                  const uint32_t bypp, const bool swap,
+                                  const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area);
+
+
+/** Convert a band of rows (the pool task function).
+ *
+ *  @param  task  Pointer to the @a task member of a @a band_t.
+ */
+static void convert_band(dlo_task_t * const task);
+
+
+/** Check that the shadow is valid for every pixel row of an area of the screen.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  area  Pointer to the area.
+ *
+ *  @return  true if every row is valid in both planes, else false.
  */
-static dlo_retcode_t scrape_24bpp(dlo_device_t * const dev, const read_pixel_t rdpx, const uint32_t bypp, const bool swap,
-                                   const uint8_t *src_base, dlo_ptr_t dest_base16, dlo_ptr_t dest_base8, const uint32_t width);
+static bool shadow_area_valid(const dlo_device_t * const dev, const dlo_area_t * const area);
 
 
 /** Dump the contents of the scrape buffers as a horizontal pixel row at 24 bpp.
@@ -251,11 +425,281 @@ static dlo_retcode_t scrape_24bpp(dlo_device_t * const dev, const read_pixel_t r
  *  @param  base16  Base address of destination 16 bpp pixel data.
  *  @param  base8   Base address of destination 8 bpp pixel data.
  *  @param  width   Width of the scrape (pixels).
+ *  @param  fine    Flag: send the 8 bpp components as well as the 16 bpp ones.
  *
  *  @return  Return code, zero for no error.
  */
 static dlo_retcode_t cmd_stripe24(dlo_device_t * const dev, dlo_ptr_t base16, dlo_ptr_t base8, const uint32_t width,
-                                  const dlo_col16_t *ptr_col16, const dlo_col8_t *ptr_col8);
+                                  const dlo_col16_t *ptr_col16, const dlo_col8_t *ptr_col8, const bool fine);
+
+
+/** Copy a bitmap in the device's native planar format to an area of the device memory.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  flags  Flags word for the copy.
+ *  @param  fbuf   Pointer to the bitmap (in @c dlo_pixfmt_native format).
+ *  @param  area   Pointer to the destination area.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t copy_native(dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area);
+
+
+/** Send a horizontal line of pixels in the device's native planar format.
+ *
+ *  @param  dev          Pointer to @a dlo_device_t structure.
+ *  @param  src16        Pointer to the source 16 bpp pixel data (big-endian).
+ *  @param  src8         Pointer to the source 8 bpp pixel data.
+ *  @param  dest_base16  Base address of destination 16 bpp pixel data.
+ *  @param  dest_base8   Base address of destination 8 bpp pixel data.
+ *  @param  width        Width of the line (pixels).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t scrape_native(dlo_device_t * const dev, const uint8_t * const src16, const uint8_t * const src8,
+                                   const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8, const uint32_t width);
+
+
+/** Copy a horizontal line of native pixels straight into raw write commands.
+ *
+ *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  @param  base16  Base address of destination 16 bpp pixel data.
+ *  @param  base8   Base address of destination 8 bpp pixel data.
+ *  @param  width   Width of the line (pixels).
+ *  @param  src16   Pointer to the source 16 bpp pixel data (big-endian).
+ *  @param  src8    Pointer to the source 8 bpp pixel data.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  This doesn't update the shadow, so it may only be used on devices without one.
+ */
+static dlo_retcode_t cmd_native(dlo_device_t * const dev, dlo_ptr_t base16, dlo_ptr_t base8, const uint32_t width,
+                                const uint8_t *src16, const uint8_t *src8);
+
+
+/** Build raw write commands for a horizontal line of 16 bpp pixels, which are in the host's byte order.
+ *
+ *  The caller must already have made room for the commands (see @c reserve()).
+ *
+ *  @param  ptr    Pointer to where the commands go.
+ *  @param  base   Base address of destination 16 bpp pixel data.
+ *  @param  width  Width of the line (pixels).
+ *  @param  src    Pointer to the pixels.
+ *
+ *  @return  Pointer to the byte following the commands.
+ */
+static char *put_raw_16bpp(char *ptr, dlo_ptr_t base, uint32_t width, const dlo_col16_t *src);
+
+
+/** Build raw write commands for a horizontal line of pixels which are already in the device's byte order.
+ *
+ *  The caller must already have made room for the commands (see @c reserve()).
+ *
+ *  @param  ptr    Pointer to where the commands go.
+ *  @param  cmd    The raw write command for the plane.
+ *  @param  base   Base address of the destination pixel data.
+ *  @param  bypp   Bytes per pixel of the plane.
+ *  @param  width  Width of the line (pixels).
+ *  @param  src    Pointer to the pixel data.
+ *
+ *  @return  Pointer to the byte following the commands.
+ */
+static char *put_raw_bytes(char *ptr, const char * const cmd, dlo_ptr_t base, const uint32_t bypp, uint32_t width, const uint8_t *src);
+
+
+/** Add raw write commands for a horizontal line of one plane to a command segment.
+ *
+ *  @param  seg    Pointer to the segment.
+ *  @param  cmd    The raw write command for the plane.
+ *  @param  base   Base address of the destination pixel data.
+ *  @param  bypp   Bytes per pixel of the plane.
+ *  @param  width  Width of the line (pixels).
+ *  @param  src    Pointer to the pixel data, in the device's byte order.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t seg_raw(dlo_seg_t * const seg, const char * const cmd, dlo_ptr_t base, const uint32_t bypp, const uint32_t width,
+                             const uint8_t *src);
+
+
+/** Add a range of device memory to the repair list, merging it with a recent entry if possible.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  addr  Base address in the device memory.
+ *  @param  len   Length of the range (bytes).
+ *  @param  bypp  Bytes per pixel of the plane the range lies in.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t repair_add(dlo_device_t * const dev, const dlo_ptr_t addr, uint32_t len, const uint8_t bypp);
+
+
+/** Grow the repair list, keeping its entries.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *  @param  num  Number of entries to make room for.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t repair_resize(dlo_device_t * const dev, const uint32_t num);
+
+
+/** Resend a range of device memory from the shadow using raw write commands.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  rng   Pointer to the range to send.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t repair_from_shadow(dlo_device_t * const dev, const dlo_range_t * const rng);
+
+
+/** Resend a range of device memory using pixels supplied by the client's source function.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  rng   Pointer to the range to send.
+ *
+ *  @return  Return code, zero for no error or @a dlo_err_unsupported if the range can't be sourced.
+ *
+ *  The range is widened to the smallest rectangle of the screen which covers it.
+ */
+static dlo_retcode_t repair_from_source(dlo_device_t * const dev, const dlo_range_t * const rng);
+
+
+/** Check whether a range of device memory lies entirely within the shadow.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  addr  Base address in the device memory.
+ *  @param  len   Length of the range (bytes).
+ *
+ *  @return  true if the range is covered by the shadow, false if not.
+ */
+static bool shadow_range(const dlo_device_t * const dev, const dlo_ptr_t addr, const uint32_t len);
+
+
+/** Mark a range of bytes in the shadow as matching (or not matching) the device memory.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  addr   Base address in the device memory.
+ *  @param  len    Length of the range (bytes).
+ *  @param  valid  true to mark the range as valid, false to mark it as unknown.
+ */
+static void shadow_mark(dlo_device_t * const dev, dlo_ptr_t addr, uint32_t len, const bool valid);
+
+
+/** Check whether every byte in a range of the shadow is known to match the device memory.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  addr  Base address in the device memory.
+ *  @param  len   Length of the range (bytes).
+ *
+ *  @return  true if the whole range is valid, else false.
+ */
+static bool shadow_valid(const dlo_device_t * const dev, dlo_ptr_t addr, uint32_t len);
+
+
+/** Update the shadow to reflect a horizontal line plotted at 24 bpp.
+ *
+ *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  @param  base16  Base address of destination 16 bpp pixel data.
+ *  @param  base8   Base address of destination 8 bpp pixel data.
+ *  @param  len     Length of the line (pixels).
+ *  @param  col16   16 bpp component of the line colour.
+ *  @param  col8    8 bpp component of the line colour.
+ */
+static void shadow_hline(dlo_device_t * const dev, const dlo_ptr_t base16, const dlo_ptr_t base8, const uint32_t len,
+                         const dlo_col16_t col16, const dlo_col8_t col8);
+
+
+/** Update the shadow to reflect a copy of a block of device memory.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  src   Source address in the device memory.
+ *  @param  dest  Destination address in the device memory.
+ *  @param  len   Length of the copy (bytes).
+ */
+static void shadow_copy(dlo_device_t * const dev, const dlo_ptr_t src, const dlo_ptr_t dest, const uint32_t len);
+
+
+/** Update the shadow to reflect a raw write into the device memory.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  dest  Destination address in the device memory.
+ *  @param  src   Pointer to the bytes written (in device byte order).
+ *  @param  len   Length of the write (bytes).
+ */
+static void shadow_write(dlo_device_t * const dev, const dlo_ptr_t dest, const uint8_t * const src, const uint32_t len);
+
+
+/** Compare a pixel in the shadow with the colour we are about to write there.
+ *
+ *  @param  old16  Pointer to the 16 bpp component of the pixel in the shadow.
+ *  @param  old8   Pointer to the 8 bpp component of the pixel in the shadow.
+ *  @param  col16  New 16 bpp component of the pixel.
+ *  @param  col8   New 8 bpp component of the pixel.
+ *
+ *  @return  true if the pixel would not change, else false.
+ */
+static bool unchanged(const uint8_t * const old16, const uint8_t * const old8, const dlo_col16_t col16, const dlo_col8_t col8);
+
+
+/** Check whether a pixel in the shadow is close enough to a new colour not to be worth sending.
+ *
+ *  @param  old16  Pointer to the 16 bpp component of the pixel in the shadow.
+ *  @param  old8   Pointer to the 8 bpp component of the pixel in the shadow.
+ *  @param  col16  16 bpp component of the new colour.
+ *  @param  col8   8 bpp component of the new colour.
+ *  @param  thr    Largest difference in any colour component which doesn't matter.
+ *
+ *  @return  true if no component differs by more than @a thr, else false.
+ */
+static bool similar(const uint8_t * const old16, const uint8_t * const old8, const dlo_col16_t col16, const dlo_col8_t col8, const uint32_t thr);
+
+
+/** Return the colour of a pixel in the shadow.
+ *
+ *  @param  old16  Pointer to the 16 bpp component of the pixel in the shadow.
+ *  @param  old8   Pointer to the 8 bpp component of the pixel in the shadow.
+ *
+ *  @return  32 bpp colour number of the pixel.
+ *
+ *  The 16 bpp and 8 bpp components together hold all 24 bits of the shadow pixel's colour,
+ *  so it can be recovered exactly.
+ */
+static dlo_col32_t shadow_colour(const uint8_t * const old16, const uint8_t * const old8);
+
+
+/** Blend a colour over a pixel in the shadow.
+ *
+ *  @param  old16  Pointer to the 16 bpp component of the pixel in the shadow.
+ *  @param  old8   Pointer to the 8 bpp component of the pixel in the shadow.
+ *  @param  col    32 bpp colour number to blend over it.
+ *  @param  alpha  Opacity of @a col, from 0 (transparent) to 255 (opaque).
+ *
+ *  @return  32 bpp colour number of the result.
+ */
+static dlo_col32_t blend_over(const uint8_t * const old16, const uint8_t * const old8, const dlo_col32_t col, const uint32_t alpha);
+
+
+/** Apply a colour-correction table to a 32 bpp colour number.
+ *
+ *  @param  ct   Pointer to the table.
+ *  @param  col  32 bpp colour number.
+ *
+ *  @return  Corrected 32 bpp colour number.
+ */
+static dlo_col32_t correct(const dlo_ctable_t * const ct, const dlo_col32_t col);
+
+
+/** Interpolate between two colour components, rounding to the nearest value in either direction.
+ *
+ *  @param  from  Component value at the start.
+ *  @param  to    Component value at the end.
+ *  @param  frac  How far from @a from to @a to (0..255).
+ *
+ *  @return  Interpolated component value.
+ */
+static int32_t lerp(const int32_t from, const int32_t to, const uint32_t frac);
 
 
 /** Given a 32 bpp colour number, return an 8 bpp colour number.
@@ -279,73 +723,133 @@ static dlo_col16_t rgb16(dlo_col32_t col);
 /** Dummy pixel reading function for an uninitialised entry.
  *
  *  @param  ptr   Pointer to pixel.
+ *  @param  lut   Look-up table for 8 bpp pixels.
  *  @param  swap  Flag to indicate red and blue components need to be swapped.
  *
  *  @return  Colour number for read pixel.
  */
-static dlo_col32_t read_pixel_NULL(const uint8_t * const ptr, const bool swap);
+static dlo_col32_t read_pixel_NULL(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap);
 
 
 /** Read an 8 bpp pixel in 323 format.
  *
  *  @param  ptr   Pointer to pixel.
+ *  @param  lut   Look-up table for 8 bpp pixels.
  *  @param  swap  Flag to indicate red and blue components need to be swapped.
  *
  *  @return  Colour number for read pixel.
  */
-static dlo_col32_t read_pixel_323(const uint8_t * const ptr, const bool swap);
+static dlo_col32_t read_pixel_323(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap);
 
 
 /** Read a 16 bpp pixel in 565 format.
  *
  *  @param  ptr   Pointer to pixel.
+ *  @param  lut   Look-up table for 8 bpp pixels.
  *  @param  swap  Flag to indicate red and blue components need to be swapped.
  *
  *  @return  Colour number for read pixel.
  */
-static dlo_col32_t read_pixel_565(const uint8_t * const ptr, const bool swap);
+static dlo_col32_t read_pixel_565(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap);
 
 
 /** Read a 16 bpp pixel in 1555 format.
  *
  *  @param  ptr   Pointer to pixel.
+ *  @param  lut   Look-up table for 8 bpp pixels.
  *  @param  swap  Flag to indicate red and blue components need to be swapped.
  *
  *  @return  Colour number for read pixel.
  */
-static dlo_col32_t read_pixel_1555(const uint8_t * const ptr, const bool swap);
+static dlo_col32_t read_pixel_1555(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap);
 
 
 /** Read a 24 bpp pixel in 888 format.
  *
  *  @param  ptr   Pointer to pixel.
+ *  @param  lut   Look-up table for 8 bpp pixels.
  *  @param  swap  Flag to indicate red and blue components need to be swapped.
  *
  *  @return  Colour number for read pixel.
  */
-static dlo_col32_t read_pixel_888(const uint8_t * const ptr, const bool swap);
+static dlo_col32_t read_pixel_888(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap);
 
 
 /** Read a 32 bpp pixel in 8888 format.
  *
  *  @param  ptr   Pointer to pixel.
+ *  @param  lut   Look-up table for 8 bpp pixels.
  *  @param  swap  Flag to indicate red and blue components need to be swapped.
  *
  *  @return  Colour number for read pixel.
  */
-static dlo_col32_t read_pixel_8888(const uint8_t * const ptr, const bool swap);
+static dlo_col32_t read_pixel_8888(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap);
 
 
-/* Public function definitions ---------------------------------------------------------*/
-
+/** Dummy pixel writing function for a format which can't be written.
+ *
+ *  @param  ptr   Pointer to pixel.
+ *  @param  col   Colour number to write.
+ *  @param  swap  Flag to indicate red and blue components need to be swapped.
+ */
+static void write_pixel_NULL(uint8_t * const ptr, const dlo_col32_t col, const bool swap);
 
-dlo_retcode_t dlo_grfx_init(const dlo_init_t flags)
-{
-  uint32_t i;
-  uint8_t  red, grn, blu;
-  uint8_t  red8, grn8, blu8;
 
-  /* Initialise the default look-up table for 8 bpp in bgr323 format */
+/** Write an 8 bpp pixel in 323 format.
+ *
+ *  @param  ptr   Pointer to pixel.
+ *  @param  col   Colour number to write.
+ *  @param  swap  Flag to indicate red and blue components need to be swapped.
+ */
+static void write_pixel_323(uint8_t * const ptr, const dlo_col32_t col, const bool swap);
+
+
+/** Write a 16 bpp pixel in 565 format.
+ *
+ *  @param  ptr   Pointer to pixel.
+ *  @param  col   Colour number to write.
+ *  @param  swap  Flag to indicate red and blue components need to be swapped.
+ */
+static void write_pixel_565(uint8_t * const ptr, const dlo_col32_t col, const bool swap);
+
+
+/** Write a 16 bpp pixel in 1555 format (with the supremacy bit clear).
+ *
+ *  @param  ptr   Pointer to pixel.
+ *  @param  col   Colour number to write.
+ *  @param  swap  Flag to indicate red and blue components need to be swapped.
+ */
+static void write_pixel_1555(uint8_t * const ptr, const dlo_col32_t col, const bool swap);
+
+
+/** Write a 24 bpp pixel in 888 format.
+ *
+ *  @param  ptr   Pointer to pixel.
+ *  @param  col   Colour number to write.
+ *  @param  swap  Flag to indicate red and blue components need to be swapped.
+ */
+static void write_pixel_888(uint8_t * const ptr, const dlo_col32_t col, const bool swap);
+
+
+/** Write a 32 bpp pixel in 8888 format (fully opaque).
+ *
+ *  @param  ptr   Pointer to pixel.
+ *  @param  col   Colour number to write.
+ *  @param  swap  Flag to indicate red and blue components need to be swapped.
+ */
+static void write_pixel_8888(uint8_t * const ptr, const dlo_col32_t col, const bool swap);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+dlo_retcode_t dlo_grfx_init(const dlo_init_t flags)
+{
+  uint32_t i;
+  uint8_t  red, grn, blu;
+  uint8_t  red8, grn8, blu8;
+
+  /* Initialise the default look-up table for 8 bpp in bgr323 format */
   for (red = 0; red < 8; red++)
   for (grn = 0; grn < 4; grn++)
   for (blu = 0; blu < 8; blu++)
@@ -372,6 +876,20 @@ dlo_retcode_t dlo_grfx_init(const dlo_init_t flags)
   fmt_to_fn[dlo_pixfmt_abgr8888] = read_pixel_8888;
   fmt_to_fn[dlo_pixfmt_argb8888] = read_pixel_8888;
 
+  /* ...and of pixel formats to pixel writing functions */
+  for (i = 0; i < DLO_PIXFMT_MAX; i++)
+    fmt_to_wr[i] = write_pixel_NULL;
+  fmt_to_wr[dlo_pixfmt_bgr323]   = write_pixel_323;
+  fmt_to_wr[dlo_pixfmt_rgb323]   = write_pixel_323;
+  fmt_to_wr[dlo_pixfmt_bgr565]   = write_pixel_565;
+  fmt_to_wr[dlo_pixfmt_rgb565]   = write_pixel_565;
+  fmt_to_wr[dlo_pixfmt_sbgr1555] = write_pixel_1555;
+  fmt_to_wr[dlo_pixfmt_srgb1555] = write_pixel_1555;
+  fmt_to_wr[dlo_pixfmt_bgr888]   = write_pixel_888;
+  fmt_to_wr[dlo_pixfmt_rgb888]   = write_pixel_888;
+  fmt_to_wr[dlo_pixfmt_abgr8888] = write_pixel_8888;
+  fmt_to_wr[dlo_pixfmt_argb8888] = write_pixel_8888;
+
   return dlo_ok;
 }
 
@@ -384,12 +902,15 @@ dlo_retcode_t dlo_grfx_final(const dlo_final_t flags)
 
 dlo_retcode_t dlo_grfx_fill_rect(dlo_device_t * const dev, const dlo_area_t * const area, const dlo_col32_t col)
 {
-  dlo_ptr_t base16, base8;
-  uint32_t  end;
+  dlo_col32_t fill;
+  dlo_ptr_t   base16, base8;
+  uint32_t    end;
 
   ASSERT(dev && area)
   ASSERT(area->view.width && area->view.height);
 
+  fill = dev->ctable ? correct(dev->ctable, col) : col;
+
   /* Only 24 bpp is supported */
   if (area->view.bpp != 24)
     return dlo_err_bad_col;
@@ -402,7 +923,7 @@ dlo_retcode_t dlo_grfx_fill_rect(dlo_device_t * const dev, const dlo_area_t * co
   /* Plot the rectangle, one pixel row at a time */
   for (; base16 < end; base16 += BYTES_PER_16BPP * area->stride)
   {
-    ERR(hline_24bpp(dev, base16, base8, area->view.width, col));
+    ERR(hline_24bpp(dev, base16, base8, area->view.width, fill));
     base8 += BYTES_PER_8BPP * area->stride;
   }
   return dlo_usb_write(dev);
@@ -475,12 +996,13 @@ dlo_retcode_t dlo_grfx_copy_rect(dlo_device_t * const dev, const dlo_area_t * co
 
 dlo_retcode_t dlo_grfx_copy_host_bmp(dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t const *fbuf, const dlo_area_t * const area)
 {
-  uint8_t     *src_base;
-  uint8_t     *end;
-  dlo_ptr_t    dest_base16, dest_base8;
-  uint32_t     bypp;
-  read_pixel_t rdpx;
-  bool         swap;
+  uint8_t           *src_base;
+  uint8_t           *end;
+  dlo_ptr_t          dest_base16, dest_base8;
+  uint32_t           bypp;
+  read_pixel_t       rdpx;
+  const dlo_col32_t *lut;
+  bool               swap;
 
   ASSERT(dev && fbuf && area);
   ASSERT(fbuf->width && fbuf->height && fbuf->base && fbuf->stride);
@@ -490,13 +1012,17 @@ dlo_retcode_t dlo_grfx_copy_host_bmp(dlo_device_t * const dev, const dlo_bmpflag
   if (area->view.bpp != 24)
     return dlo_err_bad_col;
 
+  /* Bitmaps which are already in the device's format don't need converting */
+  if (fbuf->fmt == dlo_pixfmt_native)
+    return copy_native(dev, flags, fbuf, area);
+
   /* Get a pixel reading function pointer for the fbuf */
-  if (fbuf->fmt >> DLO_PIXFMT_PTR_SFT)
+  if ((fbuf->fmt >> DLO_PIXFMT_PTR_SFT) || fbuf->fmt == dlo_pixfmt_lut8)
   {
     bypp = 1;
     rdpx = read_pixel_323;
     swap = false;
-    lut  = (dlo_col32_t *)fbuf->fmt;
+    lut  = fbuf->fmt == dlo_pixfmt_lut8 ? fbuf->lut : (const dlo_col32_t *)fbuf->fmt;
   }
   else
   {
@@ -513,6 +1039,22 @@ dlo_retcode_t dlo_grfx_copy_host_bmp(dlo_device_t * const dev, const dlo_bmpflag
   if (fbuf->width > SCRAPE_MAX_PIXELS)
     return dlo_err_big_scrape;
 
+  /* Blending needs an alpha channel and the existing screen contents to blend over */
+  if (flags.blend)
+  {
+    if (bypp != 4)
+      return dlo_err_bad_fmt;
+    if (!dev->shadow || !shadow_area_valid(dev, area))
+      return dlo_err_unsupported;
+  }
+
+  /* Share the conversion out amongst the encoder pool, if there is one and it's worth it */
+  if (dlo_pool_workers() && area->view.height >= 2 * BAND_ROWS)
+  {
+    ERR(scrape_bands(dev, rdpx, lut, bypp, swap, flags, fbuf, area));
+    return dlo_usb_write(dev);
+  }
+
   /* Set up the destination pointers in the device memory */
   dest_base16 = area->view.base;
   dest_base8  = area->base8;
@@ -525,7 +1067,7 @@ dlo_retcode_t dlo_grfx_copy_host_bmp(dlo_device_t * const dev, const dlo_bmpflag
 
     for (; src_base >= end; src_base -= bypp * fbuf->stride)
     {
-      ERR(scrape_24bpp(dev, rdpx, bypp, swap, src_base, dest_base16, dest_base8, fbuf->width));
+      ERR(scrape_24bpp(dev, rdpx, lut, bypp, swap, flags.blend, src_base, dest_base16, dest_base8, fbuf->width));
       dest_base16 += BYTES_PER_16BPP * area->stride;
       dest_base8  += BYTES_PER_8BPP  * area->stride;
     }
@@ -537,7 +1079,7 @@ dlo_retcode_t dlo_grfx_copy_host_bmp(dlo_device_t * const dev, const dlo_bmpflag
 
     for (; src_base < end; src_base += bypp * fbuf->stride)
     {
-      ERR(scrape_24bpp(dev, rdpx, bypp, swap, src_base, dest_base16, dest_base8, fbuf->width));
+      ERR(scrape_24bpp(dev, rdpx, lut, bypp, swap, flags.blend, src_base, dest_base16, dest_base8, fbuf->width));
       dest_base16 += BYTES_PER_16BPP * area->stride;
       dest_base8  += BYTES_PER_8BPP  * area->stride;
     }
@@ -546,235 +1088,1645 @@ dlo_retcode_t dlo_grfx_copy_host_bmp(dlo_device_t * const dev, const dlo_bmpflag
 }
 
 
-/* File-scope function definitions -----------------------------------------------------*/
+dlo_retcode_t dlo_grfx_read_host_bmp(dlo_device_t * const dev, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area)
+{
+  dlo_ptr_t     base16 = area->view.base;
+  dlo_ptr_t     base8  = area->base8;
+  uint8_t      *dest   = (uint8_t *)fbuf->base;
+  write_pixel_t wrpx;
+  uint32_t      bypp;
+  bool          swap;
+  uint32_t      x, y;
 
+  ASSERT(dev && fbuf && area);
+  ASSERT(fbuf->width && fbuf->height && fbuf->base && fbuf->stride);
+  ASSERT(fbuf->width == area->view.width && fbuf->height == area->view.height)
 
-static dlo_retcode_t hline_24bpp(dlo_device_t * const dev, dlo_ptr_t base16, dlo_ptr_t base8, uint32_t len, const dlo_col32_t col)
-{
-  dlo_col16_t col16 = rgb16(col);
-  dlo_col8_t  col8  = rgb8(col);
+  /* Only 24 bpp is supported */
+  if (area->view.bpp != 24)
+    return dlo_err_bad_col;
 
-  /* Flush the command buffer if it's getting full */
-  if (dev->bufend - dev->bufptr < BUF_HIGH_WATER_MARK)
-    ERR(dlo_usb_write(dev));
+  /* There's no way back from a colour to a palette entry */
+  if ((fbuf->fmt >> DLO_PIXFMT_PTR_SFT) || fbuf->fmt == dlo_pixfmt_lut8 || (int)fbuf->fmt > (int)dlo_pixfmt_argb8888)
+    return dlo_err_bad_fmt;
+
+  /* The device can't be read, so everything has to come from the shadow */
+  if (!dev->shadow || !shadow_area_valid(dev, area))
+    return dlo_err_unsupported;
 
-  /* Longer line segments require a few commands to complete */
-  while (len >= 256)
+  /* The shadow is in the native format already, so that's just a copy of each plane */
+  if (fbuf->fmt == dlo_pixfmt_native)
   {
-    ERR(cmd_hline16(dev, base16, 0, col16));
-    ERR(cmd_hline8( dev, base8,  0, col8));
-    base16 += BYTES_PER_16BPP * 256;
-    base8  += BYTES_PER_8BPP * 256;
-    len -= 256;
+    uint8_t *dest8 = (uint8_t *)fbuf->base8;
+
+    for (y = 0; y < area->view.height; y++)
+    {
+      dlo_memcpy(dest,  dev->shadow + base16, BYTES_PER_16BPP * area->view.width);
+      dlo_memcpy(dest8, dev->shadow + base8,  BYTES_PER_8BPP  * area->view.width);
+      dest   += BYTES_PER_16BPP * fbuf->stride;
+      dest8  += BYTES_PER_8BPP  * fbuf->stride;
+      base16 += BYTES_PER_16BPP * area->stride;
+      base8  += BYTES_PER_8BPP  * area->stride;
+    }
+    return dlo_ok;
   }
-  if (len)
+
+  bypp = FORMAT_TO_BYTES_PER_PIXEL(fbuf->fmt);
+  wrpx = fmt_to_wr[fbuf->fmt];
+  swap = fbuf->fmt & DLO_PIXFMT_SWP ? true : false;
+
+  for (y = 0; y < area->view.height; y++)
   {
-    ERR(cmd_hline16(dev, base16, len, col16));
-    ERR(cmd_hline8( dev, base8,  len, col8));
+    const uint8_t *old16 = dev->shadow + base16;
+    const uint8_t *old8  = dev->shadow + base8;
+    uint8_t       *ptr   = dest;
+
+    for (x = 0; x < area->view.width; x++, old16 += BYTES_PER_16BPP, old8 += BYTES_PER_8BPP, ptr += bypp)
+      wrpx(ptr, shadow_colour(old16, old8), swap);
+
+    dest   += bypp * fbuf->stride;
+    base16 += BYTES_PER_16BPP * area->stride;
+    base8  += BYTES_PER_8BPP  * area->stride;
   }
   return dlo_ok;
 }
 
 
-static dlo_retcode_t copy_24bpp(dlo_device_t * const dev, dlo_ptr_t src_base16, dlo_ptr_t dest_base16, dlo_ptr_t src_base8, dlo_ptr_t dest_base8, uint32_t len)
+dlo_retcode_t dlo_grfx_set_ctable(dlo_device_t * const dev, const dlo_clut_t * const clut)
 {
-  /* Flush the command buffer if it's getting full */
-  if (dev->bufend - dev->bufptr < BUF_HIGH_WATER_MARK)
-    ERR(dlo_usb_write(dev));
+  dlo_ctable_t *ct;
+  uint32_t      num = clut ? clut->size * clut->size * clut->size : 0;
+  uint32_t      i;
 
-  /* Longer line segments require a few commands to complete */
-  while (len >= 256)
-  {
-    ERR(cmd_copy16(dev, src_base16, 0, dest_base16));
-    ERR(cmd_copy8( dev, src_base8,  0, dest_base8));
-    src_base16  += BYTES_PER_16BPP * 256;
-    dest_base16 += BYTES_PER_16BPP * 256;
-    src_base8   += BYTES_PER_8BPP  * 256;
-    dest_base8  += BYTES_PER_8BPP  * 256;
-    len -= 256;
-  }
-  if (len)
+  dlo_grfx_ctable_free(dev);
+  if (!clut)
+    return dlo_ok;
+
+  ct = (dlo_ctable_t *)dlo_malloc(sizeof(dlo_ctable_t) + (num * sizeof(dlo_col32_t)));
+  NERR(ct);
+
+  /* Missing curves leave their component unchanged */
+  ct->size = clut->size;
+  for (i = 0; i < 256; i++)
   {
-    ERR(cmd_copy16(dev, src_base16, len, dest_base16));
-    ERR(cmd_copy8( dev, src_base8,  len, dest_base8));
+    ct->red[i] = clut->red ? clut->red[i] : (uint8_t)i;
+    ct->grn[i] = clut->grn ? clut->grn[i] : (uint8_t)i;
+    ct->blu[i] = clut->blu ? clut->blu[i] : (uint8_t)i;
   }
+  if (num)
+    dlo_memcpy(ct->cube, clut->cube, num * sizeof(dlo_col32_t));
+  dev->ctable = ct;
+
   return dlo_ok;
 }
 
 
-static dlo_retcode_t scrape_24bpp(dlo_device_t * const dev, const read_pixel_t rdpx, const uint32_t bypp, const bool swap,
-                                   const uint8_t *src_base, dlo_ptr_t dest_base16, dlo_ptr_t dest_base8, const uint32_t width)
+void dlo_grfx_ctable_free(dlo_device_t * const dev)
 {
-  const uint8_t *end       = src_base + (bypp * width);
-  dlo_col16_t  stripe16[SCRAPE_MAX_PIXELS];
-  dlo_col8_t   stripe8 [SCRAPE_MAX_PIXELS];
+  if (dev->ctable)
+    dlo_free(dev->ctable);
+  dev->ctable = NULL;
+}
 
-  dlo_col16_t   *ptr_col16 = stripe16;
-  dlo_col8_t    *ptr_col8  = stripe8;
 
-  /* Read a stripe from the source bitmap into the internal colour format */
-  for (; src_base < end; src_base += bypp)
+dlo_retcode_t dlo_grfx_set_policy(dlo_device_t * const dev, const dlo_rect_t * const rec, const dlo_policy_t * const policy)
+{
+  const dlo_view_t *view = &dev->mode.view;
+  dlo_rect_t        clip;
+  int32_t           right, bottom;
+  uint32_t          i;
+
+  if (!rec && !policy)
+  {
+    dlo_grfx_policy_free(dev);
+    return dlo_ok;
+  }
+
+  /* Clip the rectangle to the current screen mode */
+  if (rec)
+  {
+    right  = rec->origin.x + rec->width;
+    bottom = rec->origin.y + rec->height;
+    clip.origin.x = rec->origin.x < 0 ? 0 : rec->origin.x;
+    clip.origin.y = rec->origin.y < 0 ? 0 : rec->origin.y;
+    right         = right  > (int32_t)view->width  ? (int32_t)view->width  : right;
+    bottom        = bottom > (int32_t)view->height ? (int32_t)view->height : bottom;
+    if (right <= clip.origin.x || bottom <= clip.origin.y)
+      return dlo_err_bad_area;
+    clip.width  = right  - clip.origin.x;
+    clip.height = bottom - clip.origin.y;
+  }
+  else
+  {
+    clip.origin.x = 0;
+    clip.origin.y = 0;
+    clip.width    = view->width;
+    clip.height   = view->height;
+    if (!clip.width || !clip.height)
+      return dlo_err_bad_view;
+  }
+
+  /* Look for a region with exactly this rectangle */
+  for (i = 0; i < dev->nregions; i++)
+  {
+    const dlo_region_t *rgn = &dev->regions[i];
+
+    if (rgn->base == view->base && rgn->stride == view->width &&
+        rgn->rec.origin.x == clip.origin.x && rgn->rec.origin.y == clip.origin.y &&
+        rgn->rec.width == clip.width && rgn->rec.height == clip.height)
+      break;
+  }
+
+  if (!policy)
   {
-    dlo_col32_t col = rdpx(src_base, swap);
+    if (i < dev->nregions)
+    {
+      dlo_memmove(&dev->regions[i], &dev->regions[i + 1], (dev->nregions - i - 1) * sizeof(dlo_region_t));
+      dev->nregions -= 1;
+    }
+    return dlo_ok;
+  }
 
-    *ptr_col16++ = rgb16(col);
-    *ptr_col8++  = rgb8(col);
+  if (i == dev->nregions)
+  {
+    if (dev->nregions == DLO_MAX_POLICIES)
+      return dlo_err_memory;
+    if (!dev->regions)
+    {
+      dev->regions = (dlo_region_t *)dlo_malloc(DLO_MAX_POLICIES * sizeof(dlo_region_t));
+      NERR(dev->regions);
+    }
+    dev->nregions += 1;
+    dev->regions[i].base   = view->base;
+    dev->regions[i].stride = view->width;
+    dev->regions[i].height = view->height;
+    dev->regions[i].rec    = clip;
+    dev->regions[i].last   = 0;
   }
-  return cmd_stripe24(dev, dest_base16, dest_base8, width, stripe16, stripe8);
+  dev->regions[i].policy = *policy;
+  dev->regions[i].skip   = false;
+  dev->regions[i].sent   = false;
+
+  return dlo_ok;
 }
 
 
-static dlo_retcode_t cmd_stripe24(dlo_device_t * const dev, dlo_ptr_t base16, dlo_ptr_t base8, const uint32_t width,
-                                  const dlo_col16_t *ptr_col16, const dlo_col8_t *ptr_col8)
+void dlo_grfx_policy_free(dlo_device_t * const dev)
 {
-  dlo_ptr_t    end;
-  uint32_t     rem;
-  uint32_t     pix;
+  if (dev->regions)
+    dlo_free(dev->regions);
+  dev->regions  = NULL;
+  dev->nregions = 0;
+}
 
-  /* Flush the command buffer if it's getting full */
-  if (dev->bufend - dev->bufptr < BUF_HIGH_WATER_MARK)
-    ERR(dlo_usb_write(dev));
 
-  end = base16 + (BYTES_PER_16BPP * width);
-  rem = width;
+void dlo_grfx_policy_begin(dlo_device_t * const dev)
+{
+  uint64_t now = dev->nregions ? dlo_frame_now() : 0;
+  uint32_t i;
 
-  for (; base16 < end; base16 += BYTES_PER_16BPP * RAW_MAX_PIXELS)
+  for (i = 0; i < dev->nregions; i++)
   {
-    *(dev->bufptr)++ = WRITE_RAW16[0];
-    *(dev->bufptr)++ = WRITE_RAW16[1];
-    *(dev->bufptr)++ = (char)(base16 >> 16);
-    *(dev->bufptr)++ = (char)(base16 >> 8);
-    *(dev->bufptr)++ = (char)(base16 & 0xFF);
-    *(dev->bufptr)++ = rem >= RAW_MAX_PIXELS ? 0 : rem;
+    dlo_region_t       *rgn = &dev->regions[i];
+    const dlo_policy_t *pol = &rgn->policy;
+
+    /* Too soon after the last update, or the queue is too full for the region's priority? */
+    rgn->sent = false;
+    rgn->skip = (pol->max_rate && rgn->last && now - rgn->last < 1000000u / pol->max_rate) ||
+                (dev->nonblock && pol->priority < DLO_PRIORITY_MAX &&
+                 (uint64_t)dev->qlen * (DLO_PRIORITY_MAX + 1) > (uint64_t)dev->xfer.depth * (pol->priority + 1));
+  }
+}
 
-    /* Flush the command buffer if it's getting full */
-    if (dev->bufend - dev->bufptr - BYTES_PER_16BPP * RAW_MAX_PIXELS < BUF_HIGH_WATER_MARK)
-      ERR(dlo_usb_write(dev));
 
-    for (pix = 0; pix < (rem >= RAW_MAX_PIXELS ? RAW_MAX_PIXELS : rem); pix++)
-    {
-      dlo_col16_t col = *ptr_col16++;
+void dlo_grfx_policy_end(dlo_device_t * const dev)
+{
+  uint64_t now = dev->nregions ? dlo_frame_now() : 0;
+  uint32_t i;
 
-      *(dev->bufptr)++ = (char)(col >> 8);
-      *(dev->bufptr)++ = (char)(col & 0xFF);
-    }
-    rem -= RAW_MAX_PIXELS;
+  for (i = 0; i < dev->nregions; i++)
+  {
+    if (dev->regions[i].sent)
+      dev->regions[i].last = now;
+    dev->regions[i].skip = false;
+    dev->regions[i].sent = false;
   }
+}
 
-  end = base8 + (BYTES_PER_8BPP * width);
-  rem = width;
-
-  for (; base8 < end; base8 += BYTES_PER_8BPP * RAW_MAX_PIXELS)
-  {
-    *(dev->bufptr)++ = WRITE_RAW8[0];
-    *(dev->bufptr)++ = WRITE_RAW8[1];
-    *(dev->bufptr)++ = (char)(base8 >> 16);
-    *(dev->bufptr)++ = (char)(base8 >> 8);
-    *(dev->bufptr)++ = (char)(base8 & 0xFF);
-    *(dev->bufptr)++ = rem >= RAW_MAX_PIXELS ? 0 : rem;
 
-    /* Flush the command buffer if it's getting full */
-    if (dev->bufend - dev->bufptr - BYTES_PER_8BPP * RAW_MAX_PIXELS < BUF_HIGH_WATER_MARK)
-      ERR(dlo_usb_write(dev));
+dlo_retcode_t dlo_grfx_shadow_alloc(dlo_device_t * const dev)
+{
+  if (dev->shadow)
+    return dlo_ok;
 
-    for (pix = 0; pix < (rem >= RAW_MAX_PIXELS ? RAW_MAX_PIXELS : rem); pix++)
-      *(dev->bufptr)++ = (char)(*ptr_col8++);
+  dev->shadow = (uint8_t *)dlo_rt_alloc(dev, dev->memory);
+  NERR(dev->shadow);
 
-    rem -= RAW_MAX_PIXELS;
+  /* Nothing in the shadow is known to match the device until we've written to it */
+  dev->valid = (uint8_t *)dlo_rt_alloc(dev, dev->memory / 8);
+  if (!dev->valid)
+  {
+    dlo_rt_free(dev, dev->shadow);
+    dev->shadow = NULL;
+    REC_ERR();
+    return dlo_err_memory;
   }
+  dlo_memset(dev->valid, 0, dev->memory / 8);
+
   return dlo_ok;
 }
 
 
-static dlo_col32_t read_pixel_NULL(const uint8_t * const ptr, const bool swap)
+void dlo_grfx_scratch_free(dlo_device_t * const dev)
 {
-  DPRINTF("grfx: WARNING: unknown dlo_pixfmt_t doesn't map to a read_pixel_*() function\n");
-  return DLO_RGB(0, 0, 0);
+  dlo_rt_free(dev, dev->scratch);
+  dev->scratch    = NULL;
+  dev->scratch_sz = 0;
 }
 
 
-static dlo_col32_t read_pixel_323(const uint8_t * const ptr, const bool swap)
+void dlo_grfx_shadow_free(dlo_device_t * const dev)
 {
-  dlo_col32_t col = lut[*ptr];
+  dlo_rt_free(dev, dev->shadow);
+  dlo_rt_free(dev, dev->valid);
+  dev->shadow = NULL;
+  dev->valid  = NULL;
+}
 
-  if (swap)
+
+dlo_retcode_t dlo_grfx_damage(dlo_device_t * const dev, const char * const buf, const size_t size)
+{
+  const uint8_t *ptr = (const uint8_t *)buf;
+  const uint8_t *end = ptr + size;
+
+  while (ptr < end)
   {
-    uint8_t red, grn, blu;
+    dlo_ptr_t addr;
+    uint32_t  pix, run;
+    uint8_t   bypp;
 
-    red = DLO_RGB_GETRED(col);
-    grn = DLO_RGB_GETGRN(col);
-    blu = DLO_RGB_GETBLU(col);
-    return DLO_RGB(blu, grn, red);
+    /* Skip padding and anything that doesn't draw (e.g. video register writes) */
+    if (ptr[0] != 0xAF || end - ptr < 2)
+    {
+      ptr++;
+      continue;
+    }
+    switch (ptr[1])
+    {
+      case 0x20:
+        ptr += 4;
+        continue;
+      case 0x60: case 0x61: case 0x62:
+        bypp = BYTES_PER_8BPP;
+        break;
+      case 0x68: case 0x69: case 0x6A:
+        bypp = BYTES_PER_16BPP;
+        break;
+      default:
+        ptr += 2;
+        continue;
+    }
+    if (end - ptr < 6)
+      break;
+
+    /* All drawing commands start with a destination address and a pixel count */
+    addr = (ptr[2] << 16) | (ptr[3] << 8) | ptr[4];
+    pix  = ptr[5] ? ptr[5] : 256;
+    ERR(repair_add(dev, addr, bypp * pix, bypp));
+
+    /* Step over the rest of the command, according to its type */
+    switch (ptr[1] & 0x07)
+    {
+      case 0:
+        ptr += 6 + (bypp * pix);
+        break;
+      case 1:
+        for (ptr += 6, run = 0; run < pix && ptr < end; ptr += 1 + bypp)
+          run += ptr[0] ? ptr[0] : 256;
+        break;
+      default:
+        ptr += 9;
+        break;
+    }
   }
-  return col;
+  return dlo_ok;
 }
 
 
-static dlo_col32_t read_pixel_565(const uint8_t * const ptr, const bool swap)
+dlo_retcode_t dlo_grfx_repair(dlo_device_t * const dev)
 {
-  dlo_col32_t col;
-  uint16_t   *pix = (uint16_t *)ptr;
-  uint8_t     red, grn, blu;
+  uint32_t i;
 
-  col  = *pix;
-  red  = (col & 0x001F) << 3;
-  grn  = (col & 0x07E0) >> 3;
-  blu  = (col & 0xF800) >> 8;
-  red  = red | (red >> 5);
-  grn  = grn | (grn >> 5);
-  blu  = blu | (blu >> 5);
+  for (i = 0; i < dev->nrepair; i++)
+  {
+    const dlo_range_t *rng = &dev->repair[i];
+    dlo_retcode_t      err = dlo_err_unsupported;
 
-  return swap ? DLO_RGB(blu, grn, red) : DLO_RGB(red, grn, blu);
+    if (dev->shadow && shadow_valid(dev, rng->addr, rng->len))
+      err = repair_from_shadow(dev, rng);
+    else if (dev->source)
+      err = repair_from_source(dev, rng);
+
+    /* If we can't send it, the device contents are unknown and must be redrawn in full */
+    if (err == dlo_err_unsupported)
+    {
+      if (dev->shadow)
+        shadow_mark(dev, rng->addr, rng->len, false);
+    }
+    else if (err != dlo_ok)
+      return err;
+  }
+  ERR(dlo_usb_write(dev));
+  dev->nrepair = 0;
+
+  return dlo_ok;
 }
 
 
-static dlo_col32_t read_pixel_1555(const uint8_t * const ptr, const bool swap)
+dlo_retcode_t dlo_grfx_repair_alloc(dlo_device_t * const dev)
 {
-  dlo_col32_t col;
-  uint16_t   *pix = (uint16_t *)ptr;
-  uint8_t     red, grn, blu;
+  if (dev->repair_sz >= REPAIR_RT_ENTRIES)
+    return dlo_ok;
 
-  col  = *pix;
-  red  = (col & 0x001F) << 3;
-  grn  = (col & 0x03E0) >> 2;
-  blu  = (col & 0x7C00) >> 7;
-  red  = red | (red >> 5);
-  grn  = grn | (grn >> 5);
-  blu  = blu | (blu >> 5);
+  return repair_resize(dev, REPAIR_RT_ENTRIES);
+}
 
-  return swap ? DLO_RGB(blu, grn, red) : DLO_RGB(red, grn, blu);
+
+void dlo_grfx_repair_free(dlo_device_t * const dev)
+{
+  dlo_rt_free(dev, dev->repair);
+  dev->repair    = NULL;
+  dev->nrepair   = 0;
+  dev->repair_sz = 0;
 }
 
 
-static dlo_col32_t read_pixel_888(const uint8_t * const ptr, const bool swap)
+dlo_retcode_t dlo_grfx_seg_fill(dlo_seg_t * const seg, const dlo_area_t * const area, const dlo_col32_t col)
 {
-  uint8_t red, grn, blu;
+  const dlo_device_t *dev    = seg->dev;
+  dlo_col32_t         fill   = dev->ctable ? correct(dev->ctable, col) : col;
+  dlo_col16_t         col16  = rgb16(fill);
+  dlo_col8_t          col8   = rgb8(fill);
+  dlo_ptr_t           base16 = area->view.base;
+  dlo_ptr_t           base8  = area->base8;
+  uint32_t            x, y, len;
 
-  red  = ptr[0];
-  grn  = ptr[1];
-  blu  = ptr[2];
+  /* Only 24 bpp is supported */
+  if (area->view.bpp != 24)
+    return dlo_err_bad_col;
 
-  return swap ? DLO_RGB(blu, grn, red) : DLO_RGB(red, grn, blu);
+  for (y = 0; y < area->view.height; y++)
+  {
+    for (x = 0; x < area->view.width; x += len)
+    {
+      dlo_ptr_t addr16 = base16 + (BYTES_PER_16BPP * x);
+      dlo_ptr_t addr8  = base8  + (BYTES_PER_8BPP  * x);
+      char     *ptr    = dlo_seg_reserve(seg, 9 + 8);
+
+      if (!ptr)
+        return dlo_err_memory;
+      len = area->view.width - x > 256 ? 256 : area->view.width - x;
+
+      /* The same pair of run length commands as hline_24bpp() builds (a length of 256 is sent as zero) */
+      ptr = put_hline16(ptr, addr16, len, col16);
+      put_hline8(ptr, addr8, len, col8);
+    }
+    base16 += BYTES_PER_16BPP * area->stride;
+    base8  += BYTES_PER_8BPP  * area->stride;
+  }
+  return dlo_ok;
 }
 
 
-static dlo_col32_t read_pixel_8888(const uint8_t * const ptr, const bool swap)
+dlo_retcode_t dlo_grfx_seg_copy_host_bmp(dlo_seg_t * const seg, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area)
 {
-  dlo_col32_t col;
-  uint32_t   *pix = (uint32_t *)ptr;
+  const dlo_device_t *dev    = seg->dev;
+  dlo_ptr_t           base16 = area->view.base;
+  dlo_ptr_t           base8  = area->base8;
+  int32_t             step   = (int32_t)fbuf->stride;
+  uint32_t            y;
 
-  col = (dlo_col32_t) *pix;
+  ASSERT(fbuf->width == area->view.width && fbuf->height == area->view.height)
 
-  if (swap)
+  /* Only 24 bpp is supported */
+  if (area->view.bpp != 24)
+    return dlo_err_bad_col;
+
+  /* Blending needs the shadow, which other threads may be changing */
+  if (flags.blend)
+    return dlo_err_unsupported;
+
+  if (fbuf->fmt == dlo_pixfmt_native)
   {
-    uint8_t red, grn, blu;
+    const uint8_t *src16 = (const uint8_t *)fbuf->base;
+    const uint8_t *src8  = (const uint8_t *)fbuf->base8;
 
-    red = DLO_RGB_GETRED(col);
-    grn = DLO_RGB_GETGRN(col);
-    blu = DLO_RGB_GETBLU(col);
-    return DLO_RGB(blu, grn, red);
+    if (flags.v_flip)
+    {
+      src16 += (size_t)BYTES_PER_16BPP * fbuf->stride * (fbuf->height - 1);
+      src8  += (size_t)BYTES_PER_8BPP  * fbuf->stride * (fbuf->height - 1);
+      step   = -step;
+    }
+    for (y = 0; y < fbuf->height; y++)
+    {
+      ERR(seg_raw(seg, WRITE_RAW16, base16, BYTES_PER_16BPP, fbuf->width, src16));
+      ERR(seg_raw(seg, WRITE_RAW8,  base8,  BYTES_PER_8BPP,  fbuf->width, src8));
+      src16  += BYTES_PER_16BPP * step;
+      src8   += BYTES_PER_8BPP  * step;
+      base16 += BYTES_PER_16BPP * area->stride;
+      base8  += BYTES_PER_8BPP  * area->stride;
+    }
   }
-  return col;
+  else
+  {
+    dlo_col16_t        stripe16[SCRAPE_MAX_PIXELS];
+    dlo_col8_t         stripe8 [SCRAPE_MAX_PIXELS];
+    uint8_t            raw16   [BYTES_PER_16BPP * SCRAPE_MAX_PIXELS];
+    const uint8_t     *src = (const uint8_t *)fbuf->base;
+    const dlo_col32_t *lut;
+    read_pixel_t       rdpx;
+    uint32_t           bypp;
+    bool               swap;
+    uint32_t           x;
+
+    /* Paletted bitmaps bring their own look-up table, the others share our standard one */
+    if ((fbuf->fmt >> DLO_PIXFMT_PTR_SFT) || fbuf->fmt == dlo_pixfmt_lut8)
+    {
+      if (fbuf->fmt == dlo_pixfmt_lut8 && !fbuf->lut)
+        return dlo_err_bad_fbuf;
+      bypp = 1;
+      rdpx = read_pixel_323;
+      swap = false;
+      lut  = fbuf->fmt == dlo_pixfmt_lut8 ? fbuf->lut : (const dlo_col32_t *)fbuf->fmt;
+    }
+    else
+    {
+      if ((int)fbuf->fmt > (int)dlo_pixfmt_argb8888)
+        return dlo_err_bad_fmt;
+
+      bypp = FORMAT_TO_BYTES_PER_PIXEL(fbuf->fmt);
+      rdpx = fmt_to_fn[fbuf->fmt];
+      swap = fbuf->fmt & DLO_PIXFMT_SWP ? true : false;
+      lut  = lut8bpp;
+    }
+
+    if (fbuf->width > SCRAPE_MAX_PIXELS)
+      return dlo_err_big_scrape;
+
+    if (flags.v_flip)
+    {
+      src  += (size_t)bypp * fbuf->stride * (fbuf->height - 1);
+      step  = -step;
+    }
+    for (y = 0; y < fbuf->height; y++)
+    {
+      convert_24bpp(dev, rdpx, lut, bypp, swap, false, src, base16, base8, fbuf->width, stripe16, stripe8);
+      for (x = 0; x < fbuf->width; x++)
+      {
+        raw16[BYTES_PER_16BPP * x]       = (uint8_t)(stripe16[x] >> 8);
+        raw16[(BYTES_PER_16BPP * x) + 1] = (uint8_t)stripe16[x];
+      }
+      ERR(seg_raw(seg, WRITE_RAW16, base16, BYTES_PER_16BPP, fbuf->width, raw16));
+      ERR(seg_raw(seg, WRITE_RAW8,  base8,  BYTES_PER_8BPP,  fbuf->width, (const uint8_t *)stripe8));
+      src    += (int32_t)bypp * step;
+      base16 += BYTES_PER_16BPP * area->stride;
+      base8  += BYTES_PER_8BPP  * area->stride;
+    }
+  }
+  return dlo_ok;
+}
+
+
+void dlo_grfx_seg_apply(dlo_device_t * const dev, const char * const buf, const size_t size)
+{
+  const uint8_t *ptr = (const uint8_t *)buf;
+  const uint8_t *end = ptr + size;
+
+  /* Segments only hold raw writes and single-run fills, as built by the functions above */
+  while (ptr < end)
+  {
+    dlo_ptr_t addr = (ptr[2] << 16) | (ptr[3] << 8) | ptr[4];
+    uint32_t  pix  = ptr[5] ? ptr[5] : 256;
+    uint32_t  bypp = ptr[1] & 0x08 ? BYTES_PER_16BPP : BYTES_PER_8BPP;
+
+    ASSERT(ptr[0] == 0xAF);
+    if ((ptr[1] & 0x07) == 0)
+    {
+      shadow_write(dev, addr, &ptr[6], bypp * pix);
+      ptr += 6 + (bypp * pix);
+      continue;
+    }
+
+    ASSERT(ptr[6] == ptr[5]);
+    if (shadow_range(dev, addr, bypp * pix))
+    {
+      uint8_t *old = dev->shadow + addr;
+      uint32_t x;
+
+      if (bypp == BYTES_PER_16BPP)
+        for (x = 0; x < pix; x++)
+        {
+          *old++ = ptr[7];
+          *old++ = ptr[8];
+        }
+      else
+        dlo_memset(old, ptr[7], pix);
+      shadow_mark(dev, addr, bypp * pix, true);
+    }
+    ptr += 7 + bypp;
+  }
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static dlo_retcode_t reserve(dlo_device_t * const dev, const size_t len)
+{
+  ASSERT(len <= XFER_MIN && len <= (size_t)(dev->bufend - dev->buffer));
+
+  if ((size_t)(dev->bufend - dev->bufptr) < len)
+    ERR(dlo_usb_write(dev));
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t hline_24bpp(dlo_device_t * const dev, dlo_ptr_t base16, dlo_ptr_t base8, uint32_t len, const dlo_col32_t col)
+{
+  dlo_col16_t col16 = rgb16(col);
+  dlo_col8_t  col8  = rgb8(col);
+
+  if (dev->shadow)
+    shadow_hline(dev, base16, base8, len, col16, col8);
+
+  /* Longer line segments require a pair of commands for every 256 pixels. Room is made for
+   * the whole line at once, unless that's more than the command buffer is sure to hold.
+   */
+  while (len)
+  {
+    uint32_t pairs = len / 256 + 1;
+
+    if (pairs > XFER_MIN / (9 + 8))
+      pairs = XFER_MIN / (9 + 8);
+    ERR(reserve(dev, pairs * (9 + 8)));
+    for (; pairs && len; pairs--)
+    {
+      uint32_t pix = len < 256 ? len : 256;
+
+      dev->bufptr = put_hline16(dev->bufptr, base16, pix, col16);
+      dev->bufptr = put_hline8( dev->bufptr, base8,  pix, col8);
+      base16 += BYTES_PER_16BPP * pix;
+      base8  += BYTES_PER_8BPP  * pix;
+      len    -= pix;
+    }
+  }
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t copy_24bpp(dlo_device_t * const dev, dlo_ptr_t src_base16, dlo_ptr_t dest_base16, dlo_ptr_t src_base8, dlo_ptr_t dest_base8, uint32_t len)
+{
+  if (dev->shadow)
+  {
+    shadow_copy(dev, src_base16, dest_base16, BYTES_PER_16BPP * len);
+    shadow_copy(dev, src_base8,  dest_base8,  BYTES_PER_8BPP  * len);
+  }
+
+  /* As for hline_24bpp(), make room for the whole line's command pairs at once where we can */
+  while (len)
+  {
+    uint32_t pairs = len / 256 + 1;
+
+    if (pairs > XFER_MIN / (9 + 9))
+      pairs = XFER_MIN / (9 + 9);
+    ERR(reserve(dev, pairs * (9 + 9)));
+    for (; pairs && len; pairs--)
+    {
+      uint32_t pix = len < 256 ? len : 256;
+
+      dev->bufptr = put_copy(dev->bufptr, WRITE_COPY16, src_base16, pix, dest_base16);
+      dev->bufptr = put_copy(dev->bufptr, WRITE_COPY8,  src_base8,  pix, dest_base8);
+      src_base16  += BYTES_PER_16BPP * pix;
+      dest_base16 += BYTES_PER_16BPP * pix;
+      src_base8   += BYTES_PER_8BPP  * pix;
+      dest_base8  += BYTES_PER_8BPP  * pix;
+      len         -= pix;
+    }
+  }
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t scrape_24bpp(dlo_device_t * const dev, const read_pixel_t rdpx, const dlo_col32_t * const lut,
+                                   const uint32_t bypp, const bool swap, const bool blend, const uint8_t *src_base,
+                                   dlo_ptr_t dest_base16, dlo_ptr_t dest_base8, const uint32_t width)
+{
+  dlo_col16_t stripe16[SCRAPE_MAX_PIXELS];
+  dlo_col8_t  stripe8 [SCRAPE_MAX_PIXELS];
+
+  convert_24bpp(dev, rdpx, lut, bypp, swap, blend, src_base, dest_base16, dest_base8, width, stripe16, stripe8);
+
+  return send_24bpp(dev, dest_base16, dest_base8, width, stripe16, stripe8);
+}
+
+
+static void convert_24bpp(const dlo_device_t * const dev, const read_pixel_t rdpx, const dlo_col32_t * const lut,
+                          const uint32_t bypp, const bool swap, const bool blend, const uint8_t *src_base,
+                          const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8,
+                          const uint32_t width, dlo_col16_t * const stripe16, dlo_col8_t * const stripe8)
+{
+  const uint8_t *end       = src_base + (bypp * width);
+  dlo_col16_t   *ptr_col16 = stripe16;
+  dlo_col8_t    *ptr_col8  = stripe8;
+  uint32_t       x;
+
+  /* Read a stripe from the source bitmap into the internal colour format, correcting the
+   * colours on the way if the device has a table for that.
+   */
+  if (blend)
+  {
+    const dlo_ctable_t *ct    = dev->ctable;
+    const uint8_t      *old16 = dev->shadow + dest_base16;
+    const uint8_t      *old8  = dev->shadow + dest_base8;
+
+    for (x = 0; src_base < end; src_base += bypp, x++)
+    {
+      dlo_col32_t col = rdpx(src_base, lut, swap);
+      uint32_t    alpha;
+
+      /* The caller's bitmap may not be aligned, so copy out the pixel word to find its alpha */
+      dlo_memcpy(&alpha, src_base, sizeof(alpha));
+      alpha >>= 24;
+      if (ct)
+        col = correct(ct, col);
+      col = blend_over(&old16[BYTES_PER_16BPP * x], &old8[x], col, alpha);
+
+      *ptr_col16++ = rgb16(col);
+      *ptr_col8++  = rgb8(col);
+    }
+  }
+  else if (dev->ctable)
+  {
+    const dlo_ctable_t *ct = dev->ctable;
+
+    for (; src_base < end; src_base += bypp)
+    {
+      dlo_col32_t col = correct(ct, rdpx(src_base, lut, swap));
+
+      *ptr_col16++ = rgb16(col);
+      *ptr_col8++  = rgb8(col);
+    }
+  }
+  else
+  {
+    for (; src_base < end; src_base += bypp)
+    {
+      dlo_col32_t col = rdpx(src_base, lut, swap);
+
+      *ptr_col16++ = rgb16(col);
+      *ptr_col8++  = rgb8(col);
+    }
+  }
+}
+
+
+static dlo_retcode_t send_24bpp(dlo_device_t * const dev, const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8, const uint32_t width,
+                                const dlo_col16_t * const stripe16, const dlo_col8_t * const stripe8)
+{
+  uint32_t start[DLO_MAX_POLICIES];
+  uint32_t stop[DLO_MAX_POLICIES];
+  bool     hit[DLO_MAX_POLICIES];
+  uint32_t x, end, i;
+
+  if (!dev->nregions)
+    return send_span(dev, dest_base16, dest_base8, width, stripe16, stripe8, NULL);
+
+  for (i = 0; i < dev->nregions; i++)
+    hit[i] = region_span(&dev->regions[i], dest_base16, width, &start[i], &stop[i]);
+
+  /* Send the line in pieces, each under the topmost region covering it (if any) */
+  for (x = 0; x < width; x = end)
+  {
+    dlo_region_t *rgn = NULL;
+
+    end = width;
+    for (i = dev->nregions; i--; )
+    {
+      if (!hit[i])
+        continue;
+      if (start[i] <= x && x < stop[i])
+      {
+        rgn = &dev->regions[i];
+        end = stop[i] < end ? stop[i] : end;
+        break;
+      }
+      if (start[i] > x && start[i] < end)
+        end = start[i];
+    }
+    /* Lower regions only matter where they start, if we're not in a higher one */
+    if (!rgn)
+      for (i = 0; i < dev->nregions; i++)
+        if (hit[i] && start[i] > x && start[i] < end)
+          end = start[i];
+
+    ERR(send_span(dev, dest_base16 + (BYTES_PER_16BPP * x), dest_base8 + (BYTES_PER_8BPP * x), end - x,
+                  &stripe16[x], &stripe8[x], rgn));
+  }
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t send_span(dlo_device_t * const dev, const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8, const uint32_t width,
+                               const dlo_col16_t * const stripe16, const dlo_col8_t * const stripe8, dlo_region_t * const rgn)
+{
+  const uint8_t *old16;
+  const uint8_t *old8;
+  uint32_t       thr  = rgn ? rgn->policy.threshold : 0;
+  bool           fine = rgn ? !rgn->policy.coarse : true;
+  uint32_t       x, start, stop, gap;
+
+  if (rgn)
+  {
+    if (rgn->skip)
+      return dlo_ok;
+    rgn->sent = true;
+  }
+
+  /* Without a (valid) shadow of the destination, we have to send the whole stripe */
+  if (!dev->shadow ||
+      !shadow_valid(dev, dest_base16, BYTES_PER_16BPP * width) ||
+      !shadow_valid(dev, dest_base8,  BYTES_PER_8BPP  * width))
+    return cmd_stripe24(dev, dest_base16, dest_base8, width, stripe16, stripe8, fine);
+
+  /* Otherwise, only send the spans of the stripe which differ from the device's contents.
+   * Short runs of unchanged pixels are sent anyway if that's cheaper than starting a new
+   * pair of raw write commands. Where the fine detail isn't sent, the device keeps its
+   * old 8 bpp components, so those are what the new pixels are compared with.
+   */
+  old16 = dev->shadow + dest_base16;
+  old8  = dev->shadow + dest_base8;
+  x     = 0;
+  while (x < width)
+  {
+    while (x < width && similar(&old16[BYTES_PER_16BPP * x], &old8[x], stripe16[x], fine ? stripe8[x] : old8[x], thr))
+      x++;
+    if (x == width)
+      break;
+
+    start = x;
+    stop  = x;
+    gap   = 0;
+    for (; x < width; x++)
+    {
+      if (!similar(&old16[BYTES_PER_16BPP * x], &old8[x], stripe16[x], fine ? stripe8[x] : old8[x], thr))
+      {
+        gap  = 0;
+        stop = x + 1;
+      }
+      else if (++gap > DAMAGE_MIN_GAP)
+        break;
+    }
+    ERR(cmd_stripe24(dev, dest_base16 + (BYTES_PER_16BPP * start), dest_base8 + (BYTES_PER_8BPP * start), stop - start,
+                     &stripe16[start], &stripe8[start], fine));
+  }
+  return dlo_ok;
+}
+
+
+static bool region_span(const dlo_region_t * const rgn, const dlo_ptr_t base16, const uint32_t width,
+                        uint32_t * const start, uint32_t * const stop)
+{
+  uint32_t off, x, y, left, right;
+
+  if (base16 < rgn->base || base16 >= rgn->base + (BYTES_PER_16BPP * rgn->stride * rgn->height))
+    return false;
+
+  off = (base16 - rgn->base) / BYTES_PER_16BPP;
+  y   = off / rgn->stride;
+  x   = off % rgn->stride;
+  if (y < (uint32_t)rgn->rec.origin.y || y >= (uint32_t)rgn->rec.origin.y + rgn->rec.height)
+    return false;
+
+  left  = (uint32_t)rgn->rec.origin.x;
+  right = left + rgn->rec.width;
+  if (x + width <= left || x >= right)
+    return false;
+
+  *start = x < left ? left - x : 0;
+  *stop  = x + width > right ? right - x : width;
+
+  return true;
+}
+
+
+static dlo_retcode_t scrape_bands(dlo_device_t * const dev, const read_pixel_t rdpx, const dlo_col32_t * const lut,
+                                  const uint32_t bypp, const bool swap,
+                                  const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area)
+{
+  uint32_t       width  = area->view.width;
+  uint32_t       height = area->view.height;
+  uint32_t       nbands = (height + BAND_ROWS - 1) / BAND_ROWS;
+  size_t         need   = (nbands * sizeof(band_t)) + ((size_t)width * height * (sizeof(dlo_col16_t) + sizeof(dlo_col8_t)));
+  int32_t        step   = (int32_t)(bypp * fbuf->stride);
+  const uint8_t *src    = (const uint8_t *)fbuf->base;
+  dlo_retcode_t  err    = dlo_ok;
+  band_t        *band;
+  dlo_col16_t   *out16;
+  dlo_col8_t    *out8;
+  uint32_t       i, y;
+
+  /* The bands and their output live in a buffer which is kept for next time */
+  if (dev->scratch_sz < need)
+  {
+    size_t size = need;
+
+    /* A real-time device makes room for the whole screen, so that it only allocates once */
+    if (dev->realtime)
+    {
+      size_t full = (((dev->mode.view.height + BAND_ROWS - 1) / BAND_ROWS) * sizeof(band_t)) +
+                    ((size_t)dev->mode.view.width * dev->mode.view.height * (sizeof(dlo_col16_t) + sizeof(dlo_col8_t)));
+
+      size = full > need ? full : need;
+      dev->rtstats.allocs += 1;
+    }
+    dlo_grfx_scratch_free(dev);
+    dev->scratch = dlo_rt_alloc(dev, size);
+    NERR(dev->scratch);
+    dev->scratch_sz = size;
+  }
+  band  = (band_t *)dev->scratch;
+  out16 = (dlo_col16_t *)&band[nbands];
+  out8  = (dlo_col8_t *)&out16[(size_t)width * height];
+
+  if (flags.v_flip)
+  {
+    src  += (size_t)step * (height - 1);
+    step  = -step;
+  }
+
+  /* Hand out every band, then send them in order as they're finished */
+  for (i = 0; i < nbands; i++)
+  {
+    uint32_t row = i * BAND_ROWS;
+
+    band[i].task.fn  = convert_band;
+    band[i].dev      = dev;
+    band[i].rdpx     = rdpx;
+    band[i].lut      = lut;
+    band[i].bypp     = bypp;
+    band[i].swap     = swap;
+    band[i].blend    = flags.blend ? true : false;
+    band[i].src      = src + ((int32_t)row * step);
+    band[i].src_step = step;
+    band[i].base16   = area->view.base + (BYTES_PER_16BPP * area->stride * row);
+    band[i].base8    = area->base8     + (BYTES_PER_8BPP  * area->stride * row);
+    band[i].stride   = area->stride;
+    band[i].width    = width;
+    band[i].rows     = row + BAND_ROWS < height ? BAND_ROWS : height - row;
+    band[i].out16    = &out16[(size_t)width * row];
+    band[i].out8     = &out8[(size_t)width * row];
+    dlo_pool_submit(&band[i].task);
+  }
+
+  for (i = 0; i < nbands; i++)
+  {
+    dlo_pool_wait(&band[i].task);
+
+    /* After an error, we still have to wait for the rest of the bands before returning */
+    for (y = 0; err == dlo_ok && y < band[i].rows; y++)
+      err = send_24bpp(dev,
+                       band[i].base16 + (BYTES_PER_16BPP * band[i].stride * y),
+                       band[i].base8  + (BYTES_PER_8BPP  * band[i].stride * y),
+                       width, &band[i].out16[width * y], &band[i].out8[width * y]);
+  }
+  return err;
+}
+
+
+static void convert_band(dlo_task_t * const task)
+{
+  const band_t *band = (const band_t *)task;
+  uint32_t      y;
+
+  for (y = 0; y < band->rows; y++)
+    convert_24bpp(band->dev, band->rdpx, band->lut, band->bypp, band->swap, band->blend,
+                  band->src + ((int32_t)y * band->src_step),
+                  band->base16 + (BYTES_PER_16BPP * band->stride * y),
+                  band->base8  + (BYTES_PER_8BPP  * band->stride * y),
+                  band->width, &band->out16[band->width * y], &band->out8[band->width * y]);
+}
+
+
+static dlo_retcode_t cmd_stripe24(dlo_device_t * const dev, dlo_ptr_t base16, dlo_ptr_t base8, const uint32_t width,
+                                  const dlo_col16_t *ptr_col16, const dlo_col8_t *ptr_col8, const bool fine)
+{
+  uint32_t x;
+  uint32_t pix;
+
+  if (dev->shadow && shadow_range(dev, base16, BYTES_PER_16BPP * width))
+  {
+    uint8_t *old16 = dev->shadow + base16;
+
+    for (x = 0; x < width; x++)
+    {
+      *old16++ = (uint8_t)(ptr_col16[x] >> 8);
+      *old16++ = (uint8_t)ptr_col16[x];
+    }
+    shadow_mark(dev, base16, BYTES_PER_16BPP * width, true);
+  }
+  if (dev->shadow && fine)
+    shadow_write(dev, base8, (const uint8_t *)ptr_col8, BYTES_PER_8BPP * width);
+
+  /* Build the commands in batches, each of which is sure to fit in the command buffer */
+  for (x = 0; x < width; x += pix)
+  {
+    char *ptr;
+
+    pix = width - x > RAW_BATCH_PIXELS ? RAW_BATCH_PIXELS : width - x;
+    ERR(reserve(dev, RAW_CMD_BYTES(pix, BYTES_PER_16BPP) + (fine ? RAW_CMD_BYTES(pix, BYTES_PER_8BPP) : 0)));
+
+    ptr = put_raw_16bpp(dev->bufptr, base16 + (BYTES_PER_16BPP * x), pix, ptr_col16 + x);
+    if (fine)
+      ptr = put_raw_bytes(ptr, WRITE_RAW8, base8 + (BYTES_PER_8BPP * x), BYTES_PER_8BPP, pix, (const uint8_t *)(ptr_col8 + x));
+    dev->bufptr = ptr;
+  }
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t copy_native(dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area)
+{
+  const uint8_t *src16 = (const uint8_t *)fbuf->base;
+  const uint8_t *src8  = (const uint8_t *)fbuf->base8;
+  int32_t        step  = (int32_t)fbuf->stride;
+  dlo_ptr_t      dest_base16 = area->view.base;
+  dlo_ptr_t      dest_base8  = area->base8;
+  uint32_t       y;
+
+  /* There's no alpha channel to blend with */
+  if (flags.blend)
+    return dlo_err_bad_fmt;
+
+  /* Lines may be compared with the shadow, which goes through the scrape buffers */
+  if (fbuf->width > SCRAPE_MAX_PIXELS)
+    return dlo_err_big_scrape;
+
+  if (flags.v_flip)
+  {
+    src16 += (size_t)BYTES_PER_16BPP * fbuf->stride * (area->view.height - 1);
+    src8  += (size_t)BYTES_PER_8BPP  * fbuf->stride * (area->view.height - 1);
+    step   = -step;
+  }
+
+  for (y = 0; y < area->view.height; y++)
+  {
+    ERR(scrape_native(dev, src16, src8, dest_base16, dest_base8, fbuf->width));
+    src16       += BYTES_PER_16BPP * step;
+    src8        += BYTES_PER_8BPP  * step;
+    dest_base16 += BYTES_PER_16BPP * area->stride;
+    dest_base8  += BYTES_PER_8BPP  * area->stride;
+  }
+  return dlo_usb_write(dev);
+}
+
+
+static dlo_retcode_t scrape_native(dlo_device_t * const dev, const uint8_t * const src16, const uint8_t * const src8,
+                                   const dlo_ptr_t dest_base16, const dlo_ptr_t dest_base8, const uint32_t width)
+{
+  dlo_col16_t stripe16[SCRAPE_MAX_PIXELS];
+  uint32_t    x;
+
+  /* With nothing to compare against, and no policies to apply, the pixels go straight out */
+  if (!dev->shadow && !dev->nregions)
+    return cmd_native(dev, dest_base16, dest_base8, width, src16, src8);
+
+  /* Otherwise, the 16 bpp plane only needs putting into the host's byte order */
+  for (x = 0; x < width; x++)
+    stripe16[x] = (dlo_col16_t)((src16[BYTES_PER_16BPP * x] << 8) | src16[(BYTES_PER_16BPP * x) + 1]);
+
+  return send_24bpp(dev, dest_base16, dest_base8, width, stripe16, (const dlo_col8_t *)src8);
+}
+
+
+static dlo_retcode_t cmd_native(dlo_device_t * const dev, dlo_ptr_t base16, dlo_ptr_t base8, const uint32_t width,
+                                const uint8_t *src16, const uint8_t *src8)
+{
+  uint32_t x;
+  uint32_t pix;
+
+  ASSERT(!dev->shadow);
+
+  /* The source is already in the device's byte order, so it's copied in batches as it is */
+  for (x = 0; x < width; x += pix)
+  {
+    char *ptr;
+
+    pix = width - x > RAW_BATCH_PIXELS ? RAW_BATCH_PIXELS : width - x;
+    ERR(reserve(dev, RAW_CMD_BYTES(pix, BYTES_PER_16BPP) + RAW_CMD_BYTES(pix, BYTES_PER_8BPP)));
+
+    ptr = put_raw_bytes(dev->bufptr, WRITE_RAW16, base16 + (BYTES_PER_16BPP * x), BYTES_PER_16BPP, pix, src16 + (BYTES_PER_16BPP * x));
+    ptr = put_raw_bytes(ptr,         WRITE_RAW8,  base8  + (BYTES_PER_8BPP  * x), BYTES_PER_8BPP,  pix, src8  + (BYTES_PER_8BPP  * x));
+    dev->bufptr = ptr;
+  }
+  return dlo_ok;
+}
+
+
+static char *put_raw_16bpp(char *ptr, dlo_ptr_t base, uint32_t width, const dlo_col16_t *src)
+{
+  while (width)
+  {
+    uint32_t pix = width >= RAW_MAX_PIXELS ? RAW_MAX_PIXELS : width;
+    uint32_t x;
+
+    ptr = put_raw(ptr, WRITE_RAW16, base, pix);
+    for (x = 0; x < pix; x++)
+    {
+      ptr[2 * x]       = (char)(src[x] >> 8);
+      ptr[(2 * x) + 1] = (char)src[x];
+    }
+    ptr   += BYTES_PER_16BPP * pix;
+    base  += BYTES_PER_16BPP * pix;
+    src   += pix;
+    width -= pix;
+  }
+  return ptr;
+}
+
+
+static char *put_raw_bytes(char *ptr, const char * const cmd, dlo_ptr_t base, const uint32_t bypp, uint32_t width, const uint8_t *src)
+{
+  while (width)
+  {
+    uint32_t pix = width >= RAW_MAX_PIXELS ? RAW_MAX_PIXELS : width;
+
+    ptr = put_raw(ptr, cmd, base, pix);
+    dlo_memcpy(ptr, src, bypp * pix);
+    ptr   += bypp * pix;
+    base  += bypp * pix;
+    src   += bypp * pix;
+    width -= pix;
+  }
+  return ptr;
+}
+
+
+static dlo_retcode_t seg_raw(dlo_seg_t * const seg, const char * const cmd, dlo_ptr_t base, const uint32_t bypp, const uint32_t width,
+                             const uint8_t *src)
+{
+  uint32_t x;
+  uint32_t pix;
+
+  for (x = 0; x < width; x += pix)
+  {
+    char *ptr;
+
+    pix = width - x > RAW_BATCH_PIXELS ? RAW_BATCH_PIXELS : width - x;
+    ptr = dlo_seg_reserve(seg, RAW_CMD_BYTES(pix, bypp));
+    if (!ptr)
+      return dlo_err_memory;
+
+    put_raw_bytes(ptr, cmd, base + (bypp * x), bypp, pix, src + (bypp * x));
+  }
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t repair_add(dlo_device_t * const dev, const dlo_ptr_t addr, uint32_t len, const uint8_t bypp)
+{
+  uint32_t i;
+
+  /* Ignore anything outside the device memory */
+  if (addr >= dev->memory)
+    return dlo_ok;
+  if (len > dev->memory - addr)
+    len = dev->memory - addr;
+
+  /* The 16 bpp and 8 bpp commands for a line alternate, so try the last two entries */
+  for (i = dev->nrepair; i > 0 && i + 2 > dev->nrepair; i--)
+  {
+    dlo_range_t *rng = &dev->repair[i - 1];
+
+    if (rng->bypp == bypp && rng->addr + rng->len == addr)
+    {
+      rng->len += len;
+      return dlo_ok;
+    }
+  }
+
+  /* Grow the list if it's full */
+  if (dev->nrepair == dev->repair_sz)
+  {
+    if (dev->realtime)
+      dev->rtstats.allocs += 1;
+    ERR(repair_resize(dev, dev->repair_sz ? 2 * dev->repair_sz : REPAIR_MIN_ENTRIES));
+  }
+  dev->repair[dev->nrepair].addr = addr;
+  dev->repair[dev->nrepair].len  = len;
+  dev->repair[dev->nrepair].bypp = bypp;
+  dev->nrepair++;
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t repair_resize(dlo_device_t * const dev, const uint32_t num)
+{
+  dlo_range_t *lst;
+
+  lst = (dlo_range_t *)dlo_rt_alloc(dev, num * sizeof(dlo_range_t));
+  NERR(lst);
+  if (dev->repair)
+  {
+    dlo_memcpy(lst, dev->repair, dev->nrepair * sizeof(dlo_range_t));
+    dlo_rt_free(dev, dev->repair);
+  }
+  dev->repair    = lst;
+  dev->repair_sz = num;
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t repair_from_shadow(dlo_device_t * const dev, const dlo_range_t * const rng)
+{
+  const char    *cmd  = rng->bypp == BYTES_PER_16BPP ? WRITE_RAW16 : WRITE_RAW8;
+  const uint8_t *src  = dev->shadow + rng->addr;
+  dlo_ptr_t      addr = rng->addr;
+  uint32_t       rem  = rng->len / rng->bypp;
+
+  while (rem)
+  {
+    uint32_t pix = rem >= RAW_BATCH_PIXELS ? RAW_BATCH_PIXELS : rem;
+
+    ERR(reserve(dev, RAW_CMD_BYTES(pix, rng->bypp)));
+    dev->bufptr = put_raw_bytes(dev->bufptr, cmd, addr, rng->bypp, pix, src);
+    src        += rng->bypp * pix;
+    addr       += rng->bypp * pix;
+    rem        -= pix;
+  }
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t repair_from_source(dlo_device_t * const dev, const dlo_range_t * const rng)
+{
+  dlo_bmpflags_t flags = { 0 };
+  dlo_ptr_t      base  = rng->bypp == BYTES_PER_16BPP ? dev->mode.view.base : dev->base8;
+  uint32_t       line  = rng->bypp * dev->mode.view.width;
+  uint32_t       first, last;
+  dlo_rect_t     rec;
+  dlo_fbuf_t     fbuf;
+  dlo_area_t     area;
+  dlo_retcode_t  err;
+
+  /* We can only ask for things which are on the screen */
+  if (!line || rng->addr < base || rng->addr - base >= line * dev->mode.view.height)
+    return dlo_err_unsupported;
+
+  first = (rng->addr - base) / line;
+  last  = (rng->addr - base + rng->len - 1) / line;
+  if (last >= dev->mode.view.height)
+    last = dev->mode.view.height - 1;
+
+  /* A range within one line maps to part of that line, otherwise we take whole lines */
+  rec.origin.y = first;
+  rec.height   = 1 + last - first;
+  if (first == last)
+  {
+    rec.origin.x = ((rng->addr - base) % line) / rng->bypp;
+    rec.width    = rng->len / rng->bypp;
+  }
+  else
+  {
+    rec.origin.x = 0;
+    rec.width    = dev->mode.view.width;
+  }
+
+  if (dev->source((dlo_dev_t)dev, &rec, &fbuf, dev->source_pw) != dlo_ok ||
+      fbuf.width != rec.width || fbuf.height != rec.height)
+    return dlo_err_unsupported;
+
+  /* Describe the rectangle as an area of the screen and copy the pixels into it */
+  area.view.width  = rec.width;
+  area.view.height = rec.height;
+  area.view.bpp    = dev->mode.view.bpp;
+  area.view.base   = dev->mode.view.base + (BYTES_PER_16BPP * ((rec.origin.y * dev->mode.view.width) + rec.origin.x));
+  area.base8       = dev->base8          + (BYTES_PER_8BPP  * ((rec.origin.y * dev->mode.view.width) + rec.origin.x));
+  area.stride      = dev->mode.view.width;
+
+  err = dlo_grfx_copy_host_bmp(dev, flags, &fbuf, &area);
+
+  /* A bitmap we can't read is no better than no bitmap at all */
+  if (err == dlo_err_bad_fmt || err == dlo_err_big_scrape || err == dlo_err_bad_col)
+    return dlo_err_unsupported;
+
+  return err;
+}
+
+
+static bool shadow_range(const dlo_device_t * const dev, const dlo_ptr_t addr, const uint32_t len)
+{
+  return addr < dev->memory && len <= dev->memory - addr;
+}
+
+
+static void shadow_mark(dlo_device_t * const dev, dlo_ptr_t addr, uint32_t len, const bool valid)
+{
+  uint8_t *map = dev->valid;
+
+  /* Leading bits, up to a byte boundary in the bitmap */
+  for (; len && (addr & 7); addr++, len--)
+  {
+    if (valid)
+      map[addr >> 3] |= 1u << (addr & 7);
+    else
+      map[addr >> 3] &= ~(1u << (addr & 7));
+  }
+
+  /* Whole bytes of the bitmap */
+  if (len >= 8)
+  {
+    dlo_memset(&map[addr >> 3], valid ? 0xFF : 0, len >> 3);
+    addr += len & ~7u;
+    len  &= 7;
+  }
+
+  /* Trailing bits */
+  for (; len; addr++, len--)
+  {
+    if (valid)
+      map[addr >> 3] |= 1u << (addr & 7);
+    else
+      map[addr >> 3] &= ~(1u << (addr & 7));
+  }
+}
+
+
+static bool shadow_area_valid(const dlo_device_t * const dev, const dlo_area_t * const area)
+{
+  dlo_ptr_t base16 = area->view.base;
+  dlo_ptr_t base8  = area->base8;
+  uint32_t  y;
+
+  for (y = 0; y < area->view.height; y++)
+  {
+    if (!shadow_valid(dev, base16, BYTES_PER_16BPP * area->view.width) ||
+        !shadow_valid(dev, base8,  BYTES_PER_8BPP  * area->view.width))
+      return false;
+    base16 += BYTES_PER_16BPP * area->stride;
+    base8  += BYTES_PER_8BPP  * area->stride;
+  }
+  return true;
+}
+
+
+static bool shadow_valid(const dlo_device_t * const dev, dlo_ptr_t addr, uint32_t len)
+{
+  const uint8_t *map = dev->valid;
+
+  if (!shadow_range(dev, addr, len))
+    return false;
+
+  for (; len && (addr & 7); addr++, len--)
+    if (!(map[addr >> 3] & (1u << (addr & 7))))
+      return false;
+
+  for (; len >= 8; addr += 8, len -= 8)
+    if (map[addr >> 3] != 0xFF)
+      return false;
+
+  for (; len; addr++, len--)
+    if (!(map[addr >> 3] & (1u << (addr & 7))))
+      return false;
+
+  return true;
+}
+
+
+static void shadow_hline(dlo_device_t * const dev, const dlo_ptr_t base16, const dlo_ptr_t base8, const uint32_t len,
+                         const dlo_col16_t col16, const dlo_col8_t col8)
+{
+  if (shadow_range(dev, base16, BYTES_PER_16BPP * len))
+  {
+    uint8_t *ptr = dev->shadow + base16;
+    uint32_t pix;
+
+    for (pix = 0; pix < len; pix++)
+    {
+      *ptr++ = (uint8_t)(col16 >> 8);
+      *ptr++ = (uint8_t)col16;
+    }
+    shadow_mark(dev, base16, BYTES_PER_16BPP * len, true);
+  }
+  if (shadow_range(dev, base8, BYTES_PER_8BPP * len))
+  {
+    dlo_memset(dev->shadow + base8, col8, BYTES_PER_8BPP * len);
+    shadow_mark(dev, base8, BYTES_PER_8BPP * len, true);
+  }
+}
+
+
+static void shadow_copy(dlo_device_t * const dev, const dlo_ptr_t src, const dlo_ptr_t dest, const uint32_t len)
+{
+  if (!shadow_range(dev, dest, len))
+    return;
+
+  /* The destination is only known if all of the source was known */
+  if (shadow_valid(dev, src, len))
+  {
+    dlo_memmove(dev->shadow + dest, dev->shadow + src, len);
+    shadow_mark(dev, dest, len, true);
+  }
+  else
+    shadow_mark(dev, dest, len, false);
+}
+
+
+static void shadow_write(dlo_device_t * const dev, const dlo_ptr_t dest, const uint8_t * const src, const uint32_t len)
+{
+  if (!shadow_range(dev, dest, len))
+    return;
+
+  dlo_memcpy(dev->shadow + dest, src, len);
+  shadow_mark(dev, dest, len, true);
+}
+
+
+static bool unchanged(const uint8_t * const old16, const uint8_t * const old8, const dlo_col16_t col16, const dlo_col8_t col8)
+{
+  return old16[0] == (uint8_t)(col16 >> 8) && old16[1] == (uint8_t)col16 && *old8 == col8;
+}
+
+
+static bool similar(const uint8_t * const old16, const uint8_t * const old8, const dlo_col16_t col16, const dlo_col8_t col8, const uint32_t thr)
+{
+  uint8_t     new16[2];
+  dlo_col32_t old, col;
+
+  if (!thr)
+    return unchanged(old16, old8, col16, col8);
+
+  new16[0] = (uint8_t)(col16 >> 8);
+  new16[1] = (uint8_t)col16;
+  old      = shadow_colour(old16, old8);
+  col      = shadow_colour(new16, &col8);
+
+  return abs((int)DLO_RGB_GETRED(old) - (int)DLO_RGB_GETRED(col)) <= (int)thr &&
+         abs((int)DLO_RGB_GETGRN(old) - (int)DLO_RGB_GETGRN(col)) <= (int)thr &&
+         abs((int)DLO_RGB_GETBLU(old) - (int)DLO_RGB_GETBLU(col)) <= (int)thr;
+}
+
+
+static dlo_col32_t shadow_colour(const uint8_t * const old16, const uint8_t * const old8)
+{
+  uint32_t red, grn, blu;
+
+  /* Reassemble the 24 bpp colour from its 565 (high bits) and 323 (low bits) components */
+  red =  (old16[0] & 0xF8)                                  | (*old8 >> 5);
+  grn = ((old16[0] << 5) & 0xE0) | ((old16[1] >> 3) & 0x1C) | ((*old8 >> 3) & 3);
+  blu = ((old16[1] << 3) & 0xF8)                            | (*old8 & 7);
+
+  return DLO_RGB(red, grn, blu);
+}
+
+
+static dlo_col32_t blend_over(const uint8_t * const old16, const uint8_t * const old8, const dlo_col32_t col, const uint32_t alpha)
+{
+  dlo_col32_t old;
+  uint32_t    red, grn, blu;
+  uint32_t    inv = 255 - alpha;
+
+  if (alpha == 255)
+    return col;
+
+  old = shadow_colour(old16, old8);
+  if (!alpha)
+    return old;
+
+  red = DLO_RGB_GETRED(old);
+  grn = DLO_RGB_GETGRN(old);
+  blu = DLO_RGB_GETBLU(old);
+  red = ((DLO_RGB_GETRED(col) * alpha) + (red * inv) + 127) / 255;
+  grn = ((DLO_RGB_GETGRN(col) * alpha) + (grn * inv) + 127) / 255;
+  blu = ((DLO_RGB_GETBLU(col) * alpha) + (blu * inv) + 127) / 255;
+
+  return DLO_RGB(red, grn, blu);
+}
+
+
+static dlo_col32_t read_pixel_NULL(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap)
+{
+  DPRINTF("grfx: WARNING: unknown dlo_pixfmt_t doesn't map to a read_pixel_*() function\n");
+  return DLO_RGB(0, 0, 0);
+}
+
+
+static dlo_col32_t read_pixel_323(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap)
+{
+  dlo_col32_t col = lut[*ptr];
+
+  if (swap)
+  {
+    uint8_t red, grn, blu;
+
+    red = DLO_RGB_GETRED(col);
+    grn = DLO_RGB_GETGRN(col);
+    blu = DLO_RGB_GETBLU(col);
+    return DLO_RGB(blu, grn, red);
+  }
+  return col;
+}
+
+
+static dlo_col32_t read_pixel_565(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap)
+{
+  dlo_col32_t col;
+  uint16_t   *pix = (uint16_t *)ptr;
+  uint8_t     red, grn, blu;
+
+  col  = *pix;
+  red  = (col & 0x001F) << 3;
+  grn  = (col & 0x07E0) >> 3;
+  blu  = (col & 0xF800) >> 8;
+  red  = red | (red >> 5);
+  grn  = grn | (grn >> 5);
+  blu  = blu | (blu >> 5);
+
+  return swap ? DLO_RGB(blu, grn, red) : DLO_RGB(red, grn, blu);
+}
+
+
+static dlo_col32_t read_pixel_1555(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap)
+{
+  dlo_col32_t col;
+  uint16_t   *pix = (uint16_t *)ptr;
+  uint8_t     red, grn, blu;
+
+  col  = *pix;
+  red  = (col & 0x001F) << 3;
+  grn  = (col & 0x03E0) >> 2;
+  blu  = (col & 0x7C00) >> 7;
+  red  = red | (red >> 5);
+  grn  = grn | (grn >> 5);
+  blu  = blu | (blu >> 5);
+
+  return swap ? DLO_RGB(blu, grn, red) : DLO_RGB(red, grn, blu);
+}
+
+
+static dlo_col32_t read_pixel_888(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap)
+{
+  uint8_t red, grn, blu;
+
+  red  = ptr[0];
+  grn  = ptr[1];
+  blu  = ptr[2];
+
+  return swap ? DLO_RGB(blu, grn, red) : DLO_RGB(red, grn, blu);
+}
+
+
+static dlo_col32_t read_pixel_8888(const uint8_t * const ptr, const dlo_col32_t * const lut, const bool swap)
+{
+  dlo_col32_t col;
+  uint32_t   *pix = (uint32_t *)ptr;
+
+  col = (dlo_col32_t) *pix;
+
+  if (swap)
+  {
+    uint8_t red, grn, blu;
+
+    red = DLO_RGB_GETRED(col);
+    grn = DLO_RGB_GETGRN(col);
+    blu = DLO_RGB_GETBLU(col);
+    return DLO_RGB(blu, grn, red);
+  }
+  return col;
+}
+
+
+static void write_pixel_NULL(uint8_t * const ptr, const dlo_col32_t col, const bool swap)
+{
+  DPRINTF("grfx: WARNING: unknown dlo_pixfmt_t doesn't map to a write_pixel_*() function\n");
+}
+
+
+static void write_pixel_323(uint8_t * const ptr, const dlo_col32_t col, const bool swap)
+{
+  uint8_t red = DLO_RGB_GETRED(col);
+  uint8_t grn = DLO_RGB_GETGRN(col);
+  uint8_t blu = DLO_RGB_GETBLU(col);
+
+  if (swap)
+    *ptr = (blu >> 5) | ((grn >> 6) << 3) | ((red >> 5) << 5);
+  else
+    *ptr = (red >> 5) | ((grn >> 6) << 3) | ((blu >> 5) << 5);
+}
+
+
+static void write_pixel_565(uint8_t * const ptr, const dlo_col32_t col, const bool swap)
+{
+  uint16_t *pix = (uint16_t *)ptr;
+  uint8_t   red = DLO_RGB_GETRED(col);
+  uint8_t   grn = DLO_RGB_GETGRN(col);
+  uint8_t   blu = DLO_RGB_GETBLU(col);
+
+  if (swap)
+    *pix = (blu >> 3) | ((grn >> 2) << 5) | ((red >> 3) << 11);
+  else
+    *pix = (red >> 3) | ((grn >> 2) << 5) | ((blu >> 3) << 11);
+}
+
+
+static void write_pixel_1555(uint8_t * const ptr, const dlo_col32_t col, const bool swap)
+{
+  uint16_t *pix = (uint16_t *)ptr;
+  uint8_t   red = DLO_RGB_GETRED(col);
+  uint8_t   grn = DLO_RGB_GETGRN(col);
+  uint8_t   blu = DLO_RGB_GETBLU(col);
+
+  if (swap)
+    *pix = (blu >> 3) | ((grn >> 3) << 5) | ((red >> 3) << 10);
+  else
+    *pix = (red >> 3) | ((grn >> 3) << 5) | ((blu >> 3) << 10);
+}
+
+
+static void write_pixel_888(uint8_t * const ptr, const dlo_col32_t col, const bool swap)
+{
+  ptr[0] = swap ? DLO_RGB_GETBLU(col) : DLO_RGB_GETRED(col);
+  ptr[1] = DLO_RGB_GETGRN(col);
+  ptr[2] = swap ? DLO_RGB_GETRED(col) : DLO_RGB_GETBLU(col);
+}
+
+
+static void write_pixel_8888(uint8_t * const ptr, const dlo_col32_t col, const bool swap)
+{
+  uint32_t *pix = (uint32_t *)ptr;
+
+  if (swap)
+    *pix = 0xFF000000u | DLO_RGB(DLO_RGB_GETBLU(col), DLO_RGB_GETGRN(col), DLO_RGB_GETRED(col));
+  else
+    *pix = 0xFF000000u | col;
+}
+
+
+static dlo_col32_t correct(const dlo_ctable_t * const ct, const dlo_col32_t col)
+{
+  const dlo_col32_t *c000;
+  uint32_t           pos[3], frac[3], step[3];
+  uint32_t           out = 0;
+  uint32_t           i, sft;
+
+  if (!ct->size)
+    return DLO_RGB(ct->red[DLO_RGB_GETRED(col)], ct->grn[DLO_RGB_GETGRN(col)], ct->blu[DLO_RGB_GETBLU(col)]);
+
+  /* Find the cell of the table the colour lies in, and how far across the cell it is (0..255) */
+  for (i = 0; i < 3; i++)
+  {
+    uint32_t p = ((col >> (8 * i)) & 0xFF) * (ct->size - 1);
+
+    pos[i]  = p / 255;
+    frac[i] = p % 255;
+    if (pos[i] == ct->size - 1)
+    {
+      pos[i]  -= 1;
+      frac[i]  = 255;
+    }
+  }
+  step[0] = 1;
+  step[1] = ct->size;
+  step[2] = ct->size * ct->size;
+  c000    = ct->cube + pos[0] + (pos[1] * step[1]) + (pos[2] * step[2]);
+
+  /* Trilinear interpolation between the cell's eight corners, one component at a time */
+  for (sft = 0; sft < 24; sft += 8)
+  {
+    int32_t v[8], a, b;
+
+    for (i = 0; i < 8; i++)
+      v[i] = (c000[(i & 1 ? step[0] : 0) + (i & 2 ? step[1] : 0) + (i & 4 ? step[2] : 0)] >> sft) & 0xFF;
+    for (i = 0; i < 4; i++)
+      v[i] = lerp(v[2 * i], v[(2 * i) + 1], frac[0]);
+    a = lerp(v[0], v[1], frac[1]);
+    b = lerp(v[2], v[3], frac[1]);
+    out |= (uint32_t)lerp(a, b, frac[2]) << sft;
+  }
+  return (dlo_col32_t)out;
+}
+
+
+static int32_t lerp(const int32_t from, const int32_t to, const uint32_t frac)
+{
+  int32_t diff = (to - from) * (int32_t)frac;
+
+  /* Round the magnitude, so that a fall is rounded just as a rise would be */
+  return from + (diff < 0 ? -((127 - diff) / 255) : (diff + 127) / 255);
 }
 
 
@@ -90,4 +90,175 @@ extern dlo_retcode_t dlo_grfx_copy_rect(dlo_device_t * const dev, const dlo_area
 extern dlo_retcode_t dlo_grfx_copy_host_bmp(dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t const *fbuf, const dlo_area_t * const area);
 
 
+/** Copy (and translate pixel formats) a rectangular area of the shadow into host memory.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  fbuf  Struct pointer: area within host memory to copy into.
+ *  @param  area  Struct pointer: area within device memory to copy from.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  If any of @a area isn't known from the shadow, nothing is copied and @a dlo_err_unsupported
+ *  is returned.
+ */
+extern dlo_retcode_t dlo_grfx_read_host_bmp(dlo_device_t * const dev, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area);
+
+
+/** Replace the colour-correction table of a device.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  clut  Pointer to the new table (or NULL for none).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_grfx_set_ctable(dlo_device_t * const dev, const dlo_clut_t * const clut);
+
+
+/** Free the colour-correction table of a device (if it has one).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_grfx_ctable_free(dlo_device_t * const dev);
+
+
+/** Set or remove the encoding policy of a region of the screen.
+ *
+ *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  @param  rec     Rectangle within the current screen mode (or NULL for the whole screen).
+ *  @param  policy  Pointer to the policy, or NULL to remove it.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_grfx_set_policy(dlo_device_t * const dev, const dlo_rect_t * const rec, const dlo_policy_t * const policy);
+
+
+/** Free the encoding policies of a device (if it has any).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_grfx_policy_free(dlo_device_t * const dev);
+
+
+/** Decide which regions with policies to leave alone during a bitmap update.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_grfx_policy_begin(dlo_device_t * const dev);
+
+
+/** Note which regions with policies were updated by a bitmap update.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_grfx_policy_end(dlo_device_t * const dev);
+
+
+/** Free the buffer a device uses to hand bands of pixels to the encoder pool (if it has one).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_grfx_scratch_free(dlo_device_t * const dev);
+
+
+/** Allocate a host-side shadow of the device memory.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The shadow starts out with none of its bytes marked as valid because we have no idea
+ *  what the device memory contains until we have written to it. Once allocated, all of
+ *  the graphics primitives keep the shadow up to date as they build commands.
+ */
+extern dlo_retcode_t dlo_grfx_shadow_alloc(dlo_device_t * const dev);
+
+
+/** Free the host-side shadow of the device memory (if there is one).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_grfx_shadow_free(dlo_device_t * const dev);
+
+
+/** Note which areas of device memory would have been written by a block of commands that was lost.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  buf   Pointer to the commands which failed to reach the device.
+ *  @param  size  Size of the block of commands (bytes).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The destination of each drawing command in the block is added to the device's repair
+ *  list, ready for @c dlo_grfx_repair(). Anything else in the block is skipped over.
+ */
+extern dlo_retcode_t dlo_grfx_damage(dlo_device_t * const dev, const char * const buf, const size_t size);
+
+
+/** Send the areas of device memory on the repair list to the device again.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Areas which the shadow knows the contents of are sent from the shadow. Others within
+ *  the screen are fetched from the client's source function (if it has one). Anything
+ *  which can't be sent is marked as unknown in the shadow so that it gets redrawn in
+ *  full next time. The list is emptied once everything has been written successfully.
+ */
+extern dlo_retcode_t dlo_grfx_repair(dlo_device_t * const dev);
+
+
+/** Make room in the repair list of a real-time device, so a lost write needn't allocate memory.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_grfx_repair_alloc(dlo_device_t * const dev);
+
+
+/** Free the repair list of a device (if it has one).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_grfx_repair_free(dlo_device_t * const dev);
+
+
+/** Add the commands to fill a rectangle to a command segment.
+ *
+ *  @param  seg   Pointer to the segment.
+ *  @param  area  Struct pointer: area within device memory to fill.
+ *  @param  col   Colour of filled rectangle.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  This only reads the device structure, so threads can fill their own segments at once.
+ */
+extern dlo_retcode_t dlo_grfx_seg_fill(dlo_seg_t * const seg, const dlo_area_t * const area, const dlo_col32_t col);
+
+
+/** Add the commands to copy a bitmap from host memory to a command segment.
+ *
+ *  @param  seg    Pointer to the segment.
+ *  @param  flags  Flags word indicating special behaviour.
+ *  @param  fbuf   Struct pointer: information about source bitmap in host memory.
+ *  @param  area   Struct pointer: area within device memory to copy to.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  This only reads the device structure, so threads can fill their own segments at once.
+ *  The pixels are always sent in full, since the shadow can't be compared with safely.
+ */
+extern dlo_retcode_t dlo_grfx_seg_copy_host_bmp(dlo_seg_t * const seg, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area);
+
+
+/** Bring the shadow up to date with a block of commands from a command segment.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  buf   Pointer to the commands.
+ *  @param  size  Size of the block of commands (bytes).
+ */
+extern void dlo_grfx_seg_apply(dlo_device_t * const dev, const char * const buf, const size_t size);
+
+
 #endif
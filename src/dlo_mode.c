@@ -409,6 +409,22 @@ dlo_retcode_t dlo_mode_set_default(dlo_device_t * const dev, uint32_t base)
 }
 
 
+dlo_retcode_t dlo_mode_set_base(dlo_device_t * const dev, const dlo_ptr_t base)
+{
+  /* Base address must be aligned to a two byte boundary */
+  if (base & 1)
+    return dlo_err_bad_mode;
+
+  /* Flush the command buffer, so nothing queued before the switch is drawn after it */
+  ERR(dlo_usb_write(dev));
+
+  dev->mode.view.base = base;
+  dev->base8          = base + (BYTES_PER_16BPP * dev->mode.view.width * dev->mode.view.height);
+
+  return set_base(dev, dev->mode.view.base, dev->base8);
+}
+
+
 dlo_retcode_t dlo_mode_parse_edid(dlo_device_t * const dev, const uint8_t * const ptr, const size_t size)
 {
   dlo_edid_t *edid = &dev->edid;
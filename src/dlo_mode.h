@@ -120,6 +120,21 @@ extern dlo_retcode_t dlo_mode_change(dlo_device_t * const dev, const dlo_mode_t
  */
 extern dlo_retcode_t dlo_mode_set_default(dlo_device_t * const dev, uint32_t base);
 
+
+/** Show a different part of the device memory, without changing the screen mode.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  base  Base address of the viewport to show (must be on a two byte boundary).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Only the scan-out base registers are written. The viewport is assumed to have the same
+ *  size and colour depth as the current mode.
+ *
+ *  Note: this call will cause any buffered commands to be sent to the device.
+ */
+extern dlo_retcode_t dlo_mode_set_base(dlo_device_t * const dev, const dlo_ptr_t base);
+
 /** Parse the EDID structure read from a display device and build a list of supported modes.
  *
  *  @param  dev   Pointer to @a dlo_device_t structure.
@@ -0,0 +1,958 @@
+/** @file dlo_net.c
+ *
+ *  @brief Implements the network transport for remote devices.
+ *
+ *  A remote device is a device claimed by @c dlo_serve_device() on another machine. All
+ *  of the rendering and encoding for it happens in this process; each block of commands
+ *  which would have been written to the bulk endpoint is sent over TCP instead (optionally
+ *  LZ4 compressed) and the server writes it, unchanged, to its local device.
+ *
+ *  Each message starts with a one byte operation code and a 32 bit big-endian payload
+ *  length. Every operation other than a command stream write gets a reply, consisting of
+ *  a 32 bit big-endian return code and payload length followed by the payload. Writes are
+ *  not acknowledged; the first error from them is held by the server and returned in the
+ *  reply to the next channel selection or sync operation.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "netinet/in.h"
+#include "netinet/tcp.h"
+#if defined(HAVE_LZ4_H) && defined(HAVE_LIBLZ4)
+#include <lz4.h>
+#define NET_LZ4        /**< We can compress and decompress the command stream. */
+#endif
+#include "dlo_defs.h"
+#include "dlo_net.h"
+#include "dlo_usb.h"
+#include "dlo_base.h"
+#include "dlo_mode.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+#define NET_OP_HELLO     (1u)  /**< Request: return device type, server capabilities and serial number. */
+#define NET_OP_EDID      (2u)  /**< Request: return the raw EDID structure of the display. */
+#define NET_OP_CHAN_SEL  (3u)  /**< Request: select a channel (payload is the channel information). */
+#define NET_OP_WRITE     (4u)  /**< Write commands (payload is the command stream), no reply. */
+#define NET_OP_WRITE_LZ4 (5u)  /**< Write LZ4 compressed commands (payload is raw length then data), no reply. */
+#define NET_OP_SYNC      (6u)  /**< Request: return (and clear) any error from earlier writes. */
+
+/** Server capability flag: the server can decompress LZ4 compressed writes.
+ */
+#define NET_CAP_LZ4 (1u)
+
+/** Size of a message header: operation code and payload length (bytes).
+ */
+#define NET_HDR_SZ (5u)
+
+/** Size of a reply header: return code and payload length (bytes).
+ */
+#define NET_REPLY_SZ (8u)
+
+/** Largest payload we will send or accept: a full command buffer after LZ4 compression,
+ *  which can be very slightly larger than the original, plus its length word.
+ */
+#define NET_MAX_PAYLOAD (4u + BUF_SIZE + (BUF_SIZE / 255u) + 16u)
+
+/** Longest host name we'll accept (bytes, including the terminator).
+ */
+#define NET_HOST_MAX (256u)
+
+/** Longest serial number string we'll accept from the server (bytes, excluding the terminator).
+ */
+#define NET_SERIAL_MAX (255u)
+
+/** Return the network connection structure for a remote device.
+ */
+#define NCNCT(dev) ((dlo_net_dev_t *)(dev)->cnct)
+
+#ifndef MSG_MORE
+#define MSG_MORE (0)   /**< Only a hint, so don't worry if it's not available. */
+#endif
+
+
+/* File-scope types --------------------------------------------------------------------*/
+
+
+/** A remote device which was added with @c dlo_net_add().
+ */
+typedef struct net_remote_s net_remote_t;
+
+/** A remote device which was added with @c dlo_net_add().
+ */
+struct net_remote_s
+{
+  net_remote_t   *next;                /**< Pointer to next node in the list (or NULL). */
+  char           *serial;              /**< Serial number of the node in the device list. */
+  char            host[NET_HOST_MAX];  /**< Host name or address of the server. */
+  uint16_t        port;                /**< TCP port of the server. */
+  dlo_netflags_t  flags;               /**< Flags word describing the connection. */
+  dlo_devtype_t   type;                /**< Type of the device on the server. */
+};
+
+
+/** Structure used internally by dlo_net.c (stored as dev->cnct in @a dlo_device_t structure).
+ */
+typedef struct dlo_net_dev_s
+{
+  const net_remote_t *remote;          /**< Pointer to the remote device information. */
+  int                 sock;            /**< Connected socket (or -1 if not open). */
+  char               *zbuf;            /**< Buffer for compressed messages (or NULL). */
+  char               *out;             /**< Buffer for a whole message being sent without blocking (or NULL). */
+  size_t              out_len;         /**< Length of the message in @a out (zero if none). */
+  size_t              out_off;         /**< Number of bytes of the message in @a out sent so far. */
+} dlo_net_dev_t;                       /**< A struct @a dlo_net_dev_s. */
+
+
+/* External scope variables ------------------------------------------------------------*/
+
+
+/* File-scope variables ----------------------------------------------------------------*/
+
+
+/** List of the remote devices added so far.
+ */
+static net_remote_t *remotes = NULL;
+
+
+/** The last network error message.
+ */
+static char net_err_str[256] = { '\0' };
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Make a note of a network error.
+ *
+ *  @param  what    What we were trying to do.
+ *  @param  errnum  Value of errno for the error (or zero).
+ *
+ *  @return  Return code to indicate a network-related error.
+ */
+static dlo_retcode_t net_error(const char * const what, const int errnum);
+
+
+/** Store a 32 bit value in big-endian byte order.
+ *
+ *  @param  ptr  Pointer to where to store the value.
+ *  @param  val  Value to store.
+ */
+static void put_word(uint8_t * const ptr, const uint32_t val);
+
+
+/** Read a 32 bit big-endian value.
+ *
+ *  @param  ptr  Pointer to the value.
+ *
+ *  @return  Value in host byte order.
+ */
+static uint32_t get_word(const uint8_t * const ptr);
+
+
+/** Send all of a block of data to a socket.
+ *
+ *  @param  sock   Socket to write to.
+ *  @param  buf    Pointer to the data to send.
+ *  @param  size   Size of the data (bytes).
+ *  @param  flags  Flags for the send() call.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t send_all(const int sock, const void *buf, size_t size, const int flags);
+
+
+/** Receive a block of data of known size from a socket.
+ *
+ *  @param  sock  Socket to read from.
+ *  @param  buf   Pointer to the buffer to read into.
+ *  @param  size  Number of bytes to read.
+ *  @param  eof   Pointer to flag to set if the connection closed before any data was read (or NULL).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t recv_all(const int sock, void *buf, size_t size, bool * const eof);
+
+
+/** Send a message.
+ *
+ *  @param  sock  Socket to write to.
+ *  @param  op    Operation code.
+ *  @param  buf   Pointer to the payload (or NULL).
+ *  @param  size  Size of the payload (bytes).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t send_msg(const int sock, const uint32_t op, const void * const buf, const size_t size);
+
+
+/** Send a reply.
+ *
+ *  @param  sock  Socket to write to.
+ *  @param  ret   Return code of the requested operation.
+ *  @param  buf   Pointer to the payload (or NULL).
+ *  @param  size  Size of the payload (bytes).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t send_reply(const int sock, const dlo_retcode_t ret, const void * const buf, const size_t size);
+
+
+/** Send a request and wait for the reply.
+ *
+ *  @param  sock  Socket to use.
+ *  @param  op    Operation code.
+ *  @param  buf   Pointer to the request payload (or NULL).
+ *  @param  size  Size of the request payload (bytes).
+ *  @param  rep   Pointer to the buffer for the reply payload (or NULL).
+ *  @param  max   Size of the reply payload buffer (bytes).
+ *  @param  len   Pointer to the reply payload length to fill in (or NULL).
+ *
+ *  @return  Return code from the server, or an error if the request failed.
+ */
+static dlo_retcode_t request(const int sock, const uint32_t op, const void * const buf, const size_t size,
+                             void * const rep, const size_t max, size_t * const len);
+
+
+/** Open a TCP connection to a server.
+ *
+ *  @param  host     Host name or address of the server.
+ *  @param  port     TCP port of the server.
+ *  @param  timeout  Timeout for sends and receives (milliseconds, zero for none).
+ *  @param  sockp    Pointer to the socket to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t net_connect(const char * const host, const uint16_t port, const uint32_t timeout, int * const sockp);
+
+
+/** Create a device list node for a remote device.
+ *
+ *  @param  remote  Pointer to the remote device information.
+ *  @param  devp    Pointer to the device structure pointer to fill in (or NULL).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t new_remote_device(const net_remote_t * const remote, dlo_device_t ** const devp);
+
+
+/** Serve a single client connection until it closes.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  sock  Socket connected to the client.
+ *  @param  msg   Buffer to receive message payloads (@a NET_MAX_PAYLOAD bytes).
+ *  @param  raw   Buffer to decompress command streams into (@a BUF_SIZE bytes).
+ *
+ *  @return  Return code, zero if the client closed the connection cleanly.
+ */
+static dlo_retcode_t serve_client(dlo_device_t * const dev, const int sock, uint8_t * const msg, uint8_t * const raw);
+
+
+/** Network connection: open the specified device.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t net_cnct_open(dlo_device_t * const dev);
+
+
+/** Network connection: close the specified device.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, including any error held by the server from earlier writes.
+ */
+static dlo_retcode_t net_cnct_close(dlo_device_t * const dev);
+
+
+/** Network connection: select the input channel in the specified device.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the buffer containing the channel information.
+ *  @param  size  Size of the buffer (bytes).
+ *
+ *  @return  Return code, including any error held by the server from earlier writes.
+ */
+static dlo_retcode_t net_cnct_chan_sel(const dlo_device_t * const dev, const char * const buf, const size_t size);
+
+
+/** Network connection: send a block of commands (no larger than @a BUF_SIZE) to the device.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the buffer containing commands to write.
+ *  @param  size  Size of the buffer (bytes).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t net_cnct_write_buf(dlo_device_t * const dev, char * buf, size_t size);
+
+
+/** Network connection: send a block of commands without blocking.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the buffer containing commands to write.
+ *  @param  size  Size of the buffer (bytes).
+ *
+ *  @return  Return code, zero once the whole block has been sent.
+ *
+ *  If the socket won't accept the whole message yet, this returns @a dlo_err_would_block
+ *  and must be called again with the same block to send the rest of it.
+ */
+static dlo_retcode_t net_cnct_write_nb(dlo_device_t * const dev, char * buf, size_t size);
+
+
+/** Network connection: return the socket, for the caller to poll.
+ *
+ *  @param  dev  Device structure pointer.
+ *  @param  fd   Pointer to the file descriptor to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t net_cnct_get_fd(const dlo_device_t * const dev, int * const fd);
+
+
+/** Network connection: read the raw EDID bytes from the monitor attached to the device.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the buffer to read into.
+ *  @param  size  Number of bytes to read.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t net_cnct_read_edid(dlo_device_t * const dev, uint8_t * const buf, const size_t size);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+char *dlo_net_strerror(void)
+{
+  return net_err_str;
+}
+
+
+dlo_retcode_t dlo_net_init(const dlo_init_t flags)
+{
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_net_final(const dlo_final_t flags)
+{
+  while (remotes)
+  {
+    net_remote_t *next = remotes->next;
+
+    dlo_free(remotes->serial);
+    dlo_free(remotes);
+    remotes = next;
+  }
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_net_enumerate(const bool init)
+{
+  net_remote_t *remote;
+
+  for (remote = remotes; remote; remote = remote->next)
+    if (!dlo_device_lookup(remote->serial))
+      ERR(new_remote_device(remote, NULL));
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_net_add(const char * const host, const uint16_t port, const dlo_netflags_t flags, dlo_device_t ** const devp)
+{
+  dlo_retcode_t err;
+  net_remote_t *remote = NULL;
+  uint8_t       hello[2 + NET_SERIAL_MAX];
+  size_t        len;
+  int           sock;
+
+#ifndef NET_LZ4
+  if (flags.compress)
+    return dlo_err_unsupported;
+#endif
+  if (strlen(host) >= NET_HOST_MAX)
+    return net_error("Host name is too long", 0);
+
+  /* Ask the server what it is serving */
+  ERR(net_connect(host, port, 0, &sock));
+  err = request(sock, NET_OP_HELLO, NULL, 0, hello, sizeof(hello), &len);
+  (void) close(sock);
+  ERR(err);
+  if (len < 2)
+    return net_error("Bad reply from server", 0);
+  if (flags.compress && !(hello[1] & NET_CAP_LZ4))
+    return dlo_err_unsupported;
+
+  /* Add it to our list of remote devices, with a serial number which can't clash with a local device */
+  remote = (net_remote_t *)dlo_malloc(sizeof(net_remote_t));
+  NERR(remote);
+  remote->serial = dlo_malloc((len - 2) + 1 + strlen(host) + 7);
+  NERR_GOTO(remote->serial);
+  (void) sprintf(remote->serial, "%.*s@%s:%u", (int)(len - 2), (char *)&hello[2], host, (unsigned int)port);
+  if (dlo_device_lookup(remote->serial))
+    ERR_GOTO(dlo_err_claimed);
+  strcpy(remote->host, host);
+  remote->port  = port;
+  remote->flags = flags;
+  remote->type  = (dlo_devtype_t)hello[0];
+  remote->next  = remotes;
+  remotes       = remote;
+
+  return new_remote_device(remote, devp);
+
+error:
+  if (remote->serial)
+    dlo_free(remote->serial);
+  dlo_free(remote);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_net_serve(dlo_device_t * const dev, const uint16_t port)
+{
+  dlo_retcode_t      err;
+  struct sockaddr_in addr;
+  uint8_t           *msg    = NULL;
+  uint8_t           *raw    = NULL;
+  int                lsock  = -1;
+  int                one    = 1;
+
+  msg = dlo_malloc(NET_MAX_PAYLOAD);
+  NERR_GOTO(msg);
+  raw = dlo_malloc(BUF_SIZE);
+  NERR_GOTO(raw);
+
+  /* Listen on all interfaces */
+  lsock = socket(AF_INET, SOCK_STREAM, 0);
+  if (lsock < 0)
+    ERR_GOTO(net_error("socket", errno));
+  (void) setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port        = htons(port);
+  if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    ERR_GOTO(net_error("bind", errno));
+  if (listen(lsock, 1) < 0)
+    ERR_GOTO(net_error("listen", errno));
+
+  /* Serve one client at a time, for ever */
+  for (;;)
+  {
+    int sock = accept(lsock, NULL, NULL);
+
+    if (sock < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      ERR_GOTO(net_error("accept", errno));
+    }
+    (void) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    err = serve_client(dev, sock, msg, raw);
+    (void) close(sock);
+    DPRINTF("net: serve: client finished %u '%s'\n", (int)err, dlo_strerror(err));
+
+    /* Don't leave a partial command in the device's buffer for the next client */
+    dev->bufptr = dev->buffer;
+  }
+
+error:
+  if (lsock >= 0)
+    (void) close(lsock);
+  if (raw)
+    dlo_free(raw);
+  if (msg)
+    dlo_free(msg);
+
+  return err;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static dlo_retcode_t net_error(const char * const what, const int errnum)
+{
+  if (errnum)
+    (void) snprintf(net_err_str, sizeof(net_err_str), "%s: %s", what, strerror(errnum));
+  else
+    (void) snprintf(net_err_str, sizeof(net_err_str), "%s", what);
+
+  return dlo_err_net;
+}
+
+
+static void put_word(uint8_t * const ptr, const uint32_t val)
+{
+  ptr[0] = (uint8_t)(val >> 24);
+  ptr[1] = (uint8_t)(val >> 16);
+  ptr[2] = (uint8_t)(val >> 8);
+  ptr[3] = (uint8_t)val;
+}
+
+
+static uint32_t get_word(const uint8_t * const ptr)
+{
+  return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+}
+
+
+static dlo_retcode_t send_all(const int sock, const void *buf, size_t size, const int flags)
+{
+  const uint8_t *ptr = (const uint8_t *)buf;
+
+  while (size)
+  {
+    ssize_t num = send(sock, ptr, size, flags | MSG_NOSIGNAL);
+
+    if (num < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return net_error("send", errno);
+    }
+    ptr  += num;
+    size -= num;
+  }
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t recv_all(const int sock, void *buf, size_t size, bool * const eof)
+{
+  uint8_t *ptr = (uint8_t *)buf;
+  bool     any = false;
+
+  if (eof)
+    *eof = false;
+
+  while (size)
+  {
+    ssize_t num = recv(sock, ptr, size, 0);
+
+    if (num < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return net_error("recv", errno);
+    }
+    if (num == 0)
+    {
+      if (eof && !any)
+        *eof = true;
+      return net_error("Connection closed by peer", 0);
+    }
+    any   = true;
+    ptr  += num;
+    size -= num;
+  }
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t send_msg(const int sock, const uint32_t op, const void * const buf, const size_t size)
+{
+  uint8_t hdr[NET_HDR_SZ];
+
+  hdr[0] = (uint8_t)op;
+  put_word(&hdr[1], size);
+  ERR(send_all(sock, hdr, sizeof(hdr), size ? MSG_MORE : 0));
+  if (size)
+    ERR(send_all(sock, buf, size, 0));
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t send_reply(const int sock, const dlo_retcode_t ret, const void * const buf, const size_t size)
+{
+  uint8_t hdr[NET_REPLY_SZ];
+
+  put_word(&hdr[0], (uint32_t)ret);
+  put_word(&hdr[4], size);
+  ERR(send_all(sock, hdr, sizeof(hdr), size ? MSG_MORE : 0));
+  if (size)
+    ERR(send_all(sock, buf, size, 0));
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t request(const int sock, const uint32_t op, const void * const buf, const size_t size,
+                             void * const rep, const size_t max, size_t * const len)
+{
+  uint8_t  hdr[NET_REPLY_SZ];
+  uint32_t num;
+
+  ERR(send_msg(sock, op, buf, size));
+  ERR(recv_all(sock, hdr, sizeof(hdr), NULL));
+
+  num = get_word(&hdr[4]);
+  if (num > max)
+    return net_error("Reply from server is too large", 0);
+  if (num)
+    ERR(recv_all(sock, rep, num, NULL));
+  if (len)
+    *len = num;
+
+  return (dlo_retcode_t)get_word(&hdr[0]);
+}
+
+
+static dlo_retcode_t net_connect(const char * const host, const uint16_t port, const uint32_t timeout, int * const sockp)
+{
+  struct addrinfo  hints;
+  struct addrinfo *res;
+  struct addrinfo *ai;
+  char             service[8];
+  int              sock  = -1;
+  int              one   = 1;
+  int              saved = 0;
+  int              ret;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  (void) snprintf(service, sizeof(service), "%u", (unsigned int)port);
+
+  ret = getaddrinfo(host, service, &hints, &res);
+  if (ret)
+    return net_error(gai_strerror(ret), 0);
+
+  /* Try each address in turn until one of them connects */
+  for (ai = res; ai; ai = ai->ai_next)
+  {
+    sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock < 0)
+    {
+      saved = errno;
+      continue;
+    }
+    if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    saved = errno;
+    (void) close(sock);
+    sock = -1;
+  }
+  freeaddrinfo(res);
+  if (sock < 0)
+    return net_error("connect", saved);
+
+  /* Commands are already batched into large blocks, so don't delay the small requests */
+  (void) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (timeout)
+  {
+    struct timeval tv;
+
+    tv.tv_sec  = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    (void) setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    (void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  *sockp = sock;
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t new_remote_device(const net_remote_t * const remote, dlo_device_t ** const devp)
+{
+  dlo_device_t *dev = dlo_new_device(remote->type, remote->serial);
+
+  NERR(dev);
+  dev->cnct = dlo_malloc(sizeof(dlo_net_dev_t));
+  NERR(dev->cnct);
+  NCNCT(dev)->remote  = remote;
+  NCNCT(dev)->sock    = -1;
+  NCNCT(dev)->zbuf    = NULL;
+  NCNCT(dev)->out     = NULL;
+  NCNCT(dev)->out_len = 0;
+  NCNCT(dev)->out_off = 0;
+
+  /* Talk to it using our network connection functions */
+  dev->open      = net_cnct_open;
+  dev->close     = net_cnct_close;
+  dev->chan_sel  = net_cnct_chan_sel;
+  dev->write_buf = net_cnct_write_buf;
+  dev->read_edid = net_cnct_read_edid;
+  dev->write_nb  = net_cnct_write_nb;
+  dev->get_fd    = net_cnct_get_fd;
+
+  if (devp)
+    *devp = dev;
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t serve_client(dlo_device_t * const dev, const int sock, uint8_t * const msg, uint8_t * const raw)
+{
+  dlo_retcode_t held = dlo_ok;
+  dlo_retcode_t err;
+  uint8_t       hdr[NET_HDR_SZ];
+  uint8_t       edid[EDID_STRUCT_SZ];
+  uint32_t      size;
+  bool          eof;
+
+  for (;;)
+  {
+    /* Read the next message; a clean close between messages is the end of the client */
+    err = recv_all(sock, hdr, sizeof(hdr), &eof);
+    if (eof)
+      return dlo_ok;
+    ERR(err);
+    size = get_word(&hdr[1]);
+    if (size > NET_MAX_PAYLOAD)
+      return net_error("Message from client is too large", 0);
+    if (size)
+      ERR(recv_all(sock, msg, size, NULL));
+
+    switch (hdr[0])
+    {
+      case NET_OP_HELLO:
+      {
+        uint8_t hello[2 + NET_SERIAL_MAX];
+        size_t  len = strlen(dev->serial);
+
+        if (len > NET_SERIAL_MAX)
+          len = NET_SERIAL_MAX;
+        hello[0] = (uint8_t)dev->type;
+#ifdef NET_LZ4
+        hello[1] = NET_CAP_LZ4;
+#else
+        hello[1] = 0;
+#endif
+        dlo_memcpy(&hello[2], dev->serial, len);
+        ERR(send_reply(sock, dlo_ok, hello, 2 + len));
+        break;
+      }
+      case NET_OP_EDID:
+        err = dlo_usb_read_edid(dev, edid, sizeof(edid));
+        ERR(send_reply(sock, err, edid, err == dlo_ok ? sizeof(edid) : 0));
+        break;
+
+      case NET_OP_CHAN_SEL:
+        err = dlo_usb_chan_sel(dev, (char *)msg, size);
+        ERR(send_reply(sock, held != dlo_ok ? held : err, NULL, 0));
+        held = dlo_ok;
+        break;
+
+      case NET_OP_WRITE:
+        if (held == dlo_ok)
+          held = dlo_usb_write_buf(dev, (char *)msg, size);
+        break;
+
+      case NET_OP_WRITE_LZ4:
+#ifdef NET_LZ4
+      {
+        uint32_t len = size >= 4 ? get_word(msg) : 0;
+
+        if (size < 4 || len > BUF_SIZE ||
+            LZ4_decompress_safe((char *)msg + 4, (char *)raw, size - 4, BUF_SIZE) != (int)len)
+          return net_error("Bad compressed data from client", 0);
+        if (held == dlo_ok)
+          held = dlo_usb_write_buf(dev, (char *)raw, len);
+        break;
+      }
+#else
+        IGNORE(raw);
+        return net_error("Client sent compressed data", 0);
+#endif
+
+      case NET_OP_SYNC:
+        ERR(send_reply(sock, held, NULL, 0));
+        held = dlo_ok;
+        break;
+
+      default:
+        return net_error("Unknown message from client", 0);
+    }
+  }
+}
+
+
+static dlo_retcode_t net_cnct_open(dlo_device_t * const dev)
+{
+  dlo_net_dev_t *cnct = NCNCT(dev);
+
+  if (dev->nonblock)
+  {
+    cnct->out     = dlo_malloc(NET_HDR_SZ + NET_MAX_PAYLOAD);
+    NERR(cnct->out);
+    cnct->out_len = 0;
+  }
+  else if (cnct->remote->flags.compress)
+  {
+    cnct->zbuf = dlo_malloc(NET_MAX_PAYLOAD);
+    NERR(cnct->zbuf);
+  }
+
+  return net_connect(cnct->remote->host, cnct->remote->port, dev->timeout, &cnct->sock);
+}
+
+
+static dlo_retcode_t net_cnct_close(dlo_device_t * const dev)
+{
+  dlo_net_dev_t *cnct = NCNCT(dev);
+  dlo_retcode_t  err  = dlo_ok;
+
+  if (cnct->sock >= 0)
+  {
+    /* Pick up any error from our last few writes before we go */
+    err = request(cnct->sock, NET_OP_SYNC, NULL, 0, NULL, 0, NULL);
+    (void) close(cnct->sock);
+    cnct->sock = -1;
+  }
+  if (cnct->zbuf)
+  {
+    dlo_free(cnct->zbuf);
+    cnct->zbuf = NULL;
+  }
+  if (cnct->out)
+  {
+    dlo_free(cnct->out);
+    cnct->out = NULL;
+  }
+
+  return err;
+}
+
+
+static dlo_retcode_t net_cnct_chan_sel(const dlo_device_t * const dev, const char * const buf, const size_t size)
+{
+  return request(NCNCT(dev)->sock, NET_OP_CHAN_SEL, buf, size, NULL, 0, NULL);
+}
+
+
+static dlo_retcode_t net_cnct_write_buf(dlo_device_t * const dev, char * buf, size_t size)
+{
+#ifdef NET_LZ4
+  dlo_net_dev_t *cnct = NCNCT(dev);
+
+  /* Send the compressed block, unless compression didn't make it any smaller */
+  if (cnct->zbuf)
+  {
+    int num = LZ4_compress_default(buf, cnct->zbuf + 4, size, NET_MAX_PAYLOAD - 4);
+
+    if (num > 0 && (size_t)num + 4 < size)
+    {
+      put_word((uint8_t *)cnct->zbuf, size);
+      return send_msg(cnct->sock, NET_OP_WRITE_LZ4, cnct->zbuf, num + 4);
+    }
+  }
+#endif
+
+  return send_msg(NCNCT(dev)->sock, NET_OP_WRITE, buf, size);
+}
+
+
+static dlo_retcode_t net_cnct_write_nb(dlo_device_t * const dev, char * buf, size_t size)
+{
+  dlo_net_dev_t *cnct = NCNCT(dev);
+  uint8_t       *out  = (uint8_t *)cnct->out;
+
+  /* Build the whole message first, so that it can go out in as many pieces as it takes */
+  if (!cnct->out_len)
+  {
+#ifdef NET_LZ4
+    if (cnct->remote->flags.compress)
+    {
+      int num = LZ4_compress_default(buf, cnct->out + NET_HDR_SZ + 4, size, NET_MAX_PAYLOAD - 4);
+
+      if (num > 0 && (size_t)num + 4 < size)
+      {
+        out[0] = NET_OP_WRITE_LZ4;
+        put_word(&out[1], num + 4);
+        put_word(&out[NET_HDR_SZ], size);
+        cnct->out_len = NET_HDR_SZ + 4 + num;
+      }
+    }
+#endif
+    if (!cnct->out_len)
+    {
+      out[0] = NET_OP_WRITE;
+      put_word(&out[1], size);
+      dlo_memcpy(out + NET_HDR_SZ, buf, size);
+      cnct->out_len = NET_HDR_SZ + size;
+    }
+    cnct->out_off = 0;
+  }
+
+  while (cnct->out_off < cnct->out_len)
+  {
+    ssize_t num = send(cnct->sock, out + cnct->out_off, cnct->out_len - cnct->out_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (num < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return dlo_err_would_block;
+      cnct->out_len = 0;
+      return net_error("send", errno);
+    }
+    cnct->out_off += num;
+  }
+  cnct->out_len = 0;
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t net_cnct_get_fd(const dlo_device_t * const dev, int * const fd)
+{
+  *fd = NCNCT(dev)->sock;
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t net_cnct_read_edid(dlo_device_t * const dev, uint8_t * const buf, const size_t size)
+{
+  size_t len;
+
+  ERR(request(NCNCT(dev)->sock, NET_OP_EDID, NULL, 0, buf, size, &len));
+  if (len != size)
+    return dlo_err_edid_fail;
+
+  return dlo_ok;
+}
+
+
+/* End of file -------------------------------------------------------------------------*/
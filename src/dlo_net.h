@@ -0,0 +1,93 @@
+/** @file dlo_net.h
+ *
+ *  @brief Header file for the network transport functions.
+ *
+ *  This file defines the API between libdlo.c and the network transport. The client side
+ *  adds remote devices to the device list and sends their command stream over TCP; the
+ *  server side accepts such connections and writes the command stream to a local device.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_NET_H
+#define DLO_NET_H        /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Return the meaning of the last network-related error as a human-readable string.
+ *
+ *  @return  Pointer to error message string (zero-terminated).
+ */
+extern char * dlo_net_strerror(void);
+
+
+/** Initialise the network transport.
+ *
+ *  @param  flags  Initialisation flags word (unused flags ignored).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_net_init(const dlo_init_t flags);
+
+
+/** Finalisation call for the network transport.
+ *
+ *  @param  flags  Finalisation flags word (unused flags ignored).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_net_final(const dlo_final_t flags);
+
+
+/** Make sure that the device list contains a node for each remote device that was added.
+ *
+ *  @param  init  Is this the first call to the enumeration function?
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Remote devices can't be discovered, so this doesn't talk to the network. It just marks
+ *  the nodes of the remote devices as present (or re-creates any which were thrown away
+ *  after an error during an earlier enumeration).
+ */
+extern dlo_retcode_t dlo_net_enumerate(const bool init);
+
+
+/** Add a device served by another machine to the device list.
+ *
+ *  @param  host   Host name or address of the machine serving the device.
+ *  @param  port   TCP port on which the device is served.
+ *  @param  flags  Flags word describing the connection.
+ *  @param  devp   Pointer to the device structure pointer to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_net_add(const char * const host, const uint16_t port, const dlo_netflags_t flags, dlo_device_t ** const devp);
+
+
+/** Serve a claimed device to remote clients (doesn't return unless there is an error).
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  port  TCP port on which to listen.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_net_serve(dlo_device_t * const dev, const uint16_t port);
+
+
+#endif
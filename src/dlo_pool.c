@@ -0,0 +1,376 @@
+/** @file dlo_pool.c
+ *
+ *  @brief Implements the shared pool of encoder threads.
+ *
+ *  Every worker thread has a deque of tasks. Tasks are handed out to the deques in turn,
+ *  and a worker takes the newest task from its own deque, or steals the oldest task from
+ *  another deque once its own is empty, so a worker which runs out of work takes some from
+ *  a busier one. A thread waiting for a task to finish also steals tasks rather than sit
+ *  idle. Tasks from every device share the same workers; it is up to the caller to use the
+ *  results of its own tasks in order.
+ *
+ *  Each deque has its own lock; the tasks are large enough (a band of pixel rows) that
+ *  this costs nothing noticeable.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <pthread.h>
+#include "dlo_defs.h"
+#include "dlo_pool.h"
+#include "dlo_rt.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+/** Largest number of worker threads.
+ */
+#define MAX_WORKERS (64u)
+
+/** Number of tasks each deque can hold.
+ */
+#define DEQUE_SIZE (256u)
+
+/** Value passed to @c take() by a thread which isn't a worker.
+ */
+#define NOT_A_WORKER (MAX_WORKERS)
+
+
+/* File-scope types --------------------------------------------------------------------*/
+
+
+/** A deque of tasks belonging to one worker.
+ */
+typedef struct deque_s
+{
+  pthread_mutex_t lock;               /**< Lock for the rest of the structure. */
+  dlo_task_t     *slot[DEQUE_SIZE];   /**< Ring buffer of tasks. */
+  uint32_t        top;                /**< Index of the oldest task (the end other threads steal from). */
+  uint32_t        bottom;             /**< Index after the newest task (the end the owner works from). */
+} deque_t;                            /**< A struct @a deque_s. */
+
+
+/* File-scope variables ----------------------------------------------------------------*/
+
+
+/** Number of worker threads running.
+ */
+static uint32_t num_workers = 0;
+
+/** Number of deques in use (set before the workers start, so they can read it freely).
+ */
+static uint32_t num_deques = 0;
+
+/** The worker threads.
+ */
+static pthread_t worker[MAX_WORKERS];
+
+/** A deque for each worker thread.
+ */
+static deque_t deque[MAX_WORKERS];
+
+/** Lock for @a pending, @a stopping and the @a done flag of every task.
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signalled when a task is added to a deque (or the workers are to stop).
+ */
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+
+/** Broadcast when a task finishes.
+ */
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/** Number of tasks waiting in the deques.
+ */
+static uint32_t pending = 0;
+
+/** Flag: the workers should exit once the deques are empty.
+ */
+static bool stopping = false;
+
+/** Deque to give the next task to.
+ */
+static uint32_t next_deque = 0;
+
+/** Scheduling for the worker threads, if @a sched_set.
+ */
+static dlo_rtsched_t sched;
+
+/** Flag: @a sched has been set, so new workers are given it.
+ */
+static bool sched_set = false;
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Body of a worker thread.
+ *
+ *  @param  arg  Index of the worker (cast to a pointer).
+ *
+ *  @return  NULL.
+ */
+static void *worker_main(void *arg);
+
+
+/** Take a task from the deques, preferring the newest task of a worker's own deque.
+ *
+ *  @param  self  Index of the calling worker, or @c NOT_A_WORKER.
+ *
+ *  @return  Pointer to the task (or NULL if every deque is empty).
+ */
+static dlo_task_t *take(const uint32_t self);
+
+
+/** Run a task and mark it as finished.
+ *
+ *  @param  task  Pointer to the task.
+ */
+static void run(dlo_task_t * const task);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+dlo_retcode_t dlo_pool_start(const uint32_t workers)
+{
+  uint32_t i;
+
+  if (workers > MAX_WORKERS)
+    return dlo_err_unsupported;
+
+  dlo_pool_stop();
+
+  for (i = 0; i < workers; i++)
+  {
+    deque[i].top    = 0;
+    deque[i].bottom = 0;
+    (void) pthread_mutex_init(&deque[i].lock, NULL);
+  }
+  stopping   = false;
+  next_deque = 0;
+  num_deques = workers;
+
+  for (i = 0; i < workers; i++)
+  {
+    if (pthread_create(&worker[i], NULL, worker_main, (void *)(unsigned long)i))
+      break;
+    num_workers = i + 1;
+    if (sched_set)
+      (void) dlo_rt_sched(worker[i], &sched);
+  }
+  if (num_workers == workers)
+    return dlo_ok;
+
+  dlo_pool_stop();
+
+  return dlo_err_memory;
+}
+
+
+void dlo_pool_stop(void)
+{
+  uint32_t i;
+  uint32_t num = num_workers;
+
+  if (!num_deques)
+    return;
+
+  (void) pthread_mutex_lock(&pool_lock);
+  stopping = true;
+  (void) pthread_cond_broadcast(&work_cond);
+  (void) pthread_mutex_unlock(&pool_lock);
+
+  for (i = 0; i < num; i++)
+    (void) pthread_join(worker[i], NULL);
+
+  for (i = 0; i < num_deques; i++)
+    (void) pthread_mutex_destroy(&deque[i].lock);
+  num_workers = 0;
+  num_deques  = 0;
+}
+
+
+uint32_t dlo_pool_workers(void)
+{
+  return num_workers;
+}
+
+
+dlo_retcode_t dlo_pool_sched(const dlo_rtsched_t * const new_sched)
+{
+  uint32_t i;
+
+  sched     = *new_sched;
+  sched_set = true;
+  for (i = 0; i < num_workers; i++)
+    ERR(dlo_rt_sched(worker[i], &sched));
+
+  return dlo_ok;
+}
+
+
+void dlo_pool_submit(dlo_task_t * const task)
+{
+  deque_t *dq;
+  bool     room;
+
+  task->done = false;
+  if (!num_workers)
+  {
+    run(task);
+    return;
+  }
+
+  /* Count the task before publishing it, so a worker can't take it (and uncount it) first */
+  (void) pthread_mutex_lock(&pool_lock);
+  dq         = &deque[next_deque];
+  next_deque = (next_deque + 1) % num_deques;
+  pending++;
+  (void) pthread_mutex_unlock(&pool_lock);
+
+  (void) pthread_mutex_lock(&dq->lock);
+  room = dq->bottom - dq->top < DEQUE_SIZE;
+  if (room)
+    dq->slot[dq->bottom++ % DEQUE_SIZE] = task;
+  (void) pthread_mutex_unlock(&dq->lock);
+
+  (void) pthread_mutex_lock(&pool_lock);
+  if (room)
+    (void) pthread_cond_signal(&work_cond);
+  else
+    pending--;
+  (void) pthread_mutex_unlock(&pool_lock);
+
+  if (!room)
+    run(task);
+}
+
+
+void dlo_pool_wait(dlo_task_t * const task)
+{
+  for (;;)
+  {
+    dlo_task_t *other;
+    bool        done;
+
+    (void) pthread_mutex_lock(&pool_lock);
+    done = task->done;
+    (void) pthread_mutex_unlock(&pool_lock);
+    if (done)
+      return;
+
+    /* Help out rather than sit idle */
+    other = take(NOT_A_WORKER);
+    if (other)
+    {
+      run(other);
+      continue;
+    }
+
+    /* Nothing left to steal, so our task must be running on a worker */
+    (void) pthread_mutex_lock(&pool_lock);
+    while (!task->done && !pending)
+      (void) pthread_cond_wait(&done_cond, &pool_lock);
+    (void) pthread_mutex_unlock(&pool_lock);
+  }
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static void *worker_main(void *arg)
+{
+  uint32_t self = (uint32_t)(unsigned long)arg;
+
+  for (;;)
+  {
+    dlo_task_t *task = take(self);
+
+    if (task)
+    {
+      run(task);
+      continue;
+    }
+
+    (void) pthread_mutex_lock(&pool_lock);
+    while (!pending && !stopping)
+      (void) pthread_cond_wait(&work_cond, &pool_lock);
+    if (!pending && stopping)
+    {
+      (void) pthread_mutex_unlock(&pool_lock);
+      break;
+    }
+    (void) pthread_mutex_unlock(&pool_lock);
+  }
+  return NULL;
+}
+
+
+static dlo_task_t *take(const uint32_t self)
+{
+  dlo_task_t *task = NULL;
+  uint32_t    i;
+
+  /* A worker's own deque first, newest task first */
+  if (self != NOT_A_WORKER)
+  {
+    deque_t *dq = &deque[self];
+
+    (void) pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top)
+      task = dq->slot[--dq->bottom % DEQUE_SIZE];
+    (void) pthread_mutex_unlock(&dq->lock);
+  }
+
+  /* Then steal the oldest task from the other deques */
+  for (i = 1; !task && i <= num_deques; i++)
+  {
+    deque_t *dq = &deque[(self + i) % num_deques];
+
+    (void) pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top)
+      task = dq->slot[dq->top++ % DEQUE_SIZE];
+    (void) pthread_mutex_unlock(&dq->lock);
+  }
+
+  if (task)
+  {
+    (void) pthread_mutex_lock(&pool_lock);
+    pending--;
+    (void) pthread_mutex_unlock(&pool_lock);
+  }
+  return task;
+}
+
+
+static void run(dlo_task_t * const task)
+{
+  task->fn(task);
+
+  (void) pthread_mutex_lock(&pool_lock);
+  task->done = true;
+  (void) pthread_cond_broadcast(&done_cond);
+  (void) pthread_mutex_unlock(&pool_lock);
+}
+
+
+/* End of file -------------------------------------------------------------------------*/
@@ -0,0 +1,91 @@
+/** @file dlo_pool.h
+ *
+ *  @brief Header file for the shared pool of encoder threads.
+ *
+ *  This file defines the API between the graphics code and the process-wide pool of
+ *  worker threads which share out encoding tasks from every device.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_POOL_H
+#define DLO_POOL_H        /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** A task for the pool.
+ */
+typedef struct dlo_task_s dlo_task_t;
+
+/** A task for the pool, usually the first member of a larger structure holding its arguments.
+ */
+struct dlo_task_s
+{
+  void (*fn)(dlo_task_t * const task);  /**< Function to run the task. */
+  bool done;                 /**< Flag: the task has finished (use @c dlo_pool_wait() to read). */
+};                           /**< A struct @a dlo_task_s. */
+
+
+/** Start the pool with a given number of worker threads, stopping any previous workers.
+ *
+ *  @param  workers  Number of worker threads (zero to run every task on its caller's thread).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_pool_start(const uint32_t workers);
+
+
+/** Stop the worker threads, once they have finished every task submitted so far.
+ */
+extern void dlo_pool_stop(void);
+
+
+/** Return the number of worker threads in the pool.
+ *
+ *  @return  Number of worker threads (zero if tasks run on their caller's thread).
+ */
+extern uint32_t dlo_pool_workers(void);
+
+
+/** Set the scheduling of the worker threads, now and whenever the pool is restarted.
+ *
+ *  @param  new_sched  Pointer to the scheduling to use.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_pool_sched(const dlo_rtsched_t * const new_sched);
+
+
+/** Hand a task to the pool.
+ *
+ *  @param  task  Pointer to the task (which must stay valid until it has finished).
+ *
+ *  If the pool has no workers, or no room for the task, it is run before this returns.
+ */
+extern void dlo_pool_submit(dlo_task_t * const task);
+
+
+/** Wait for a task to finish, running other tasks from the pool in the meantime.
+ *
+ *  @param  task  Pointer to the task.
+ */
+extern void dlo_pool_wait(dlo_task_t * const task);
+
+
+#endif
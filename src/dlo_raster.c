@@ -0,0 +1,269 @@
+/** @file dlo_raster.c
+ *
+ *  @brief Implements sending updates in the order which chases the display's beam.
+ *
+ *  The position of the beam is estimated from the time since a calibrated phase, the
+ *  frame period and the number of lines in a frame (including vertical blanking). A
+ *  bitmap copy with the @a chase flag is split into bands of rows, and the band sent next
+ *  is always the one which the beam left most recently, at the time the band would start
+ *  arriving. A band sent like that has most of a frame to arrive before it is scanned out
+ *  again, so it doesn't tear, and a band the beam is part way through goes last.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "dlo_defs.h"
+#include "dlo_raster.h"
+#include "dlo_frame.h"
+#include "dlo_grfx.h"
+#include "dlo_usb.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+/** Smallest number of rows in a band.
+ */
+#define BAND_ROWS (16u)
+
+/** Largest number of bands a copy is split into (taller bitmaps have taller bands).
+ */
+#define MAX_BANDS (256u)
+
+/** Without a detailed timing for the mode, vertical blanking is taken to be this fraction of the height.
+ */
+#define BLANK_DIV (24u)
+
+/** Frame period (microseconds) to assume if the mode has no refresh rate.
+ */
+#define DEFAULT_PERIOD (16667u)
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Work out the frame period and line count of the specified device's current mode.
+ *
+ *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  @param  period  Pointer to the frame period to fill in (microseconds).
+ *  @param  lines   Pointer to the line count to fill in.
+ */
+static void raster_timing(const dlo_device_t * const dev, uint32_t * const period, uint32_t * const lines);
+
+
+/** Return how far through its frame the scan-out is at a given time.
+ *
+ *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  @param  period  Frame period (microseconds).
+ *  @param  t       Time (microseconds).
+ *
+ *  @return  Time since the start of the frame (microseconds).
+ */
+static uint32_t raster_offset(const dlo_device_t * const dev, const uint32_t period, const uint64_t t);
+
+
+/** Make sure there is an entry in the row time table for every row of the current mode.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t row_table(dlo_device_t * const dev);
+
+
+/** Return the number of bytes of commands waiting to be carried to the specified device.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Number of bytes.
+ */
+static uint64_t pending(const dlo_device_t * const dev);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+void dlo_raster_set(dlo_device_t * const dev, const dlo_raster_t * const raster)
+{
+  dev->raster_on = raster ? true : false;
+  if (raster)
+    dev->raster = *raster;
+  else
+    dlo_raster_free(dev);
+}
+
+
+dlo_retcode_t dlo_raster_copy(dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area)
+{
+  uint32_t   line   = BYTES_PER_16BPP * dev->mode.view.width;
+  uint32_t   height = area->view.height;
+  uint32_t   bypp   = FORMAT_TO_BYTES_PER_PIXEL(fbuf->fmt);
+  bool       done[MAX_BANDS];
+  uint32_t   period, lines, top, band, nbands, n, i;
+
+  /* Only an area of the visible screen can chase the beam */
+  if (!dev->raster_on || !line || area->stride != dev->mode.view.width || area->view.base < dev->mode.view.base ||
+      (area->view.base - dev->mode.view.base) % line + (BYTES_PER_16BPP * area->view.width) > line ||
+      (area->view.base - dev->mode.view.base) / line + height > dev->mode.view.height)
+    return dlo_grfx_copy_host_bmp(dev, flags, fbuf, area);
+
+  ERR(row_table(dev));
+  raster_timing(dev, &period, &lines);
+  top    = (area->view.base - dev->mode.view.base) / line;
+  band   = height > BAND_ROWS * MAX_BANDS ? (height + MAX_BANDS - 1) / MAX_BANDS : BAND_ROWS;
+  nbands = (height + band - 1) / band;
+  dlo_memset(done, 0, sizeof(done));
+
+  for (n = 0; n < nbands; n++)
+  {
+    uint64_t   start = dlo_frame_now() + dlo_usb_link_time(dev, pending(dev));
+    uint32_t   beam  = (uint32_t)(((uint64_t)raster_offset(dev, period, start) * lines) / period);
+    uint32_t   best  = 0;
+    uint32_t   least = UINT32_MAX;
+    uint32_t   r0, r1;
+    uint64_t   arrive;
+    dlo_fbuf_t sub_fbuf;
+    dlo_area_t sub_area;
+
+    /* Pick the band whose last row the beam passed most recently */
+    for (i = 0; i < nbands; i++)
+    {
+      uint32_t end = top + ((i + 1) * band < height ? (i + 1) * band : height);
+      uint32_t behind;
+
+      if (done[i])
+        continue;
+      behind = (beam + lines - end) % lines;
+      if (behind < least)
+      {
+        least = behind;
+        best  = i;
+      }
+    }
+    done[best] = true;
+    r0 = best * band;
+    r1 = r0 + band < height ? r0 + band : height;
+
+    /* Copy just the rows of that band (which come from the other end of the bitmap if it's flipped) */
+    sub_fbuf               = *fbuf;
+    sub_fbuf.base          = (uint8_t *)fbuf->base + ((size_t)bypp * fbuf->stride * (flags.v_flip ? height - r1 : r0));
+    sub_fbuf.height        = r1 - r0;
+    if (fbuf->fmt == dlo_pixfmt_native)
+      sub_fbuf.base8       = (uint8_t *)fbuf->base8 + ((size_t)fbuf->stride * (flags.v_flip ? height - r1 : r0));
+    sub_area               = *area;
+    sub_area.view.base    += BYTES_PER_16BPP * area->stride * r0;
+    sub_area.base8        += BYTES_PER_8BPP  * area->stride * r0;
+    sub_area.view.height   = r1 - r0;
+    ERR(dlo_grfx_copy_host_bmp(dev, flags, &sub_fbuf, &sub_area));
+
+    /* Note when the band should have finished arriving */
+    arrive = dlo_frame_now() + dlo_usb_link_time(dev, pending(dev));
+    for (i = top + r0; i < top + r1; i++)
+      dev->row_time[i] = arrive;
+  }
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_raster_row_time(const dlo_device_t * const dev, const uint32_t row, uint64_t * const when)
+{
+  uint32_t period, lines, off, scan;
+  uint64_t t;
+
+  if (!dev->raster_on)
+    return dlo_err_unsupported;
+
+  if (row >= dev->row_count || !dev->row_time[row])
+    return dlo_err_bad_area;
+
+  /* Find the first time the beam reached the row after its update had arrived */
+  raster_timing(dev, &period, &lines);
+  t     = dev->row_time[row];
+  off   = raster_offset(dev, period, t);
+  scan  = (uint32_t)(((uint64_t)row * period) / lines);
+  *when = t + ((scan + period - off) % period);
+
+  return dlo_ok;
+}
+
+
+void dlo_raster_free(dlo_device_t * const dev)
+{
+  if (dev->row_time)
+    dlo_free(dev->row_time);
+  dev->row_time  = NULL;
+  dev->row_count = 0;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static void raster_timing(const dlo_device_t * const dev, uint32_t * const period, uint32_t * const lines)
+{
+  const edid_detail_unpacked_t *det = &dev->edid.timings[0];
+  bool                          use = det->pixelClock10KHz && det->vBlanking &&
+                                      det->hActive == dev->mode.view.width && det->vActive == dev->mode.view.height;
+
+  /* The display's preferred timing gives the exact figures, if that's the mode in use */
+  *lines = dev->raster.lines;
+  if (!*lines)
+    *lines = use ? det->vActive + det->vBlanking : dev->mode.view.height + (dev->mode.view.height / BLANK_DIV);
+  if (*lines < dev->mode.view.height)
+    *lines = dev->mode.view.height;
+
+  *period = dev->raster.period;
+  if (!*period && use)
+    *period = (uint32_t)(((uint64_t)(det->hActive + det->hBlanking) * (det->vActive + det->vBlanking) * 100u) / det->pixelClock10KHz);
+  if (!*period)
+    *period = dev->mode.refresh ? 1000000u / dev->mode.refresh : DEFAULT_PERIOD;
+}
+
+
+static uint32_t raster_offset(const dlo_device_t * const dev, const uint32_t period, const uint64_t t)
+{
+  int64_t off = (int64_t)(t - dev->raster.phase) % (int64_t)period;
+
+  return (uint32_t)(off < 0 ? off + period : off);
+}
+
+
+static dlo_retcode_t row_table(dlo_device_t * const dev)
+{
+  if (dev->row_time && dev->row_count == dev->mode.view.height)
+    return dlo_ok;
+
+  /* The mode has changed, so the old times no longer mean anything */
+  dlo_raster_free(dev);
+  dev->row_time = (uint64_t *)dlo_malloc(dev->mode.view.height * sizeof(uint64_t));
+  NERR(dev->row_time);
+  dlo_memset(dev->row_time, 0, dev->mode.view.height * sizeof(uint64_t));
+  dev->row_count = dev->mode.view.height;
+
+  return dlo_ok;
+}
+
+
+static uint64_t pending(const dlo_device_t * const dev)
+{
+  return dev->qbytes + (dev->bufptr - dev->buffer);
+}
+
+
+/* End of file -------------------------------------------------------------------------*/
@@ -0,0 +1,73 @@
+/** @file dlo_raster.h
+ *
+ *  @brief Header file for sending updates in the order which chases the display's beam.
+ *
+ *  This file defines the API between libdlo.c and the code which estimates where each
+ *  device's raster is and orders the bands of a bitmap copy to follow it.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_RASTER_H
+#define DLO_RASTER_H      /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Set (or forget) the raster timing of the specified device.
+ *
+ *  @param  dev     Pointer to @a dlo_device_t structure.
+ *  @param  raster  Pointer to the raster timing (or NULL to forget it).
+ */
+extern void dlo_raster_set(dlo_device_t * const dev, const dlo_raster_t * const raster);
+
+
+/** Copy a bitmap to the device in bands, in the order which chases the beam.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  flags  Flags word indicating special behaviour.
+ *  @param  fbuf   Pointer to the (clipped) bitmap.
+ *  @param  area   Pointer to the (clipped) destination area.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  If the device has no raster timing, or the area is not on the visible screen, the
+ *  bitmap is copied in the usual way.
+ */
+extern dlo_retcode_t dlo_raster_copy(dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf, const dlo_area_t * const area);
+
+
+/** Return when a screen row's latest chased update became visible.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  row   Row of the screen.
+ *  @param  when  Pointer to the time to fill in (microseconds).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_raster_row_time(const dlo_device_t * const dev, const uint32_t row, uint64_t * const when);
+
+
+/** Free the record of when each screen row was updated.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_raster_free(dlo_device_t * const dev);
+
+
+#endif
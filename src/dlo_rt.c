@@ -0,0 +1,153 @@
+/** @file dlo_rt.c
+ *
+ *  @brief Implements the real-time support: pinned buffers, thread scheduling and jitter.
+ *
+ *  A device claimed with the @a realtime flag has its buffers allocated up front and pinned
+ *  in memory, so the drawing calls neither allocate nor take page faults. Each buffer is
+ *  mapped in whole pages of its own, as locks apply to whole pages: unpinning a buffer which
+ *  shared a page with another would unpin that one too. Pinning can fail (it is limited by
+ *  @c RLIMIT_MEMLOCK), in which case the buffer is used anyway and the shortfall is counted
+ *  for @c dlo_get_rt_stats().
+ *
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE       /**< For the CPU affinity calls. */
+#endif
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "dlo_defs.h"
+#include "dlo_rt.h"
+#include "dlo_stats.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+/** Number of CPUs which can be named in the @a cpus mask of @c dlo_rtsched_t.
+ */
+#define MASK_CPUS (64u)
+
+/** Bytes in front of each real-time buffer, holding its @a rthdr_t (keeps the buffer 16 byte aligned).
+ */
+#define RT_HDR_SZ (16u)
+
+
+/* File-scope types --------------------------------------------------------------------*/
+
+
+/** What is known about the mapping which holds a real-time buffer.
+ */
+typedef struct rthdr_s
+{
+  size_t len;                /**< Length of the mapping (bytes, a whole number of pages). */
+  bool   pinned;             /**< Flag: the mapping is locked in memory. */
+} rthdr_t;                   /**< A struct @a rthdr_s. */
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+void *dlo_rt_alloc(dlo_device_t * const dev, const size_t size)
+{
+  size_t   page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t   len;
+  rthdr_t *hdr;
+
+  if (!dev->realtime)
+    return dlo_malloc(size);
+
+  /* Give the buffer pages of its own, so that unpinning it leaves other buffers pinned */
+  len = (RT_HDR_SZ + size + page - 1) & ~(page - 1);
+  hdr = (rthdr_t *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (hdr == (rthdr_t *)MAP_FAILED)
+    return NULL;
+
+  hdr->len    = len;
+  hdr->pinned = mlock(hdr, len) == 0;
+  if (hdr->pinned)
+    dev->rtstats.pinned += len;
+  else
+    dev->rtstats.unpinned += len;
+
+  return (uint8_t *)hdr + RT_HDR_SZ;
+}
+
+
+void dlo_rt_free(dlo_device_t * const dev, void * const ptr)
+{
+  rthdr_t *hdr;
+
+  if (!ptr)
+    return;
+  if (!dev->realtime)
+  {
+    dlo_free(ptr);
+    return;
+  }
+
+  /* Unmapping the pages unpins them too */
+  hdr = (rthdr_t *)((uint8_t *)ptr - RT_HDR_SZ);
+  if (hdr->pinned)
+    dev->rtstats.pinned -= hdr->len;
+  else
+    dev->rtstats.unpinned -= hdr->len;
+  (void) munmap(hdr, hdr->len);
+}
+
+
+dlo_retcode_t dlo_rt_sched(const pthread_t thread, const dlo_rtsched_t * const sched)
+{
+  if (sched->cpus)
+  {
+#ifdef CPU_SET
+    cpu_set_t set;
+    uint32_t  i;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < MASK_CPUS; i++)
+      if (sched->cpus & ((uint64_t)1 << i))
+        CPU_SET(i, &set);
+    if (pthread_setaffinity_np(thread, sizeof(set), &set))
+      return dlo_err_sched;
+#else
+    return dlo_err_unsupported;
+#endif
+  }
+
+  if (sched->policy >= 0)
+  {
+    struct sched_param param;
+
+    dlo_memset(&param, 0, sizeof(param));
+    param.sched_priority = sched->priority;
+    if (pthread_setschedparam(thread, sched->policy, &param))
+      return dlo_err_sched;
+  }
+  return dlo_ok;
+}
+
+
+void dlo_rt_jitter(uint64_t * const hist, const uint64_t actual, const uint64_t expected)
+{
+  hist[dlo_stats_bucket(actual > expected ? actual - expected : expected - actual)] += 1;
+}
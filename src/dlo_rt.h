@@ -0,0 +1,75 @@
+/** @file dlo_rt.h
+ *
+ *  @brief Header file for the real-time support: pinned buffers, thread scheduling and jitter.
+ *
+ *  This file defines the API used by the rest of libdlo to pin the buffers of a device which
+ *  was claimed with the @a realtime flag, to set the scheduling of its threads and to count
+ *  timing jitter.
+ *
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_RT_H
+#define DLO_RT_H          /**< Avoid multiple inclusion. */
+
+#include <pthread.h>
+#include "dlo_structs.h"
+
+
+/** Allocate a buffer for a device, in pages of its own pinned in memory if the device is real-time.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  size  Size of the buffer (bytes).
+ *
+ *  @return  Pointer to the buffer, or NULL if it couldn't be allocated.
+ *
+ *  A buffer which can't be pinned is still usable, so this only counts the failure. For
+ *  devices which aren't real-time, this is just @c dlo_malloc().
+ */
+extern void *dlo_rt_alloc(dlo_device_t * const dev, const size_t size);
+
+
+/** Free (and unpin) a buffer which was allocated with @c dlo_rt_alloc().
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure (whose @a realtime flag mustn't have changed since).
+ *  @param  ptr  Pointer to the buffer (or NULL).
+ */
+extern void dlo_rt_free(dlo_device_t * const dev, void * const ptr);
+
+
+/** Apply a scheduling policy, priority and CPU affinity to a thread.
+ *
+ *  @param  thread  The thread.
+ *  @param  sched   Pointer to the scheduling to use.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_rt_sched(const pthread_t thread, const dlo_rtsched_t * const sched);
+
+
+/** Count a time in a jitter histogram, by how far it was from the time expected.
+ *
+ *  @param  hist      Pointer to the histogram (@c DLO_STATS_BUCKETS entries).
+ *  @param  actual    Time taken (or reached) (microseconds).
+ *  @param  expected  Time expected (microseconds).
+ */
+extern void dlo_rt_jitter(uint64_t * const hist, const uint64_t actual, const uint64_t expected);
+
+
+#endif
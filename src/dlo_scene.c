@@ -0,0 +1,207 @@
+/** @file dlo_scene.c
+ *
+ *  @brief Implements named scenes: whole screens kept in spare device memory.
+ *
+ *  A scene is a viewport the size of the current screen mode, placed where it doesn't
+ *  overlap the screen being displayed or any other scene. The caller draws into it with the
+ *  normal drawing calls, then shows it by moving the scan-out base address, which costs a
+ *  few register writes rather than a whole frame of pixels. While a scene is on the screen,
+ *  drawing to the screen (a NULL viewport) draws into that scene.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "dlo_defs.h"
+#include "dlo_scene.h"
+#include "dlo_mode.h"
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Find the link which points to a named scene.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  name  Name of the scene.
+ *
+ *  @return  Pointer to the link (which points to NULL if there's no such scene).
+ */
+static dlo_scene_t **find_scene(dlo_device_t * const dev, const char * const name);
+
+
+/** Return the number of bytes of device memory a viewport uses.
+ *
+ *  @param  view  Pointer to the viewport.
+ *
+ *  @return  Size of the viewport, rounded up to keep the next base address aligned (bytes).
+ */
+static uint32_t view_bytes(const dlo_view_t * const view);
+
+
+/** Test whether a range of device memory is clear of the screen and of all scenes.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  base  Base address of the range.
+ *  @param  size  Size of the range (bytes).
+ *
+ *  @return  true if nothing else is using the range, false if it is in use.
+ */
+static bool range_free(const dlo_device_t * const dev, const dlo_ptr_t base, const uint32_t size);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+dlo_retcode_t dlo_scene_new(dlo_device_t * const dev, const char * const name, dlo_view_t * const view)
+{
+  dlo_scene_t **prev = &dev->scenes;
+  dlo_scene_t  *scene;
+  dlo_view_t    slot = dev->mode.view;
+  uint32_t      size = view_bytes(&slot);
+
+  if (!size)
+    return dlo_err_bad_view;
+
+  /* Scenes made for a different screen mode can't be shown any more */
+  while (*prev)
+  {
+    scene = *prev;
+    if (scene->view.width  != slot.width  ||
+        scene->view.height != slot.height ||
+        scene->view.bpp    != slot.bpp)
+    {
+      *prev = scene->next;
+      dlo_free(scene);
+    }
+    else
+      prev = &scene->next;
+  }
+
+  scene = *find_scene(dev, name);
+  if (scene)
+  {
+    *view = scene->view;
+    return dlo_ok;
+  }
+
+  /* Take the lowest slot which doesn't overlap anything in use */
+  for (slot.base = 0; slot.base + size <= dev->memory; slot.base += size)
+  {
+    if (range_free(dev, slot.base, size))
+      break;
+  }
+  if (slot.base + size > dev->memory)
+    return dlo_err_memory;
+
+  scene = (dlo_scene_t *)dlo_malloc(sizeof(dlo_scene_t) + strlen(name) + 1);
+  NERR(scene);
+
+  scene->name = (char *)(scene + 1);
+  strcpy(scene->name, name);
+  scene->view = slot;
+  scene->next = dev->scenes;
+  dev->scenes = scene;
+
+  *view = slot;
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_scene_show(dlo_device_t * const dev, const char * const name)
+{
+  dlo_scene_t *scene = *find_scene(dev, name);
+
+  if (!scene)
+    return dlo_err_bad_view;
+
+  if (scene->view.width  != dev->mode.view.width  ||
+      scene->view.height != dev->mode.view.height ||
+      scene->view.bpp    != dev->mode.view.bpp)
+    return dlo_err_bad_mode;
+
+  return dlo_mode_set_base(dev, scene->view.base);
+}
+
+
+dlo_retcode_t dlo_scene_free(dlo_device_t * const dev, const char * const name)
+{
+  dlo_scene_t **prev  = find_scene(dev, name);
+  dlo_scene_t  *scene = *prev;
+
+  if (!scene)
+    return dlo_err_bad_view;
+
+  *prev = scene->next;
+  dlo_free(scene);
+
+  return dlo_ok;
+}
+
+
+void dlo_scene_free_all(dlo_device_t * const dev)
+{
+  while (dev->scenes)
+  {
+    dlo_scene_t *next = dev->scenes->next;
+
+    dlo_free(dev->scenes);
+    dev->scenes = next;
+  }
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static dlo_scene_t **find_scene(dlo_device_t * const dev, const char * const name)
+{
+  dlo_scene_t **prev = &dev->scenes;
+
+  while (*prev && strcmp((*prev)->name, name))
+    prev = &(*prev)->next;
+
+  return prev;
+}
+
+
+static uint32_t view_bytes(const dlo_view_t * const view)
+{
+  uint32_t pixels = (uint32_t)view->width * view->height;
+  uint32_t size   = (BYTES_PER_16BPP * pixels) + (view->bpp == 24 ? BYTES_PER_8BPP * pixels : 0);
+
+  return (size + 1) & ~1u;
+}
+
+
+static bool range_free(const dlo_device_t * const dev, const dlo_ptr_t base, const uint32_t size)
+{
+  const dlo_scene_t *scene;
+  dlo_ptr_t          screen = dev->mode.view.base;
+
+  if (base < screen + view_bytes(&dev->mode.view) && screen < base + size)
+    return false;
+
+  for (scene = dev->scenes; scene; scene = scene->next)
+  {
+    if (base < scene->view.base + view_bytes(&scene->view) && scene->view.base < base + size)
+      return false;
+  }
+  return true;
+}
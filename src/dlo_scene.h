@@ -0,0 +1,74 @@
+/** @file dlo_scene.h
+ *
+ *  @brief Header file for named scenes.
+ *
+ *  This file defines the API between the rest of libdlo and the code which keeps whole
+ *  screens (scenes) in spare device memory, under names given by the caller, so that they
+ *  can be shown again without being sent over again.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_SCENE_H
+#define DLO_SCENE_H       /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Find a named scene, or find room for a new one in the device memory.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  name  Name of the scene.
+ *  @param  view  Pointer to the viewport holding the scene (filled in).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Scenes are the size of the current screen mode; any made for a different mode are
+ *  forgotten first.
+ */
+extern dlo_retcode_t dlo_scene_new(dlo_device_t * const dev, const char * const name, dlo_view_t * const view);
+
+
+/** Show a named scene on the screen.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  name  Name of the scene.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_scene_show(dlo_device_t * const dev, const char * const name);
+
+
+/** Forget a named scene, so its device memory can be used for another.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  name  Name of the scene.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_scene_free(dlo_device_t * const dev, const char * const name);
+
+
+/** Forget all of a device's scenes.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_scene_free_all(dlo_device_t * const dev);
+
+
+#endif
@@ -0,0 +1,195 @@
+/** @file dlo_seg.c
+ *
+ *  @brief Implements command segments, which several threads can fill for one device at once.
+ *
+ *  A segment is a private list of command blocks. The thread which owns a segment appends
+ *  commands to it without looking at (or locking) anything the other threads change, so
+ *  any number of threads can build up commands for the same device together. When the
+ *  segments are flushed, their blocks are copied into the device's command buffer in a
+ *  fixed order (by the order number each segment was created with, then by age), so the
+ *  result doesn't depend on how the threads were scheduled. Only the device's list of
+ *  segments is shared, so creating, freeing and flushing segments take the device's
+ *  segment lock, and drawing into a segment takes none.
+ *
+ *  Blocks only ever hold whole commands, and are small enough to fit in an empty command
+ *  buffer, so flushing never splits a command between two writes.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "dlo_defs.h"
+#include "dlo_seg.h"
+#include "dlo_grfx.h"
+#include "dlo_usb.h"
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Free a list of command blocks.
+ *
+ *  @param  blk  Pointer to the first block (or NULL).
+ */
+static void free_blocks(dlo_segblk_t *blk);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+dlo_retcode_t dlo_seg_new(dlo_device_t * const dev, const uint32_t order, dlo_seg_t ** const seg)
+{
+  dlo_seg_t **prev = &dev->segs;
+  dlo_seg_t  *new_seg;
+
+  new_seg = (dlo_seg_t *)dlo_malloc(sizeof(dlo_seg_t));
+  NERR(new_seg);
+
+  new_seg->dev   = dev;
+  new_seg->order = order;
+  new_seg->head  = NULL;
+  new_seg->tail  = NULL;
+  new_seg->spare = NULL;
+
+  /* Insert the segment in flush order (after any others with the same order number) */
+  (void) pthread_mutex_lock(&dev->seg_lock);
+  while (*prev && (*prev)->order <= order)
+    prev = &(*prev)->next;
+  new_seg->next = *prev;
+  *prev         = new_seg;
+  (void) pthread_mutex_unlock(&dev->seg_lock);
+
+  *seg = new_seg;
+
+  return dlo_ok;
+}
+
+
+void dlo_seg_free(dlo_seg_t * const seg)
+{
+  dlo_device_t * const dev  = seg->dev;
+  dlo_seg_t          **prev = &dev->segs;
+
+  (void) pthread_mutex_lock(&dev->seg_lock);
+  while (*prev && *prev != seg)
+    prev = &(*prev)->next;
+  if (*prev)
+    *prev = seg->next;
+  (void) pthread_mutex_unlock(&dev->seg_lock);
+
+  free_blocks(seg->head);
+  free_blocks(seg->spare);
+  dlo_free(seg);
+}
+
+
+void dlo_seg_free_all(dlo_device_t * const dev)
+{
+  while (dev->segs)
+    dlo_seg_free(dev->segs);
+}
+
+
+char *dlo_seg_reserve(dlo_seg_t * const seg, const size_t len)
+{
+  dlo_segblk_t *blk = seg->tail;
+  char         *ptr;
+
+  ASSERT(len <= SEG_BLOCK_SIZE);
+
+  /* Start a new block if the commands won't fit in the current one */
+  if (!blk || blk->size + len > SEG_BLOCK_SIZE)
+  {
+    blk = seg->spare;
+    if (blk)
+      seg->spare = blk->next;
+    else
+    {
+      blk = (dlo_segblk_t *)dlo_malloc(sizeof(dlo_segblk_t) + SEG_BLOCK_SIZE);
+      if (!blk)
+        return NULL;
+      blk->data = (char *)(blk + 1);
+    }
+    blk->size = 0;
+    blk->next = NULL;
+    if (seg->tail)
+      seg->tail->next = blk;
+    else
+      seg->head = blk;
+    seg->tail = blk;
+  }
+  ptr        = blk->data + blk->size;
+  blk->size += len;
+
+  return ptr;
+}
+
+
+dlo_retcode_t dlo_seg_flush(dlo_device_t * const dev)
+{
+  dlo_seg_t    *seg;
+  dlo_retcode_t err = dlo_ok;
+
+  /* Hold the list still while it's walked, in case other threads create or free segments */
+  (void) pthread_mutex_lock(&dev->seg_lock);
+  for (seg = dev->segs; seg && err == dlo_ok; seg = seg->next)
+  {
+    while (seg->head)
+    {
+      dlo_segblk_t *blk = seg->head;
+
+      /* Make room for the whole block, so no command gets split between writes */
+      if ((size_t)(dev->bufend - dev->bufptr) < blk->size)
+      {
+        err = dlo_usb_write(dev);
+        if (err != dlo_ok)
+          break;
+      }
+
+      dlo_memcpy(dev->bufptr, blk->data, blk->size);
+      dev->bufptr += blk->size;
+      if (dev->shadow)
+        dlo_grfx_seg_apply(dev, blk->data, blk->size);
+
+      /* Keep the block for the segment's next lot of commands */
+      seg->head = blk->next;
+      if (!seg->head)
+        seg->tail = NULL;
+      blk->next  = seg->spare;
+      seg->spare = blk;
+    }
+  }
+  (void) pthread_mutex_unlock(&dev->seg_lock);
+
+  return err == dlo_ok ? dlo_usb_write(dev) : err;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static void free_blocks(dlo_segblk_t *blk)
+{
+  while (blk)
+  {
+    dlo_segblk_t *next = blk->next;
+
+    dlo_free(blk);
+    blk = next;
+  }
+}
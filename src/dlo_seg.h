@@ -0,0 +1,80 @@
+/** @file dlo_seg.h
+ *
+ *  @brief Header file for command segments.
+ *
+ *  This file defines the API between the rest of libdlo and the code which keeps the command
+ *  segments that several threads can fill for one device at once, and merges them into the
+ *  device's command stream when they're flushed.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_SEG_H
+#define DLO_SEG_H         /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Create a new, empty command segment for a device.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  order  Position of the segment when the device's segments are flushed.
+ *  @param  seg    Pointer to the segment pointer (filled in).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_seg_new(dlo_device_t * const dev, const uint32_t order, dlo_seg_t ** const seg);
+
+
+/** Free a command segment, throwing away any commands in it.
+ *
+ *  @param  seg  Pointer to the segment.
+ */
+extern void dlo_seg_free(dlo_seg_t * const seg);
+
+
+/** Free all of a device's command segments.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_seg_free_all(dlo_device_t * const dev);
+
+
+/** Make room for some commands at the end of a segment.
+ *
+ *  @param  seg  Pointer to the segment.
+ *  @param  len  Number of bytes needed (no more than @a SEG_BLOCK_SIZE).
+ *
+ *  @return  Pointer to where the commands should go, or NULL if out of memory.
+ *
+ *  The bytes are counted as part of the segment straight away, so the caller must fill
+ *  all of them. Only the thread which owns the segment may call this.
+ */
+extern char *dlo_seg_reserve(dlo_seg_t * const seg, const size_t len);
+
+
+/** Send the commands in all of a device's segments, in order, leaving the segments empty.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_seg_flush(dlo_device_t * const dev);
+
+
+#endif
@@ -0,0 +1,281 @@
+/** @file dlo_stats.c
+ *
+ *  @brief Implements the shared-memory telemetry export.
+ *
+ *  Each claimed device gets a slot in a POSIX shared-memory segment, which is updated
+ *  after every transfer of commands to the device. A slot only ever has one writer (the
+ *  thread driving its device), so each slot is guarded by a sequence count rather than
+ *  a lock: the count is made odd before the slot is changed and even again afterwards,
+ *  with barriers in between, and readers retry if the count was odd or changed under
+ *  them. Readers can never hold up the writer.
+ *
+ *  Commands are counted by walking each transfer's command headers, so that drawing
+ *  calls don't pay anything while no segment is exported.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "dlo_defs.h"
+#include "dlo_stats.h"
+#include "dlo_frame.h"
+#include "dlo_usb.h"
+#include "dlo_rt.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+/** Transfers quicker than this go in the first latency bucket (microseconds, a power of two).
+ */
+#define FIRST_BUCKET_US (64u)
+
+/** Longest name we keep for the segment (characters).
+ */
+#define MAX_NAME (255u)
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Count the commands in a buffer.
+ *
+ *  @param  buf   Pointer to the commands.
+ *  @param  size  Size of the commands (bytes).
+ *
+ *  @return  Number of commands.
+ */
+static uint32_t count_commands(const char * const buf, const size_t size);
+
+
+/* File-scope variables ----------------------------------------------------------------*/
+
+
+/** The mapped segment (or NULL if not exporting).
+ */
+static dlo_stats_shm_t *shm = NULL;
+
+/** Name of the mapped segment, to remove it afterwards.
+ */
+static char shm_name[MAX_NAME + 1];
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+dlo_retcode_t dlo_stats_export(const char * const name)
+{
+  void *map;
+  int   fd;
+
+  if (shm)
+  {
+    (void) munmap(shm, sizeof(*shm));
+    (void) shm_unlink(shm_name);
+    shm = NULL;
+  }
+  if (!name)
+    return dlo_ok;
+  if (strlen(name) > MAX_NAME)
+    return dlo_err_open;
+
+  /* Other processes may only read the segment */
+  fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return dlo_err_open;
+  if (ftruncate(fd, sizeof(*shm)) < 0)
+  {
+    (void) close(fd);
+    (void) shm_unlink(name);
+    return dlo_err_open;
+  }
+  map = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  (void) close(fd);
+  if (map == MAP_FAILED)
+  {
+    (void) shm_unlink(name);
+    return dlo_err_memory;
+  }
+
+  /* The new segment reads as zeros, so readers see no devices until the header is done */
+  shm            = (dlo_stats_shm_t *)map;
+  shm->version   = DLO_STATS_VERSION;
+  shm->slot_size = sizeof(shm->dev[0]);
+  shm->num_slots = DLO_STATS_DEVICES;
+  __sync_synchronize();
+  shm->magic     = DLO_STATS_MAGIC;
+  snprintf(shm_name, sizeof(shm_name), "%s", name);
+
+  return dlo_ok;
+}
+
+
+void dlo_stats_attach(dlo_device_t * const dev)
+{
+  dlo_stats_dev_t *slot;
+  uint32_t         i;
+
+  if (!shm || dev->stats)
+    return;
+
+  for (i = 0; i < DLO_STATS_DEVICES; i++)
+    if (!shm->dev[i].in_use)
+      break;
+  if (i == DLO_STATS_DEVICES)
+    return;
+
+  /* Clear out whatever the slot's previous owner left behind */
+  slot = &shm->dev[i];
+  slot->seq++;
+  __sync_synchronize();
+  memset((char *)slot + sizeof(slot->seq), 0, sizeof(*slot) - sizeof(slot->seq));
+  slot->in_use  = 1;
+  slot->updated = dlo_frame_now();
+  snprintf(slot->serial, sizeof(slot->serial), "%s", dev->serial ? dev->serial : "");
+  __sync_synchronize();
+  slot->seq++;
+
+  dev->stats = slot;
+}
+
+
+void dlo_stats_detach(dlo_device_t * const dev)
+{
+  dlo_stats_dev_t *slot = dev->stats;
+
+  if (!slot)
+    return;
+
+  slot->seq++;
+  __sync_synchronize();
+  slot->in_use  = 0;
+  slot->updated = dlo_frame_now();
+  __sync_synchronize();
+  slot->seq++;
+
+  dev->stats = NULL;
+}
+
+
+void dlo_stats_xfer(dlo_device_t * const dev, const char * const buf, const size_t size, const uint64_t time, const bool ok)
+{
+  dlo_stats_dev_t *slot = dev->stats;
+  uint32_t         cmds;
+
+  /* Jitter is kept whether or not the counters are exported */
+  if (ok && dev->xfer.kbps)
+    dlo_rt_jitter(dev->rtstats.xfer_jitter, time, dlo_usb_link_time(dev, size));
+
+  if (!slot)
+    return;
+
+  /* Do the slow part before the slot is marked as changing */
+  cmds = count_commands(buf, size);
+
+  slot->seq++;
+  __sync_synchronize();
+  slot->updated         = dlo_frame_now();
+  slot->bytes          += size;
+  slot->commands       += cmds;
+  slot->flushes        += 1;
+  slot->errors         += ok ? 0 : 1;
+  slot->latency[dlo_stats_bucket(time)] += 1;
+  slot->qlen            = dev->qlen;
+  slot->qlen_max        = dev->qlen > slot->qlen_max ? dev->qlen : slot->qlen_max;
+  slot->frames_shown    = dev->fstats.shown;
+  slot->frames_late     = dev->fstats.late;
+  slot->frames_dropped  = dev->fstats.dropped;
+  slot->width           = dev->mode.view.width;
+  slot->height          = dev->mode.view.height;
+  slot->bpp             = dev->mode.view.bpp;
+  slot->refresh         = dev->mode.refresh;
+  __sync_synchronize();
+  slot->seq++;
+}
+
+
+uint32_t dlo_stats_bucket(uint64_t time)
+{
+  uint32_t i;
+
+  for (i = 0; i < DLO_STATS_BUCKETS - 1 && time >= FIRST_BUCKET_US; i++)
+    time >>= 1;
+
+  return i;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static uint32_t count_commands(const char * const buf, const size_t size)
+{
+  const uint8_t *ptr = (const uint8_t *)buf;
+  const uint8_t *end = ptr + size;
+  uint32_t       num = 0;
+
+  /* This steps over commands in the same way as dlo_grfx_damage() */
+  while (ptr < end)
+  {
+    uint32_t pix, run;
+    uint8_t  bypp;
+
+    if (ptr[0] != 0xAF || end - ptr < 2)
+    {
+      ptr++;
+      continue;
+    }
+    num++;
+    switch (ptr[1])
+    {
+      case 0x20:
+        ptr += 4;
+        continue;
+      case 0x60: case 0x61: case 0x62:
+        bypp = BYTES_PER_8BPP;
+        break;
+      case 0x68: case 0x69: case 0x6A:
+        bypp = BYTES_PER_16BPP;
+        break;
+      default:
+        ptr += 2;
+        continue;
+    }
+    if (end - ptr < 6)
+      break;
+
+    pix = ptr[5] ? ptr[5] : 256;
+    switch (ptr[1] & 0x07)
+    {
+      case 0:
+        ptr += 6 + (bypp * pix);
+        break;
+      case 1:
+        for (ptr += 6, run = 0; run < pix && ptr < end; ptr += 1 + bypp)
+          run += ptr[0] ? ptr[0] : 256;
+        break;
+      default:
+        ptr += 9;
+        break;
+    }
+  }
+  return num;
+}
@@ -0,0 +1,77 @@
+/** @file dlo_stats.h
+ *
+ *  @brief Header file for the shared-memory telemetry export.
+ *
+ *  This file defines the API between the rest of libdlo and the code which publishes
+ *  per-device counters in a shared-memory segment for monitoring processes to read.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_STATS_H
+#define DLO_STATS_H       /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Create (or remove) the shared-memory segment.
+ *
+ *  @param  name  Name of the segment, or NULL to remove the current one.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Any current segment is removed first, so every device must have been detached.
+ */
+extern dlo_retcode_t dlo_stats_export(const char * const name);
+
+
+/** Give a claimed device a slot in the segment, if there is a segment and a free slot.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_stats_attach(dlo_device_t * const dev);
+
+
+/** Give up the device's slot in the segment (if it has one).
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_stats_detach(dlo_device_t * const dev);
+
+
+/** Count a transfer of commands to the device.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  buf   Pointer to the commands.
+ *  @param  size  Size of the commands (bytes).
+ *  @param  time  Time the transfer took (microseconds).
+ *  @param  ok    Flag: the transfer succeeded.
+ */
+extern void dlo_stats_xfer(dlo_device_t * const dev, const char * const buf, const size_t size, const uint64_t time, const bool ok);
+
+
+/** Return the histogram bucket for a time (as used for @a latency in @c dlo_stats_dev_t).
+ *
+ *  @param  time  The time (microseconds).
+ *
+ *  @return  Index of the bucket.
+ */
+extern uint32_t dlo_stats_bucket(uint64_t time);
+
+
+#endif
@@ -23,10 +23,69 @@
 #ifndef DLO_STRUCTS_H
 #define DLO_STRUCTS_H        /**< Avoid multiple inclusion. */
 
+#include <pthread.h>
 #include "libdlo.h"
 #include "dlo_data.h"
 
 
+/** Timings of bulk transfers, gathered to tune the transfer parameters of a device.
+ */
+typedef struct dlo_xstats_s
+{
+  uint32_t  num;             /**< Number of transfers timed. */
+  uint64_t  sum_x;           /**< Sum of transfer sizes (bytes). */
+  uint64_t  sum_y;           /**< Sum of transfer times (microseconds). */
+  uint64_t  sum_xx;          /**< Sum of squared transfer sizes. */
+  uint64_t  sum_xy;          /**< Sum of the products of size and time. */
+} dlo_xstats_t;              /**< A struct @a dlo_xstats_s. */
+
+
+/** A device's copy of its colour-correction table.
+ */
+typedef struct dlo_ctable_s
+{
+  uint32_t     size;         /**< Number of points along each edge of @a cube (zero to use the curves). */
+  uint8_t      red[256];     /**< Curve for the red component. */
+  uint8_t      grn[256];     /**< Curve for the green component. */
+  uint8_t      blu[256];     /**< Curve for the blue component. */
+  dlo_col32_t  cube[];       /**< The 3D table (size * size * size entries, following the structure). */
+} dlo_ctable_t;              /**< A struct @a dlo_ctable_s. */
+
+
+/** A region of the screen with its own encoding policy.
+ */
+typedef struct dlo_region_s
+{
+  dlo_ptr_t    base;         /**< Base address of the screen mode's viewport when the policy was set. */
+  uint32_t     stride;       /**< Width of that viewport (pixels). */
+  uint32_t     height;       /**< Height of that viewport (pixels). */
+  dlo_rect_t   rec;          /**< The region, clipped to the viewport. */
+  dlo_policy_t policy;       /**< The policy. */
+  uint64_t     last;         /**< When some of the region was last sent (microseconds, zero if never). */
+  bool         skip;         /**< Flag: leave the region alone during the current update. */
+  bool         sent;         /**< Flag: some of the region has been sent during the current update. */
+} dlo_region_t;              /**< A struct @a dlo_region_s. */
+
+
+/** A video frame waiting to be sent at its presentation time.
+ */
+typedef struct dlo_frame_s dlo_frame_t;
+
+/** A video frame waiting to be sent at its presentation time.
+ */
+struct dlo_frame_s
+{
+  dlo_frame_t   *next;       /**< Pointer to the frame with the next presentation time (or NULL). */
+  uint64_t       pts;        /**< Presentation time (microseconds). */
+  dlo_bmpflags_t flags;      /**< Flags to use when copying the frame. */
+  dlo_fbuf_t     fbuf;       /**< The frame, with its pixels following the structure. */
+  bool           use_view;   /**< Flag: copy into @a view (otherwise into the current screen). */
+  dlo_view_t     view;       /**< Viewport to copy the frame into. */
+  dlo_dot_t      pos;        /**< Position within the viewport to copy the frame to. */
+  size_t         size;       /**< Number of bytes of pixels the block has room for. */
+};                           /**< A struct @a dlo_frame_s. */
+
+
 /** Structure holding all of the information specific to a particular device.
  */
 typedef struct dlo_device_s dlo_device_t;
@@ -198,6 +257,90 @@ typedef struct dlo_area_s
 } dlo_area_t;                /**< A struct @a dlo_area_s. */
 
 
+/** A callback waiting for a fence to be signalled.
+ */
+typedef struct dlo_fence_cb_s dlo_fence_cb_t;
+
+/** A callback waiting for a fence to be signalled.
+ */
+struct dlo_fence_cb_s
+{
+  dlo_fence_cb_t *next;      /**< Pointer to the callback for the next fence (or NULL). */
+  dlo_fence_t     fence;     /**< Fence being waited for. */
+  dlo_fence_fn_t  fn;        /**< Function to call. */
+  void           *pw;        /**< Private word to pass to the function. */
+};                           /**< A struct @a dlo_fence_cb_s. */
+
+
+/** A block of commands queued for a device which was claimed in non-blocking mode.
+ */
+typedef struct dlo_qblock_s dlo_qblock_t;
+
+/** A block of commands queued for a device which was claimed in non-blocking mode.
+ */
+struct dlo_qblock_s
+{
+  dlo_qblock_t *next;        /**< Pointer to the next block in the queue (or NULL). */
+  size_t        size;        /**< Number of bytes of commands in the block. */
+  char         *data;        /**< Pointer to the commands (@a BUF_SIZE bytes, following the structure). */
+};                           /**< A struct @a dlo_qblock_s. */
+
+
+/** A block of commands in a command segment.
+ */
+typedef struct dlo_segblk_s dlo_segblk_t;
+
+/** A block of commands in a command segment.
+ */
+struct dlo_segblk_s
+{
+  dlo_segblk_t *next;        /**< Pointer to the next block in the segment (or NULL). */
+  size_t        size;        /**< Number of bytes of commands in the block. */
+  char         *data;        /**< Pointer to the commands (@a SEG_BLOCK_SIZE bytes, following the structure). */
+};                           /**< A struct @a dlo_segblk_s. */
+
+
+/** A command segment, which one thread fills with commands for a device while others fill their own.
+ */
+typedef struct dlo_seg_s dlo_seg_t;
+
+/** A command segment, which one thread fills with commands for a device while others fill their own.
+ */
+struct dlo_seg_s
+{
+  dlo_seg_t     *next;       /**< Pointer to the segment which is flushed after this one (or NULL). */
+  dlo_device_t  *dev;        /**< Pointer to the device the commands are for. */
+  uint32_t       order;      /**< Position of the segment when the device's segments are flushed. */
+  dlo_segblk_t  *head;       /**< First block of commands (or NULL). */
+  dlo_segblk_t  *tail;       /**< Block being filled (or NULL). */
+  dlo_segblk_t  *spare;      /**< List of empty blocks, for reuse. */
+};                           /**< A struct @a dlo_seg_s. */
+
+
+/** A named scene: a whole screen held in the device memory, ready to be shown.
+ */
+typedef struct dlo_scene_s dlo_scene_t;
+
+/** A named scene: a whole screen held in the device memory, ready to be shown.
+ */
+struct dlo_scene_s
+{
+  dlo_scene_t   *next;       /**< Pointer to the next scene (or NULL). */
+  char          *name;       /**< Name of the scene (following the structure). */
+  dlo_view_t     view;       /**< Viewport holding the scene. */
+};                           /**< A struct @a dlo_scene_s. */
+
+
+/** A range of addresses in the device memory which needs to be sent again.
+ */
+typedef struct dlo_range_s
+{
+  dlo_ptr_t addr;            /**< Base address in the device memory. */
+  uint32_t  len;             /**< Length of the range (bytes). */
+  uint8_t   bypp;            /**< Bytes per pixel of the plane the range lies in (1 or 2). */
+} dlo_range_t;               /**< A struct @a dlo_range_s. */
+
+
 /** Structure holding all of the information specific to a particular device.
  */
 struct dlo_device_s
@@ -214,7 +357,57 @@ struct dlo_device_s
   char          *buffer;     /**< Pointer to the base of the command buffer. */
   char          *bufptr;     /**< Pointer to the first free byte in the command buffer. */
   char          *bufend;     /**< Pointer to the byte after the end byte of the command buffer. */
-  dlo_usb_dev_t *cnct;       /**< Private word for connection specific data or structure pointer. */
+  dlo_fence_t    done;       /**< Number of command bytes the transport has finished with (fences up to here are signalled). */
+  dlo_fence_cb_t *fence_cb;  /**< List of callbacks waiting on fences, earliest fence first. */
+  bool           nonblock;   /**< Writes are queued and sent from @c dlo_handle_events(). */
+  bool           realtime;   /**< Buffers are preallocated and pinned in memory (see @c dlo_claim_t). */
+  dlo_rtstats_t  rtstats;    /**< Memory pinning counts and jitter histograms. */
+  dlo_qblock_t  *qhead;      /**< Oldest block in the write queue (or NULL). */
+  dlo_qblock_t  *qtail;      /**< Newest block in the write queue (or NULL). */
+  dlo_qblock_t  *qfree;      /**< List of spare blocks, for reuse. */
+  uint32_t       qlen;       /**< Number of blocks in the write queue. */
+  size_t         qbytes;     /**< Number of bytes of commands in the write queue. */
+  uint64_t       qstamp;     /**< Time (milliseconds) at which the write queue last made progress. */
+  dlo_xfer_t     xfer;       /**< Transfer parameters in use. */
+  bool           xfer_auto;  /**< Flag: the transfer parameters are tuned from measurements. */
+  uint64_t       xfer_stamp; /**< Time (milliseconds) at which the transfer parameters were last tuned. */
+  dlo_xstats_t   xstats;     /**< Timings of the transfers made since then. */
+  uint8_t       *shadow;     /**< Host copy of the device memory, if shadowing (else NULL). */
+  uint8_t       *valid;      /**< Bitmap, one bit per byte of @a shadow, set where the shadow matches the device. */
+  dlo_range_t   *repair;     /**< Ranges of device memory lost in failed writes, waiting to be sent again. */
+  uint32_t       nrepair;    /**< Number of entries in the @a repair list. */
+  uint32_t       repair_sz;  /**< Number of entries allocated for the @a repair list. */
+  bool           repairing;  /**< Flag: the @a repair list is being sent (writes bypass the queue and fences). */
+  char          *rbuf;       /**< Buffer for building a retransmission, kept by real-time devices (or NULL). */
+  dlo_ctable_t  *ctable;     /**< Colour-correction table applied to every colour converted (or NULL). */
+  dlo_region_t  *regions;    /**< Regions with encoding policies, lowest first (or NULL). */
+  uint32_t       nregions;   /**< Number of entries in @a regions. */
+  void          *scratch;    /**< Buffer for handing bands of a bitmap to the encoder pool (or NULL). */
+  size_t         scratch_sz; /**< Size of @a scratch (bytes). */
+  dlo_frame_t   *frames;     /**< Video frames waiting to be sent, earliest presentation time first. */
+  dlo_frame_t   *fspare;     /**< A frame block kept for reuse (or NULL). */
+  dlo_framestats_t fstats;   /**< Counts of what has happened to submitted frames. */
+  uint32_t       frame_us;   /**< Estimated time to send a frame (microseconds, zero if unknown). */
+  uint32_t       frame_gap;  /**< Time between the presentation times of recent frames (microseconds, zero if unknown). */
+  uint64_t       frame_pts;  /**< Latest presentation time submitted (microseconds). */
+  dlo_raster_t   raster;     /**< Timing of the display's scan-out, given by the caller. */
+  bool           raster_on;  /**< Flag: @a raster has been set, so updates can chase the beam. */
+  uint64_t      *row_time;   /**< For each screen row, when its latest chased update finished arriving (zero if none). */
+  uint32_t       row_count;  /**< Number of entries in @a row_time. */
+  dlo_stats_dev_t *stats;    /**< Slot in the exported telemetry segment (or NULL). */
+  dlo_seg_t     *segs;       /**< Command segments, in the order they're flushed. */
+  pthread_mutex_t seg_lock;  /**< Lock for the @a segs list, which any thread may add to or take from. */
+  dlo_scene_t   *scenes;     /**< Named scenes held in the device memory (or NULL). */
+  dlo_source_fn_t source;    /**< Client function to supply pixels that the shadow can't (or NULL). */
+  void          *source_pw;  /**< Private word to pass to @a source. */
+  void          *cnct;       /**< Private word for connection specific data or structure pointer. */
+  dlo_retcode_t (*open)(dlo_device_t * const dev);                                           /**< Connection: open the device. */
+  dlo_retcode_t (*close)(dlo_device_t * const dev);                                          /**< Connection: close the device. */
+  dlo_retcode_t (*chan_sel)(const dlo_device_t * const dev, const char * const buf, const size_t size);  /**< Connection: select a channel. */
+  dlo_retcode_t (*write_buf)(dlo_device_t * const dev, char * buf, size_t size);             /**< Connection: bulk write of commands. */
+  dlo_retcode_t (*read_edid)(dlo_device_t * const dev, uint8_t * const buf, const size_t size);  /**< Connection: read raw EDID from the display. */
+  dlo_retcode_t (*write_nb)(dlo_device_t * const dev, char * buf, size_t size);              /**< Connection: non-blocking bulk write (optional). */
+  dlo_retcode_t (*get_fd)(const dlo_device_t * const dev, int * const fd);                    /**< Connection: file descriptor to poll for writing (optional). */
   dlo_mode_t     mode;       /**< Current display mode information. */
   dlo_ptr_t      base8;      /**< Pointer to the base of the 8bpp segment (if any). */
   bool           low_blank;  /**< The current raster screen mode has reduced blanking. */
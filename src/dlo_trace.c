@@ -0,0 +1,967 @@
+/** @file dlo_trace.c
+ *
+ *  @brief Implements recording and replaying traces of drawing calls.
+ *
+ *  A trace records the calls made to libdlo's drawing API rather than the commands which
+ *  were sent, so a trace of a real session can be played back through a changed encoder
+ *  (or over a different transport) to compare the results on exactly the same input.
+ *
+ *  A trace file starts with the eight bytes "DLOTRACE" and a 32-bit version number,
+ *  followed by records. Every record starts with a 32-bit type, a 32-bit device number
+ *  and the 64-bit time of the call (microseconds since recording started). The rest of
+ *  the record is a sequence of 32-bit words, depending on the type:
+ *
+ *  - @c REC_DEVICE: the length of the serial number, then the serial number (padded to a
+ *    whole number of words), then the device's mode at the time.
+ *  - @c REC_MODE: the requested mode.
+ *  - @c REC_FILL: a viewport, a rectangle and a colour.
+ *  - @c REC_COPY: a viewport, a rectangle, a viewport and a position.
+ *  - @c REC_BMP: the flags, a viewport, a position, the bitmap's width, height and pixel
+ *    format, a palette of 256 colours if the format is a palette, then the pixels, with
+ *    rows packed together (for @c dlo_pixfmt_native, the 8 bpp plane follows the 16 bpp
+ *    one), padded to a whole number of words.
+ *  - @c REC_SEGMENT: a segment number and the segment's order number.
+ *  - @c REC_SEG_FILL: a segment number, then as for @c REC_FILL (the viewport is the
+ *    surface's).
+ *  - @c REC_SEG_BMP: a segment number, then as for @c REC_BMP.
+ *  - @c REC_SEG_FREE: a segment number.
+ *  - @c REC_FLUSH: nothing more.
+ *
+ *  Viewports, rectangles, positions and modes are written as a word which is non-zero if
+ *  the caller supplied one, followed by their fields. Everything is in the host's byte
+ *  order. A device is given its number, in a @c REC_DEVICE record, just before its first
+ *  call is recorded. Likewise a command segment is given a number, in a @c REC_SEGMENT
+ *  record, when it is created (or, if it was created before recording started, just before
+ *  its first call); the number may be given to a new segment once the old one is freed.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "dlo_defs.h"
+#include "dlo_trace.h"
+#include "dlo_frame.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+/** Version of the trace file layout.
+ */
+#define TRACE_VERSION (2u)
+
+/** Largest number of devices in one trace.
+ */
+#define MAX_DEVICES (64u)
+
+/** Largest number of command segments which can exist at once in a trace.
+ */
+#define MAX_SEGMENTS (256u)
+
+/** Longest serial number recorded (characters).
+ */
+#define MAX_SERIAL (255u)
+
+/** Words in a recorded viewport.
+ */
+#define VIEW_WORDS (5u)
+
+/** Words in a recorded rectangle.
+ */
+#define RECT_WORDS (5u)
+
+/** Words in a recorded position.
+ */
+#define DOT_WORDS (3u)
+
+/** Words in a recorded mode.
+ */
+#define MODE_WORDS (6u)
+
+/** Words in the fixed part of the largest record.
+ */
+#define MAX_WORDS (32u)
+
+/** Words in the fixed part of a bitmap record.
+ */
+#define BMP_WORDS (1u + VIEW_WORDS + DOT_WORDS + 3u)
+
+/** Value for the number of words in a record of unknown type.
+ */
+#define BAD_WORDS (~0u)
+
+
+/* File-scope types --------------------------------------------------------------------*/
+
+
+/** Types of trace record.
+ */
+typedef enum
+{
+  REC_DEVICE = 1,            /**< A device's number and serial number. */
+  REC_MODE,                  /**< A call to @c dlo_set_mode(). */
+  REC_FILL,                  /**< A call to @c dlo_fill_rect(). */
+  REC_COPY,                  /**< A call to @c dlo_copy_rect(). */
+  REC_BMP,                   /**< A call to @c dlo_copy_host_bmp(). */
+  REC_SEGMENT,               /**< A call to @c dlo_new_segment(). */
+  REC_SEG_FILL,              /**< A call to @c dlo_segment_fill(). */
+  REC_SEG_BMP,               /**< A call to @c dlo_segment_copy_host_bmp(). */
+  REC_SEG_FREE,              /**< A call to @c dlo_free_segment(). */
+  REC_FLUSH                  /**< A call to @c dlo_flush_segments(). */
+} rectype_t;
+
+
+/** The start of every trace record.
+ */
+typedef struct rechdr_s
+{
+  uint32_t type;             /**< Type of record (see @a rectype_t). */
+  uint32_t dev;              /**< Number of the device in the trace. */
+  uint64_t time;             /**< Time of the call (microseconds since recording started). */
+} rechdr_t;                  /**< A struct @a rechdr_s. */
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Write the header of a record, first announcing the device if it's new to the trace.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  type  Type of record.
+ *
+ *  @return  true if the record can be written, false if the device can't be traced.
+ */
+static bool begin_record(const dlo_device_t * const dev, const rectype_t type);
+
+
+/** Return the number of a segment in the trace, announcing it first if it's new to the trace.
+ *
+ *  @param  seg  Pointer to the segment.
+ *
+ *  @return  Number of the segment, or zero if it can't be traced.
+ */
+static uint32_t seg_number(const dlo_seg_t * const seg);
+
+
+/** Write the fixed part of a bitmap record (after the header) and the pixels which follow.
+ *
+ *  @param  flags      Flags word for the copy.
+ *  @param  fbuf       Pointer to the bitmap.
+ *  @param  dest_view  Pointer to the destination viewport (or NULL).
+ *  @param  dest_pos   Pointer to the destination position (or NULL).
+ */
+static void put_bmp(const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf,
+                    const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
+
+
+/** Read the pixels of a bitmap record and describe them for a copy.
+ *
+ *  @param  in     File to read from.
+ *  @param  word   Pointer to the fixed part of the record.
+ *  @param  buf    Pointer to the buffer pointer (updated).
+ *  @param  size   Pointer to the size of the buffer (updated).
+ *  @param  flags  Pointer to the flags word to fill in.
+ *  @param  fbuf   Pointer to the bitmap to fill in (pointing into the buffer).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t get_bmp(FILE * const in, const uint32_t * const word, uint8_t ** const buf, size_t * const size,
+                             dlo_bmpflags_t * const flags, dlo_fbuf_t * const fbuf);
+
+
+/** Add a viewport to an array of words.
+ *
+ *  @param  word  Pointer to the first word to fill in.
+ *  @param  view  Pointer to the viewport (or NULL).
+ *
+ *  @return  Pointer to the word after those filled in.
+ */
+static uint32_t *put_view(uint32_t *word, const dlo_view_t * const view);
+
+
+/** Add a rectangle to an array of words.
+ *
+ *  @param  word  Pointer to the first word to fill in.
+ *  @param  rec   Pointer to the rectangle (or NULL).
+ *
+ *  @return  Pointer to the word after those filled in.
+ */
+static uint32_t *put_rect(uint32_t *word, const dlo_rect_t * const rec);
+
+
+/** Add a position to an array of words.
+ *
+ *  @param  word  Pointer to the first word to fill in.
+ *  @param  dot   Pointer to the position (or NULL).
+ *
+ *  @return  Pointer to the word after those filled in.
+ */
+static uint32_t *put_dot(uint32_t *word, const dlo_dot_t * const dot);
+
+
+/** Add a mode to an array of words.
+ *
+ *  @param  word  Pointer to the first word to fill in.
+ *  @param  mode  Pointer to the mode (or NULL).
+ *
+ *  @return  Pointer to the word after those filled in.
+ */
+static uint32_t *put_mode(uint32_t *word, const dlo_mode_t * const mode);
+
+
+/** Read a viewport from an array of words.
+ *
+ *  @param  word  Pointer to the first word.
+ *  @param  view  Pointer to the viewport to fill in.
+ *
+ *  @return  Pointer to @a view, or NULL if none was recorded.
+ */
+static const dlo_view_t *get_view(const uint32_t * const word, dlo_view_t * const view);
+
+
+/** Read a rectangle from an array of words.
+ *
+ *  @param  word  Pointer to the first word.
+ *  @param  rec   Pointer to the rectangle to fill in.
+ *
+ *  @return  Pointer to @a rec, or NULL if none was recorded.
+ */
+static const dlo_rect_t *get_rect(const uint32_t * const word, dlo_rect_t * const rec);
+
+
+/** Read a position from an array of words.
+ *
+ *  @param  word  Pointer to the first word.
+ *  @param  dot   Pointer to the position to fill in.
+ *
+ *  @return  Pointer to @a dot, or NULL if none was recorded.
+ */
+static const dlo_dot_t *get_dot(const uint32_t * const word, dlo_dot_t * const dot);
+
+
+/** Read a mode from an array of words.
+ *
+ *  @param  word  Pointer to the first word.
+ *  @param  mode  Pointer to the mode to fill in.
+ *
+ *  @return  Pointer to @a mode, or NULL if none was recorded.
+ */
+static const dlo_mode_t *get_mode(const uint32_t * const word, dlo_mode_t * const mode);
+
+
+/** Read the variable-length part of a record into a buffer, making the buffer bigger if needed.
+ *
+ *  @param  in    File to read from.
+ *  @param  buf   Pointer to the buffer pointer (updated).
+ *  @param  size  Pointer to the size of the buffer (updated).
+ *  @param  len   Number of bytes to read.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t read_more(FILE * const in, uint8_t ** const buf, size_t * const size, const size_t len);
+
+
+/** Retry a replayed call once the device has caught up, if it would have blocked.
+ *
+ *  @param  uid  Unique ID of the device.
+ *  @param  err  Return code from the call.
+ *
+ *  @return  true if the call should be made again, else false.
+ */
+static bool catch_up(const dlo_dev_t uid, const dlo_retcode_t err);
+
+
+/* File-scope variables ----------------------------------------------------------------*/
+
+
+/** The trace file being written (or NULL if not recording).
+ */
+static FILE *out = NULL;
+
+/** Time at which recording started (microseconds).
+ */
+static uint64_t start_us = 0;
+
+/** Devices announced in the trace, in order of their numbers.
+ */
+static const dlo_device_t *known[MAX_DEVICES];
+
+/** Number of entries in @a known.
+ */
+static uint32_t num_known = 0;
+
+/** Segments announced in the trace, by their numbers (less one), or NULL for a free number.
+ */
+static const dlo_seg_t *known_seg[MAX_SEGMENTS];
+
+/** Lock for the trace file and the tables of devices and segments, as calls for different
+ *  devices (and for the segments of one device) may be made from different threads.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+dlo_retcode_t dlo_trace_record(const char * const path)
+{
+  static const char magic[8] = { 'D', 'L', 'O', 'T', 'R', 'A', 'C', 'E' };
+  uint32_t          version  = TRACE_VERSION;
+  dlo_retcode_t     err      = dlo_ok;
+
+  (void) pthread_mutex_lock(&lock);
+  if (out)
+    (void) fclose(out);
+  out       = NULL;
+  num_known = 0;
+  memset(known_seg, 0, sizeof(known_seg));
+
+  if (path)
+  {
+    out = fopen(path, "wb");
+    if (!out)
+      err = dlo_err_open;
+  }
+  if (out)
+  {
+    start_us = dlo_frame_now();
+    if (fwrite(magic, sizeof(magic), 1, out) != 1 || fwrite(&version, sizeof(version), 1, out) != 1)
+    {
+      (void) fclose(out);
+      out = NULL;
+      err = dlo_err_open;
+    }
+  }
+  (void) pthread_mutex_unlock(&lock);
+
+  return err;
+}
+
+
+void dlo_trace_forget(const dlo_device_t * const dev)
+{
+  uint32_t i;
+
+  (void) pthread_mutex_lock(&lock);
+
+  /* Keep the device's number, so a new device at the same address gets a new number */
+  for (i = 0; i < num_known; i++)
+    if (known[i] == dev)
+      known[i] = NULL;
+
+  /* The device's segments are about to go with it */
+  for (i = 0; i < MAX_SEGMENTS; i++)
+    if (known_seg[i] && known_seg[i]->dev == dev)
+      known_seg[i] = NULL;
+
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_mode(const dlo_device_t * const dev, const dlo_mode_t * const mode)
+{
+  uint32_t word[MODE_WORDS];
+
+  (void) pthread_mutex_lock(&lock);
+  if (out && begin_record(dev, REC_MODE))
+  {
+    (void) put_mode(word, mode);
+    (void) fwrite(word, sizeof(word), 1, out);
+  }
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_fill(const dlo_device_t * const dev, const dlo_view_t * const view, const dlo_rect_t * const rec, const dlo_col32_t col)
+{
+  uint32_t  word[MAX_WORDS];
+  uint32_t *ptr = word;
+
+  (void) pthread_mutex_lock(&lock);
+  if (out && begin_record(dev, REC_FILL))
+  {
+    ptr    = put_view(ptr, view);
+    ptr    = put_rect(ptr, rec);
+    *ptr++ = col;
+    (void) fwrite(word, sizeof(uint32_t), ptr - word, out);
+  }
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_copy(const dlo_device_t * const dev,
+                    const dlo_view_t * const src_view,  const dlo_rect_t * const src_rec,
+                    const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  uint32_t  word[MAX_WORDS];
+  uint32_t *ptr = word;
+
+  (void) pthread_mutex_lock(&lock);
+  if (out && begin_record(dev, REC_COPY))
+  {
+    ptr = put_view(ptr, src_view);
+    ptr = put_rect(ptr, src_rec);
+    ptr = put_view(ptr, dest_view);
+    ptr = put_dot(ptr, dest_pos);
+    (void) fwrite(word, sizeof(uint32_t), ptr - word, out);
+  }
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_bmp(const dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf,
+                   const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  (void) pthread_mutex_lock(&lock);
+  if (out && begin_record(dev, REC_BMP))
+    put_bmp(flags, fbuf, dest_view, dest_pos);
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_seg_new(const dlo_seg_t * const seg)
+{
+  (void) pthread_mutex_lock(&lock);
+  if (out)
+    (void) seg_number(seg);
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_seg_fill(const dlo_seg_t * const seg, const dlo_view_t * const view, const dlo_rect_t * const rec, const dlo_col32_t col)
+{
+  uint32_t  word[MAX_WORDS];
+  uint32_t *ptr = word;
+  uint32_t  num;
+
+  (void) pthread_mutex_lock(&lock);
+  if (out && (num = seg_number(seg)) != 0 && begin_record(seg->dev, REC_SEG_FILL))
+  {
+    *ptr++ = num;
+    ptr    = put_view(ptr, view);
+    ptr    = put_rect(ptr, rec);
+    *ptr++ = col;
+    (void) fwrite(word, sizeof(uint32_t), ptr - word, out);
+  }
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_seg_bmp(const dlo_seg_t * const seg, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf,
+                       const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  uint32_t num;
+
+  (void) pthread_mutex_lock(&lock);
+  if (out && (num = seg_number(seg)) != 0 && begin_record(seg->dev, REC_SEG_BMP))
+  {
+    (void) fwrite(&num, sizeof(num), 1, out);
+    put_bmp(flags, fbuf, dest_view, dest_pos);
+  }
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_seg_free(const dlo_seg_t * const seg)
+{
+  uint32_t i;
+
+  (void) pthread_mutex_lock(&lock);
+  for (i = 0; i < MAX_SEGMENTS; i++)
+    if (known_seg[i] == seg)
+      break;
+
+  /* Segments which were never announced needn't be mentioned */
+  if (out && i < MAX_SEGMENTS && begin_record(seg->dev, REC_SEG_FREE))
+  {
+    uint32_t num = i + 1;
+
+    (void) fwrite(&num, sizeof(num), 1, out);
+  }
+  if (i < MAX_SEGMENTS)
+    known_seg[i] = NULL;
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+void dlo_trace_flush(const dlo_device_t * const dev)
+{
+  (void) pthread_mutex_lock(&lock);
+  if (out)
+    (void) begin_record(dev, REC_FLUSH);
+  (void) pthread_mutex_unlock(&lock);
+}
+
+
+dlo_retcode_t dlo_trace_replay(const dlo_dev_t uid, const char * const path, const char * const serial, const bool paced)
+{
+  FILE         *in;
+  char          magic[8];
+  uint32_t      version;
+  rechdr_t      hdr;
+  uint32_t      word[MAX_WORDS];
+  dlo_segment_t segs[MAX_SEGMENTS];
+  uint8_t      *buf    = NULL;
+  size_t        size   = 0;
+  bool          found  = false;
+  uint32_t      want   = 0;
+  uint64_t      origin = dlo_frame_now();
+  dlo_retcode_t err    = dlo_ok;
+  uint32_t      i;
+
+  in = fopen(path, "rb");
+  if (!in)
+    return dlo_err_open;
+  if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, "DLOTRACE", sizeof(magic)) ||
+      fread(&version, sizeof(version), 1, in) != 1 || version != TRACE_VERSION)
+  {
+    (void) fclose(in);
+    return dlo_err_bad_fmt;
+  }
+  memset(segs, 0, sizeof(segs));
+
+  while (err == dlo_ok && fread(&hdr, sizeof(hdr), 1, in) == 1)
+  {
+    dlo_view_t     view1, view2;
+    dlo_rect_t     rec;
+    dlo_dot_t      dot;
+    dlo_mode_t     mode;
+    dlo_surface_t  surf;
+    dlo_bmpflags_t flags;
+    dlo_fbuf_t     fbuf;
+    const uint32_t num = hdr.type == REC_DEVICE   ? 1 :
+                         hdr.type == REC_MODE     ? MODE_WORDS :
+                         hdr.type == REC_FILL     ? VIEW_WORDS + RECT_WORDS + 1 :
+                         hdr.type == REC_COPY     ? VIEW_WORDS + RECT_WORDS + VIEW_WORDS + DOT_WORDS :
+                         hdr.type == REC_BMP      ? BMP_WORDS :
+                         hdr.type == REC_SEGMENT  ? 2 :
+                         hdr.type == REC_SEG_FILL ? 1 + VIEW_WORDS + RECT_WORDS + 1 :
+                         hdr.type == REC_SEG_BMP  ? 1 + BMP_WORDS :
+                         hdr.type == REC_SEG_FREE ? 1 :
+                         hdr.type == REC_FLUSH    ? 0 : BAD_WORDS;
+    dlo_segment_t *seg = NULL;
+    bool           mine;
+
+    if (num == BAD_WORDS || fread(word, sizeof(uint32_t), num, in) != num)
+    {
+      err = dlo_err_bad_fmt;
+      break;
+    }
+
+    /* Devices are announced with their serial number and the mode they were in */
+    if (hdr.type == REC_DEVICE)
+    {
+      size_t len = (word[0] + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+
+      err = read_more(in, &buf, &size, len + (MODE_WORDS * sizeof(uint32_t)));
+      if (err == dlo_ok && !found && (!serial || (strlen(serial) == word[0] && !memcmp(buf, serial, word[0]))))
+      {
+        const dlo_mode_t *cur = get_mode((const uint32_t *)(buf + len), &mode);
+
+        found = true;
+        want  = hdr.dev;
+        if (cur && cur->view.width)
+          while (catch_up(uid, err = dlo_set_mode(uid, cur)));
+        if (SUCCEEDED(err))
+          err = dlo_ok;
+      }
+      continue;
+    }
+    mine = found && hdr.dev == want;
+
+    /* Segment records start with the segment's number */
+    if (hdr.type >= REC_SEGMENT && hdr.type <= REC_SEG_FREE)
+    {
+      if (!word[0] || word[0] > MAX_SEGMENTS)
+      {
+        err = dlo_err_bad_fmt;
+        break;
+      }
+      seg = &segs[word[0] - 1];
+    }
+
+    /* The bitmap's pixels follow, whether or not they're for this device */
+    if (hdr.type == REC_BMP || hdr.type == REC_SEG_BMP)
+    {
+      err = get_bmp(in, hdr.type == REC_BMP ? word : &word[1], &buf, &size, &flags, &fbuf);
+      if (err != dlo_ok)
+        break;
+    }
+
+    /* Wait until it's time for the call, if keeping to the recorded timing */
+    if (mine && paced)
+    {
+      uint64_t now = dlo_frame_now();
+
+      if (origin + hdr.time > now)
+      {
+        struct timespec ts;
+
+        ts.tv_sec  = (origin + hdr.time - now) / 1000000u;
+        ts.tv_nsec = ((origin + hdr.time - now) % 1000000u) * 1000u;
+        (void) nanosleep(&ts, NULL);
+      }
+    }
+    if (!mine)
+      continue;
+
+    switch (hdr.type)
+    {
+      case REC_MODE:
+        while (catch_up(uid, err = dlo_set_mode(uid, get_mode(word, &mode))));
+        break;
+
+      case REC_FILL:
+        while (catch_up(uid, err = dlo_fill_rect(uid, get_view(word, &view1), get_rect(&word[VIEW_WORDS], &rec),
+                                                 (dlo_col32_t)word[VIEW_WORDS + RECT_WORDS])));
+        break;
+
+      case REC_COPY:
+        while (catch_up(uid, err = dlo_copy_rect(uid, get_view(word, &view1), get_rect(&word[VIEW_WORDS], &rec),
+                                                 get_view(&word[VIEW_WORDS + RECT_WORDS], &view2),
+                                                 get_dot(&word[VIEW_WORDS + RECT_WORDS + VIEW_WORDS], &dot))));
+        break;
+
+      case REC_BMP:
+        while (catch_up(uid, err = dlo_copy_host_bmp(uid, flags, &fbuf, get_view(&word[1], &view1),
+                                                     get_dot(&word[1 + VIEW_WORDS], &dot))));
+        break;
+
+      case REC_SEGMENT:
+        /* A number can only be reused once its segment has gone (perhaps with its device) */
+        dlo_free_segment(*seg);
+        *seg = NULL;
+        err  = dlo_new_segment(uid, word[1], seg);
+        break;
+
+      case REC_SEG_FILL:
+        if (!*seg || !get_view(&word[1], &view1) || !get_rect(&word[1 + VIEW_WORDS], &rec))
+          err = dlo_err_bad_fmt;
+        else
+        {
+          err = dlo_prepare_surface(uid, &view1, &surf);
+          if (err == dlo_ok)
+            err = dlo_segment_fill(*seg, &surf, &rec, (dlo_col32_t)word[1 + VIEW_WORDS + RECT_WORDS]);
+        }
+        break;
+
+      case REC_SEG_BMP:
+        if (!*seg || !get_view(&word[2], &view1) || !get_dot(&word[2 + VIEW_WORDS], &dot))
+          err = dlo_err_bad_fmt;
+        else
+        {
+          err = dlo_prepare_surface(uid, &view1, &surf);
+          if (err == dlo_ok)
+            err = dlo_segment_copy_host_bmp(*seg, &surf, flags, &fbuf, &dot);
+        }
+        break;
+
+      case REC_SEG_FREE:
+        dlo_free_segment(*seg);
+        *seg = NULL;
+        break;
+
+      default:
+        while (catch_up(uid, err = dlo_flush_segments(uid)));
+    }
+
+    /* Warnings were recorded as successes, so only an error stops the playback */
+    if (SUCCEEDED(err))
+      err = dlo_ok;
+  }
+  for (i = 0; i < MAX_SEGMENTS; i++)
+    dlo_free_segment(segs[i]);
+  if (buf)
+    dlo_free(buf);
+  (void) fclose(in);
+
+  return err == dlo_ok && !found ? dlo_err_bad_device : err;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static bool begin_record(const dlo_device_t * const dev, const rectype_t type)
+{
+  rechdr_t hdr;
+  uint32_t i;
+
+  for (i = 0; i < num_known; i++)
+    if (known[i] == dev)
+      break;
+
+  hdr.time = dlo_frame_now() - start_us;
+
+  /* Announce a device the first time it does anything */
+  if (i == num_known)
+  {
+    static const uint8_t pad[sizeof(uint32_t)] = { 0 };
+    uint32_t             word[MODE_WORDS];
+    uint32_t             len = dev->serial ? strlen(dev->serial) : 0;
+
+    if (num_known == MAX_DEVICES)
+      return false;
+    known[num_known++] = dev;
+
+    len      = len > MAX_SERIAL ? MAX_SERIAL : len;
+    hdr.type = REC_DEVICE;
+    hdr.dev  = i;
+    (void) fwrite(&hdr, sizeof(hdr), 1, out);
+    (void) fwrite(&len, sizeof(len), 1, out);
+    (void) fwrite(dev->serial, len, 1, out);
+    if (len % sizeof(uint32_t))
+      (void) fwrite(pad, sizeof(uint32_t) - (len % sizeof(uint32_t)), 1, out);
+    (void) put_mode(word, &dev->mode);
+    (void) fwrite(word, sizeof(word), 1, out);
+  }
+
+  hdr.type = type;
+  hdr.dev  = i;
+  (void) fwrite(&hdr, sizeof(hdr), 1, out);
+
+  return true;
+}
+
+
+static uint32_t seg_number(const dlo_seg_t * const seg)
+{
+  uint32_t word[2];
+  uint32_t i;
+  uint32_t free_slot = MAX_SEGMENTS;
+
+  for (i = 0; i < MAX_SEGMENTS; i++)
+  {
+    if (known_seg[i] == seg)
+      return i + 1;
+    if (!known_seg[i] && free_slot == MAX_SEGMENTS)
+      free_slot = i;
+  }
+
+  /* Announce a segment the first time it's seen */
+  if (free_slot == MAX_SEGMENTS || !begin_record(seg->dev, REC_SEGMENT))
+    return 0;
+  known_seg[free_slot] = seg;
+
+  word[0] = free_slot + 1;
+  word[1] = seg->order;
+  (void) fwrite(word, sizeof(word), 1, out);
+
+  return free_slot + 1;
+}
+
+
+static void put_bmp(const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf,
+                    const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  static const uint8_t pad[sizeof(uint32_t)] = { 0 };
+  uint32_t             word[MAX_WORDS];
+  uint32_t            *ptr   = word;
+  bool                 lut   = (fbuf->fmt >> DLO_PIXFMT_PTR_SFT) || fbuf->fmt == dlo_pixfmt_lut8;
+  uint32_t             bypp  = FORMAT_TO_BYTES_PER_PIXEL(fbuf->fmt);
+  uint32_t             row   = bypp * fbuf->width;
+  uint32_t             total = row * fbuf->height;
+  const uint8_t       *src   = (const uint8_t *)fbuf->base;
+  uint32_t             y;
+
+  *ptr++ = (flags.v_flip ? 1u : 0) | (flags.blend ? 2u : 0) | (flags.chase ? 4u : 0);
+  ptr    = put_view(ptr, dest_view);
+  ptr    = put_dot(ptr, dest_pos);
+  *ptr++ = fbuf->width;
+  *ptr++ = fbuf->height;
+  *ptr++ = lut ? 0 : (uint32_t)fbuf->fmt;
+  (void) fwrite(word, sizeof(uint32_t), ptr - word, out);
+
+  /* A palette is recorded in place of the pointer to it (replay always uses dlo_pixfmt_lut8) */
+  if (lut)
+    (void) fwrite(fbuf->fmt == dlo_pixfmt_lut8 ? (const void *)fbuf->lut : (const void *)(uintptr_t)fbuf->fmt,
+                  sizeof(dlo_col32_t), 256, out);
+
+  for (y = 0; y < fbuf->height; y++, src += bypp * fbuf->stride)
+    (void) fwrite(src, row, 1, out);
+
+  /* The second plane of a native bitmap follows the first */
+  if (fbuf->fmt == dlo_pixfmt_native)
+  {
+    src    = (const uint8_t *)fbuf->base8;
+    total += fbuf->width * fbuf->height;
+    for (y = 0; y < fbuf->height; y++, src += fbuf->stride)
+      (void) fwrite(src, fbuf->width, 1, out);
+  }
+  if (total % sizeof(uint32_t))
+    (void) fwrite(pad, sizeof(uint32_t) - (total % sizeof(uint32_t)), 1, out);
+}
+
+
+static dlo_retcode_t get_bmp(FILE * const in, const uint32_t * const word, uint8_t ** const buf, size_t * const size,
+                             dlo_bmpflags_t * const flags, dlo_fbuf_t * const fbuf)
+{
+  const uint32_t *tail = &word[1 + VIEW_WORDS + DOT_WORDS];
+  dlo_pixfmt_t    fmt  = (dlo_pixfmt_t)tail[2];
+  size_t          lut  = fmt ? 0 : 256 * sizeof(dlo_col32_t);
+  size_t          pix, pix8, len;
+
+  /* Palettes are always recorded in full, never as a pointer squeezed into the format */
+  if ((uint32_t)fmt >= DLO_PIXFMT_MAX)
+    return dlo_err_bad_fmt;
+
+  pix  = (size_t)tail[0] * tail[1] * (fmt ? FORMAT_TO_BYTES_PER_PIXEL(fmt) : 1);
+  pix8 = fmt == dlo_pixfmt_native ? (size_t)tail[0] * tail[1] : 0;
+  len  = (pix + pix8 + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+  ERR(read_more(in, buf, size, lut + len));
+
+  memset(flags, 0, sizeof(*flags));
+  flags->v_flip = word[0] & 1u ? 1 : 0;
+  flags->blend  = word[0] & 2u ? 1 : 0;
+  flags->chase  = word[0] & 4u ? 1 : 0;
+  fbuf->width   = tail[0];
+  fbuf->height  = tail[1];
+  fbuf->fmt     = fmt ? fmt : dlo_pixfmt_lut8;
+  fbuf->lut     = (const dlo_col32_t *)*buf;
+  fbuf->base    = *buf + lut;
+  fbuf->stride  = tail[0];
+  fbuf->base8   = *buf + lut + pix;
+
+  return dlo_ok;
+}
+
+
+static uint32_t *put_view(uint32_t *word, const dlo_view_t * const view)
+{
+  *word++ = view ? 1 : 0;
+  *word++ = view ? view->width  : 0;
+  *word++ = view ? view->height : 0;
+  *word++ = view ? view->bpp    : 0;
+  *word++ = view ? view->base   : 0;
+
+  return word;
+}
+
+
+static uint32_t *put_rect(uint32_t *word, const dlo_rect_t * const rec)
+{
+  *word++ = rec ? 1 : 0;
+  *word++ = rec ? (uint32_t)rec->origin.x : 0;
+  *word++ = rec ? (uint32_t)rec->origin.y : 0;
+  *word++ = rec ? rec->width  : 0;
+  *word++ = rec ? rec->height : 0;
+
+  return word;
+}
+
+
+static uint32_t *put_dot(uint32_t *word, const dlo_dot_t * const dot)
+{
+  *word++ = dot ? 1 : 0;
+  *word++ = dot ? (uint32_t)dot->x : 0;
+  *word++ = dot ? (uint32_t)dot->y : 0;
+
+  return word;
+}
+
+
+static uint32_t *put_mode(uint32_t *word, const dlo_mode_t * const mode)
+{
+  word    = put_view(word, mode ? &mode->view : NULL);
+  *word++ = mode ? mode->refresh : 0;
+
+  return word;
+}
+
+
+static const dlo_view_t *get_view(const uint32_t * const word, dlo_view_t * const view)
+{
+  if (!word[0])
+    return NULL;
+
+  view->width  = (uint16_t)word[1];
+  view->height = (uint16_t)word[2];
+  view->bpp    = (uint8_t)word[3];
+  view->base   = word[4];
+
+  return view;
+}
+
+
+static const dlo_rect_t *get_rect(const uint32_t * const word, dlo_rect_t * const rec)
+{
+  if (!word[0])
+    return NULL;
+
+  rec->origin.x = (int32_t)word[1];
+  rec->origin.y = (int32_t)word[2];
+  rec->width    = (uint16_t)word[3];
+  rec->height   = (uint16_t)word[4];
+
+  return rec;
+}
+
+
+static const dlo_dot_t *get_dot(const uint32_t * const word, dlo_dot_t * const dot)
+{
+  if (!word[0])
+    return NULL;
+
+  dot->x = (int32_t)word[1];
+  dot->y = (int32_t)word[2];
+
+  return dot;
+}
+
+
+static const dlo_mode_t *get_mode(const uint32_t * const word, dlo_mode_t * const mode)
+{
+  if (!get_view(word, &mode->view))
+    return NULL;
+
+  mode->refresh = (uint8_t)word[VIEW_WORDS];
+
+  return mode;
+}
+
+
+static dlo_retcode_t read_more(FILE * const in, uint8_t ** const buf, size_t * const size, const size_t len)
+{
+  if (*size < len)
+  {
+    if (*buf)
+      dlo_free(*buf);
+    *size = 0;
+    *buf  = (uint8_t *)dlo_malloc(len);
+    NERR(*buf);
+    *size = len;
+  }
+  if (len && fread(*buf, len, 1, in) != 1)
+    return dlo_err_bad_fmt;
+
+  return dlo_ok;
+}
+
+
+static bool catch_up(const dlo_dev_t uid, const dlo_retcode_t err)
+{
+  dlo_fence_t fence;
+
+  if (err != dlo_err_would_block)
+    return false;
+
+  /* Let the write queue drain before trying again */
+  return dlo_insert_fence(uid, &fence) == dlo_ok && dlo_wait_fence(uid, fence, 0) == dlo_ok;
+}
@@ -0,0 +1,146 @@
+/** @file dlo_trace.h
+ *
+ *  @brief Header file for recording and replaying traces of drawing calls.
+ *
+ *  This file defines the API between the public drawing calls and the code which records
+ *  them (with the pixels of any bitmaps) to a trace file, and plays a trace file back.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DLO_TRACE_H
+#define DLO_TRACE_H       /**< Avoid multiple inclusion. */
+
+#include "dlo_structs.h"
+
+
+/** Start recording drawing calls to a file, or stop recording.
+ *
+ *  @param  path  Path of the file to write (or NULL to stop).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_trace_record(const char * const path);
+
+
+/** Forget a device which is about to be freed.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_trace_forget(const dlo_device_t * const dev);
+
+
+/** Record a call to @c dlo_set_mode(), if recording.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  mode  Pointer to the requested mode (or NULL).
+ */
+extern void dlo_trace_mode(const dlo_device_t * const dev, const dlo_mode_t * const mode);
+
+
+/** Record a call to @c dlo_fill_rect(), if recording.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  view  Pointer to the viewport (or NULL).
+ *  @param  rec   Pointer to the rectangle (or NULL).
+ *  @param  col   Colour of the fill.
+ */
+extern void dlo_trace_fill(const dlo_device_t * const dev, const dlo_view_t * const view, const dlo_rect_t * const rec, const dlo_col32_t col);
+
+
+/** Record a call to @c dlo_copy_rect(), if recording.
+ *
+ *  @param  dev        Pointer to @a dlo_device_t structure.
+ *  @param  src_view   Pointer to the source viewport (or NULL).
+ *  @param  src_rec    Pointer to the source rectangle (or NULL).
+ *  @param  dest_view  Pointer to the destination viewport (or NULL).
+ *  @param  dest_pos   Pointer to the destination position (or NULL).
+ */
+extern void dlo_trace_copy(const dlo_device_t * const dev,
+                           const dlo_view_t * const src_view,  const dlo_rect_t * const src_rec,
+                           const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
+
+
+/** Record a call to @c dlo_copy_host_bmp(), with a copy of the bitmap, if recording.
+ *
+ *  @param  dev        Pointer to @a dlo_device_t structure.
+ *  @param  flags      Flags word for the copy.
+ *  @param  fbuf       Pointer to the bitmap.
+ *  @param  dest_view  Pointer to the destination viewport (or NULL).
+ *  @param  dest_pos   Pointer to the destination position (or NULL).
+ */
+extern void dlo_trace_bmp(const dlo_device_t * const dev, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf,
+                          const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
+
+
+/** Record the creation of a command segment, if recording.
+ *
+ *  @param  seg  Pointer to the new segment.
+ */
+extern void dlo_trace_seg_new(const dlo_seg_t * const seg);
+
+
+/** Record a call to @c dlo_segment_fill(), if recording.
+ *
+ *  @param  seg   Pointer to the segment.
+ *  @param  view  Pointer to the surface's viewport.
+ *  @param  rec   Pointer to the rectangle.
+ *  @param  col   Colour of the fill.
+ */
+extern void dlo_trace_seg_fill(const dlo_seg_t * const seg, const dlo_view_t * const view, const dlo_rect_t * const rec, const dlo_col32_t col);
+
+
+/** Record a call to @c dlo_segment_copy_host_bmp(), with a copy of the bitmap, if recording.
+ *
+ *  @param  seg        Pointer to the segment.
+ *  @param  flags      Flags word for the copy.
+ *  @param  fbuf       Pointer to the bitmap.
+ *  @param  dest_view  Pointer to the surface's viewport.
+ *  @param  dest_pos   Pointer to the destination position.
+ */
+extern void dlo_trace_seg_bmp(const dlo_seg_t * const seg, const dlo_bmpflags_t flags, const dlo_fbuf_t * const fbuf,
+                              const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
+
+
+/** Record the freeing of a command segment, if recording.
+ *
+ *  @param  seg  Pointer to the segment, which is about to be freed.
+ */
+extern void dlo_trace_seg_free(const dlo_seg_t * const seg);
+
+
+/** Record a call to @c dlo_flush_segments(), if recording.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ */
+extern void dlo_trace_flush(const dlo_device_t * const dev);
+
+
+/** Play back the calls recorded for one device in a trace file.
+ *
+ *  @param  uid     Unique ID of the device to draw on.
+ *  @param  path    Path of the trace file.
+ *  @param  serial  Serial number of the recorded device to play back (or NULL for the first).
+ *  @param  paced   Flag: keep to the recorded timing, rather than going as fast as possible.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_trace_replay(const dlo_dev_t uid, const char * const path, const char * const serial, const bool paced);
+
+
+#endif
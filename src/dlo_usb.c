@@ -21,11 +21,16 @@
  */
 
 #include <string.h>
+#include <time.h>
+#include <poll.h>
 #include "netinet/in.h"
 #include "dlo_defs.h"
 #include "dlo_usb.h"
 #include "dlo_base.h"
 #include "dlo_mode.h"
+#include "dlo_grfx.h"
+#include "dlo_stats.h"
+#include "dlo_rt.h"
 
 
 /* File-scope defines ------------------------------------------------------------------*/
@@ -59,6 +64,58 @@
  */
 #define STD_CHANNEL "\x57\xCD\xDC\xA7\x1C\x88\x5E\x15\x60\xFE\xC6\x97\x16\x3D\x47\xF2"
 
+/** Size of the smaller of the bulk transfers timed when a device is claimed.
+ */
+#define PROBE_SMALL (4*1024u)
+
+/** Size of the larger of the bulk transfers timed when a device is claimed.
+ */
+#define PROBE_LARGE (32*1024u)
+
+/** Number of transfers of each size to time when a device is claimed.
+ */
+#define PROBE_COUNT (2u)
+
+/** A transfer should take at least this many times longer than the fixed cost of a transfer.
+ */
+#define XFER_EFFICIENCY (9u)
+
+/** Longest time (microseconds) that sending a full command buffer should take.
+ */
+#define XFER_LATENCY (8000u)
+
+/** Time (microseconds) that sending a full write queue should take.
+ */
+#define QUEUE_TIME (16000u)
+
+/** Largest write queue depth that tuning will choose.
+ */
+#define QUEUE_MAX (16u)
+
+/** Number of milliseconds between re-checks of the transfer parameters.
+ */
+#define RETUNE_INTERVAL (5000u)
+
+/** Number of timed transfers needed before the transfer parameters are re-checked.
+ */
+#define RETUNE_SAMPLES (16u)
+
+/** Byte sequence of a null command, used to fill the transfers timed at claim time.
+ */
+#define NULL_CMD "\xAF\xA0"
+
+/** Longest error message kept from libusb (characters, including the terminator).
+ */
+#define USB_ERR_MAX (256u)
+
+/** Size of a write queue block, including its header.
+ */
+#define QBLOCK_SIZE (sizeof(dlo_qblock_t) + BUF_SIZE)
+
+/** Return the USB connection structure for a device which was found on the USB.
+ */
+#define UCNCT(dev) ((dlo_usb_dev_t *)(dev)->cnct)
+
 
 /* File-scope types --------------------------------------------------------------------*/
 
@@ -72,9 +129,11 @@ int32_t usberr = 0;
 /* File-scope variables ----------------------------------------------------------------*/
 
 
-/** Pointer to a copy of the last error message string read out of libusb (or NULL).
+/** Copy of the last error message string read out of libusb (empty if none).
+ *
+ *  This is a fixed buffer so that a failed write doesn't have to allocate memory.
  */
-static char *usb_err_str = NULL;
+static char usb_err_str[USB_ERR_MAX];
 
 
 /* File-scope function declarations ----------------------------------------------------*/
@@ -89,14 +148,180 @@ static char *usb_err_str = NULL;
 static dlo_retcode_t check_device(struct usb_device *dev);
 
 
-/** Attempt to read the EDID structure from the monitor attached to the specified device.
+/** Attempt to read and parse the EDID structure from the monitor attached to the specified device.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t read_edid(dlo_device_t * const dev);
+
+
+/** Call the callbacks for any fences which have now been signalled.
+ *
+ *  @param  dev  Device structure pointer.
+ *  @param  all  Call all of the callbacks, signalled or not (the device is being closed).
+ */
+static void fence_signal(dlo_device_t * const dev, const bool all);
+
+
+/** Return the time from a monotonic clock.
+ *
+ *  @return  Time in milliseconds.
+ */
+static uint64_t now_ms(void);
+
+
+/** Return the time from a monotonic clock.
+ *
+ *  @return  Time in microseconds.
+ */
+static uint64_t now_us(void);
+
+
+/** Time a bulk write of a block of commands and add it to the transfer statistics.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the commands.
+ *  @param  size  Number of bytes to write.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t timed_write(dlo_device_t * const dev, char * const buf, const size_t size);
+
+
+/** Time some bulk transfers of null commands and tune the transfer parameters from them.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t xfer_probe(dlo_device_t * const dev);
+
+
+/** Tune the transfer parameters from the transfer statistics (and then clear them).
+ *
+ *  @param  dev  Device structure pointer.
+ */
+static void xfer_tune(dlo_device_t * const dev);
+
+
+/** Make the command buffer the size given by the transfer parameters.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  The command buffer must be empty.
+ */
+static void xfer_apply(dlo_device_t * const dev);
+
+
+/** Append a block of commands to the write queue of a non-blocking device.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the commands.
+ *  @param  size  Number of bytes of commands.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t queue_buf(dlo_device_t * const dev, const char *buf, size_t size);
+
+
+/** Allocate a spare block for the write queue, pinning it if the device is real-time.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Pointer to the block (or NULL if out of memory).
+ */
+static dlo_qblock_t *queue_new(dlo_device_t * const dev);
+
+
+/** Allocate everything a real-time device needs to send commands, so that it needn't later.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t preallocate(dlo_device_t * const dev);
+
+
+/** Remove the oldest block from the write queue, counting its commands as finished with.
+ *
+ *  @param  dev  Device structure pointer.
+ */
+static void queue_pop(dlo_device_t * const dev);
+
+
+/** Note where the commands in a block which failed to be written would have drawn.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the lost commands.
+ *  @param  size  Number of bytes of commands.
+ *
+ *  @return  true if the block can be repaired, false if not.
+ *
+ *  Only devices with a shadow or a client source function can repair lost commands.
+ */
+static bool note_lost(dlo_device_t * const dev, const char * const buf, const size_t size);
+
+
+/** Send everything on the repair list, straight to the transport.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t repair(dlo_device_t * const dev);
+
+
+/** USB connection: open the specified device.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t usb_cnct_open(dlo_device_t * const dev);
+
+
+/** USB connection: close the specified device.
+ *
+ *  @param  dev  Device structure pointer.
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t usb_cnct_close(dlo_device_t * const dev);
+
+
+/** USB connection: select the input channel in the specified device.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the buffer containing the channel information.
+ *  @param  size  Size of the buffer (bytes).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t usb_cnct_chan_sel(const dlo_device_t * const dev, const char * const buf, const size_t size);
+
+
+/** USB connection: bulk write a block of commands (no larger than @a BUF_SIZE) to the device.
+ *
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the buffer containing commands to write.
+ *  @param  size  Size of the buffer (bytes).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t usb_cnct_write_buf(dlo_device_t * const dev, char * buf, size_t size);
+
+
+/** USB connection: read the raw EDID bytes from the monitor attached to the device.
  *
- *  @param  dev    Device structure pointer.
- *  @param  uhand  USB device handle.
+ *  @param  dev   Device structure pointer.
+ *  @param  buf   Pointer to the buffer to read into.
+ *  @param  size  Number of bytes to read.
  *
  *  @return  Return code, zero for no error.
  */
-static dlo_retcode_t read_edid(dlo_device_t * const dev, usb_dev_handle *uhand);
+static dlo_retcode_t usb_cnct_read_edid(dlo_device_t * const dev, uint8_t * const buf, const size_t size);
 
 
 /** Make a note of any error returned by libusb.
@@ -119,7 +344,7 @@ static dlo_retcode_t usb_error_grab(void);
 char *dlo_usb_strerror(void)
 {
   //DPRINTF("usb: error lookup %d\n", usberr);
-  return usb_err_str;
+  return usb_err_str[0] ? usb_err_str : NULL;
 }
 
 
@@ -139,8 +364,7 @@ dlo_retcode_t dlo_usb_init(const dlo_init_t flags)
 
 dlo_retcode_t dlo_usb_final(const dlo_final_t flags)
 {
-  if (usb_err_str)
-    dlo_free(usb_err_str);
+  usb_err_str[0] = '\0';
 
   return dlo_ok;
 }
@@ -241,7 +465,7 @@ static dlo_retcode_t check_device(struct usb_device *udev)
     /* Use this opportunity to update the USB device structure pointer, just in
      * case it has moved.
      */
-    dev->cnct->udev = udev;
+    UCNCT(dev)->udev = udev;
     //DPRINTF("usb: check: already in list\n");
   }
   else
@@ -252,10 +476,17 @@ static dlo_retcode_t check_device(struct usb_device *udev)
     NERR_GOTO(dev);
 
     /* It's not. Create and initialise a new list node for the device */
-    dev->cnct = (dlo_usb_dev_t *)dlo_malloc(sizeof(dlo_usb_dev_t));
+    dev->cnct = dlo_malloc(sizeof(dlo_usb_dev_t));
     NERR_GOTO(dev->cnct);
-    dev->cnct->udev = udev;
-    dev->cnct->uhand = NULL;
+    UCNCT(dev)->udev  = udev;
+    UCNCT(dev)->uhand = NULL;
+
+    /* Talk to it using our USB connection functions */
+    dev->open      = usb_cnct_open;
+    dev->close     = usb_cnct_close;
+    dev->chan_sel  = usb_cnct_chan_sel;
+    dev->write_buf = usb_cnct_write_buf;
+    dev->read_edid = usb_cnct_read_edid;
   }
   //DPRINTF("usb: check: dlpp node &%X\n", (int)dev);
 
@@ -290,62 +521,15 @@ error:
 
 dlo_retcode_t dlo_usb_open(dlo_device_t * const dev)
 {
-  dlo_retcode_t   err;
-  usb_dev_handle *uhand;
-  char*		  driver_name;
-  int             usb_configuration;
-  int             i;
-  int32_t         db = usb_find_busses();
-  int32_t         dd = usb_find_devices();
-
-  /* Do we trust the USB device pointer? Not if the structures may have changed under us... */
-  if (db || dd)
-    return dlo_err_reenum;
-
-  /* Open the device */
-  uhand = usb_open(dev->cnct->udev);
-  DPRINTF("usb: open: uhand &%X\n", (int)uhand);
-
-  if (!uhand)
-    return dlo_err_open;
+  dlo_retcode_t err;
 
-  /* Store the USB device handle in our dev->cnct word */
-  dev->cnct->uhand = uhand;
+  /* Use the default timeout if none was specified */
+  if (!dev->timeout)
+    dev->timeout = WRITE_TIMEOUT;
+  //DPRINTF("usb: open: timeout %u ms\n", dev->timeout);
 
   /* Establish the connection with the device */
-  //DPRINTF("usb: open: setting config...\n");
-
-  /*
-   * Because some displaylink devices may report 
-   * a class code (like HID or MSC) that gets
-   * matched by a kernel driver, we must detach
-   * those drivers before libusb can successfully
-   * set configuration or talk to those devices.
-   * For now, we kick everyone off our device, 
-   * but that includes cases we're intentionally
-   * a composite device with HID interfaces that
-   * control something (e.g. a button on a dock).
-   * And the code below is blindly unloading
-   * the kernel HID drivers for those.  May want
-   * to get more sophisticated in the future.
-   */
-  driver_name = dlo_malloc(128);
-  for (i=0; i < dev->cnct->udev->config->bNumInterfaces; i++) 
-  {
-    memset(driver_name, 0, 128);
-    if (usb_get_driver_np(uhand, i, driver_name, 128) == 0)
-    {
-      DPRINTF("usb: driver (%s) already attached to device\n", driver_name);
-
-      // Reports are that this call can return error even if successful
-      usb_detach_kernel_driver_np(uhand,i);
-    }
-  }
-   
-  UERR(usb_set_configuration(uhand, 1));
-
-  //DPRINTF("usb: open: claiming iface...\n");
-  UERR(usb_claim_interface(uhand, 0));
+  ERR(CALL(dev, open));
 
   /* Mark the device as claimed */
   dev->claimed = true;
@@ -354,29 +538,56 @@ dlo_retcode_t dlo_usb_open(dlo_device_t * const dev)
   if (!dev->buffer)
   {
     //DPRINTF("usb: open: alloc buffer...\n");
-    dev->buffer = dlo_malloc(BUF_SIZE);
-    NERR(dev->buffer);
+    dev->buffer = dlo_rt_alloc(dev, BUF_SIZE);
+    NERR_GOTO(dev->buffer);
     dev->bufptr = dev->buffer;
     dev->bufend = dev->buffer + BUF_SIZE;
   }
   //DPRINTF("usb: open: buffer &%X, &%X, &%X\n", (int)dev->buffer, (int)dev->bufptr, (int)dev->bufend);
 
-  /* Use the default timeout if none was specified */
-  if (!dev->timeout)
-    dev->timeout = WRITE_TIMEOUT;
-  //DPRINTF("usb: open: timeout %u ms\n", dev->timeout);
+  /* Unless the caller fixed the transfer parameters, measure the link to choose them */
+  if (!dev->xfer_auto)
+    xfer_apply(dev);
+  else
+  {
+    dev->xfer.size     = BUF_SIZE;
+    dev->xfer.depth    = QUEUE_DEPTH;
+    dev->xfer.kbps     = 0;
+    dev->xfer.overhead = 0;
+    xfer_apply(dev);
+    err = xfer_probe(dev);
+#ifdef DEBUG
+    if (err != dlo_ok)
+      DPRINTF("usb: open: probe error %u '%s'\n", (int)err, dlo_strerror(err));
+#else
+    IGNORE(err);
+#endif
+  }
+
+  /* Now that the queue depth is settled, a real-time device gets everything it will need */
+  if (dev->realtime)
+    ERR_GOTO(preallocate(dev));
 
   /* Initialise the supported modes array for this device to include all our pre-defined modes */
   use_default_modes(dev);
 
   /* Attempt to read the EDID information, to refine the supported modes array contents */
-  err = read_edid(dev, uhand);
+  err = read_edid(dev);
 #ifdef DEBUG
   if (err != dlo_ok)
     DPRINTF("usb: open: edid error %u '%s'\n", (int)err, dlo_strerror(err));
+#else
+  IGNORE(err);
 #endif
 
   return dlo_ok;
+
+error:
+  /* Don't leave the device claimed with only part of what it needs */
+  (void) dlo_usb_close(dev);
+  dlo_grfx_repair_free(dev);
+
+  return err;
 }
 
 
@@ -384,37 +595,56 @@ dlo_retcode_t dlo_usb_close(dlo_device_t * const dev)
 {
   if (dev->claimed)
   {
+    /* Give the write queue a chance to empty, then throw away anything left in it */
+    if (dev->qhead)
+      (void) dlo_usb_wait(dev, dev->done + dev->qbytes, dev->timeout);
+    while (dev->qhead)
+      queue_pop(dev);
+    while (dev->qfree)
+    {
+      dlo_qblock_t *next = dev->qfree->next;
+
+      dlo_rt_free(dev, dev->qfree);
+      dev->qfree = next;
+    }
+    if (dev->rbuf)
+    {
+      dlo_rt_free(dev, dev->rbuf);
+      dev->rbuf = NULL;
+    }
+
     if (dev->buffer)
     {
-      dlo_free(dev->buffer);
+      dev->done += dev->bufptr - dev->buffer;
+      dlo_rt_free(dev, dev->buffer);
       dev->buffer = NULL;
       dev->bufptr = NULL;
       dev->bufend = NULL;
     }
     dev->claimed = false;
-    UERR(usb_release_interface(dev->cnct->uhand, 0));
-    UERR(usb_close(dev->cnct->uhand));
+
+    /* Nothing else will be written, so let anyone waiting on a fence know */
+    fence_signal(dev, true);
+    ERR(CALL(dev, close));
   }
   return dlo_ok;
 }
 
 
-dlo_retcode_t dlo_usb_chan_sel(const dlo_device_t * const dev, const char * const buf, const size_t size)
+dlo_retcode_t dlo_usb_chan_sel(dlo_device_t * const dev, const char * const buf, const size_t size)
 {
-  if (size)
-    UERR(usb_control_msg(/* handle */      dev->cnct->uhand,
-                         /* requestType */ USB_TYPE_VENDOR,
-                         /* request */     NR_USB_REQUEST_CHANNEL,
-                         /* value */       0,
-                         /* index */       0,
-                         /* bytes */       (char *)buf,
-                         /* size */        size,
-                         /* timeout */     CHANSEL_TIMEOUT));
-  return dlo_ok;
+  if (!size)
+    return dlo_ok;
+
+  /* Commands which were queued before the channel selection must reach the device first */
+  if (dev->qhead)
+    ERR(dlo_usb_wait(dev, dev->done + dev->qbytes, 0));
+
+  return CALL(dev, chan_sel, buf, size);
 }
 
 
-dlo_retcode_t dlo_usb_std_chan(const dlo_device_t * const dev)
+dlo_retcode_t dlo_usb_std_chan(dlo_device_t * const dev)
 {
   dlo_retcode_t err;
 
@@ -431,12 +661,21 @@ dlo_retcode_t dlo_usb_write(dlo_device_t * const dev)
 
   dev->bufptr = dev->buffer;
 
+  /* Now that the buffer is empty, it's a good time to re-check the transfer parameters */
+  if (dev->xfer_auto && !dev->repairing && dev->xstats.num >= RETUNE_SAMPLES &&
+      now_ms() >= dev->xfer_stamp + RETUNE_INTERVAL)
+  {
+    xfer_tune(dev);
+    xfer_apply(dev);
+  }
+
   return err;
 }
 
 
 dlo_retcode_t dlo_usb_write_buf(dlo_device_t * const dev, char * buf, size_t size)
 {
+  dlo_retcode_t   err;
 #ifdef DEBUG_DUMP
   static char     outfile[64];
   static uint32_t outnum = 0;
@@ -453,44 +692,262 @@ dlo_retcode_t dlo_usb_write_buf(dlo_device_t * const dev, char * buf, size_t siz
   /* If the buffer to write is fewer than 513 bytes in size, copy into 513 byte buffer and pad with zeros */
   if (size < WRITE_BUF_BODGE)
   {
-    dlo_retcode_t err;
     uint32_t       rem = WRITE_BUF_BODGE - size;
-    char          *cpy = dlo_malloc(WRITE_BUF_BODGE);
+    char           cpy[WRITE_BUF_BODGE];
 
-    NERR(cpy);
     dlo_memcpy(cpy, buf, size);
     dlo_memset(cpy + size, 0, rem);
-    err = dlo_usb_write_buf(dev, cpy, size + rem);
-    dlo_free(cpy);
 
-    return err;
+    return dlo_usb_write_buf(dev, cpy, size + rem);
   }
 #endif
 
+  /* Retransmissions go straight to the transport (they aren't part of the fenced stream) */
+  if (dev->repairing)
+    return CALL(dev, write_buf, buf, size);
+
+  /* Non-blocking devices leave the writing to dlo_usb_handle_events() */
+  if (dev->nonblock)
+    return queue_buf(dev, buf, size);
+
+  /* Anything lost from an earlier write has to reach the device before newer commands */
+  err = dev->nrepair ? repair(dev) : dlo_ok;
+
   while (size)
   {
-    size_t num = size > BUF_SIZE ? BUF_SIZE : size;
+    size_t num = size > dev->xfer.size ? dev->xfer.size : size;
 
-#ifdef DEBUG_DUMP
-    (void) snprintf(outfile, sizeof(outfile), "dump/%02X/bulk%03X.dat", outnum & 0xFF, outnum >> 8);
-    outnum++;
-    out = fopen(outfile, "wb");
-    if (out)
+    if (err == dlo_ok)
     {
-      (void) fwrite(buf, num, 1, out);
-      (void) fclose(out);
-      out = NULL;
-    }
+#ifdef DEBUG_DUMP
+      (void) snprintf(outfile, sizeof(outfile), "dump/%02X/bulk%03X.dat", outnum & 0xFF, outnum >> 8);
+      outnum++;
+      out = fopen(outfile, "wb");
+      if (out)
+      {
+        (void) fwrite(buf, num, 1, out);
+        (void) fclose(out);
+        out = NULL;
+      }
 #endif
 
-    UERR(usb_bulk_write(/* handle */   dev->cnct->uhand,
-                        /* endpoint */ 1,
-                        /* bytes */    buf,
-                        /* size */     num,
-                        /* timeout */  dev->timeout));
+      /* If the write fails, try sending just what the lost commands would have drawn */
+      err = timed_write(dev, buf, num);
+      if (err != dlo_ok && note_lost(dev, buf, num) && repair(dev) == dlo_ok)
+        err = dlo_ok;
+    }
+    else
+      (void) note_lost(dev, buf, num);
+
+    /* Even if it wasn't written, this part of the buffer counts as finished with */
+    dev->done += num;
+    fence_signal(dev, false);
     buf  += num;
     size -= num;
   }
+  return err;
+}
+
+
+dlo_retcode_t dlo_usb_read_edid(dlo_device_t * const dev, uint8_t * const buf, const size_t size)
+{
+  return CALL(dev, read_edid, buf, size);
+}
+
+
+dlo_retcode_t dlo_usb_set_xfer(dlo_device_t * const dev, const dlo_xfer_t * const xfer)
+{
+  if (xfer && (xfer->size < XFER_MIN || xfer->size > BUF_SIZE))
+    return dlo_err_unsupported;
+
+  /* The command buffer has to be empty before it can change size */
+  if (dev->claimed)
+    ERR(dlo_usb_write(dev));
+
+  dev->xfer_auto = !xfer;
+  if (xfer)
+  {
+    dev->xfer.size = xfer->size;
+    if (xfer->depth)
+      dev->xfer.depth = xfer->depth;
+  }
+  if (!dev->claimed)
+    return dlo_ok;
+
+  if (dev->xfer_auto)
+    return xfer_probe(dev);
+  xfer_apply(dev);
+
+  return dlo_ok;
+}
+
+
+uint32_t dlo_usb_link_time(const dlo_device_t * const dev, const uint64_t bytes)
+{
+  uint64_t xfers;
+
+  if (!dev->xfer.kbps)
+    return 0;
+
+  xfers = (bytes + dev->xfer.size - 1) / dev->xfer.size;
+
+  return (uint32_t)((xfers * dev->xfer.overhead) + ((bytes * 1000u) / dev->xfer.kbps));
+}
+
+
+dlo_fence_t dlo_usb_fence(const dlo_device_t * const dev)
+{
+  return dev->done + dev->qbytes + (dev->bufptr - dev->buffer);
+}
+
+
+dlo_retcode_t dlo_usb_fence_notify(dlo_device_t * const dev, const dlo_fence_t fence, const dlo_fence_fn_t fn, void * const pw)
+{
+  dlo_fence_cb_t **prev = &dev->fence_cb;
+  dlo_fence_cb_t  *cb   = (dlo_fence_cb_t *)dlo_malloc(sizeof(dlo_fence_cb_t));
+
+  NERR(cb);
+  cb->fence = fence;
+  cb->fn    = fn;
+  cb->pw    = pw;
+
+  /* Keep the list in fence order (after any others for the same fence) */
+  while (*prev && (*prev)->fence <= fence)
+    prev = &(*prev)->next;
+  cb->next = *prev;
+  *prev    = cb;
+
+  return dlo_ok;
+}
+
+
+bool dlo_usb_would_block(const dlo_device_t * const dev)
+{
+  return dev->nonblock && dev->qlen >= dev->xfer.depth;
+}
+
+
+void dlo_usb_get_poll(const dlo_device_t * const dev, dlo_pollfd_t * const pfd, int32_t * const timeout)
+{
+  int64_t left;
+
+  pfd->fd     = -1;
+  pfd->events = 0;
+  *timeout    = -1;
+  if (!dev->qhead)
+  {
+    /* Commands lost in a failed write are sent again from dlo_usb_handle_events() */
+    if (dev->nrepair)
+      *timeout = 0;
+    return;
+  }
+
+  /* Without a file descriptor to wait on, the write has to be done straight away */
+  if (CALL(dev, get_fd, &pfd->fd) != dlo_ok)
+  {
+    pfd->fd  = -1;
+    *timeout = 0;
+    return;
+  }
+  pfd->events = POLLOUT;
+
+  /* Otherwise, we only need waking up if the device stops accepting commands for too long */
+  left     = (int64_t)(dev->qstamp + dev->timeout) - (int64_t)now_ms();
+  *timeout = left < 0 ? 0 : (int32_t)left;
+}
+
+
+dlo_retcode_t dlo_usb_handle_events(dlo_device_t * const dev)
+{
+  dlo_retcode_t err = dlo_ok;
+
+  /* Anything lost from an earlier write has to reach the device before the rest of the queue */
+  if (dev->nrepair)
+    ERR(repair(dev));
+
+  while (dev->qhead)
+  {
+    dlo_qblock_t *blk = dev->qhead;
+
+    if (dev->write_nb)
+    {
+      uint64_t start = now_us();
+
+      err = CALL(dev, write_nb, blk->data, blk->size);
+      if (err != dlo_err_would_block)
+        dlo_stats_xfer(dev, blk->data, blk->size, now_us() - start, err == dlo_ok);
+      if (err == dlo_err_would_block)
+      {
+        if (now_ms() < dev->qstamp + dev->timeout)
+          return dlo_ok;
+
+        /* The device has stopped accepting commands, so give up on the whole queue (but
+         * remember what it would have drawn, to be sent again next time we're called)
+         */
+        while (dev->qhead)
+        {
+          (void) note_lost(dev, dev->qhead->data, dev->qhead->size);
+          queue_pop(dev);
+        }
+        fence_signal(dev, false);
+        return dlo_err_timeout;
+      }
+    }
+    else
+      err = timed_write(dev, blk->data, blk->size);
+
+    /* If the write failed, try sending just what the lost commands would have drawn */
+    if (err != dlo_ok && note_lost(dev, blk->data, blk->size) && repair(dev) == dlo_ok)
+      err = dlo_ok;
+
+    /* Even if the write failed, the block has been dealt with */
+    queue_pop(dev);
+    dev->qstamp = now_ms();
+    fence_signal(dev, false);
+    if (err != dlo_ok || !dev->write_nb)
+      break;
+  }
+  return err;
+}
+
+
+dlo_retcode_t dlo_usb_wait(dlo_device_t * const dev, const dlo_fence_t fence, const uint32_t timeout)
+{
+  uint64_t end = now_ms() + timeout;
+
+  while (fence > dev->done)
+  {
+    struct pollfd pfd;
+    dlo_pollfd_t  dpfd;
+    int32_t       wait;
+
+    /* If the fence isn't covered by the write queue, we can't get there from here */
+    if (!dev->qhead)
+      return dlo_err_timeout;
+
+    ERR(dlo_usb_handle_events(dev));
+    if (fence <= dev->done)
+      break;
+
+    /* Wait until the device can accept more, or until the time is up */
+    dlo_usb_get_poll(dev, &dpfd, &wait);
+    if (timeout)
+    {
+      uint64_t now = now_ms();
+
+      if (now >= end)
+        return dlo_err_timeout;
+      if (wait < 0 || (uint64_t)wait > end - now)
+        wait = (int32_t)(end - now);
+    }
+    if (dpfd.fd >= 0)
+    {
+      pfd.fd      = dpfd.fd;
+      pfd.events  = dpfd.events;
+      pfd.revents = 0;
+      (void) poll(&pfd, 1, wait);
+    }
+  }
   return dlo_ok;
 }
 
@@ -502,16 +959,12 @@ static dlo_retcode_t usb_error_grab(void)
 {
   char *str = usb_strerror();
 
-  /* If we have a previous USB error message stored, free it */
-  if (usb_err_str)
-    dlo_free(usb_err_str);
-
+  /* Keep a copy of the new error message (truncated if need be) */
+  usb_err_str[0] = '\0';
   if (str)
   {
-    /* Allocate memory for the new error message and store that */
-    usb_err_str = dlo_malloc(1 + strlen(str));
-    if (usb_err_str)
-      strcpy(usb_err_str, str);
+    strncpy(usb_err_str, str, USB_ERR_MAX - 1);
+    usb_err_str[USB_ERR_MAX - 1] = '\0';
   }
 
   /* Always return the generic USB error code */
@@ -520,11 +973,9 @@ static dlo_retcode_t usb_error_grab(void)
 
 
 
-static dlo_retcode_t read_edid(dlo_device_t * const dev, usb_dev_handle *uhand)
+static dlo_retcode_t read_edid(dlo_device_t * const dev)
 {
   dlo_retcode_t err;
-  uint32_t      i;
-  uint8_t       buf[2];
   uint8_t      *edid;
 
   /* Allocate a buffer to hold the EDID structure */
@@ -532,21 +983,7 @@ static dlo_retcode_t read_edid(dlo_device_t * const dev, usb_dev_handle *uhand)
   NERR(edid);
 
   /* Attempt to read the EDID structure from the device */
-  for (i = 0; i < EDID_STRUCT_SZ; i++)
-  {
-    UERR_GOTO(usb_control_msg(/* handle */      uhand,
-                              /* requestType */ USB_ENDPOINT_IN | USB_TYPE_VENDOR,
-                              /* request */     NR_USB_REQUEST_I2C_SUB_IO,
-                              /* value */       i << 8,
-                              /* index */       0xA1,
-                              /* bytes */       (char *)buf,
-                              /* size */        sizeof(buf),
-                              /* timeout */     dev->timeout));
-    if (buf[0])
-      ERR_GOTO(dlo_err_iic_op);
-    //DPRINTF("usb: edid[%u]=&%02X\n", i, buf[1]);
-    edid[i] = buf[1];
-  }
+  ERR_GOTO(dlo_usb_read_edid(dev, edid, EDID_STRUCT_SZ));
 
   /* Supply the prospective EDID structure to the parser */
   ERR_GOTO(dlo_mode_parse_edid(dev, edid, EDID_STRUCT_SZ));
@@ -558,4 +995,404 @@ error:
 }
 
 
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t)ts.tv_sec * 1000u) + (ts.tv_nsec / 1000000u);
+}
+
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t)ts.tv_sec * 1000000u) + (ts.tv_nsec / 1000u);
+}
+
+
+static dlo_retcode_t timed_write(dlo_device_t * const dev, char * const buf, const size_t size)
+{
+  uint64_t      start = now_us();
+  dlo_retcode_t err   = CALL(dev, write_buf, buf, size);
+  uint64_t      time  = now_us() - start;
+
+  dlo_stats_xfer(dev, buf, size, time, err == dlo_ok);
+
+  /* Failed transfers (and timeouts) say nothing useful about the link */
+  if (err == dlo_ok)
+  {
+    dev->xstats.num    += 1;
+    dev->xstats.sum_x  += size;
+    dev->xstats.sum_y  += time;
+    dev->xstats.sum_xx += (uint64_t)size * size;
+    dev->xstats.sum_xy += (uint64_t)size * time;
+  }
+  return err;
+}
+
+
+static dlo_retcode_t xfer_probe(dlo_device_t * const dev)
+{
+  dlo_retcode_t err = dlo_ok;
+  char         *buf = dlo_malloc(PROBE_LARGE);
+  uint32_t      i;
+
+  NERR(buf);
+  for (i = 0; i < PROBE_LARGE; i += DSIZEOF(NULL_CMD))
+    dlo_memcpy(buf + i, NULL_CMD, DSIZEOF(NULL_CMD));
+
+  /* Alternate the sizes, so that a change in the link part way through affects both */
+  dlo_memset(&dev->xstats, 0, sizeof(dev->xstats));
+  for (i = 0; i < PROBE_COUNT && err == dlo_ok; i++)
+  {
+    err = timed_write(dev, buf, PROBE_SMALL);
+    if (err == dlo_ok)
+      err = timed_write(dev, buf, PROBE_LARGE);
+  }
+  dlo_free(buf);
+
+  xfer_tune(dev);
+  xfer_apply(dev);
+
+  return err;
+}
+
+
+static void xfer_tune(dlo_device_t * const dev)
+{
+  const dlo_xstats_t *st = &dev->xstats;
+  double              n  = st->num;
+  double              mx, my, var, us_per_byte, overhead;
+  double              size;
+  uint32_t            depth;
+
+  dev->xfer_stamp = now_ms();
+  if (!st->num || !st->sum_x)
+    return;
+
+  /* Fit time = overhead + (size * us_per_byte) to the timings by least squares. If the
+   * transfers were all much the same size, keep the overhead we had and just update the
+   * throughput.
+   */
+  mx  = st->sum_x / n;
+  my  = st->sum_y / n;
+  var = (st->sum_xx / n) - (mx * mx);
+  if (var > (mx * mx) / 100.0)
+  {
+    us_per_byte = ((st->sum_xy / n) - (mx * my)) / var;
+    overhead    = my - (us_per_byte * mx);
+  }
+  else
+  {
+    overhead    = dev->xfer.overhead;
+    us_per_byte = (my - overhead) / mx;
+  }
+  if (overhead < 0)
+    overhead = 0;
+  if (us_per_byte <= 0)
+    us_per_byte = (my > overhead ? my - overhead : my) / mx;
+  dlo_memset(&dev->xstats, 0, sizeof(dev->xstats));
+  if (us_per_byte <= 0)
+    return;
+
+  dev->xfer.overhead = (uint32_t)overhead;
+  dev->xfer.kbps     = (uint32_t)(1000.0 / us_per_byte);
+
+  /* Large enough that the fixed cost is a small part of each transfer, but not so large
+   * that a full buffer takes too long to send.
+   */
+  size = XFER_EFFICIENCY * overhead / us_per_byte;
+  dev->xfer.size = XFER_MIN;
+  while (dev->xfer.size < BUF_SIZE && dev->xfer.size < size)
+    dev->xfer.size *= 2;
+  while (dev->xfer.size > XFER_MIN && dev->xfer.size * us_per_byte > XFER_LATENCY)
+    dev->xfer.size /= 2;
+
+  /* Queue enough buffers to keep the link busy for a while */
+  depth = 1 + (uint32_t)(QUEUE_TIME / (us_per_byte * dev->xfer.size));
+  dev->xfer.depth = depth < 2 ? 2 : depth > QUEUE_MAX ? QUEUE_MAX : depth;
+  DPRINTF("usb: tune: %u kB/s overhead %u us: size %u depth %u\n", dev->xfer.kbps, dev->xfer.overhead, dev->xfer.size, dev->xfer.depth);
+}
+
+
+static void xfer_apply(dlo_device_t * const dev)
+{
+  ASSERT(dev->xfer.size >= XFER_MIN && dev->xfer.size <= BUF_SIZE);
+  if (dev->buffer && !dev->repairing)
+  {
+    ASSERT(dev->bufptr == dev->buffer);
+    dev->bufend = dev->buffer + dev->xfer.size;
+  }
+}
+
+
+static dlo_retcode_t queue_buf(dlo_device_t * const dev, const char *buf, size_t size)
+{
+  while (size)
+  {
+    size_t        num = size > dev->xfer.size ? dev->xfer.size : size;
+    dlo_qblock_t *blk = dev->qfree;
+
+    /* Reuse a spare block if we have one */
+    if (blk)
+      dev->qfree = blk->next;
+    else
+    {
+      blk = queue_new(dev);
+      NERR(blk);
+      if (dev->realtime)
+        dev->rtstats.allocs += 1;
+    }
+    dlo_memcpy(blk->data, buf, num);
+    blk->size = num;
+    blk->next = NULL;
+
+    /* The stall timeout runs from when the queue stopped being empty */
+    if (dev->qtail)
+      dev->qtail->next = blk;
+    else
+    {
+      dev->qhead  = blk;
+      dev->qstamp = now_ms();
+    }
+    dev->qtail   = blk;
+    dev->qlen   += 1;
+    dev->qbytes += num;
+    buf  += num;
+    size -= num;
+  }
+  return dlo_ok;
+}
+
+
+static dlo_qblock_t *queue_new(dlo_device_t * const dev)
+{
+  dlo_qblock_t *blk = (dlo_qblock_t *)dlo_rt_alloc(dev, QBLOCK_SIZE);
+
+  if (!blk)
+    return NULL;
+  blk->data = (char *)(blk + 1);
+
+  return blk;
+}
+
+
+static dlo_retcode_t preallocate(dlo_device_t * const dev)
+{
+  uint32_t num = dev->xfer_auto ? QUEUE_MAX : dev->xfer.depth;
+  uint32_t i;
+
+  /* Enough write queue blocks for the queue depth that was set, or the deepest that tuning will choose */
+  for (i = 0; dev->nonblock && i < num; i++)
+  {
+    dlo_qblock_t *blk = queue_new(dev);
+
+    NERR(blk);
+    blk->next  = dev->qfree;
+    dev->qfree = blk;
+  }
+
+  /* A buffer to build retransmissions in */
+  if (!dev->rbuf)
+  {
+    dev->rbuf = dlo_rt_alloc(dev, BUF_SIZE);
+    NERR(dev->rbuf);
+  }
+
+  /* And a list of what to send in it */
+  return dlo_grfx_repair_alloc(dev);
+}
+
+
+static void queue_pop(dlo_device_t * const dev)
+{
+  dlo_qblock_t *blk = dev->qhead;
+
+  dev->qhead = blk->next;
+  if (!dev->qhead)
+    dev->qtail = NULL;
+  dev->qlen   -= 1;
+  dev->qbytes -= blk->size;
+  dev->done   += blk->size;
+  blk->next    = dev->qfree;
+  dev->qfree   = blk;
+}
+
+
+static bool note_lost(dlo_device_t * const dev, const char * const buf, const size_t size)
+{
+  if (dev->repairing || (!dev->shadow && !dev->source))
+    return false;
+
+  return dlo_grfx_damage(dev, buf, size) == dlo_ok;
+}
+
+
+static dlo_retcode_t repair(dlo_device_t * const dev)
+{
+  dlo_retcode_t err;
+  char         *buffer = dev->buffer;
+  char         *bufptr = dev->bufptr;
+  char         *bufend = dev->bufend;
+  char         *tmp    = dev->rbuf ? dev->rbuf : dlo_malloc(BUF_SIZE);
+
+  NERR(tmp);
+
+  /* Build the retransmission in a buffer of its own, as the command buffer may be part full */
+  dev->buffer    = tmp;
+  dev->bufptr    = tmp;
+  dev->bufend    = tmp + BUF_SIZE;
+  dev->repairing = true;
+
+  err = dlo_grfx_repair(dev);
+  DPRINTF("usb: repair: err %u\n", (int)err);
+
+  dev->repairing = false;
+  dev->buffer    = buffer;
+  dev->bufptr    = bufptr;
+  dev->bufend    = bufend;
+  if (tmp != dev->rbuf)
+    dlo_free(tmp);
+
+  return err;
+}
+
+
+static void fence_signal(dlo_device_t * const dev, const bool all)
+{
+  while (dev->fence_cb && (all || dev->fence_cb->fence <= dev->done))
+  {
+    dlo_fence_cb_t *cb = dev->fence_cb;
+
+    dev->fence_cb = cb->next;
+    cb->fn((dlo_dev_t)dev, cb->fence, cb->pw);
+    dlo_free(cb);
+  }
+}
+
+
+static dlo_retcode_t usb_cnct_open(dlo_device_t * const dev)
+{
+  usb_dev_handle *uhand;
+  char*		  driver_name;
+  int             i;
+  int32_t         db = usb_find_busses();
+  int32_t         dd = usb_find_devices();
+
+  /* Do we trust the USB device pointer? Not if the structures may have changed under us... */
+  if (db || dd)
+    return dlo_err_reenum;
+
+  /* Open the device */
+  uhand = usb_open(UCNCT(dev)->udev);
+  DPRINTF("usb: open: uhand &%X\n", (int)uhand);
+
+  if (!uhand)
+    return dlo_err_open;
+
+  /* Store the USB device handle in our dev->cnct word */
+  UCNCT(dev)->uhand = uhand;
+
+  /* Establish the connection with the device */
+  //DPRINTF("usb: open: setting config...\n");
+
+  /*
+   * Because some displaylink devices may report 
+   * a class code (like HID or MSC) that gets
+   * matched by a kernel driver, we must detach
+   * those drivers before libusb can successfully
+   * set configuration or talk to those devices.
+   * For now, we kick everyone off our device, 
+   * but that includes cases we're intentionally
+   * a composite device with HID interfaces that
+   * control something (e.g. a button on a dock).
+   * And the code below is blindly unloading
+   * the kernel HID drivers for those.  May want
+   * to get more sophisticated in the future.
+   */
+  driver_name = dlo_malloc(128);
+  for (i=0; i < UCNCT(dev)->udev->config->bNumInterfaces; i++) 
+  {
+    memset(driver_name, 0, 128);
+    if (usb_get_driver_np(uhand, i, driver_name, 128) == 0)
+    {
+      DPRINTF("usb: driver (%s) already attached to device\n", driver_name);
+
+      // Reports are that this call can return error even if successful
+      usb_detach_kernel_driver_np(uhand,i);
+    }
+  }
+   
+  UERR(usb_set_configuration(uhand, 1));
+
+  //DPRINTF("usb: open: claiming iface...\n");
+  UERR(usb_claim_interface(uhand, 0));
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t usb_cnct_close(dlo_device_t * const dev)
+{
+  UERR(usb_release_interface(UCNCT(dev)->uhand, 0));
+  UERR(usb_close(UCNCT(dev)->uhand));
+
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t usb_cnct_chan_sel(const dlo_device_t * const dev, const char * const buf, const size_t size)
+{
+  UERR(usb_control_msg(/* handle */      UCNCT(dev)->uhand,
+                       /* requestType */ USB_TYPE_VENDOR,
+                       /* request */     NR_USB_REQUEST_CHANNEL,
+                       /* value */       0,
+                       /* index */       0,
+                       /* bytes */       (char *)buf,
+                       /* size */        size,
+                       /* timeout */     CHANSEL_TIMEOUT));
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t usb_cnct_write_buf(dlo_device_t * const dev, char * buf, size_t size)
+{
+  UERR(usb_bulk_write(/* handle */   UCNCT(dev)->uhand,
+                      /* endpoint */ 1,
+                      /* bytes */    buf,
+                      /* size */     size,
+                      /* timeout */  dev->timeout));
+  return dlo_ok;
+}
+
+
+static dlo_retcode_t usb_cnct_read_edid(dlo_device_t * const dev, uint8_t * const buf, const size_t size)
+{
+  uint32_t i;
+  uint8_t  rd[2];
+
+  for (i = 0; i < size; i++)
+  {
+    UERR(usb_control_msg(/* handle */      UCNCT(dev)->uhand,
+                         /* requestType */ USB_ENDPOINT_IN | USB_TYPE_VENDOR,
+                         /* request */     NR_USB_REQUEST_I2C_SUB_IO,
+                         /* value */       i << 8,
+                         /* index */       0xA1,
+                         /* bytes */       (char *)rd,
+                         /* size */        sizeof(rd),
+                         /* timeout */     dev->timeout));
+    if (rd[0])
+      return dlo_err_iic_op;
+    //DPRINTF("usb: edid[%u]=&%02X\n", i, rd[1]);
+    buf[i] = rd[1];
+  }
+  return dlo_ok;
+}
+
+
 /* End of file -------------------------------------------------------------------------*/
@@ -6,6 +6,11 @@
  *  example implementation uses libusb but it should be simple to replace dlo_usb.c with
  *  some alternative implementation.
  *
+ *  The calls which operate on an individual device (open, close, channel selection, writes
+ *  and EDID reads) are connection-independent: they go through the function pointers held
+ *  in the @a dlo_device_t structure, which are set up by whichever connection found the
+ *  device. Devices reached over the network (see dlo_net.c) are driven through the same calls.
+ *
  *  DisplayLink Open Source Software (libdlo)
  *  Copyright (C) 2009, DisplayLink
  *  www.displaylink.com
@@ -98,8 +103,10 @@ extern dlo_retcode_t dlo_usb_close(dlo_device_t * const dev);
  *  @param  size  Size of the buffer (bytes).
  *
  *  @return  Return code, zero for no error.
+ *
+ *  If the device has a write queue, this waits for it to empty first.
  */
-extern dlo_retcode_t dlo_usb_chan_sel(const dlo_device_t * const dev, const char * const buf, const size_t size);
+extern dlo_retcode_t dlo_usb_chan_sel(dlo_device_t * const dev, const char * const buf, const size_t size);
 
 
 /** Switch to the default input channel in the specified device.
@@ -108,7 +115,7 @@ extern dlo_retcode_t dlo_usb_chan_sel(const dlo_device_t * const dev, const char
  *
  *  @return  Return code, zero for no error.
  */
-extern dlo_retcode_t dlo_usb_std_chan(const dlo_device_t * const dev);
+extern dlo_retcode_t dlo_usb_std_chan(dlo_device_t * const dev);
 
 
 /** Flush the command buffer contents to the specified device.
@@ -127,8 +134,105 @@ extern dlo_retcode_t dlo_usb_write(dlo_device_t * const dev);
  *  @param  size  Size of the buffer (bytes).
  *
  *  @return  Return code, zero for no error.
+ *
+ *  If part of the buffer can't be written, only the areas of device memory which that
+ *  part would have drawn are sent again (see @c dlo_grfx_repair()). An error is only
+ *  returned if that fails too.
  */
 extern dlo_retcode_t dlo_usb_write_buf(dlo_device_t * const dev, char * buf, size_t size);
 
 
+/** Read the raw EDID structure from the monitor attached to the specified device.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  buf   Pointer to the buffer to read into.
+ *  @param  size  Number of bytes to read (normally @a EDID_STRUCT_SZ).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_usb_read_edid(dlo_device_t * const dev, uint8_t * const buf, const size_t size);
+
+
+/** Fix the transfer parameters of the specified device, or have them tuned automatically.
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  xfer  Pointer to the parameters (or NULL to measure the link and tune them).
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_usb_set_xfer(dlo_device_t * const dev, const dlo_xfer_t * const xfer);
+
+
+/** Estimate how long the link to the specified device will take to carry a number of bytes of commands.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  bytes  Number of bytes.
+ *
+ *  @return  Time in microseconds (zero if the link hasn't been measured).
+ */
+extern uint32_t dlo_usb_link_time(const dlo_device_t * const dev, const uint64_t bytes);
+
+
+/** Return a fence for all of the commands issued to the specified device so far.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  The fence.
+ */
+extern dlo_fence_t dlo_usb_fence(const dlo_device_t * const dev);
+
+
+/** Add a callback to the list of those waiting for fences on the specified device.
+ *
+ *  @param  dev    Pointer to @a dlo_device_t structure.
+ *  @param  fence  Fence to wait for.
+ *  @param  fn     Function to call once the fence is signalled.
+ *  @param  pw     Private word to pass to the function.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_usb_fence_notify(dlo_device_t * const dev, const dlo_fence_t fence, const dlo_fence_fn_t fn, void * const pw);
+
+
+/** Is the write queue of the specified device too full to start another drawing operation?
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  true if the caller should return @a dlo_err_would_block, false otherwise.
+ */
+extern bool dlo_usb_would_block(const dlo_device_t * const dev);
+
+
+/** Find out what the write queue of the specified device is waiting for.
+ *
+ *  @param  dev      Pointer to @a dlo_device_t structure.
+ *  @param  pfd      Pointer to the file descriptor information to fill in.
+ *  @param  timeout  Pointer to the timeout to fill in (milliseconds, -1 for none).
+ */
+extern void dlo_usb_get_poll(const dlo_device_t * const dev, dlo_pollfd_t * const pfd, int32_t * const timeout);
+
+
+/** Send as much of the write queue of the specified device as can be sent now.
+ *
+ *  @param  dev  Pointer to @a dlo_device_t structure.
+ *
+ *  @return  Return code, zero for no error.
+ */
+extern dlo_retcode_t dlo_usb_handle_events(dlo_device_t * const dev);
+
+
+/** Wait until the transport has finished with all commands before a fence.
+ *
+ *  @param  dev      Pointer to @a dlo_device_t structure.
+ *  @param  fence    Fence to wait for.
+ *  @param  timeout  Maximum time to wait (milliseconds, zero for no limit).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  This only sends commands which are already in the write queue; anything before the
+ *  fence which is still in the command buffer should be flushed first.
+ */
+extern dlo_retcode_t dlo_usb_wait(dlo_device_t * const dev, const dlo_fence_t fence, const uint32_t timeout);
+
+
 #endif
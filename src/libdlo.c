@@ -25,6 +25,16 @@
 #include "dlo_grfx.h"
 #include "dlo_mode.h"
 #include "dlo_usb.h"
+#include "dlo_net.h"
+#include "dlo_frame.h"
+#include "dlo_raster.h"
+#include "dlo_pool.h"
+#include "dlo_stats.h"
+#include "dlo_trace.h"
+#include "dlo_seg.h"
+#include "dlo_scene.h"
+#include "dlo_bmp.h"
+#include "dlo_rt.h"
 
 
 /* File-scope defines ------------------------------------------------------------------*/
@@ -117,6 +127,16 @@ static bool valid_device(const dlo_device_t * const dev);
 static dlo_retcode_t remove_device(dlo_device_t *dev);
 
 
+/** Change the screen mode of a device (the work of @c dlo_set_mode()).
+ *
+ *  @param  dev   Pointer to @a dlo_device_t structure.
+ *  @param  desc  Pointer to the requested mode (or NULL for the monitor's preferred mode).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t set_mode(dlo_device_t * const dev, const dlo_mode_t * const desc);
+
+
 /** Initialise an area structure based upon a viewport and rectangle within it.
  *
  *  @param  dev   Pointer to @a dlo_device_t structure.
@@ -153,6 +173,43 @@ static bool sanitise_view_rect(const dlo_device_t * const dev, const dlo_view_t
 static vstat_t check_overlaps(const dlo_device_t * const dev, const dlo_view_t * const src_view, const dlo_view_t * const dest_view);
 
 
+/** Work out the area of device memory covered by a rectangle within a prepared surface.
+ *
+ *  @param  surf    Struct pointer: the surface.
+ *  @param  x       X co-ordinate of the rectangle's origin.
+ *  @param  y       Y co-ordinate of the rectangle's origin.
+ *  @param  width   Width of the rectangle (pixels).
+ *  @param  height  Height of the rectangle (pixels).
+ *  @param  area    Struct pointer: the area to fill in.
+ *
+ *  The rectangle must already lie within the surface.
+ */
+static void surface_area(const dlo_surface_t * const surf, const int32_t x, const int32_t y,
+                         const uint32_t width, const uint32_t height, dlo_area_t * const area);
+
+
+/** Find the intersection of two rectangles.
+ *
+ *  @param  a    Pointer to the first rectangle.
+ *  @param  b    Pointer to the second rectangle.
+ *  @param  out  Pointer to the rectangle to fill in (may be the same as @a a or @a b).
+ *
+ *  @return  true if the rectangles intersect, false if @a out is empty.
+ */
+static bool rect_intersect(const dlo_rect_t * const a, const dlo_rect_t * const b, dlo_rect_t * const out);
+
+
+/** Split the part of a rectangle which lies outside another into strips.
+ *
+ *  @param  a    Pointer to the rectangle.
+ *  @param  b    Pointer to the rectangle to take away from it (only the part inside @a a matters).
+ *  @param  out  Array of four rectangles to fill in.
+ *
+ *  @return  Number of rectangles filled in.
+ */
+static uint32_t rect_subtract(const dlo_rect_t * const a, const dlo_rect_t * const b, dlo_rect_t * const out);
+
+
 /* Public function definitions ---------------------------------------------------------*/
 
 
@@ -260,14 +317,19 @@ const char *dlo_strerror(const dlo_retcode_t err)
     case dlo_err_edid_fail:    return "Attempt to access EDID information failed";
     case dlo_err_iic_op:       return "IIC operation with device failed";
     case dlo_err_not_root:     return "Executable should be run as root (e.g. using 'su root' or 'sudo')";
-    case dlo_err_open:         return "Attempt to open connection to device failed";
+    case dlo_err_open:         return "Attempt to open connection to device (or file) failed";
     case dlo_err_overlap:      return "Source and destination viewports cannot overlap (unless the same)";
     case dlo_err_reenum:       return "Reenumeration required before device can be claimed";
     case dlo_err_unclaimed:    return "Device cannot be written to: unclaimed";
     case dlo_err_unsupported:  return "Requested feature is not supported";
     case dlo_err_usb:          return dlo_usb_strerror();
+    case dlo_err_net:          return dlo_net_strerror();
+    case dlo_err_timeout:      return "Timed out waiting for the device";
+    case dlo_err_would_block:  return "Write queue is full: call dlo_handle_events() and try again";
+    case dlo_err_sched:        return "The system refused a thread scheduling change";
     /* Warnings... */
     case dlo_warn_dl160_mode:  return "This screen mode may not display correctly on DL120 devices";
+    case dlo_warn_fence_pending: return "The fence has not been signalled yet";
     default:                   return "Unknown error";
   }
 
@@ -297,6 +359,10 @@ dlo_retcode_t dlo_init(const dlo_init_t flags)
   DPRINTF("dlo: usb_init\n");
   ERR(dlo_usb_init(flags));
 
+  /* Initialise the network transport */
+  DPRINTF("dlo: net_init\n");
+  ERR(dlo_net_init(flags));
+
   return dlo_ok;
 }
 
@@ -309,14 +375,70 @@ dlo_retcode_t dlo_final(const dlo_final_t flags)
     (void) remove_device(dev_list);
   }
 
+  dlo_pool_stop();
+  (void) dlo_stats_export(NULL);
+  (void) dlo_trace_record(NULL);
+
   ERR(dlo_grfx_final(flags));
   ERR(dlo_mode_final(flags));
   ERR(dlo_usb_final(flags));
+  ERR(dlo_net_final(flags));
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_set_workers(const uint32_t workers)
+{
+  return dlo_pool_start(workers);
+}
+
+
+dlo_retcode_t dlo_set_thread_sched(const dlo_rtsched_t * const workers, const dlo_rtsched_t * const caller)
+{
+  if (workers)
+    ERR(dlo_pool_sched(workers));
+  if (caller)
+    ERR(dlo_rt_sched(pthread_self(), caller));
 
   return dlo_ok;
 }
 
 
+dlo_retcode_t dlo_export_stats(const char * const name)
+{
+  dlo_device_t *dev;
+  dlo_retcode_t err;
+
+  /* Devices have to let go of the old segment before it goes away */
+  for (dev = dev_list; dev; dev = dev->next)
+    dlo_stats_detach(dev);
+
+  err = dlo_stats_export(name);
+
+  for (dev = dev_list; dev; dev = dev->next)
+    if (dev->claimed)
+      dlo_stats_attach(dev);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_record_trace(const char * const path)
+{
+  return dlo_trace_record(path);
+}
+
+
+dlo_retcode_t dlo_replay_trace(const dlo_dev_t uid, const char * const path, const char * const serial, const bool paced)
+{
+  if (!uid)
+    return dlo_err_bad_device;
+
+  return dlo_trace_replay(uid, path, serial, paced);
+}
+
+
 dlo_devlist_t *dlo_enumerate_devices(void)
 {
   dlo_devlist_t *out = NULL;
@@ -334,6 +456,9 @@ dlo_devlist_t *dlo_enumerate_devices(void)
   //DPRINTF("dlo: enum: enumerating USB devices\n");
   ERR_GOTO(dlo_usb_enumerate(false));
 
+  /* Keep any remote devices added with dlo_add_net_device() on the list */
+  ERR_GOTO(dlo_net_enumerate(false));
+
   /* Remove all devices which weren't updated or added during this enumeration and
    * build the list of device information to return. Note: if a dlo_malloc() call
    * fails during this operation, we note it and continue otherwise the dev_list could
@@ -421,7 +546,14 @@ dlo_dev_t dlo_claim_device(const dlo_dev_t uid, const dlo_claim_t flags, const u
   if (dev->claimed)
     ERR_GOTO(dlo_err_claimed);
 
-  dev->timeout = timeout;
+  dev->timeout  = timeout;
+  dev->nonblock = flags.nonblock;
+  dev->realtime = flags.realtime;
+  dlo_memset(&dev->rtstats, 0, sizeof(dev->rtstats));
+  dev->frame_us = 0;
+  dev->frame_gap = 0;
+  dev->frame_pts = 0;
+  dlo_memset(&dev->fstats, 0, sizeof(dev->fstats));
 
   /* Attempt to open a connection to the device */
   err = dlo_usb_open(dev);
@@ -450,6 +582,22 @@ dlo_dev_t dlo_claim_device(const dlo_dev_t uid, const dlo_claim_t flags, const u
   }
   /* Any other errors from opening the connection get returned to the caller */
   ERR_GOTO(err);
+  dlo_stats_attach(dev);
+
+  /* Allocate the shadow of the device memory, if the caller asked for one */
+  if (flags.shadow)
+  {
+    err = dlo_grfx_shadow_alloc(dev);
+    if (err != dlo_ok)
+    {
+      /* Undo the open as dlo_release_device() would, including its real-time buffers */
+      dlo_stats_detach(dev);
+      (void) dlo_usb_close(dev);
+      dlo_grfx_repair_free(dev);
+      dev->realtime = false;
+      goto error;
+    }
+  }
 
   /* Attempt to change mode into the native resolution of the display (if we have one) */
   dlo_mode_set_default(dev, 0);
@@ -561,258 +709,998 @@ dlo_dev_t dlo_claim_default_device(int *argc_p, char *argv[],
 }
 
 
-dlo_retcode_t dlo_release_device(const dlo_dev_t uid)
+dlo_dev_t dlo_add_net_device(const char * const host, const uint16_t port, const dlo_netflags_t flags)
 {
-  dlo_device_t *dev = (dlo_device_t *)uid;
-
-  return dev ? dlo_usb_close(dev) : dlo_err_bad_device;
-}
+  dlo_device_t *dev = NULL;
+  dlo_retcode_t err;
 
+  if (!host)
+    ERR_GOTO(dlo_err_open);
 
-dlo_devinfo_t *dlo_device_info(const dlo_dev_t uid)
-{
-  static dlo_devinfo_t info;
-  dlo_device_t        *dev = (dlo_device_t *)uid;
+  ERR_GOTO(dlo_net_add(host, port ? port : DLO_NET_PORT, flags, &dev));
 
-  if (!dev)
-    return NULL;
+  return (dlo_dev_t)dev;
 
-  info.uid     = uid;
-  info.serial  = dev->serial;
-  info.type    = dev->type;
-  info.claimed = dev->claimed;
+error:
+  DPRINTF("dlo: add_net: error %u '%s'\n", (int)err, dlo_strerror(err));
 
-  return &info;
+  return (dlo_dev_t)0;
 }
 
 
-dlo_retcode_t dlo_set_mode(const dlo_dev_t uid, const dlo_mode_t * const desc)
+dlo_retcode_t dlo_serve_device(const dlo_dev_t uid, const uint16_t port)
 {
   dlo_device_t *dev = (dlo_device_t *)uid;
-  dlo_modenum_t num;
 
-  if (!dev)
+  if (!dev || !valid_device(dev))
     return dlo_err_bad_device;
 
-  /* TODO: clean up the cases we use the direct-from-EDID path, when we 
-   * generally clean up (or is that clean out?) the standard mode tables
-   */
-  if ((desc == NULL) || (desc->view.width == 0) ||
-      /* or if width and hight the same as monitor's preferred mode */
-      ((dev->edid.timings[0].pixelClock10KHz) && (desc->view.width == dev->edid.timings[0].hActive) && (desc->view.height == dev->edid.timings[0].vActive))) {
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
 
-    uint32_t base = 0;
+  return dlo_net_serve(dev, port ? port : DLO_NET_PORT);
+}
 
-    if (desc) {
-      base = desc->view.base;
-    }
 
-    /* Then do a modeset directly from the preferred mode in the EDID */
-    return dlo_mode_set_default(dev, base);
-  }
+dlo_retcode_t dlo_insert_fence(const dlo_dev_t uid, dlo_fence_t * const fence)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
 
-  DPRINTF("dlo: set_mode: asking for width %u height %u refresh %u bpp %u\n", desc->view.width, desc->view.height, desc->refresh, desc->view.bpp);
+  if (!dev)
+    return dlo_err_bad_device;
 
-  /* See if we can provide a mode which matches the required parameters */
-  num = dlo_mode_lookup(dev, desc->view.width, desc->view.height, desc->refresh, desc->view.bpp);
-  DPRINTF("dlo: set_mode: lookup %d\n", (int32_t)num);
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
 
-  return num == DLO_INVALID_MODE ? dlo_err_bad_mode : dlo_mode_change(dev, desc, num);
+  *fence = dlo_usb_fence(dev);
+
+  return dlo_ok;
 }
 
 
-dlo_mode_t *dlo_get_mode(const dlo_dev_t uid)
+dlo_retcode_t dlo_poll_fence(const dlo_dev_t uid, const dlo_fence_t fence)
 {
   dlo_device_t *dev = (dlo_device_t *)uid;
 
-  return dev ? &(dev->mode) : NULL;
+  if (!dev)
+    return dlo_err_bad_device;
+
+  return fence <= dev->done ? dlo_ok : dlo_warn_fence_pending;
 }
 
 
-dlo_retcode_t dlo_fill_rect(const dlo_dev_t uid, const dlo_view_t * const view, const dlo_rect_t * const rec, const dlo_col32_t col)
+dlo_retcode_t dlo_wait_fence(const dlo_dev_t uid, const dlo_fence_t fence, const uint32_t timeout)
 {
-  static clip_t        clip;
-  static dlo_area_t    area;
-  dlo_device_t * const dev = (dlo_device_t *)uid;
+  dlo_device_t *dev = (dlo_device_t *)uid;
 
   if (!dev)
     return dlo_err_bad_device;
 
-  /* Clip the rectangle to its viewport edges */
-  if (!sanitise_view_rect(dev, view, rec, &area, &clip))
-    return dlo_ok;
+  /* Send anything before the fence which is still sitting in the command buffer */
+  if (fence > dev->done && dev->claimed)
+    ERR(dlo_usb_write(dev));
 
-  return dlo_grfx_fill_rect(dev, &area, col);
+  /* Unless the device is non-blocking, that's all there is to do */
+  return dlo_usb_wait(dev, fence, timeout);
 }
 
 
-dlo_retcode_t dlo_copy_rect(const dlo_dev_t uid,
-                             const dlo_view_t * const src_view,  const dlo_rect_t * const src_rec,
-                             const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+dlo_retcode_t dlo_notify_fence(const dlo_dev_t uid, const dlo_fence_t fence, const dlo_fence_fn_t fn, void * const pw)
 {
-  static clip_t        clip;
-  static dlo_area_t    src_area;
-  static dlo_area_t    dest_area;
-  static dlo_rect_t    dest_rec;
-  dlo_device_t * const dev     = (dlo_device_t *)uid;
-  bool                 overlap = false;
+  dlo_device_t *dev = (dlo_device_t *)uid;
 
   if (!dev)
     return dlo_err_bad_device;
 
-  /* Check to see if (and how) the source and destination viewports overlap */
-  switch (check_overlaps(dev, src_view, dest_view))
+  if (!fn)
+    return dlo_err_unsupported;
+
+  /* Call it straight away if we're already past the fence */
+  if (fence <= dev->done)
   {
-    case vstat_good_view:
-      break;
-    case vstat_bad_view:
-      return dlo_err_bad_view;
-    case vstat_bad_overlap:
-      return dlo_err_overlap;
-    default:
-    {
-      DPRINTF("dlo: copy_rec: src_view == dest_view... overlap? ");
-      overlap = (dest_pos->x + src_rec->width  > src_rec->origin.x) &&
-                (dest_pos->y + src_rec->height > src_rec->origin.y) &&
-                (dest_pos->x < src_rec->origin.x + src_rec->width)  &&
-                (dest_pos->y < src_rec->origin.y + src_rec->height);
-      DPRINTF("%s\n", overlap ? "yes" : "no");
-    }
+    fn(uid, fence, pw);
+    return dlo_ok;
   }
 
-  /* Clip the source rectangle to its viewport edges */
-  if (!sanitise_view_rect(dev, src_view, src_rec, &src_area, &clip))
-    return dlo_ok;
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
 
-  /* Clip the destination rectangle by the same amounts as we needed to clip the source */
-  dest_rec.origin.x = dest_pos ? dest_pos->x + clip.left  : clip.left;
-  dest_rec.origin.y = dest_pos ? dest_pos->y + clip.below : clip.below;
-  dest_rec.width    = src_area.view.width;
-  dest_rec.height   = src_area.view.height;
+  return dlo_usb_fence_notify(dev, fence, fn, pw);
+}
 
-  /* Further clip the destination rectangle to its viewport edges */
-  if (!sanitise_view_rect(dev, dest_view, &dest_rec, &dest_area, &clip))
-    return dlo_ok;
 
-  /* Further clip the source area by the same amounts as we needed to clip the destination */
-  src_area.view.base  += (BYTES_PER_16BPP * clip.left) + (BYTES_PER_16BPP * clip.below * src_area.stride);
-  src_area.base8      += (BYTES_PER_8BPP  * clip.left) + (BYTES_PER_8BPP  * clip.below * src_area.stride);
-  src_area.view.width  = dest_area.view.width;
-  src_area.view.height = dest_area.view.height;
+dlo_retcode_t dlo_get_poll(const dlo_dev_t uid, dlo_pollfd_t * const pfd, int32_t * const timeout)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+  int32_t       wait;
+
+  if (!dev)
+    return dlo_err_bad_device;
 
-  return dlo_grfx_copy_rect(dev, &src_area, &dest_area, overlap);
+  dlo_usb_get_poll(dev, pfd, timeout);
+
+  /* Wake up in time to send the next video frame, too */
+  wait = dlo_frame_timeout(dev);
+  if (wait >= 0 && (*timeout < 0 || wait < *timeout))
+    *timeout = wait;
+
+  return dlo_ok;
 }
 
 
-dlo_retcode_t dlo_copy_host_bmp(const dlo_dev_t uid, const dlo_bmpflags_t flags,
-                             const dlo_fbuf_t * const fbuf,
-                             const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+dlo_retcode_t dlo_handle_events(const dlo_dev_t uid)
 {
-  static clip_t        clip;
-  static dlo_area_t    dest_area;
-  static dlo_rect_t    dest_rec;
-  static dlo_fbuf_t    src_fbuf;
-  dlo_device_t * const dev = (dlo_device_t *)uid;
-  uint32_t             off;
+  dlo_device_t *dev = (dlo_device_t *)uid;
 
-  /* Do some sanity checks */
   if (!dev)
     return dlo_err_bad_device;
 
-  if (!fbuf)
-    return dlo_err_bad_fbuf;
-
-  if (!fbuf->width || !fbuf->height)
-    return dlo_ok;
-
-  /* Clip the destination rectangle to its viewport edges */
-  src_fbuf          = *fbuf;
-  dest_rec.origin.x = dest_pos ? dest_pos->x : 0;
-  dest_rec.origin.y = dest_pos ? dest_pos->y : 0;
-  dest_rec.width    = src_fbuf.width;
-  dest_rec.height   = src_fbuf.height;
-  if (!sanitise_view_rect(dev, dest_view, &dest_rec, &dest_area, &clip))
-    return dlo_ok;
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
 
-  /* Update the source framebuffer information if the destination was clipped */
-  off              = clip.left + (clip.below * src_fbuf.stride);
-  off             *= FORMAT_TO_BYTES_PER_PIXEL(src_fbuf.fmt);
-  src_fbuf.base    = (void *)((unsigned long)src_fbuf.base + (unsigned long)off);
-  src_fbuf.width  -= clip.left  + clip.right;
-  src_fbuf.height -= clip.below + clip.above;
+  /* Send any video frames which are due first, so they can join the write queue */
+  ERR(dlo_frame_pump(dev));
 
-  return dlo_grfx_copy_host_bmp(dev, flags, &src_fbuf, &dest_area);
+  return dlo_usb_handle_events(dev);
 }
 
 
-dlo_device_t *dlo_new_device(const dlo_devtype_t type, const char * const serial)
+dlo_retcode_t dlo_get_xfer(const dlo_dev_t uid, dlo_xfer_t * const xfer)
 {
-  dlo_device_t *dev = (dlo_device_t *)dlo_malloc(sizeof(dlo_device_t));
-  char          *str = NULL;
-  dlo_retcode_t err;
+  dlo_device_t *dev = (dlo_device_t *)uid;
 
-  NERR_GOTO(dev);
+  if (!dev)
+    return dlo_err_bad_device;
 
-  /* Copy the serial number string and keep a pointer to it */
-  str = dlo_malloc(1 + strlen(serial));
-  NERR_GOTO(str);
-  dev->serial = str;
-  strcpy(dev->serial, serial);
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
 
-  /* Link into the device list structure */
-  dev->prev    = NULL;
-  dev->next    = dev_list;
-  dev_list     = dev;
-  dev->claimed = false;
+  *xfer = dev->xfer;
 
-  /* Defaults are for an "Alex" device via USB */
-  dev->type    = type;
-  dev->check   = check_state;
-  dev->timeout = 0;
+  return dlo_ok;
+}
 
-  /* Mode-dependent attributes and function pointers */
-  dev->mode.view.width  = 0;
-  dev->mode.view.height = 0;
-  dev->mode.view.bpp    = 0;
-  dev->mode.refresh     = 0;
-  dev->mode.view.base   = 0;
-  dev->base8            = 0;
-  dev->low_blank        = false;
 
-  /* Device-dependent attributes */
-  dev->buffer = NULL;
+dlo_retcode_t dlo_set_xfer(const dlo_dev_t uid, const dlo_xfer_t * const xfer)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
 
-  /* Connection-dependent attributes.
-   *
-   * It is up to the communications code (re)initialise this values to something which
-   * makes sense to it.
-   */
-  dev->cnct = NULL;
+  if (!dev)
+    return dlo_err_bad_device;
 
-  /* Set up some feature flags based upon what we know about DisplayLink device types.
-   *
-   * NOTE: this section will probably become more refined as more features are added
-   * to libdlo. Currently, it assumes all devices are the same.
-   */
-  dev->memory  = 16 * 1024 * 1024;
+  return dlo_usb_set_xfer(dev, xfer);
+}
 
-  DPRINTF("dlo: new_device: initialised &%X\n", (int)dev);
 
-  return dev;
+dlo_retcode_t dlo_set_colour_lut(const dlo_dev_t uid, const dlo_clut_t * const clut)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
 
-error:
-  if (str)
-    dlo_free(str);
-  if (dev)
-    dlo_free(dev);
+  if (!dev)
+    return dlo_err_bad_device;
 
-  return NULL;
+  if (clut && clut->size && (clut->size < 2 || clut->size > 65 || !clut->cube))
+    return dlo_err_bad_col;
+
+  return dlo_grfx_set_ctable(dev, clut);
 }
 
 
-dlo_device_t *dlo_device_lookup(const char * const serial)
+dlo_retcode_t dlo_set_policy(const dlo_dev_t uid, const dlo_rect_t * const rec, const dlo_policy_t * const policy)
 {
-  dlo_device_t *dev = dev_list;
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  return dlo_grfx_set_policy(dev, rec, policy);
+}
+
+
+uint64_t dlo_time_us(void)
+{
+  return dlo_frame_now();
+}
+
+
+dlo_retcode_t dlo_submit_frame(const dlo_dev_t uid, const dlo_bmpflags_t flags,
+                               const dlo_fbuf_t * const fbuf,
+                               const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos,
+                               const uint64_t pts)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
+
+  if (!fbuf || (fbuf->fmt == dlo_pixfmt_native && !fbuf->base8) ||
+      (fbuf->fmt == dlo_pixfmt_lut8 && !fbuf->lut))
+    return dlo_err_bad_fbuf;
+
+  return dlo_frame_submit(dev, flags, fbuf, dest_view, dest_pos, pts);
+}
+
+
+dlo_retcode_t dlo_get_frame_stats(const dlo_dev_t uid, dlo_framestats_t * const stats)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  *stats = dev->fstats;
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_get_rt_stats(const dlo_dev_t uid, dlo_rtstats_t * const stats)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  *stats = dev->rtstats;
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_set_raster(const dlo_dev_t uid, const dlo_raster_t * const raster)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
+
+  dlo_raster_set(dev, raster);
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_get_row_time(const dlo_dev_t uid, const uint32_t row, uint64_t * const when)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  return dlo_raster_row_time(dev, row, when);
+}
+
+
+dlo_retcode_t dlo_set_source(const dlo_dev_t uid, const dlo_source_fn_t fn, void * const pw)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!dev->claimed)
+    return dlo_err_unclaimed;
+
+  dev->source    = fn;
+  dev->source_pw = pw;
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_release_device(const dlo_dev_t uid)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  dlo_retcode_t err;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  dlo_frame_free(dev);
+  dlo_raster_set(dev, NULL);
+  dlo_grfx_scratch_free(dev);
+  dlo_grfx_policy_free(dev);
+  dlo_grfx_shadow_free(dev);
+  dev->source    = NULL;
+  dev->source_pw = NULL;
+  dlo_stats_detach(dev);
+  err = dlo_usb_close(dev);
+  dlo_grfx_repair_free(dev);
+  dev->realtime = false;
+
+  return err;
+}
+
+
+dlo_devinfo_t *dlo_device_info(const dlo_dev_t uid)
+{
+  static dlo_devinfo_t info;
+  dlo_device_t        *dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return NULL;
+
+  info.uid     = uid;
+  info.serial  = dev->serial;
+  info.type    = dev->type;
+  info.claimed = dev->claimed;
+
+  return &info;
+}
+
+
+dlo_retcode_t dlo_set_mode(const dlo_dev_t uid, const dlo_mode_t * const desc)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+  dlo_retcode_t err;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  /* Only record mode changes which were accepted (perhaps with a warning) */
+  err = set_mode(dev, desc);
+  if (SUCCEEDED(err))
+    dlo_trace_mode(dev, desc);
+
+  return err;
+}
+
+
+dlo_mode_t *dlo_get_mode(const dlo_dev_t uid)
+{
+  dlo_device_t *dev = (dlo_device_t *)uid;
+
+  return dev ? &(dev->mode) : NULL;
+}
+
+
+dlo_retcode_t dlo_fill_rect(const dlo_dev_t uid, const dlo_view_t * const view, const dlo_rect_t * const rec, const dlo_col32_t col)
+{
+  clip_t               clip;
+  dlo_area_t           area;
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+  dlo_retcode_t        err;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (dlo_usb_would_block(dev))
+    return dlo_err_would_block;
+
+  /* Clip the rectangle to its viewport edges */
+  if (!sanitise_view_rect(dev, view, rec, &area, &clip))
+    return dlo_ok;
+
+  /* Only record calls which succeeded, as a replay stops at the first one which fails */
+  err = dlo_grfx_fill_rect(dev, &area, col);
+  if (SUCCEEDED(err))
+    dlo_trace_fill(dev, view, rec, col);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_copy_rect(const dlo_dev_t uid,
+                             const dlo_view_t * const src_view,  const dlo_rect_t * const src_rec,
+                             const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  clip_t               clip;
+  dlo_area_t           src_area;
+  dlo_area_t           dest_area;
+  dlo_rect_t           dest_rec;
+  dlo_device_t * const dev     = (dlo_device_t *)uid;
+  dlo_retcode_t        err;
+  bool                 overlap = false;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (dlo_usb_would_block(dev))
+    return dlo_err_would_block;
+
+  /* Check to see if (and how) the source and destination viewports overlap */
+  switch (check_overlaps(dev, src_view, dest_view))
+  {
+    case vstat_good_view:
+      break;
+    case vstat_bad_view:
+      return dlo_err_bad_view;
+    case vstat_bad_overlap:
+      return dlo_err_overlap;
+    default:
+    {
+      DPRINTF("dlo: copy_rec: src_view == dest_view... overlap? ");
+      overlap = (dest_pos->x + src_rec->width  > src_rec->origin.x) &&
+                (dest_pos->y + src_rec->height > src_rec->origin.y) &&
+                (dest_pos->x < src_rec->origin.x + src_rec->width)  &&
+                (dest_pos->y < src_rec->origin.y + src_rec->height);
+      DPRINTF("%s\n", overlap ? "yes" : "no");
+    }
+  }
+
+  /* Clip the source rectangle to its viewport edges */
+  if (!sanitise_view_rect(dev, src_view, src_rec, &src_area, &clip))
+    return dlo_ok;
+
+  /* Clip the destination rectangle by the same amounts as we needed to clip the source */
+  dest_rec.origin.x = dest_pos ? dest_pos->x + clip.left  : clip.left;
+  dest_rec.origin.y = dest_pos ? dest_pos->y + clip.below : clip.below;
+  dest_rec.width    = src_area.view.width;
+  dest_rec.height   = src_area.view.height;
+
+  /* Further clip the destination rectangle to its viewport edges */
+  if (!sanitise_view_rect(dev, dest_view, &dest_rec, &dest_area, &clip))
+    return dlo_ok;
+
+  /* Further clip the source area by the same amounts as we needed to clip the destination */
+  src_area.view.base  += (BYTES_PER_16BPP * clip.left) + (BYTES_PER_16BPP * clip.below * src_area.stride);
+  src_area.base8      += (BYTES_PER_8BPP  * clip.left) + (BYTES_PER_8BPP  * clip.below * src_area.stride);
+  src_area.view.width  = dest_area.view.width;
+  src_area.view.height = dest_area.view.height;
+
+  err = dlo_grfx_copy_rect(dev, &src_area, &dest_area, overlap);
+  if (SUCCEEDED(err))
+    dlo_trace_copy(dev, src_view, src_rec, dest_view, dest_pos);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_move_rect(const dlo_dev_t uid, const dlo_view_t * const view, const dlo_rect_t * const rec,
+                             const int32_t dx, const int32_t dy, const bool within,
+                             dlo_rect_t * const exposed, uint32_t * const num)
+{
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+  const dlo_view_t    *my_view;
+  dlo_rect_t           whole;
+  dlo_rect_t           from;
+  dlo_rect_t           to;
+  dlo_rect_t           moved;
+  uint32_t             count = 0;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (num)
+    *num = 0;
+
+  my_view = view ? view : &(dev->mode.view);
+  if (!my_view->width || !my_view->height)
+    return dlo_err_bad_view;
+
+  whole.origin.x = 0;
+  whole.origin.y = 0;
+  whole.width    = my_view->width;
+  whole.height   = my_view->height;
+
+  /* Only the part of the rectangle inside the viewport was on the device to be moved */
+  if (!rect_intersect(rec ? rec : &whole, &whole, &from))
+    return dlo_ok;
+
+  /* Work out where those pixels land, and copy them there (if they're still to be seen) */
+  moved           = from;
+  moved.origin.x += dx;
+  moved.origin.y += dy;
+  if (rect_intersect(&moved, within ? &from : &whole, &to))
+  {
+    dlo_rect_t src = to;
+
+    src.origin.x -= dx;
+    src.origin.y -= dy;
+    ERR(dlo_copy_rect(uid, view, &src, view, &to.origin));
+  }
+  else
+    dlo_memset(&to, 0, sizeof(to));
+
+  if (!exposed)
+    return dlo_ok;
+
+  /* Everything the copy didn't cover in the old place needs drawing... */
+  count = rect_subtract(&from, &to, exposed);
+
+  /* ...as does any part of a moved window which wasn't in the viewport before */
+  if (!within)
+  {
+    moved           = rec ? *rec : whole;
+    moved.origin.x += dx;
+    moved.origin.y += dy;
+    if (rect_intersect(&moved, &whole, &moved))
+      count += rect_subtract(&moved, &to, &exposed[count]);
+  }
+  if (num)
+    *num = count;
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_copy_host_bmp(const dlo_dev_t uid, const dlo_bmpflags_t flags,
+                             const dlo_fbuf_t * const fbuf,
+                             const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  clip_t               clip;
+  dlo_area_t           dest_area;
+  dlo_rect_t           dest_rec;
+  dlo_fbuf_t           src_fbuf;
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+  dlo_retcode_t        err;
+  uint32_t             off;
+
+  /* Do some sanity checks */
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!fbuf || (fbuf->fmt == dlo_pixfmt_native && !fbuf->base8) ||
+      (fbuf->fmt == dlo_pixfmt_lut8 && !fbuf->lut))
+    return dlo_err_bad_fbuf;
+
+  if (!fbuf->width || !fbuf->height)
+    return dlo_ok;
+
+  if (dlo_usb_would_block(dev))
+    return dlo_err_would_block;
+
+  /* Clip the destination rectangle to its viewport edges */
+  src_fbuf          = *fbuf;
+  dest_rec.origin.x = dest_pos ? dest_pos->x : 0;
+  dest_rec.origin.y = dest_pos ? dest_pos->y : 0;
+  dest_rec.width    = src_fbuf.width;
+  dest_rec.height   = src_fbuf.height;
+  if (!sanitise_view_rect(dev, dest_view, &dest_rec, &dest_area, &clip))
+    return dlo_ok;
+
+  /* Update the source framebuffer information if the destination was clipped */
+  off              = clip.left + (clip.below * src_fbuf.stride);
+  if (src_fbuf.fmt == dlo_pixfmt_native)
+    src_fbuf.base8 = (void *)((unsigned long)src_fbuf.base8 + (unsigned long)off);
+  off             *= FORMAT_TO_BYTES_PER_PIXEL(src_fbuf.fmt);
+  src_fbuf.base    = (void *)((unsigned long)src_fbuf.base + (unsigned long)off);
+  src_fbuf.width  -= clip.left  + clip.right;
+  src_fbuf.height -= clip.below + clip.above;
+
+  dlo_grfx_policy_begin(dev);
+  if (flags.chase)
+    err = dlo_raster_copy(dev, flags, &src_fbuf, &dest_area);
+  else
+    err = dlo_grfx_copy_host_bmp(dev, flags, &src_fbuf, &dest_area);
+  dlo_grfx_policy_end(dev);
+  if (SUCCEEDED(err))
+    dlo_trace_bmp(dev, flags, fbuf, dest_view, dest_pos);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_copy_bmp_file(const dlo_dev_t uid, const dlo_bmpflags_t flags, const char * const path,
+                                const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos)
+{
+  if (!uid)
+    return dlo_err_bad_device;
+
+  if (!path)
+    return dlo_err_open;
+
+  return dlo_bmp_copy_file(uid, flags, path, dest_view, dest_pos);
+}
+
+
+dlo_retcode_t dlo_read_host_bmp(const dlo_dev_t uid, const dlo_fbuf_t * const fbuf,
+                                const dlo_view_t * const src_view, const dlo_dot_t * const src_pos)
+{
+  clip_t               clip;
+  dlo_area_t           src_area;
+  dlo_rect_t           src_rec;
+  dlo_fbuf_t           dest_fbuf;
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+  uint32_t             off;
+
+  /* Do some sanity checks */
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!fbuf || !fbuf->base || (fbuf->fmt == dlo_pixfmt_native && !fbuf->base8))
+    return dlo_err_bad_fbuf;
+
+  if (!fbuf->width || !fbuf->height)
+    return dlo_ok;
+
+  /* Clip the source rectangle to its viewport edges */
+  dest_fbuf        = *fbuf;
+  src_rec.origin.x = src_pos ? src_pos->x : 0;
+  src_rec.origin.y = src_pos ? src_pos->y : 0;
+  src_rec.width    = dest_fbuf.width;
+  src_rec.height   = dest_fbuf.height;
+  if (!sanitise_view_rect(dev, src_view, &src_rec, &src_area, &clip))
+    return dlo_ok;
+
+  /* Update the destination framebuffer information if the source was clipped */
+  off               = clip.left + (clip.below * dest_fbuf.stride);
+  if (dest_fbuf.fmt == dlo_pixfmt_native)
+    dest_fbuf.base8 = (void *)((unsigned long)dest_fbuf.base8 + (unsigned long)off);
+  off              *= FORMAT_TO_BYTES_PER_PIXEL(dest_fbuf.fmt);
+  dest_fbuf.base    = (void *)((unsigned long)dest_fbuf.base + (unsigned long)off);
+  dest_fbuf.width  -= clip.left  + clip.right;
+  dest_fbuf.height -= clip.below + clip.above;
+
+  return dlo_grfx_read_host_bmp(dev, &dest_fbuf, &src_area);
+}
+
+
+dlo_retcode_t dlo_prepare_surface(const dlo_dev_t uid, const dlo_view_t * const view, dlo_surface_t * const surf)
+{
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+  const dlo_view_t    *my_view;
+  uint32_t             pixels;
+  uint64_t             bytes;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  my_view = view ? view : &(dev->mode.view);
+  if (!my_view->width || !my_view->height || (my_view->bpp != 16 && my_view->bpp != 24))
+    return dlo_err_bad_view;
+
+  /* The surface calls don't check addresses, so the whole viewport must lie in the device memory */
+  pixels = my_view->width * my_view->height;
+  bytes  = (uint64_t)pixels * (my_view->bpp == 24 ? BYTES_PER_16BPP + BYTES_PER_8BPP : BYTES_PER_16BPP);
+  if ((my_view->base & 1) || (uint64_t)my_view->base + bytes > dev->memory)
+    return dlo_err_bad_area;
+
+  surf->uid   = uid;
+  surf->view  = *my_view;
+  surf->base8 = my_view->base + (BYTES_PER_16BPP * pixels);
+  surf->end   = surf->base8 + (my_view->bpp == 24 ? BYTES_PER_8BPP * pixels : 0);
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_surface_fill(const dlo_surface_t * const surf, const dlo_rect_t * const rec, const dlo_col32_t col)
+{
+  dlo_area_t           area;
+  dlo_device_t * const dev = (dlo_device_t *)surf->uid;
+  dlo_retcode_t        err;
+
+  ASSERT(rec->origin.x >= 0 && rec->origin.x + rec->width  <= surf->view.width);
+  ASSERT(rec->origin.y >= 0 && rec->origin.y + rec->height <= surf->view.height);
+
+  if (dlo_usb_would_block(dev))
+    return dlo_err_would_block;
+
+  surface_area(surf, rec->origin.x, rec->origin.y, rec->width, rec->height, &area);
+
+  /* Surface calls are recorded as the calls they stand in for */
+  err = dlo_grfx_fill_rect(dev, &area, col);
+  if (SUCCEEDED(err))
+    dlo_trace_fill(dev, &surf->view, rec, col);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_surface_copy(const dlo_surface_t * const src, const dlo_rect_t * const src_rec,
+                               const dlo_surface_t * const dest, const dlo_dot_t * const dest_pos)
+{
+  dlo_area_t           src_area;
+  dlo_area_t           dest_area;
+  dlo_device_t * const dev     = (dlo_device_t *)dest->uid;
+  dlo_retcode_t        err;
+  bool                 overlap = false;
+
+  ASSERT(src->uid == dest->uid);
+  ASSERT(src_rec->origin.x >= 0 && src_rec->origin.x + src_rec->width  <= src->view.width);
+  ASSERT(src_rec->origin.y >= 0 && src_rec->origin.y + src_rec->height <= src->view.height);
+  ASSERT(dest_pos->x >= 0 && dest_pos->x + src_rec->width  <= dest->view.width);
+  ASSERT(dest_pos->y >= 0 && dest_pos->y + src_rec->height <= dest->view.height);
+
+  if (dlo_usb_would_block(dev))
+    return dlo_err_would_block;
+
+  /* Only a surface copied within itself may overlap, and then only the rectangles matter */
+  if (src->view.base == dest->view.base)
+  {
+    if (src->view.width != dest->view.width || src->view.height != dest->view.height || src->view.bpp != dest->view.bpp)
+      return dlo_err_overlap;
+    overlap = (dest_pos->x + src_rec->width  > src_rec->origin.x) &&
+              (dest_pos->y + src_rec->height > src_rec->origin.y) &&
+              (dest_pos->x < src_rec->origin.x + src_rec->width)  &&
+              (dest_pos->y < src_rec->origin.y + src_rec->height);
+  }
+  else if (dest->end > src->view.base && dest->view.base < src->end)
+    return dlo_err_overlap;
+
+  surface_area(src,  src_rec->origin.x, src_rec->origin.y, src_rec->width, src_rec->height, &src_area);
+  surface_area(dest, dest_pos->x,       dest_pos->y,       src_rec->width, src_rec->height, &dest_area);
+
+  err = dlo_grfx_copy_rect(dev, &src_area, &dest_area, overlap);
+  if (SUCCEEDED(err))
+    dlo_trace_copy(dev, &src->view, src_rec, &dest->view, dest_pos);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_surface_copy_host_bmp(const dlo_surface_t * const surf, const dlo_bmpflags_t flags,
+                                        const dlo_fbuf_t * const fbuf, const dlo_dot_t * const pos)
+{
+  dlo_area_t           area;
+  dlo_device_t * const dev = (dlo_device_t *)surf->uid;
+  dlo_retcode_t        err;
+
+  ASSERT(pos->x >= 0 && pos->x + fbuf->width  <= surf->view.width);
+  ASSERT(pos->y >= 0 && pos->y + fbuf->height <= surf->view.height);
+
+  if (dlo_usb_would_block(dev))
+    return dlo_err_would_block;
+
+  surface_area(surf, pos->x, pos->y, fbuf->width, fbuf->height, &area);
+
+  dlo_grfx_policy_begin(dev);
+  if (flags.chase)
+    err = dlo_raster_copy(dev, flags, fbuf, &area);
+  else
+    err = dlo_grfx_copy_host_bmp(dev, flags, fbuf, &area);
+  dlo_grfx_policy_end(dev);
+  if (SUCCEEDED(err))
+    dlo_trace_bmp(dev, flags, fbuf, &surf->view, pos);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_new_segment(const dlo_dev_t uid, const uint32_t order, dlo_segment_t * const seg)
+{
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+  dlo_seg_t           *new_seg;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  ERR(dlo_seg_new(dev, order, &new_seg));
+  dlo_trace_seg_new(new_seg);
+  *seg = (dlo_segment_t)new_seg;
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_segment_fill(const dlo_segment_t seg, const dlo_surface_t * const surf, const dlo_rect_t * const rec, const dlo_col32_t col)
+{
+  dlo_area_t    area;  /* Not static: other threads may be filling their own segments */
+  dlo_retcode_t err;
+
+  ASSERT(((dlo_seg_t *)seg)->dev == (dlo_device_t *)surf->uid);
+  ASSERT(rec->origin.x >= 0 && rec->origin.x + rec->width  <= surf->view.width);
+  ASSERT(rec->origin.y >= 0 && rec->origin.y + rec->height <= surf->view.height);
+
+  surface_area(surf, rec->origin.x, rec->origin.y, rec->width, rec->height, &area);
+
+  err = dlo_grfx_seg_fill((dlo_seg_t *)seg, &area, col);
+  if (SUCCEEDED(err))
+    dlo_trace_seg_fill((dlo_seg_t *)seg, &surf->view, rec, col);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_segment_copy_host_bmp(const dlo_segment_t seg, const dlo_surface_t * const surf, const dlo_bmpflags_t flags,
+                                        const dlo_fbuf_t * const fbuf, const dlo_dot_t * const pos)
+{
+  dlo_area_t    area;
+  dlo_retcode_t err;
+
+  ASSERT(((dlo_seg_t *)seg)->dev == (dlo_device_t *)surf->uid);
+  ASSERT(pos->x >= 0 && pos->x + fbuf->width  <= surf->view.width);
+  ASSERT(pos->y >= 0 && pos->y + fbuf->height <= surf->view.height);
+
+  surface_area(surf, pos->x, pos->y, fbuf->width, fbuf->height, &area);
+
+  err = dlo_grfx_seg_copy_host_bmp((dlo_seg_t *)seg, flags, fbuf, &area);
+  if (SUCCEEDED(err))
+    dlo_trace_seg_bmp((dlo_seg_t *)seg, flags, fbuf, &surf->view, pos);
+
+  return err;
+}
+
+
+dlo_retcode_t dlo_flush_segments(const dlo_dev_t uid)
+{
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+  dlo_retcode_t        err;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (dlo_usb_would_block(dev))
+    return dlo_err_would_block;
+
+  err = dlo_seg_flush(dev);
+  if (SUCCEEDED(err))
+    dlo_trace_flush(dev);
+
+  return err;
+}
+
+
+void dlo_free_segment(const dlo_segment_t seg)
+{
+  if (seg)
+  {
+    dlo_trace_seg_free((dlo_seg_t *)seg);
+    dlo_seg_free((dlo_seg_t *)seg);
+  }
+}
+
+
+dlo_retcode_t dlo_new_scene(const dlo_dev_t uid, const char * const name, dlo_view_t * const view)
+{
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!name || !view)
+    return dlo_err_bad_view;
+
+  return dlo_scene_new(dev, name, view);
+}
+
+
+dlo_retcode_t dlo_show_scene(const dlo_dev_t uid, const char * const name)
+{
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!name)
+    return dlo_err_bad_view;
+
+  ERR(dlo_scene_show(dev, name));
+  dlo_trace_mode(dev, &dev->mode);
+
+  return dlo_ok;
+}
+
+
+dlo_retcode_t dlo_free_scene(const dlo_dev_t uid, const char * const name)
+{
+  dlo_device_t * const dev = (dlo_device_t *)uid;
+
+  if (!dev)
+    return dlo_err_bad_device;
+
+  if (!name)
+    return dlo_err_bad_view;
+
+  return dlo_scene_free(dev, name);
+}
+
+
+dlo_device_t *dlo_new_device(const dlo_devtype_t type, const char * const serial)
+{
+  dlo_device_t *dev = (dlo_device_t *)dlo_malloc(sizeof(dlo_device_t));
+  char          *str = NULL;
+  dlo_retcode_t err;
+
+  NERR_GOTO(dev);
+
+  /* Copy the serial number string and keep a pointer to it */
+  str = dlo_malloc(1 + strlen(serial));
+  NERR_GOTO(str);
+  dev->serial = str;
+  strcpy(dev->serial, serial);
+
+  /* Link into the device list structure */
+  dev->prev    = NULL;
+  dev->next    = dev_list;
+  dev_list     = dev;
+  dev->claimed = false;
+
+  /* Defaults are for an "Alex" device via USB */
+  dev->type    = type;
+  dev->check   = check_state;
+  dev->timeout = 0;
+
+  /* Mode-dependent attributes and function pointers */
+  dev->mode.view.width  = 0;
+  dev->mode.view.height = 0;
+  dev->mode.view.bpp    = 0;
+  dev->mode.refresh     = 0;
+  dev->mode.view.base   = 0;
+  dev->base8            = 0;
+  dev->low_blank        = false;
+
+  /* Device-dependent attributes */
+  dev->buffer    = NULL;
+  dev->done      = 0;
+  dev->fence_cb  = NULL;
+  dev->nonblock  = false;
+  dev->realtime  = false;
+  dlo_memset(&dev->rtstats, 0, sizeof(dev->rtstats));
+  dev->qhead     = NULL;
+  dev->qtail     = NULL;
+  dev->qfree     = NULL;
+  dev->qlen      = 0;
+  dev->qbytes    = 0;
+  dev->qstamp    = 0;
+  dev->xfer.size     = BUF_SIZE;
+  dev->xfer.depth    = QUEUE_DEPTH;
+  dev->xfer.kbps     = 0;
+  dev->xfer.overhead = 0;
+  dev->xfer_auto = true;
+  dev->shadow    = NULL;
+  dev->valid     = NULL;
+  dev->repair    = NULL;
+  dev->nrepair   = 0;
+  dev->repair_sz = 0;
+  dev->repairing = false;
+  dev->rbuf      = NULL;
+  dev->source    = NULL;
+  dev->source_pw = NULL;
+  dev->ctable      = NULL;
+  dev->regions     = NULL;
+  dev->nregions    = 0;
+  dev->scratch     = NULL;
+  dev->scratch_sz  = 0;
+  dev->frames      = NULL;
+  dev->fspare      = NULL;
+  dev->frame_us    = 0;
+  dev->frame_gap   = 0;
+  dev->frame_pts   = 0;
+  dev->raster_on   = false;
+  dev->row_time    = NULL;
+  dev->row_count   = 0;
+  dev->stats       = NULL;
+  dev->segs        = NULL;
+  dev->scenes      = NULL;
+  (void) pthread_mutex_init(&dev->seg_lock, NULL);
+
+  /* Connection-dependent attributes.
+   *
+   * It is up to the communications code (re)initialise this values to something which
+   * makes sense to it, including the connection function pointers.
+   */
+  dev->cnct      = NULL;
+  dev->open      = NULL;
+  dev->close     = NULL;
+  dev->chan_sel  = NULL;
+  dev->write_buf = NULL;
+  dev->read_edid = NULL;
+  dev->write_nb  = NULL;
+  dev->get_fd    = NULL;
+
+  /* Set up some feature flags based upon what we know about DisplayLink device types.
+   *
+   * NOTE: this section will probably become more refined as more features are added
+   * to libdlo. Currently, it assumes all devices are the same.
+   */
+  dev->memory  = 16 * 1024 * 1024;
+
+  DPRINTF("dlo: new_device: initialised &%X\n", (int)dev);
+
+  return dev;
+
+error:
+  if (str)
+    dlo_free(str);
+  if (dev)
+    dlo_free(dev);
+
+  return NULL;
+}
+
+
+dlo_device_t *dlo_device_lookup(const char * const serial)
+{
+  dlo_device_t *dev = dev_list;
 
   //DPRINTF("dlo: lookup: '%s' dev_list &%X\n", serial, (int)dev_list);
 
@@ -868,6 +1756,20 @@ static dlo_retcode_t remove_device(dlo_device_t *dev)
     err = dlo_ok;
 
   /* Free the structure (and associated data) even if there was an error */
+  dlo_stats_detach(dev);
+  dlo_trace_forget(dev);
+  dlo_frame_free(dev);
+  dlo_raster_free(dev);
+  dlo_grfx_scratch_free(dev);
+  dlo_grfx_ctable_free(dev);
+  dlo_grfx_policy_free(dev);
+  dlo_seg_free_all(dev);
+  (void) pthread_mutex_destroy(&dev->seg_lock);
+  dlo_scene_free_all(dev);
+  dlo_grfx_shadow_free(dev);
+  dlo_grfx_repair_free(dev);
+  if (dev->cnct)
+    dlo_free(dev->cnct);
   if (dev->serial)
     dlo_free(dev->serial);
   dlo_free(dev);
@@ -876,9 +1778,107 @@ static dlo_retcode_t remove_device(dlo_device_t *dev)
 }
 
 
+static dlo_retcode_t set_mode(dlo_device_t * const dev, const dlo_mode_t * const desc)
+{
+  dlo_modenum_t num;
+
+  /* TODO: clean up the cases we use the direct-from-EDID path, when we 
+   * generally clean up (or is that clean out?) the standard mode tables
+   */
+  if ((desc == NULL) || (desc->view.width == 0) ||
+      /* or if width and hight the same as monitor's preferred mode */
+      ((dev->edid.timings[0].pixelClock10KHz) && (desc->view.width == dev->edid.timings[0].hActive) && (desc->view.height == dev->edid.timings[0].vActive))) {
+
+    uint32_t base = 0;
+
+    if (desc) {
+      base = desc->view.base;
+    }
+
+    /* Then do a modeset directly from the preferred mode in the EDID */
+    return dlo_mode_set_default(dev, base);
+  }
+
+  DPRINTF("dlo: set_mode: asking for width %u height %u refresh %u bpp %u\n", desc->view.width, desc->view.height, desc->refresh, desc->view.bpp);
+
+  /* See if we can provide a mode which matches the required parameters */
+  num = dlo_mode_lookup(dev, desc->view.width, desc->view.height, desc->refresh, desc->view.bpp);
+  DPRINTF("dlo: set_mode: lookup %d\n", (int32_t)num);
+
+  return num == DLO_INVALID_MODE ? dlo_err_bad_mode : dlo_mode_change(dev, desc, num);
+}
+
+
+static bool rect_intersect(const dlo_rect_t * const a, const dlo_rect_t * const b, dlo_rect_t * const out)
+{
+  int32_t left   = a->origin.x > b->origin.x ? a->origin.x : b->origin.x;
+  int32_t top    = a->origin.y > b->origin.y ? a->origin.y : b->origin.y;
+  int32_t right  = a->origin.x + (int32_t)a->width;
+  int32_t bottom = a->origin.y + (int32_t)a->height;
+
+  if (right > b->origin.x + (int32_t)b->width)
+    right = b->origin.x + (int32_t)b->width;
+  if (bottom > b->origin.y + (int32_t)b->height)
+    bottom = b->origin.y + (int32_t)b->height;
+
+  if (right <= left || bottom <= top)
+    return false;
+
+  out->origin.x = left;
+  out->origin.y = top;
+  out->width    = (uint16_t)(right - left);
+  out->height   = (uint16_t)(bottom - top);
+
+  return true;
+}
+
+
+static uint32_t rect_subtract(const dlo_rect_t * const a, const dlo_rect_t * const b, dlo_rect_t * const out)
+{
+  dlo_rect_t inner;
+  uint32_t   n = 0;
+
+  if (!rect_intersect(a, b, &inner))
+  {
+    out[0] = *a;
+    return 1;
+  }
+
+  /* Full-width strips above and below, then the pieces either side of what's left */
+  if (inner.origin.y > a->origin.y)
+  {
+    out[n]        = *a;
+    out[n].height = (uint16_t)(inner.origin.y - a->origin.y);
+    n++;
+  }
+  if (inner.origin.y + inner.height < a->origin.y + a->height)
+  {
+    out[n]          = *a;
+    out[n].origin.y = inner.origin.y + inner.height;
+    out[n].height   = (uint16_t)((a->origin.y + a->height) - out[n].origin.y);
+    n++;
+  }
+  if (inner.origin.x > a->origin.x)
+  {
+    out[n]          = inner;
+    out[n].origin.x = a->origin.x;
+    out[n].width    = (uint16_t)(inner.origin.x - a->origin.x);
+    n++;
+  }
+  if (inner.origin.x + inner.width < a->origin.x + a->width)
+  {
+    out[n]          = inner;
+    out[n].origin.x = inner.origin.x + inner.width;
+    out[n].width    = (uint16_t)((a->origin.x + a->width) - out[n].origin.x);
+    n++;
+  }
+  return n;
+}
+
+
 static bool sanitise_view_rect(const dlo_device_t * const dev, const dlo_view_t * const view, const dlo_rect_t * const rec, dlo_area_t * const area, clip_t * const clip)
 {
-  static dlo_rect_t        my_rec;
+  dlo_rect_t               my_rec;
   const dlo_view_t * const my_view = view ? view : &(dev->mode.view);
   uint32_t                 pix_off;
 
@@ -950,6 +1950,20 @@ static bool sanitise_view_rect(const dlo_device_t * const dev, const dlo_view_t
 }
 
 
+static void surface_area(const dlo_surface_t * const surf, const int32_t x, const int32_t y,
+                         const uint32_t width, const uint32_t height, dlo_area_t * const area)
+{
+  uint32_t pix_off = x + (y * surf->view.width);
+
+  area->view.width  = width;
+  area->view.height = height;
+  area->view.bpp    = surf->view.bpp;
+  area->view.base   = surf->view.base + (BYTES_PER_16BPP * pix_off);
+  area->base8       = surf->base8 + pix_off;
+  area->stride      = surf->view.width;
+}
+
+
 static vstat_t check_overlaps(const dlo_device_t * const dev, const dlo_view_t * const src_view, const dlo_view_t * const dest_view)
 {
   const dlo_view_t * const src  = src_view  ? src_view  : &(dev->mode.view);
@@ -211,6 +211,10 @@ extern uint32_t my_used(void);
 typedef void *dlo_dev_t;
 
 
+/** An opaque command segment handle (see @c dlo_new_segment()). */
+typedef void *dlo_segment_t;
+
+
 /** Return codes used within the libdlo sources. Note: libdlo will never return top-bit-set return
  *  codes so these can safely be allocated within your own programs for your own purposes.
  *
@@ -238,15 +242,20 @@ typedef enum
   dlo_err_edid_fail,         /**< EDID communication with monitor failed. */
   dlo_err_iic_op,            /**< An IIC operation with the device failed. */
   dlo_err_not_root,          /**< Executable should be run as root (e.g. using 'su root' or 'sudo'). */
-  dlo_err_open,              /**< Attempt to open a connection to the device failed. */
+  dlo_err_open,              /**< Attempt to open a connection to the device (or to open a file) failed. */
   dlo_err_overlap,           /**< Source and destination viewports cannot overlap (unless the same). */
   dlo_err_reenum,            /**< Reenumeration required before device can be claimed. */
   dlo_err_unclaimed,         /**< Device cannot be written to: unclaimed. */
   dlo_err_unsupported,       /**< Requested feature is not supported. */
   dlo_err_usb,               /**< A USB-related error: call @c dlo_usb_strerror() for further info. */
+  dlo_err_net,               /**< A network connection to a remote device failed or was lost. */
+  dlo_err_timeout,           /**< Timed out waiting for the device. */
+  dlo_err_would_block,       /**< Write queue is full: call @c dlo_handle_events() and try again. */
+  dlo_err_sched,             /**< The system refused a thread scheduling change (e.g. a real-time policy without privilege). */
   /* Warnings... */
   dlo_warn_dl160_mode = 0x10000000u, /**< This screen mode may not display correctly on DL120 devices. */
   dlo_warn_no_edid_detailed_timing,  /**< EDID descriptor not detailed timing */
+  dlo_warn_fence_pending,            /**< The fence has not been signalled yet. */
   /* User return codes... */
   dlo_user_example = 0x80000000      /**< Return codes 0x80000000 to 0xFFFFFFFF are free for user allocation. */
 } dlo_retcode_t;             /**< Return codes. Used to indicate the success or otherwise of a call to the library. */
@@ -323,17 +332,188 @@ typedef struct dlo_final_s
 } dlo_final_t;               /**< A struct @a dlo_final_s. */
 
 
-/** Flags word to configure the device connection (no flags defined at present). */
+/** Flags word to configure the device connection.
+ *
+ *  If the @a shadow flag is set, libdlo keeps a host-resident copy of the whole of the
+ *  device memory (plus a bitmap recording which bytes of it are known to match the device).
+ *  This costs around 18 MB of host memory per device but allows @c dlo_copy_host_bmp() to
+ *  compare each pixel row against what the device already holds and only send the spans
+ *  of the row which have changed.
+ *
+ *  If the @a realtime flag is set, everything the device needs in the steady state (the
+ *  command buffer, the shadow, the write queue blocks and the buffers used to resend lost
+ *  writes) is allocated when it is claimed and pinned in memory with @c mlock(), so that
+ *  drawing calls don't allocate memory or take page faults. Pinning is limited by the
+ *  process's @c RLIMIT_MEMLOCK; buffers which can't be pinned are still used, and
+ *  @c dlo_get_rt_stats() reports how much was pinned.
+ */
 typedef struct dlo_claim_s
 {
-  unsigned undef :1;         /**< Undefined flag (placeholder). */
+  unsigned shadow   :1;      /**< Keep a host-side shadow of the device memory (enables damage detection). */
+  unsigned nonblock :1;      /**< Queue writes to be sent from @c dlo_handle_events() (see @c dlo_get_poll()). */
+  unsigned realtime :1;      /**< Preallocate and pin the device's buffers, for deterministic timing. */
 } dlo_claim_t;               /**< A struct @a dlo_claim_s. */
 
 
+/** A file descriptor which the caller's event loop should watch on behalf of a device. */
+typedef struct dlo_pollfd_s
+{
+  int   fd;                  /**< File descriptor (or -1 if there is nothing to watch). */
+  short events;              /**< Events to wait for, as for poll() (e.g. POLLOUT). */
+} dlo_pollfd_t;              /**< A struct @a dlo_pollfd_s. */
+
+
+/** Flags word to configure a remote device added with @c dlo_add_net_device(). */
+typedef struct dlo_netflags_s
+{
+  unsigned compress :1;      /**< Compress the command stream with LZ4 (if libdlo was built with LZ4). */
+} dlo_netflags_t;            /**< A struct @a dlo_netflags_s. */
+
+
+/** Transfer parameters of a claimed device (see @c dlo_get_xfer() and @c dlo_set_xfer()). */
+typedef struct dlo_xfer_s
+{
+  uint32_t size;             /**< Largest bulk transfer, which is also the size of the command buffer, sent once it is too full for the next command (bytes). */
+  uint32_t depth;            /**< Buffers a non-blocking device may queue before drawing calls would block. */
+  uint32_t kbps;             /**< Measured bulk throughput (kilobytes per second, zero if not measured, read only). */
+  uint32_t overhead;         /**< Measured fixed cost of each bulk transfer (microseconds, read only). */
+} dlo_xfer_t;                /**< A struct @a dlo_xfer_s. */
+
+
+/** Highest priority of an encoding policy: regions with this priority are never dropped. */
+#define DLO_PRIORITY_MAX (3u)
+
+/** Largest number of regions with encoding policies a device can have at once. */
+#define DLO_MAX_POLICIES (16u)
+
+
+/** How bitmaps copied into a region of the screen are encoded (see @c dlo_set_policy()). */
+typedef struct dlo_policy_s
+{
+  uint8_t  threshold;        /**< Largest change in a colour component (0 to 255) not worth sending, or zero to send every change. */
+  bool     coarse;           /**< Flag: don't send the 8 bpp fine detail plane (only the top 5 or 6 bits of each component change). */
+  uint8_t  max_rate;         /**< Most updates of the region per second, or zero for no limit. */
+  uint8_t  priority;         /**< From 0 (dropped first when the write queue backs up) to @c DLO_PRIORITY_MAX (never dropped). */
+} dlo_policy_t;              /**< A struct @a dlo_policy_s. */
+
+
+/** A colour-correction table for a device (see @c dlo_set_colour_lut()).
+ *
+ *  With a @a size of zero, each colour component is looked up in its own 256 entry curve
+ *  (a NULL curve leaves that component unchanged). Otherwise @a cube holds a 3D table of
+ *  @a size * @a size * @a size colours, sampling the colour space at evenly spaced points
+ *  from 0 to 255 along each axis, with the red index varying fastest and the blue index
+ *  slowest. Colours between the sample points are interpolated.
+ */
+typedef struct dlo_clut_s
+{
+  uint32_t           size;   /**< Number of points along each edge of the 3D table (2 to 65), or zero for curves. */
+  const uint8_t     *red;    /**< Curve for the red component (or NULL). */
+  const uint8_t     *grn;    /**< Curve for the green component (or NULL). */
+  const uint8_t     *blu;    /**< Curve for the blue component (or NULL). */
+  const dlo_col32_t *cube;   /**< The 3D table, if @a size is non-zero. */
+} dlo_clut_t;                /**< A struct @a dlo_clut_s. */
+
+
+/** Counts of what has happened to the frames submitted with @c dlo_submit_frame(). */
+typedef struct dlo_framestats_s
+{
+  uint32_t submitted;        /**< Number of frames submitted. */
+  uint32_t shown;            /**< Number of frames sent to the device. */
+  uint32_t late;             /**< Number of those which finished sending after their presentation time. */
+  uint32_t dropped;          /**< Number of frames thrown away without being sent. */
+  uint32_t queued;           /**< Number of frames waiting to be sent. */
+} dlo_framestats_t;          /**< A struct @a dlo_framestats_s. */
+
+
+/** Timing of the display's scan-out, used to chase the beam (see @c dlo_set_raster()). */
+typedef struct dlo_raster_s
+{
+  uint64_t phase;            /**< A time at which the display began scanning out the top row (microseconds, see @c dlo_time_us()). */
+  uint32_t period;           /**< Time to scan out a whole frame (microseconds), or zero to work it out from the mode. */
+  uint32_t lines;            /**< Lines in a whole frame, including vertical blanking, or zero to work it out from the mode. */
+} dlo_raster_t;              /**< A struct @a dlo_raster_s. */
+
+
+/** Value of the @a magic word at the start of the telemetry segment (see @c dlo_export_stats()). */
+#define DLO_STATS_MAGIC (0x534F4C44u)
+
+/** Version of the telemetry segment layout described by @c dlo_stats_shm_t. */
+#define DLO_STATS_VERSION (1u)
+
+/** Number of device slots in the telemetry segment. */
+#define DLO_STATS_DEVICES (32u)
+
+/** Number of buckets in each transfer latency histogram. */
+#define DLO_STATS_BUCKETS (16u)
+
+
+/** Counters for one device in the telemetry segment (see @c dlo_export_stats()). */
+typedef struct dlo_stats_dev_s
+{
+  uint32_t seq;              /**< Even when the slot is consistent, odd while libdlo is updating it. */
+  uint32_t in_use;           /**< Non-zero if the slot belongs to a claimed device. */
+  char     serial[32];       /**< Serial number of the device (nul-terminated, possibly truncated). */
+  uint64_t updated;          /**< Time of the latest update (microseconds, see @c dlo_time_us()). */
+  uint64_t bytes;            /**< Bytes of commands sent to the device. */
+  uint64_t commands;         /**< Number of commands sent to the device. */
+  uint64_t flushes;          /**< Number of transfers made to the device. */
+  uint64_t errors;           /**< Number of those transfers which failed (or timed out). */
+  uint64_t latency[DLO_STATS_BUCKETS];  /**< Transfers by time taken: bucket 0 under 64 us, bucket n from 32 << n to 64 << n us, the last anything slower. */
+  uint32_t qlen;             /**< Blocks in the non-blocking write queue at the latest transfer. */
+  uint32_t qlen_max;         /**< Most blocks seen in the write queue. */
+  uint32_t frames_shown;     /**< Frames from @c dlo_submit_frame() sent to the device. */
+  uint32_t frames_late;      /**< Number of those which finished sending after their presentation time. */
+  uint32_t frames_dropped;   /**< Frames thrown away without being sent. */
+  uint16_t width;            /**< Width of the current screen mode (pixels). */
+  uint16_t height;           /**< Height of the current screen mode (pixels). */
+  uint8_t  bpp;              /**< Colour depth of the current screen mode (bits per pixel). */
+  uint8_t  refresh;          /**< Refresh rate of the current screen mode (Hz). */
+  uint8_t  pad[6];           /**< Reserved (zero). */
+} dlo_stats_dev_t;           /**< A struct @a dlo_stats_dev_s. */
+
+
+/** Layout of the telemetry segment (see @c dlo_export_stats()). */
+typedef struct dlo_stats_shm_s
+{
+  uint32_t        magic;     /**< @c DLO_STATS_MAGIC. */
+  uint32_t        version;   /**< @c DLO_STATS_VERSION. */
+  uint32_t        slot_size; /**< Size of each entry in @a dev (bytes). */
+  uint32_t        num_slots; /**< Number of entries in @a dev. */
+  dlo_stats_dev_t dev[DLO_STATS_DEVICES];  /**< One slot per claimed device. */
+} dlo_stats_shm_t;           /**< A struct @a dlo_stats_shm_s. */
+
+
+/** Scheduling for the threads which do libdlo's work (see @c dlo_set_thread_sched()). */
+typedef struct dlo_rtsched_s
+{
+  int      policy;           /**< Scheduling policy, as for @c pthread_setschedparam() (e.g. @c SCHED_FIFO), or -1 to leave it alone. */
+  int      priority;         /**< Priority within the @a policy. */
+  uint64_t cpus;             /**< Bitmask of the CPUs (0 to 63) the threads may run on, or zero to leave it alone. */
+} dlo_rtsched_t;             /**< A struct @a dlo_rtsched_s. */
+
+
+/** Timing and memory counts for a device, chiefly of interest if it was claimed with the @a realtime flag. */
+typedef struct dlo_rtstats_s
+{
+  uint64_t pinned;           /**< Bytes of the device's buffers pinned in memory. */
+  uint64_t unpinned;         /**< Bytes of the device's buffers which couldn't be pinned. */
+  uint32_t allocs;           /**< Buffers which had to be allocated (or grown) after the device was claimed. */
+  uint64_t xfer_jitter[DLO_STATS_BUCKETS];   /**< Transfers by how far their time differed from the link's measured speed (buckets as for @a latency in @c dlo_stats_dev_t). */
+  uint64_t frame_jitter[DLO_STATS_BUCKETS];  /**< Frames from @c dlo_submit_frame() by how far from their presentation time they finished sending (likewise). */
+} dlo_rtstats_t;             /**< A struct @a dlo_rtstats_s. */
+
+
+/** Default TCP port used by @c dlo_serve_device() and @c dlo_add_net_device(). */
+#define DLO_NET_PORT (7373u)
+
+
 /** Flags word to configure the @c dlo_copy_host_bmp() call. */
 typedef struct dlo_bmpflags_s
 {
   unsigned v_flip :1;        /**< Vertically flip the bitmap during the copy. */
+  unsigned blend  :1;        /**< Blend the bitmap over the screen using its alpha channel (needs a shadow). */
+  unsigned chase  :1;        /**< Send the rows in the order which chases the display's beam (see @c dlo_set_raster()). */
 } dlo_bmpflags_t;            /**< A struct @a dlo_bmpflags_s. */
 
 
@@ -396,6 +576,19 @@ typedef struct dlo_bmpflags_s
  *
  *  static dlo_col32_t mylut[256]; // this is the palette for my 8bpp bitmap
  *  static dlo_pixfmt_t mypixfmt = (dlo_pixfmt_t)mylut;
+ *
+ *  The @c dlo_pixfmt_native format is the way the device itself stores 24 bpp pixels, in
+ *  two planes with the same stride. The plane at @a base has two bytes per pixel, holding
+ *  the top bits of each component as 2_rrrrrggggggbbbbb, most significant byte first
+ *  (whatever the host's byte order). The plane at @a base8 has one byte per pixel, holding
+ *  the bits which were left out as 2_rrrggbbb. A renderer which draws in this format can be
+ *  copied to the device without any conversion, but bitmaps in this format can't be
+ *  blended and aren't colour-corrected (see @c dlo_set_colour_lut()).
+ *
+ *  The @c dlo_pixfmt_lut8 format is 8 bpp paletted data, like a LUT pointer, but with the
+ *  palette given by the @a lut member of the @a dlo_fbuf_t instead. This works wherever the
+ *  palette is in memory (a pointer cast to a @a dlo_pixfmt_t loses its top bits on hosts
+ *  with 64 bit pointers).
  */
 typedef enum
 {
@@ -408,7 +601,9 @@ typedef enum
   dlo_pixfmt_bgr888   = 3 | DLO_PIXFMT_3BYPP,                   /**< 24 bit per pixel 0xbbggrr. */
   dlo_pixfmt_rgb888   = 3 | DLO_PIXFMT_3BYPP | DLO_PIXFMT_SWP,  /**< 24 bit per pixel 0xrrggbb. */
   dlo_pixfmt_abgr8888 = 4 | DLO_PIXFMT_4BYPP,                   /**< 32 bit per pixel 0xaabbggrr. */
-  dlo_pixfmt_argb8888 = 4 | DLO_PIXFMT_4BYPP | DLO_PIXFMT_SWP   /**< 32 bit per pixel 0xaarrggbb. */
+  dlo_pixfmt_argb8888 = 4 | DLO_PIXFMT_4BYPP | DLO_PIXFMT_SWP,  /**< 32 bit per pixel 0xaarrggbb. */
+  dlo_pixfmt_native   = 5 | DLO_PIXFMT_2BYPP,                   /**< Device-native planes: see below. */
+  dlo_pixfmt_lut8     = 6 | DLO_PIXFMT_1BYPP                    /**< 8 bit per pixel indices into the palette at @a lut: see below. */
   /* Any value greater than 1023 is assumed to be a pointer to: dlo_col32_t palette[256]
    * for translating paletted 8 bits per pixel data into colour numbers.
    */
@@ -423,6 +618,8 @@ typedef struct dlo_fbuf_s
   dlo_pixfmt_t fmt;          /**< Pixel format (e.g. bits per pixel, colour component order, etc). */
   void        *base;         /**< Base address in host memory. */
   uint32_t     stride;       /**< Stride (pixels) from a pixel to the one directly below. */
+  void        *base8;        /**< Base address of the 8 bpp plane in host memory (@c dlo_pixfmt_native only). */
+  const dlo_col32_t *lut;    /**< Palette of 256 colours (@c dlo_pixfmt_lut8 only). */
 } dlo_fbuf_t;                /**< A struct @a dlo_fbuf_s. */
 
 
@@ -504,6 +701,46 @@ typedef struct dlo_rect_s
 } dlo_rect_t;                /**< A struct @a dlo_rect_s. */
 
 
+/** A viewport which has been checked once, for drawing into many times (see @c dlo_prepare_surface()). */
+typedef struct dlo_surface_s
+{
+  dlo_dev_t  uid;            /**< Unique ID of the device the viewport belongs to. */
+  dlo_view_t view;           /**< The viewport. */
+  dlo_ptr_t  base8;          /**< Base address of the viewport's 8 bpp fine detail colour information. */
+  dlo_ptr_t  end;            /**< Address after the end of the viewport in the device memory. */
+} dlo_surface_t;             /**< A struct @a dlo_surface_s. */
+
+
+/** A fence: marks a point in the stream of commands sent to a device.
+ *
+ *  A fence is signalled once the transport has finished with all of the commands which
+ *  were issued before it. Fence values increase over the lifetime of a claim, so a later
+ *  fence is never signalled before an earlier one.
+ */
+typedef uint64_t dlo_fence_t;
+
+
+/** Function to call when a fence is signalled.
+ *
+ *  @param  uid    Unique ID of the device.
+ *  @param  fence  The fence which was signalled.
+ *  @param  pw     Private word supplied when the callback was registered.
+ */
+typedef void (*dlo_fence_fn_t)(const dlo_dev_t uid, const dlo_fence_t fence, void * const pw);
+
+
+/** Function to supply the pixels for an area of the screen which has to be sent again.
+ *
+ *  @param  uid   Unique ID of the device.
+ *  @param  rec   Rectangle within the current screen mode which needs redrawing.
+ *  @param  fbuf  Pointer to the bitmap structure to fill in (it must describe exactly @a rec).
+ *  @param  pw    Private word supplied when the function was registered.
+ *
+ *  @return  Return code, zero if @a fbuf has been filled in.
+ */
+typedef dlo_retcode_t (*dlo_source_fn_t)(const dlo_dev_t uid, const dlo_rect_t * const rec, dlo_fbuf_t * const fbuf, void * const pw);
+
+
 /** Return the meaning of the specified return code as a human-readable string.
  *
  *  @param  err  Return code.
@@ -547,6 +784,110 @@ extern dlo_retcode_t dlo_init(const dlo_init_t flags);
 extern dlo_retcode_t dlo_final(const dlo_final_t flags);
 
 
+/** Start a pool of threads to share out the work of converting bitmaps for every device.
+ *
+ *  @param  workers  Number of worker threads (up to 64), or zero to stop the pool.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  By default, @c dlo_copy_host_bmp() converts pixels into the device's format on the
+ *  calling thread. With a pool, a bitmap is split into bands of rows which any worker
+ *  (and the calling thread, while it waits) can convert, so one large update no longer
+ *  holds up the others while cores sit idle. Each band is still sent in order, so every
+ *  device gets exactly the same commands as before. The pool is shared by all devices,
+ *  including calls for different devices made from different threads at once (calls for
+ *  the same device must not overlap, other than through command segments). Workers which
+ *  run out of bands take some from the busier ones.
+ *
+ *  Don't call this while other calls into libdlo are in progress. @c dlo_final() stops
+ *  the pool.
+ */
+extern dlo_retcode_t dlo_set_workers(const uint32_t workers);
+
+
+/** Set the scheduling policy, priority and CPU affinity of the threads which do libdlo's work.
+ *
+ *  @param  workers  Scheduling for the encoder pool's workers (or NULL to leave them alone).
+ *  @param  caller   Scheduling for the calling thread (or NULL to leave it alone).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  libdlo has no transmit thread of its own: commands are sent by whichever thread makes
+ *  the drawing calls (or calls @c dlo_handle_events() for a device claimed with the
+ *  @a nonblock flag), so that thread should pass its own scheduling as @a caller. The
+ *  @a workers scheduling applies to the pool started by @c dlo_set_workers(), including
+ *  any workers started later. Real-time policies usually need privilege (or
+ *  @c RLIMIT_RTPRIO), and @c dlo_err_sched is returned if the system refuses them.
+ */
+extern dlo_retcode_t dlo_set_thread_sched(const dlo_rtsched_t * const workers, const dlo_rtsched_t * const caller);
+
+
+/** Publish counters for every claimed device in a shared-memory segment.
+ *
+ *  @param  name  Name of the POSIX shared-memory segment (e.g. "/libdlo.1234"), or NULL to stop publishing.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The segment holds a @c dlo_stats_shm_t which libdlo keeps up to date as it sends
+ *  commands, so a monitoring process can watch throughput, transfer latencies, queue
+ *  depths, dropped frames and screen modes without calling into libdlo or slowing it
+ *  down. Any previous segment is removed first, and stopping removes the segment too.
+ *
+ *  Readers should open the segment read-only and check @a magic, @a version and
+ *  @a slot_size before use. Each slot is a sequence lock: read @a seq, skip the slot
+ *  (or try again) if it is odd, copy the slot, issue a read barrier and read @a seq
+ *  again; the copy is consistent only if both reads of @a seq gave the same even value.
+ *  A slot whose @a in_use is zero is free, and may be given to another device later.
+ *
+ *  Devices claimed while the segment exists get a slot each, for as long as they
+ *  stay claimed (devices beyond @c DLO_STATS_DEVICES aren't published).
+ */
+extern dlo_retcode_t dlo_export_stats(const char * const name);
+
+
+/** Start recording the drawing calls made on every device to a trace file, or stop recording.
+ *
+ *  @param  path  Path of the trace file to write, or NULL to stop recording.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Calls to @c dlo_set_mode(), @c dlo_fill_rect(), @c dlo_copy_rect() and
+ *  @c dlo_copy_host_bmp() are recorded with the time they were made, once they have
+ *  succeeded (calls which return an error, such as @c dlo_err_would_block, aren't
+ *  recorded, but calls which return a warning are). Calls
+ *  which are made on a prepared surface are recorded as the equivalent call on its
+ *  viewport, frames from @c dlo_submit_frame() are recorded as they are sent, and
+ *  @c dlo_move_rect() is recorded as the copies it makes. Command segments are
+ *  recorded too: their creation and freeing, @c dlo_segment_fill(),
+ *  @c dlo_segment_copy_host_bmp() and @c dlo_flush_segments(). Recording may be started
+ *  and stopped from any thread. Bitmaps are copied into the trace in full, so traces of
+ *  large updates grow quickly.
+ *
+ *  Any previous trace file is closed first.
+ */
+extern dlo_retcode_t dlo_record_trace(const char * const path);
+
+
+/** Play back the drawing calls recorded for one device in a trace file.
+ *
+ *  @param  uid     Unique ID of the device to draw on.
+ *  @param  path    Path of the trace file (see @c dlo_record_trace()).
+ *  @param  serial  Serial number of the recorded device to play back, or NULL for the first device in the trace.
+ *  @param  paced   Flag: wait between calls to keep to the recorded timing, rather than going as fast as possible.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The device is first put into the mode which the recorded device was in when the
+ *  trace started, then the recorded calls are made again on it. Calls which would
+ *  block are retried once the device has caught up, and warnings (such as
+ *  @c dlo_warn_dl160_mode) are ignored. Playback stops at the first call which fails
+ *  with an error, returning it. It returns @c dlo_err_bad_fmt if the file isn't
+ *  a trace (or is cut short), and @c dlo_err_bad_device if no recorded device has the
+ *  given serial number.
+ */
+extern dlo_retcode_t dlo_replay_trace(const dlo_dev_t uid, const char * const path, const char * const serial, const bool paced);
+
+
 /** Map the caller's pointer to a udev structure from libusb to a unique ID in libdlo.
  *
  *  @param  udev  Pointer to USB device structure for given device (from libusb).
@@ -656,6 +997,47 @@ extern dlo_dev_t dlo_claim_default_device(int *argc_p, char *argv[],
                                           const dlo_claim_t flags, const uint32_t timeout);
 
 
+/** Add a device attached to another machine to the device list.
+ *
+ *  @param  host   Host name or address of the machine serving the device.
+ *  @param  port   TCP port on which it is served (zero for @a DLO_NET_PORT).
+ *  @param  flags  Flags word describing the connection.
+ *
+ *  @return  Unique ID of the remote device (or NULL if failed).
+ *
+ *  The remote machine must be running @c dlo_serve_device() (for example, using the
+ *  dlo_netrecv tool). This call connects to it, asks for the type and serial number
+ *  of the device it serves and adds a node for that device to the device list. The
+ *  serial number of the node is the remote serial number followed by "@host:port".
+ *
+ *  The returned device is unclaimed; claim it and draw into it as for a local device.
+ *  All of the encoding is done on this machine and the encoded command stream is sent
+ *  over TCP (LZ4 compressed if the @a compress flag is set) for the remote machine to
+ *  write straight to the device. Channel selection and EDID reads are forwarded too.
+ *
+ *  Command stream writes are not acknowledged individually; if one fails on the remote
+ *  machine, the error is returned by the next synchronous operation (a channel selection,
+ *  e.g. during a mode change, or releasing the device).
+ *
+ *  The device stays on the device list until @c dlo_final() is called.
+ */
+extern dlo_dev_t dlo_add_net_device(const char * const host, const uint16_t port, const dlo_netflags_t flags);
+
+
+/** Serve a claimed device to other machines over the network.
+ *
+ *  @param  uid   Unique ID of the (claimed) device to serve.
+ *  @param  port  TCP port on which to listen (zero for @a DLO_NET_PORT).
+ *
+ *  @return  Return code, only returns if there was an error.
+ *
+ *  Listens for connections from @c dlo_add_net_device() on another machine and writes
+ *  the command stream that it sends straight to the device. One connection is served at
+ *  a time; when a connection closes, the next one is accepted.
+ */
+extern dlo_retcode_t dlo_serve_device(const dlo_dev_t uid, const uint16_t port);
+
+
 /** Release the specified device.
  *
  *  @param  uid  Unique ID of the device to release.
@@ -777,6 +1159,43 @@ extern dlo_retcode_t dlo_copy_rect(const dlo_dev_t uid,
                                    const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
 
 
+/** Largest number of rectangles @c dlo_move_rect() may return as needing new pixels. */
+#define DLO_MOVE_MAX_EXPOSED (8u)
+
+
+/** Tell libdlo that the contents of a rectangle have moved by a known offset.
+ *
+ *  @param  uid      Unique ID of the device to access.
+ *  @param  view     Struct pointer: viewport the rectangle lies in.
+ *  @param  rec      Struct pointer: co-ordinates of the rectangle before the move (relative to the viewport).
+ *  @param  dx       Distance moved to the right (pixels, may be negative).
+ *  @param  dy       Distance moved down (pixels, may be negative).
+ *  @param  within   Flag: the contents scrolled within @a rec, rather than @a rec itself moving.
+ *  @param  exposed  Array of @c DLO_MOVE_MAX_EXPOSED rectangles to fill in (or NULL).
+ *  @param  num      Pointer to the number of entries of @a exposed filled in (or NULL).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  For a caller which already knows that a window has been dragged or a list scrolled, this
+ *  moves the pixels which are still on the device to their new place with rectangle copies,
+ *  so they don't have to be uploaded or found again. The shadow (if any) is updated to match.
+ *
+ *  If @a within is set, the contents moved inside @a rec and whatever moved outside it is
+ *  lost, as for a scrolled list. Otherwise, @a rec and everything in it moved to a new place in
+ *  the viewport, as for a dragged window. Either way, @a exposed is filled in with the
+ *  rectangles (relative to the viewport) which the moved pixels didn't cover and which the
+ *  caller should now draw: the strips scrolled into view, or the parts of the viewport
+ *  uncovered by a dragged window together with any part of the window which was previously
+ *  outside the viewport. The rectangles may overlap.
+ *
+ *  If @a view is NULL, then the current visible screen is used as the viewport.
+ *  If @a rec is NULL, then the whole of the viewport is used as the rectangle.
+ */
+extern dlo_retcode_t dlo_move_rect(const dlo_dev_t uid, const dlo_view_t * const view, const dlo_rect_t * const rec,
+                                   const int32_t dx, const int32_t dy, const bool within,
+                                   dlo_rect_t * const exposed, uint32_t * const num);
+
+
 /** Copy (and translate pixel formats) a rectangular area from host memory into the device.
  *
  *  @param  uid        Unique ID of the device to access.
@@ -794,11 +1213,579 @@ extern dlo_retcode_t dlo_copy_rect(const dlo_dev_t uid,
  *
  *  If @a dest_view is NULL, then the current visible screen is used as the destination viewport.
  *  If @a dest_pos is NULL, then the origin (top-left) of the destination viewport is used.
+ *
+ *  If the device was claimed with the @a shadow flag set, only those parts of each pixel row
+ *  which differ from the current contents of the device will be sent. This makes it cheap to
+ *  call this function repeatedly for a whole framebuffer of which only a small part changes.
+ *
+ *  If the @a blend flag is set, the bitmap must be in @a dlo_pixfmt_argb8888 or
+ *  @a dlo_pixfmt_abgr8888 format and is composited over the existing screen contents, which
+ *  are read back from the shadow: each pixel is mixed with what lies beneath it in proportion
+ *  to its alpha value (not premultiplied), from 0 (transparent) to 255 (opaque). Only the
+ *  pixels which change as a result are sent, so an overlay needs no copy of its background
+ *  on the host. This needs the device to have been claimed with the @a shadow flag, and
+ *  returns @a dlo_err_unsupported otherwise or if any part of the destination is not known
+ *  to match the shadow (for example after a failed write which has not been repaired yet).
+ *  If the device has a colour-correction table, the bitmap's colours are corrected before
+ *  they are mixed with the (already corrected) screen contents.
  */
 extern dlo_retcode_t dlo_copy_host_bmp(const dlo_dev_t uid, const dlo_bmpflags_t flags,
                                        const dlo_fbuf_t * const fbuf,
                                        const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
 
+
+/** Copy a Windows BMP file to the device, reading its pixels straight from a mapping of the file.
+ *
+ *  @param  uid        Unique ID of the device.
+ *  @param  flags      Flags word indicating special behaviour (as for @c dlo_copy_host_bmp()).
+ *  @param  path       Path of the BMP file.
+ *  @param  dest_view  Struct pointer: destination viewport.
+ *  @param  dest_pos   Struct pointer: origin of copy destination (relative to destination viewport).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The file is memory-mapped and its headers are read in place, then the pixels are passed
+ *  to @c dlo_copy_host_bmp() where they lie, so no copy of the file is made on the host and
+ *  a file shown again (by this or any other process) is read from the page cache. The image
+ *  appears the right way up: set @a v_flip to turn it upside down.
+ *
+ *  Uncompressed 8 bpp paletted, 16 bpp (555, or 565 described by bit fields), 24 bpp and 32
+ *  bpp files are supported; anything else returns @a dlo_err_bad_fmt. @a dlo_err_open is
+ *  returned if the file can't be opened.
+ */
+extern dlo_retcode_t dlo_copy_bmp_file(const dlo_dev_t uid, const dlo_bmpflags_t flags, const char * const path,
+                                       const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos);
+
+
+/** Copy (and translate pixel formats) a rectangular area of the screen into host memory.
+ *
+ *  @param  uid       Unique ID of the device to access.
+ *  @param  fbuf      Struct pointer: information about destination bitmap in host memory.
+ *  @param  src_view  Struct pointer: source viewport.
+ *  @param  src_pos   Struct pointer: origin of copy source (relative to source viewport).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The device can't be read over USB, so the pixels come from the shadow: the device must
+ *  have been claimed with the @a shadow flag set. This is the reverse of @c dlo_copy_host_bmp(),
+ *  filling the bitmap described by @a fbuf with the rectangle of the same size at the given
+ *  co-ordinates in the viewport, converted into the bitmap's pixel format. Parts of the bitmap
+ *  which fall outside of the viewport are left alone. The colours are those on the screen, so
+ *  they include any colour correction. Formats with an alpha channel are filled in as opaque,
+ *  and palette formats aren't supported.
+ *
+ *  Returns @a dlo_err_unsupported, without changing the bitmap, if the device has no shadow or
+ *  if any part of the rectangle is not known to match the shadow (for example if it hasn't
+ *  been drawn since the device was claimed).
+ *
+ *  If @a src_view is NULL, then the current visible screen is used as the source viewport.
+ *  If @a src_pos is NULL, then the origin (top-left) of the source viewport is used.
+ */
+extern dlo_retcode_t dlo_read_host_bmp(const dlo_dev_t uid, const dlo_fbuf_t * const fbuf,
+                                       const dlo_view_t * const src_view, const dlo_dot_t * const src_pos);
+
+
+/** Check a viewport once, so that it can be drawn into many times without checking it again.
+ *
+ *  @param  uid   Unique ID of the device to access.
+ *  @param  view  Struct pointer: the viewport (or NULL for the current visible screen).
+ *  @param  surf  Struct pointer: the surface to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The surface records the viewport together with the addresses which every drawing call
+ *  would otherwise work out from it, for use with @c dlo_surface_fill(),
+ *  @c dlo_surface_copy() and @c dlo_surface_copy_host_bmp(). These calls don't clip or
+ *  check their rectangles, so they are much cheaper than the usual calls when there are many
+ *  small updates. The surface is a snapshot: if @a view is NULL, prepare it again after a
+ *  change of screen mode.
+ *
+ *  Returns @a dlo_err_bad_area if the viewport's base address is odd or if the viewport
+ *  doesn't lie entirely within the device's memory.
+ */
+extern dlo_retcode_t dlo_prepare_surface(const dlo_dev_t uid, const dlo_view_t * const view, dlo_surface_t * const surf);
+
+
+/** Fill a rectangle of a prepared surface with a colour.
+ *
+ *  @param  surf  Struct pointer: the surface (see @c dlo_prepare_surface()).
+ *  @param  rec   Struct pointer: the rectangle, which must lie entirely within the surface.
+ *  @param  col   Colour to fill the rectangle with.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  This is @c dlo_fill_rect() without the clipping, so the rectangle mustn't be empty or
+ *  extend outside the surface.
+ */
+extern dlo_retcode_t dlo_surface_fill(const dlo_surface_t * const surf, const dlo_rect_t * const rec, const dlo_col32_t col);
+
+
+/** Copy a rectangle from one prepared surface to another (or within the same one).
+ *
+ *  @param  src       Struct pointer: the source surface (see @c dlo_prepare_surface()).
+ *  @param  src_rec   Struct pointer: the rectangle, which must lie entirely within @a src.
+ *  @param  dest      Struct pointer: the destination surface, on the same device.
+ *  @param  dest_pos  Struct pointer: where to put the rectangle, which must fit entirely within @a dest.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  This is @c dlo_copy_rect() without the clipping. Surfaces whose memory overlaps must be
+ *  the same surface, otherwise @a dlo_err_overlap is returned.
+ */
+extern dlo_retcode_t dlo_surface_copy(const dlo_surface_t * const src, const dlo_rect_t * const src_rec,
+                                      const dlo_surface_t * const dest, const dlo_dot_t * const dest_pos);
+
+
+/** Copy (and translate pixel formats) a bitmap from host memory into a prepared surface.
+ *
+ *  @param  surf   Struct pointer: the surface (see @c dlo_prepare_surface()).
+ *  @param  flags  Flags word indicating special behaviour (unused flags should be zero).
+ *  @param  fbuf   Struct pointer: information about source bitmap in host memory.
+ *  @param  pos    Struct pointer: where to put the bitmap, which must fit entirely within the surface.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  This is @c dlo_copy_host_bmp() without the clipping, so the bitmap mustn't be empty or
+ *  extend outside the surface.
+ */
+extern dlo_retcode_t dlo_surface_copy_host_bmp(const dlo_surface_t * const surf, const dlo_bmpflags_t flags,
+                                               const dlo_fbuf_t * const fbuf, const dlo_dot_t * const pos);
+
+
+/** Create a command segment, so that a thread can build up drawing commands for a device alongside other threads.
+ *
+ *  @param  uid    Unique ID of the device.
+ *  @param  order  Where the segment's commands go when the device's segments are flushed (lowest first).
+ *  @param  seg    Pointer to the segment handle (filled in).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Each thread which draws for the device should have a segment of its own. Drawing into
+ *  a segment (with @c dlo_segment_fill() or @c dlo_segment_copy_host_bmp()) doesn't take
+ *  any locks or change anything but the segment, so any number of threads can do it at
+ *  once. Nothing reaches the device until @c dlo_flush_segments() is called, which sends
+ *  the segments' commands in order of @a order (segments with the same @a order go in
+ *  the order they were created), so the result is the same however the threads ran.
+ *
+ *  A segment lasts until @c dlo_free_segment() is called, or the device is removed.
+ *  Segments may be created and freed from any thread; doing so while the device's segments
+ *  are being flushed waits until the flush has finished.
+ */
+extern dlo_retcode_t dlo_new_segment(const dlo_dev_t uid, const uint32_t order, dlo_segment_t * const seg);
+
+
+/** Add a filled rectangle to a command segment.
+ *
+ *  @param  seg   Handle of the segment (see @c dlo_new_segment()).
+ *  @param  surf  Struct pointer: the surface to fill in (see @c dlo_prepare_surface()), on the segment's device.
+ *  @param  rec   Struct pointer: the rectangle, which must lie entirely within the surface.
+ *  @param  col   Colour of the filled rectangle.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Only the thread which owns the segment may call this. The device's colour-correction
+ *  table is applied, but encoding policies aren't (see @c dlo_set_policy()).
+ */
+extern dlo_retcode_t dlo_segment_fill(const dlo_segment_t seg, const dlo_surface_t * const surf, const dlo_rect_t * const rec, const dlo_col32_t col);
+
+
+/** Add a copy of a bitmap from host memory to a command segment.
+ *
+ *  @param  seg    Handle of the segment (see @c dlo_new_segment()).
+ *  @param  surf   Struct pointer: the surface to copy into (see @c dlo_prepare_surface()), on the segment's device.
+ *  @param  flags  Flags word indicating special behaviour (only @a v_flip is used).
+ *  @param  fbuf   Struct pointer: information about source bitmap in host memory.
+ *  @param  pos    Struct pointer: where to put the bitmap, which must fit entirely within the surface.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Only the thread which owns the segment may call this. The pixels are converted straight
+ *  away, so the bitmap can be reused as soon as this returns. Every pixel is sent when the
+ *  segment is flushed, because the shadow can't safely be compared with while other threads
+ *  are drawing. Blending isn't possible (@a dlo_err_unsupported is returned).
+ */
+extern dlo_retcode_t dlo_segment_copy_host_bmp(const dlo_segment_t seg, const dlo_surface_t * const surf, const dlo_bmpflags_t flags,
+                                               const dlo_fbuf_t * const fbuf, const dlo_dot_t * const pos);
+
+
+/** Send the commands in all of a device's command segments, leaving the segments empty.
+ *
+ *  @param  uid  Unique ID of the device.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  No thread may be drawing into any of the device's segments while this is called (e.g.
+ *  call it once the threads have finished building a frame), and the device's other
+ *  settings mustn't be changed while they are drawing.
+ */
+extern dlo_retcode_t dlo_flush_segments(const dlo_dev_t uid);
+
+
+/** Free a command segment, throwing away any commands it holds.
+ *
+ *  @param  seg  Handle of the segment (see @c dlo_new_segment()).
+ *
+ *  This may be called from any thread, but the segment mustn't be drawn into (or freed)
+ *  by another thread at the same time. If the device's segments are being flushed, this
+ *  waits until the flush has finished.
+ */
+extern void dlo_free_segment(const dlo_segment_t seg);
+
+
+/** Find a named scene in the device memory, or make room for a new one.
+ *
+ *  @param  uid   Unique ID of the device.
+ *  @param  name  Name of the scene.
+ *  @param  view  Struct pointer: the viewport holding the scene (filled in).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  A scene is a whole screen, the size of the current mode, kept in device memory which
+ *  isn't being displayed. Draw the scene into @a view with the normal drawing calls, then
+ *  switch to it with @c dlo_show_scene(), which only rewrites the scan-out base address
+ *  rather than sending the pixels again. A new scene's contents are undefined until it's
+ *  drawn. If the scene already exists, its viewport is returned and its contents are kept.
+ *
+ *  New scenes go in the lowest part of the device memory not used by the screen or by
+ *  another scene; @a dlo_err_memory is returned if there is no room. Scenes made in a
+ *  different screen mode are forgotten.
+ */
+extern dlo_retcode_t dlo_new_scene(const dlo_dev_t uid, const char * const name, dlo_view_t * const view);
+
+
+/** Show a named scene on the screen.
+ *
+ *  @param  uid   Unique ID of the device.
+ *  @param  name  Name of the scene (see @c dlo_new_scene()).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Any buffered commands are sent first. Afterwards the scene is the current screen, so
+ *  drawing with a NULL viewport changes the scene (and, on a device claimed with a shadow,
+ *  only the pixels which differ from what it already holds are sent). Returns
+ *  @a dlo_err_bad_view for an unknown name, and @a dlo_err_bad_mode if the scene was made
+ *  for a different screen mode.
+ */
+extern dlo_retcode_t dlo_show_scene(const dlo_dev_t uid, const char * const name);
+
+
+/** Forget a named scene, so that its device memory can be used for another.
+ *
+ *  @param  uid   Unique ID of the device.
+ *  @param  name  Name of the scene (see @c dlo_new_scene()).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The screen isn't changed, even if the scene is being shown.
+ */
+extern dlo_retcode_t dlo_free_scene(const dlo_dev_t uid, const char * const name);
+
+
+
+/** Insert a fence after all of the commands issued to a device so far.
+ *
+ *  @param  uid    Unique ID of the device to access.
+ *  @param  fence  Pointer to the fence to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The fence is signalled once the transport has finished with every command issued
+ *  before this call. Once that has happened, host buffers used by those commands may
+ *  be reused. Commands which failed to be written (the call which tried to write them
+ *  will have returned the error) also count as finished.
+ *
+ *  For a device added with @c dlo_add_net_device(), the transport has finished with a
+ *  command once it has been handed to the network.
+ */
+extern dlo_retcode_t dlo_insert_fence(const dlo_dev_t uid, dlo_fence_t * const fence);
+
+
+/** Check whether a fence has been signalled, without waiting.
+ *
+ *  @param  uid    Unique ID of the device to access.
+ *  @param  fence  Fence to check.
+ *
+ *  @return  Zero if the fence has been signalled, @a dlo_warn_fence_pending if not (or an error).
+ */
+extern dlo_retcode_t dlo_poll_fence(const dlo_dev_t uid, const dlo_fence_t fence);
+
+
+/** Wait for a fence to be signalled.
+ *
+ *  @param  uid      Unique ID of the device to access.
+ *  @param  fence    Fence to wait for.
+ *  @param  timeout  Maximum time to wait (milliseconds, zero to wait for as long as it takes).
+ *
+ *  @return  Zero if the fence has been signalled, @a dlo_err_timeout if not (or another error).
+ *
+ *  Any commands issued before the fence which are still buffered are sent first. For a
+ *  device claimed with the @a nonblock flag, this sends the write queue as far as the fence.
+ */
+extern dlo_retcode_t dlo_wait_fence(const dlo_dev_t uid, const dlo_fence_t fence, const uint32_t timeout);
+
+
+/** Ask for a function to be called when a fence is signalled.
+ *
+ *  @param  uid    Unique ID of the device to access.
+ *  @param  fence  Fence to wait for.
+ *  @param  fn     Function to call.
+ *  @param  pw     Private word to pass to the function.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  If the fence has already been signalled, @a fn is called before this returns. Otherwise,
+ *  it is called from within whichever libdlo call finishes writing the commands before the
+ *  fence (callbacks for earlier fences are always called first). The callback must not call
+ *  back into libdlo for the same device. If the device is released before the fence is
+ *  signalled, any outstanding callbacks are called during the release.
+ */
+extern dlo_retcode_t dlo_notify_fence(const dlo_dev_t uid, const dlo_fence_t fence, const dlo_fence_fn_t fn, void * const pw);
+
+
+
+/** Find out what a non-blocking device is waiting for.
+ *
+ *  @param  uid      Unique ID of the device to access.
+ *  @param  pfd      Pointer to the file descriptor information to fill in.
+ *  @param  timeout  Pointer to the timeout to fill in (milliseconds, -1 for none).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  If a device is claimed with the @a nonblock flag set, drawing calls don't write to the
+ *  device themselves. Their commands are queued instead and the caller's event loop sends
+ *  them by calling @c dlo_handle_events() whenever the file descriptor returned here is
+ *  ready, or when the timeout expires (whichever is first). Fence callbacks are called from
+ *  within @c dlo_handle_events() as the commands before them are sent.
+ *
+ *  If the write queue already holds several buffers full of commands, drawing calls return
+ *  @a dlo_err_would_block without doing anything. A single drawing call which is allowed to
+ *  start always queues all of its commands.
+ *
+ *  Only devices added with @c dlo_add_net_device() have a file descriptor. libusb 0.1 can
+ *  only write synchronously, so for a USB device the timeout is zero whenever there is
+ *  anything queued and each call to @c dlo_handle_events() writes one buffer full.
+ *
+ *  Setting the screen mode and releasing the device wait for the queue to empty first.
+ */
+extern dlo_retcode_t dlo_get_poll(const dlo_dev_t uid, dlo_pollfd_t * const pfd, int32_t * const timeout);
+
+
+/** Send as much of the write queue of a non-blocking device as can be sent now.
+ *
+ *  @param  uid  Unique ID of the device to access.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  If the device has been unable to accept any commands for longer than the device's
+ *  timeout, the queue is thrown away and @a dlo_err_timeout is returned.
+ */
+extern dlo_retcode_t dlo_handle_events(const dlo_dev_t uid);
+
+
+/** Read the transfer parameters which a device is using.
+ *
+ *  @param  uid   Unique ID of the device to access.
+ *  @param  xfer  Pointer to the structure to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  When a device is claimed, libdlo times a few bulk transfers of null commands to find
+ *  the throughput of the link to the device and the fixed cost of each transfer. From
+ *  these, it picks a transfer size large enough that the fixed cost is a small part of
+ *  each transfer, but small enough that a full buffer doesn't take too long to send. The
+ *  queue depth of a non-blocking device is chosen to hold about a frame's worth of
+ *  commands. A device on a fast root port ends up with larger transfers than one behind
+ *  a slow hub.
+ *
+ *  The measurements are refined every few seconds from the timings of the transfers made
+ *  while drawing, and the parameters are changed to match.
+ */
+extern dlo_retcode_t dlo_get_xfer(const dlo_dev_t uid, dlo_xfer_t * const xfer);
+
+
+/** Set the transfer parameters for a device, or return to choosing them automatically.
+ *
+ *  @param  uid   Unique ID of the device to access.
+ *  @param  xfer  Pointer to the parameters (or NULL to have them chosen automatically).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Only the @a size and @a depth fields are used; a @a depth of zero leaves the depth
+ *  unchanged. The size must be between 4 KB and 64 KB. Parameters set here stay fixed
+ *  until this is called again with a NULL @a xfer, which measures the link afresh.
+ */
+extern dlo_retcode_t dlo_set_xfer(const dlo_dev_t uid, const dlo_xfer_t * const xfer);
+
+
+/** Give a device a colour-correction table, or remove its table.
+ *
+ *  @param  uid   Unique ID of the device to access.
+ *  @param  clut  Pointer to the table (copied), or NULL for no correction.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The table is applied to every colour as it is converted into the device's pixel
+ *  format, by @c dlo_fill_rect(), @c dlo_copy_host_bmp() and @c dlo_submit_frame(), so
+ *  calibrating a panel costs no extra pass over the pixels. Anything already on the
+ *  screen is not changed.
+ */
+extern dlo_retcode_t dlo_set_colour_lut(const dlo_dev_t uid, const dlo_clut_t * const clut);
+
+
+/** Give a region of the screen its own encoding policy, or remove policies.
+ *
+ *  @param  uid     Unique ID of the device to access.
+ *  @param  rec     Rectangle within the current screen mode (or NULL for the whole screen).
+ *  @param  policy  Pointer to the policy (copied), or NULL to remove the region's policy.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Bitmaps copied to the screen by @c dlo_copy_host_bmp() and @c dlo_submit_frame() are
+ *  encoded according to the policy of each region they cover, and as usual everywhere
+ *  else. So a video tile can give up exactness to save bandwidth while text next to it
+ *  stays exact:
+ *
+ *  - With a @a threshold, pixels which differ from what's on the screen by no more than
+ *    the threshold in every component aren't sent (this needs the @a shadow claim flag).
+ *  - A @a coarse region only sends the 16 bpp plane, which is two thirds of the data.
+ *  - Updates to a region with a @a max_rate which come sooner than the rate allows are
+ *    dropped, leaving the previous contents on the screen until a later update.
+ *  - On a non-blocking device, updates to a region with a @a priority below
+ *    @c DLO_PRIORITY_MAX are dropped while the write queue is more than
+ *    (priority + 1) / (DLO_PRIORITY_MAX + 1) full.
+ *
+ *  Fills and copies within the device aren't affected. Setting a policy for a rectangle
+ *  which already has one replaces it; otherwise the new region goes on top of any which
+ *  it overlaps. Removing the policy of a NULL rectangle removes every policy. Regions
+ *  stay at the same place in the device memory if the screen mode changes, so set them
+ *  again afterwards. Up to @c DLO_MAX_POLICIES regions are allowed.
+ */
+extern dlo_retcode_t dlo_set_policy(const dlo_dev_t uid, const dlo_rect_t * const rec, const dlo_policy_t * const policy);
+
+
+/** Return the current time on the clock used for frame presentation times.
+ *
+ *  @return  Time in microseconds (from an arbitrary starting point).
+ */
+extern uint64_t dlo_time_us(void);
+
+
+/** Queue a frame of video to be copied to the device at a given presentation time.
+ *
+ *  @param  uid        Unique ID of the device to access.
+ *  @param  flags      Flags word indicating special behaviour (as for @c dlo_copy_host_bmp()).
+ *  @param  fbuf       Pointer to the frame (copied, so may be reused straight away).
+ *  @param  dest_view  Viewport to copy the frame into (or NULL for the current screen).
+ *  @param  dest_pos   Position within the viewport of the frame's top-left corner (or NULL for 0,0).
+ *  @param  pts        Presentation time of the frame (microseconds, see @c dlo_time_us()).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  Each frame is sent so that it should finish arriving at the device just as its
+ *  presentation time comes round, going by how long recent frames took. A frame which
+ *  could not finish arriving before the next frame is due is dropped, as the next frame
+ *  would replace it anyway, so a congested link drops frames rather than falling further
+ *  and further behind. If no later frame has been submitted yet, the next one is assumed
+ *  to follow at the same interval as the last two.
+ *
+ *  Frames are sent from within this call and from @c dlo_handle_events(). The timeout
+ *  returned by @c dlo_get_poll() allows for the next frame which is due, so a caller with
+ *  an event loop should call @c dlo_handle_events() when it expires, even if the device was
+ *  not claimed with the @a nonblock flag. If the frame has a palette pixel format, the
+ *  palette must stay valid until the frame has been sent.
+ */
+extern dlo_retcode_t dlo_submit_frame(const dlo_dev_t uid, const dlo_bmpflags_t flags,
+                                      const dlo_fbuf_t * const fbuf,
+                                      const dlo_view_t * const dest_view, const dlo_dot_t * const dest_pos,
+                                      const uint64_t pts);
+
+
+/** Read the counts of submitted, shown, late and dropped frames for a device.
+ *
+ *  @param  uid    Unique ID of the device to access.
+ *  @param  stats  Pointer to the structure to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The counts run from when the device was claimed.
+ */
+extern dlo_retcode_t dlo_get_frame_stats(const dlo_dev_t uid, dlo_framestats_t * const stats);
+
+
+/** Read the memory pinning counts and jitter histograms for a device.
+ *
+ *  @param  uid    Unique ID of the device to access.
+ *  @param  stats  Pointer to the structure to fill in.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The counts run from when the device was claimed. Transfer jitter is only counted once
+ *  the link's speed has been measured (see @c dlo_set_xfer()), and frame jitter only for
+ *  frames which were sent.
+ */
+extern dlo_retcode_t dlo_get_rt_stats(const dlo_dev_t uid, dlo_rtstats_t * const stats);
+
+
+/** Tell libdlo when the display scans out each row, so that updates can chase the beam.
+ *
+ *  @param  uid     Unique ID of the device to access.
+ *  @param  raster  Pointer to the raster timing (or NULL to forget it).
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  The device gives no indication of where its raster is, so the position is estimated
+ *  from the time which has passed since @a phase. Unless they are given, the frame period
+ *  and line count come from the display's detailed timing if it matches the current mode,
+ *  or else from the mode's refresh rate with a typical vertical blanking interval. The
+ *  phase has to be calibrated by the caller, for example by moving it until a test pattern
+ *  sent with the @a chase flag stops tearing, and may need to be set again from time to
+ *  time as the device's clock drifts from the host's.
+ *
+ *  Once this has been called, @c dlo_copy_host_bmp() and @c dlo_submit_frame() with the
+ *  @a chase flag send a bitmap on the visible screen in bands, starting with the band just
+ *  behind the beam and working round in the order in which the beam leaves them. Each band
+ *  then has most of a frame to arrive before it is next scanned out, so it doesn't tear,
+ *  and is shown as soon as it can be without tearing. Use @c dlo_get_row_time() to find
+ *  out when each row became visible.
+ */
+extern dlo_retcode_t dlo_set_raster(const dlo_dev_t uid, const dlo_raster_t * const raster);
+
+
+/** Find out when a row of the screen last updated with the @a chase flag became visible.
+ *
+ *  @param  uid   Unique ID of the device to access.
+ *  @param  row   Row of the screen (0 at the top).
+ *  @param  when  Pointer to the time to fill in (microseconds, see @c dlo_time_us()).
+ *
+ *  @return  Return code, zero for no error or @a dlo_err_bad_area if that row hasn't been updated.
+ *
+ *  The time is when the beam first reached the row after the update was estimated to have
+ *  finished arriving at the device, so it may still be in the future.
+ */
+extern dlo_retcode_t dlo_get_row_time(const dlo_dev_t uid, const uint32_t row, uint64_t * const when);
+
+
+/** Register a function to supply pixels when part of the screen has to be sent again.
+ *
+ *  @param  uid  Unique ID of the device to access.
+ *  @param  fn   Function to call (or NULL to remove the current one).
+ *  @param  pw   Private word to pass to the function.
+ *
+ *  @return  Return code, zero for no error.
+ *
+ *  If a write to the device fails or times out, libdlo works out which areas of the
+ *  device memory the lost commands would have written to and sends just those areas
+ *  again. Where the device was claimed with the @a shadow flag, the pixels come from
+ *  the shadow. Anything the shadow can't supply is asked for from @a fn, one rectangle
+ *  at a time, and is then copied to the device as if by @c dlo_copy_host_bmp(). The
+ *  function must not call back into libdlo for the same device.
+ *
+ *  If the retransmission succeeds, the drawing call which hit the failure carries on as
+ *  normal. If not, its error is returned and the retransmission is tried again before
+ *  anything else is written to the device.
+ */
+extern dlo_retcode_t dlo_set_source(const dlo_dev_t uid, const dlo_source_fn_t fn, void * const pw);
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,4 @@
+#!/bin/sh
+# Run test1 for 'make check' (from the top build directory). It draws on a real
+# DisplayLink device, which needs root to claim, unlike test_sim.
+exec sudo ./test/test1 "$@"
@@ -0,0 +1,1437 @@
+/** @file test_sim.c
+ *
+ *  @brief This file checks the behaviour of libdlo against a simulated adapter.
+ *
+ *  The program links the usbsim backend in place of libusb, so it needs no hardware.
+ *  The device is claimed with a shadow, and the results of each call are read back
+ *  from the shadow with @c dlo_read_host_bmp() and compared with what was expected.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/libdlo.h"
+#include "usbsim.h"
+
+
+/** Check a condition, reporting it and counting a failure if it doesn't hold.
+ */
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+/** Check that a call returns the expected return code.
+ */
+#define CHECK_RET(call, ret) check_ret((call), (ret), #call, __LINE__)
+
+/** Size of the file header at the start of a Windows BMP file (bytes).
+ */
+#define BMP_FILE_HDR_SZ (14u)
+
+/** Size of a BITMAPINFOHEADER (bytes).
+ */
+#define BMP_INFO_HDR_SZ (40u)
+
+/** Compression type for uncompressed pixels.
+ */
+#define BMP_BI_RGB (0u)
+
+/** Compression type for run-length encoded 8 bpp pixels.
+ */
+#define BMP_BI_RLE8 (1u)
+
+/** Compression type for uncompressed pixels described by colour bit masks.
+ */
+#define BMP_BI_BITFIELDS (3u)
+
+/** Number of entries in a full BMP palette.
+ */
+#define BMP_PAL_ENTRIES (256u)
+
+/** Largest bitmap drawn by the tests (pixels in either direction).
+ */
+#define MAX_BMP (64u)
+
+/** Largest BMP file written by the tests (bytes).
+ */
+#define MAX_BMP_FILE (BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ + 12u + (4u * BMP_PAL_ENTRIES) + (MAX_BMP * MAX_BMP * 4u))
+
+/** Most files the tests write (so they can be removed afterwards).
+ */
+#define MAX_FILES (64u)
+
+/** Longest name of a file the tests write (including terminator).
+ */
+#define MAX_NAME (32u)
+
+/** Where the tests draw bitmaps on the screen.
+ */
+#define BMP_X (100)
+
+/** Where the tests draw bitmaps on the screen.
+ */
+#define BMP_Y (120)
+
+/** Background colour which the screen is cleared to between checks.
+ */
+#define BACKGROUND DLO_RGB(0x12, 0x34, 0x56)
+
+/** Most bytes of the command stream kept for checking (bytes).
+ */
+#define MAX_STREAM (1024u * 1024u)
+
+
+/** Description of a BMP file for @c make_bmp() to write.
+ */
+typedef struct bmp_desc_s
+{
+  uint32_t bpp;            /**< Bits per pixel. */
+  uint32_t comp;           /**< Compression type. */
+  int32_t  width;          /**< Width (pixels). */
+  int32_t  height;         /**< Height (pixels, negative for a top-down file). */
+  uint32_t red;            /**< Red bit mask (bit field files only). */
+  uint32_t grn;            /**< Green bit mask (bit field files only). */
+  uint32_t blu;            /**< Blue bit mask (bit field files only). */
+} bmp_desc_t;              /**< A struct @a bmp_desc_s. */
+
+
+/** Number of checks which have failed.
+ */
+static unsigned int failures = 0;
+
+/** Directory which the tests write their files into.
+ */
+static char dir[] = "/tmp/dlo_test_XXXXXX";
+
+/** Names of the files written into the test directory.
+ */
+static char names[MAX_FILES][MAX_NAME];
+
+/** Number of entries in @a names.
+ */
+static unsigned int num_names = 0;
+
+/** Pixels read back from the shadow (in @a dlo_pixfmt_rgb888 format, blue first).
+ */
+static uint8_t got[MAX_BMP * MAX_BMP * 3];
+
+/** Pixels expected to be read back from the shadow.
+ */
+static uint8_t want[MAX_BMP * MAX_BMP * 3];
+
+/** Command stream sent to the simulated adapter while it's being captured.
+ */
+static uint8_t stream[MAX_STREAM];
+
+
+/** Report a failed check and count it.
+ *
+ *  @param  ok    Result of the check.
+ *  @param  what  Text of the check.
+ *  @param  line  Line number of the check.
+ */
+static void check(const bool ok, const char * const what, const int line)
+{
+  if (ok)
+    return;
+  printf("test_sim: FAILED line %d: %s\n", line, what);
+  failures++;
+}
+
+
+/** Report a call which didn't return what was expected and count it.
+ *
+ *  @param  err   Return code from the call.
+ *  @param  ret   Expected return code.
+ *  @param  what  Text of the call.
+ *  @param  line  Line number of the call.
+ */
+static void check_ret(const dlo_retcode_t err, const dlo_retcode_t ret, const char * const what, const int line)
+{
+  if (err == ret)
+    return;
+  printf("test_sim: FAILED line %d: %s returned '%s', expected '%s'\n", line, what, dlo_strerror(err), dlo_strerror(ret));
+  failures++;
+}
+
+
+/** Build the full path of a file in the test directory.
+ *
+ *  @param  name  Name of the file.
+ *
+ *  @return  Pointer to the path (overwritten by the next call).
+ */
+static const char *path_of(const char * const name)
+{
+  static char path[sizeof(dir) + MAX_NAME];
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return path;
+}
+
+
+/** Remember the name of a file in the test directory, so that it can be removed at the end.
+ *
+ *  @param  name  Name of the file.
+ *
+ *  @return  Pointer to the path of the file (overwritten by the next call to @c path_of()).
+ */
+static const char *note_file(const char * const name)
+{
+  unsigned int i;
+
+  for (i = 0; i < num_names && strcmp(names[i], name); i++) ;
+  if (i == num_names && num_names < MAX_FILES)
+    snprintf(names[num_names++], MAX_NAME, "%s", name);
+
+  return path_of(name);
+}
+
+
+/** Write a block of memory to a file in the test directory.
+ *
+ *  @param  name  Name of the file.
+ *  @param  data  Pointer to the data.
+ *  @param  size  Size of the data (bytes).
+ *
+ *  @return  Pointer to the path of the file.
+ */
+static const char *write_file(const char * const name, const uint8_t * const data, const size_t size)
+{
+  const char *path = note_file(name);
+  FILE       *fp   = fopen(path, "wb");
+
+  if (!fp || fwrite(data, 1, size, fp) != size)
+  {
+    printf("test_sim: ERROR: can't write '%s'\n", path);
+    exit(1);
+  }
+  fclose(fp);
+
+  return path;
+}
+
+
+/** Store a little-endian 16 bit number.
+ *
+ *  @param  ptr  Where to store the number.
+ *  @param  val  The number.
+ */
+static void put16(uint8_t * const ptr, const uint32_t val)
+{
+  ptr[0] = (uint8_t)val;
+  ptr[1] = (uint8_t)(val >> 8);
+}
+
+
+/** Store a little-endian 32 bit number.
+ *
+ *  @param  ptr  Where to store the number.
+ *  @param  val  The number.
+ */
+static void put32(uint8_t * const ptr, const uint32_t val)
+{
+  put16(ptr, val);
+  put16(ptr + 2, val >> 16);
+}
+
+
+/** Write a BMP file in memory with random pixels, and the same pixels as a top-down
+ *  bitmap without row padding, as @c dlo_copy_host_bmp() would be given them.
+ *
+ *  @param  desc  Struct pointer: description of the file.
+ *  @param  file  Buffer for the file (@c MAX_BMP_FILE bytes).
+ *  @param  pix   Buffer for the unpadded pixels.
+ *  @param  pal   Palette of an 8 bpp file.
+ *
+ *  @return  Size of the file (bytes).
+ */
+static size_t make_bmp(const bmp_desc_t * const desc, uint8_t * const file, uint8_t * const pix, dlo_col32_t * const pal)
+{
+  uint32_t rows   = desc->height < 0 ? (uint32_t)-desc->height : (uint32_t)desc->height;
+  uint32_t bypp   = desc->bpp / 8;
+  uint32_t row_sz = (((uint32_t)desc->width * desc->bpp + 31) / 32) * 4;
+  uint32_t off    = BMP_FILE_HDR_SZ + BMP_INFO_HDR_SZ;
+  uint32_t x, y;
+
+  memset(file, 0, MAX_BMP_FILE);
+  file[0] = 'B';
+  file[1] = 'M';
+  put32(file + 14, BMP_INFO_HDR_SZ);
+  put32(file + 18, (uint32_t)desc->width);
+  put32(file + 22, (uint32_t)desc->height);
+  put16(file + 26, 1);
+  put16(file + 28, desc->bpp);
+  put32(file + 30, desc->comp);
+
+  if (desc->comp == BMP_BI_BITFIELDS)
+  {
+    put32(file + off,     desc->red);
+    put32(file + off + 4, desc->grn);
+    put32(file + off + 8, desc->blu);
+    off += 12;
+  }
+  if (desc->bpp == 8)
+  {
+    for (x = 0; x < BMP_PAL_ENTRIES; x++, off += 4)
+    {
+      pal[x] = (dlo_col32_t)rand() & 0xFFFFFF;
+      file[off]     = DLO_RGB_GETBLU(pal[x]);
+      file[off + 1] = DLO_RGB_GETGRN(pal[x]);
+      file[off + 2] = DLO_RGB_GETRED(pal[x]);
+    }
+  }
+  put32(file + 10, off);
+
+  /* File rows run bottom to top unless the height is negative */
+  for (y = 0; y < rows; y++)
+  {
+    uint8_t *row = file + off + (row_sz * y);
+    uint8_t *dst = pix + ((desc->height < 0 ? y : rows - 1 - y) * desc->width * bypp);
+
+    for (x = 0; x < desc->width * bypp; x++)
+      row[x] = dst[x] = (uint8_t)rand();
+  }
+  put32(file + 2, off + (row_sz * rows));
+
+  return off + (row_sz * rows);
+}
+
+
+/** Read back the area of the screen where the bitmap tests draw.
+ *
+ *  @param  uid     Unique ID of the device.
+ *  @param  width   Width of the area (pixels).
+ *  @param  height  Height of the area (pixels).
+ *  @param  buf     Buffer for the pixels (24 bpp).
+ *
+ *  @return  Return code, zero for no error.
+ */
+static dlo_retcode_t read_back(const dlo_dev_t uid, const uint32_t width, const uint32_t height, uint8_t * const buf)
+{
+  dlo_fbuf_t fbuf;
+  dlo_dot_t  pos = { BMP_X, BMP_Y };
+
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = (uint16_t)width;
+  fbuf.height = (uint16_t)height;
+  fbuf.stride = (uint16_t)width;
+  fbuf.fmt    = dlo_pixfmt_rgb888;
+  fbuf.base   = buf;
+
+  return dlo_read_host_bmp(uid, &fbuf, NULL, &pos);
+}
+
+
+/** Write a BMP file, show it, and check that it looks the same as its pixels do when
+ *  given straight to @c dlo_copy_host_bmp().
+ *
+ *  @param  uid   Unique ID of the device.
+ *  @param  name  Name of the file.
+ *  @param  desc  Struct pointer: description of the file.
+ *  @param  fmt   Pixel format the file's pixels are in.
+ */
+static void bmp_variant(const dlo_dev_t uid, const char * const name, const bmp_desc_t * const desc, const dlo_pixfmt_t fmt)
+{
+  static uint8_t     file[MAX_BMP_FILE];
+  static uint8_t     pix[MAX_BMP * MAX_BMP * 4];
+  static dlo_col32_t pal[BMP_PAL_ENTRIES];
+  dlo_bmpflags_t     flags = { 0 };
+  dlo_fbuf_t         fbuf;
+  dlo_dot_t          pos   = { BMP_X, BMP_Y };
+  uint32_t           rows  = desc->height < 0 ? (uint32_t)-desc->height : (uint32_t)desc->height;
+  const char        *path  = write_file(name, file, make_bmp(desc, file, pix, pal));
+
+  printf("test_sim: BMP file %s...\n", name);
+
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  CHECK_RET(dlo_copy_bmp_file(uid, flags, path, NULL, &pos), dlo_ok);
+  CHECK_RET(read_back(uid, (uint32_t)desc->width, rows, got), dlo_ok);
+
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = (uint16_t)desc->width;
+  fbuf.height = (uint16_t)rows;
+  fbuf.stride = (uint16_t)desc->width;
+  fbuf.fmt    = fmt;
+  fbuf.lut    = pal;
+  fbuf.base   = pix;
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK_RET(read_back(uid, (uint32_t)desc->width, rows, want), dlo_ok);
+
+  CHECK(!memcmp(got, want, (size_t)desc->width * rows * 3));
+
+  /* Asking for a flip of the file turns it upside down */
+  flags.v_flip = 1;
+  CHECK_RET(dlo_copy_bmp_file(uid, flags, path, NULL, &pos), dlo_ok);
+  CHECK_RET(read_back(uid, (uint32_t)desc->width, rows, got), dlo_ok);
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK_RET(read_back(uid, (uint32_t)desc->width, rows, want), dlo_ok);
+  CHECK(!memcmp(got, want, (size_t)desc->width * rows * 3));
+}
+
+
+/** Write a BMP file, spoil it, and check that it is turned down without drawing anything.
+ *
+ *  @param  uid   Unique ID of the device.
+ *  @param  name  Name of the file.
+ *  @param  file  Pointer to the file contents.
+ *  @param  size  Size of the file (bytes).
+ */
+static void bmp_bad(const dlo_dev_t uid, const char * const name, const uint8_t * const file, const size_t size)
+{
+  dlo_bmpflags_t flags = { 0 };
+  dlo_dot_t      pos   = { BMP_X, BMP_Y };
+
+  printf("test_sim: bad BMP file %s...\n", name);
+
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  CHECK_RET(dlo_copy_bmp_file(uid, flags, write_file(name, file, size), NULL, &pos), dlo_err_bad_fmt);
+  CHECK_RET(read_back(uid, 1, 1, got), dlo_ok);
+  CHECK(DLO_RGB(got[2], got[1], got[0]) == BACKGROUND);
+}
+
+
+/** Check that BMP files of each supported kind are shown correctly, and that malformed
+ *  files are turned down.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void bmp_test(const dlo_dev_t uid)
+{
+  static uint8_t     file[MAX_BMP_FILE];
+  static uint8_t     pix[MAX_BMP * MAX_BMP * 4];
+  static dlo_col32_t pal[BMP_PAL_ENTRIES];
+  bmp_desc_t         desc;
+  dlo_bmpflags_t     flags = { 0 };
+  size_t             size;
+
+  /* Odd widths need padding at the end of each row (and for 24 bpp, a row at a time) */
+  desc = (bmp_desc_t){ 8, BMP_BI_RGB, 37, 23, 0, 0, 0 };
+  bmp_variant(uid, "pal8.bmp", &desc, dlo_pixfmt_lut8);
+  desc = (bmp_desc_t){ 16, BMP_BI_RGB, 37, 23, 0, 0, 0 };
+  bmp_variant(uid, "rgb555.bmp", &desc, dlo_pixfmt_srgb1555);
+  desc = (bmp_desc_t){ 16, BMP_BI_BITFIELDS, 37, 23, 0xF800, 0x07E0, 0x001F };
+  bmp_variant(uid, "rgb565.bmp", &desc, dlo_pixfmt_rgb565);
+  desc = (bmp_desc_t){ 16, BMP_BI_BITFIELDS, 20, 9, 0x7C00, 0x03E0, 0x001F };
+  bmp_variant(uid, "rgb555bf.bmp", &desc, dlo_pixfmt_srgb1555);
+  desc = (bmp_desc_t){ 24, BMP_BI_RGB, 37, 23, 0, 0, 0 };
+  bmp_variant(uid, "rgb24odd.bmp", &desc, dlo_pixfmt_rgb888);
+  desc = (bmp_desc_t){ 24, BMP_BI_RGB, 36, 23, 0, 0, 0 };
+  bmp_variant(uid, "rgb24.bmp", &desc, dlo_pixfmt_rgb888);
+  desc = (bmp_desc_t){ 32, BMP_BI_RGB, 37, 23, 0, 0, 0 };
+  bmp_variant(uid, "rgb32.bmp", &desc, dlo_pixfmt_argb8888);
+  desc = (bmp_desc_t){ 32, BMP_BI_BITFIELDS, 33, 40, 0xFF0000, 0xFF00, 0xFF };
+  bmp_variant(uid, "rgb32bf.bmp", &desc, dlo_pixfmt_argb8888);
+
+  /* Top-down files have a negative height */
+  desc = (bmp_desc_t){ 8, BMP_BI_RGB, 37, -23, 0, 0, 0 };
+  bmp_variant(uid, "pal8td.bmp", &desc, dlo_pixfmt_lut8);
+  desc = (bmp_desc_t){ 24, BMP_BI_RGB, 37, -23, 0, 0, 0 };
+  bmp_variant(uid, "rgb24td.bmp", &desc, dlo_pixfmt_rgb888);
+  desc = (bmp_desc_t){ 32, BMP_BI_RGB, 37, -(int32_t)MAX_BMP, 0, 0, 0 };
+  bmp_variant(uid, "rgb32td.bmp", &desc, dlo_pixfmt_argb8888);
+
+  /* Each of these is a good 24 bpp file with one thing wrong with it */
+  desc = (bmp_desc_t){ 24, BMP_BI_RGB, 37, 23, 0, 0, 0 };
+  size = make_bmp(&desc, file, pix, pal);
+  file[0] = 'M';
+  bmp_bad(uid, "magic.bmp", file, size);
+
+  size = make_bmp(&desc, file, pix, pal);
+  bmp_bad(uid, "truncated.bmp", file, size - 1);
+  bmp_bad(uid, "short.bmp", file, BMP_FILE_HDR_SZ + 20);
+
+  put32(file + 14, 0xFFFFFFF0u);
+  bmp_bad(uid, "hdrsz.bmp", file, size);
+
+  size = make_bmp(&desc, file, pix, pal);
+  put32(file + 10, BMP_FILE_HDR_SZ + 8);
+  bmp_bad(uid, "pixoff.bmp", file, size);
+
+  size = make_bmp(&desc, file, pix, pal);
+  put16(file + 26, 2);
+  bmp_bad(uid, "planes.bmp", file, size);
+
+  size = make_bmp(&desc, file, pix, pal);
+  put16(file + 28, 4);
+  bmp_bad(uid, "bpp4.bmp", file, size);
+
+  size = make_bmp(&desc, file, pix, pal);
+  put32(file + 18, 0);
+  bmp_bad(uid, "width0.bmp", file, size);
+
+  size = make_bmp(&desc, file, pix, pal);
+  put32(file + 30, BMP_BI_BITFIELDS);
+  bmp_bad(uid, "rgb24bf.bmp", file, size);
+
+  desc = (bmp_desc_t){ 8, BMP_BI_RGB, 37, 23, 0, 0, 0 };
+  size = make_bmp(&desc, file, pix, pal);
+  put32(file + 30, BMP_BI_RLE8);
+  bmp_bad(uid, "rle8.bmp", file, size);
+
+  size = make_bmp(&desc, file, pix, pal);
+  put32(file + 46, BMP_PAL_ENTRIES + 1);
+  bmp_bad(uid, "ncols.bmp", file, size);
+
+  desc = (bmp_desc_t){ 16, BMP_BI_BITFIELDS, 37, 23, 0xF00, 0xF0, 0xF };
+  bmp_bad(uid, "rgb444.bmp", file, make_bmp(&desc, file, pix, pal));
+
+  printf("test_sim: missing BMP file...\n");
+  CHECK_RET(dlo_copy_bmp_file(uid, flags, path_of("missing.bmp"), NULL, NULL), dlo_err_open);
+}
+
+
+/** Record a trace of drawing, then check that replaying it draws the same screen again.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void trace_test(const dlo_dev_t uid)
+{
+  static uint8_t     src[MAX_BMP * MAX_BMP * 3];
+  static uint8_t     lut_pix[MAX_BMP * MAX_BMP];
+  static dlo_col32_t lut[BMP_PAL_ENTRIES];
+  dlo_mode_t        *mode = dlo_get_mode(uid);
+  dlo_mode_t         orig = *mode;
+  dlo_mode_t         bad  = { { 12345, 3, 24, 0 }, 60 };
+  dlo_mode_t         wide = { { 1600, 1200, 24, 0 }, 60 };
+  dlo_bmpflags_t     flags = { 0 };
+  dlo_surface_t      surf;
+  dlo_segment_t      early;
+  dlo_segment_t      seg;
+  dlo_fbuf_t         fbuf;
+  dlo_fbuf_t         lbuf;
+  dlo_fbuf_t         screen;
+  dlo_rect_t         rec;
+  dlo_dot_t          pos;
+  uint8_t           *before;
+  uint8_t           *after;
+  size_t             size;
+  char               path[sizeof(dir) + MAX_NAME];
+  uint32_t           i;
+
+  printf("test_sim: trace round trip...\n");
+
+  for (i = 0; i < sizeof(src); i++)
+    src[i] = (uint8_t)rand();
+  for (i = 0; i < sizeof(lut_pix); i++)
+    lut_pix[i] = (uint8_t)rand();
+  for (i = 0; i < BMP_PAL_ENTRIES; i++)
+    lut[i] = (dlo_col32_t)rand() & 0xFFFFFF;
+
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = MAX_BMP;
+  fbuf.height = MAX_BMP;
+  fbuf.stride = MAX_BMP;
+  fbuf.fmt    = dlo_pixfmt_rgb888;
+  fbuf.base   = src;
+  lbuf        = fbuf;
+  lbuf.fmt    = dlo_pixfmt_lut8;
+  lbuf.lut    = lut;
+  lbuf.base   = lut_pix;
+
+  /* A segment made before recording starts is announced when it is first used */
+  CHECK_RET(dlo_new_segment(uid, 5, &early), dlo_ok);
+
+  snprintf(path, sizeof(path), "%s", note_file("test.trace"));
+  CHECK_RET(dlo_record_trace(path), dlo_ok);
+
+  /* A mode which only gives a warning is recorded, and doesn't stop the replay */
+  CHECK_RET(dlo_set_mode(uid, &wide), dlo_warn_dl160_mode);
+
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, DLO_RGB(10, 20, 30)), dlo_ok);
+  rec = (dlo_rect_t){ { 10, 10 }, 200, 100 };
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(200, 0, 0)), dlo_ok);
+  pos = (dlo_dot_t){ 300, 200 };
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  pos = (dlo_dot_t){ 600, 50 };
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &lbuf, NULL, &pos), dlo_ok);
+  rec = (dlo_rect_t){ { 290, 190 }, 120, 80 };
+  pos = (dlo_dot_t){ 700, 500 };
+  CHECK_RET(dlo_copy_rect(uid, NULL, &rec, NULL, &pos), dlo_ok);
+  CHECK_RET(dlo_prepare_surface(uid, NULL, &surf), dlo_ok);
+  rec = (dlo_rect_t){ { 0, 900 }, 50, 50 };
+  CHECK_RET(dlo_surface_fill(&surf, &rec, DLO_RGB(1, 255, 7)), dlo_ok);
+
+  /* A mode the device turns down is left out of the trace */
+  CHECK(dlo_set_mode(uid, &bad) != dlo_ok);
+
+  CHECK_RET(dlo_new_segment(uid, 1, &seg), dlo_ok);
+  rec = (dlo_rect_t){ { 100, 600 }, 300, 200 };
+  CHECK_RET(dlo_segment_fill(seg, &surf, &rec, DLO_RGB(0, 0, 255)), dlo_ok);
+  rec = (dlo_rect_t){ { 150, 650 }, 300, 200 };
+  CHECK_RET(dlo_segment_fill(early, &surf, &rec, DLO_RGB(0, 255, 0)), dlo_ok);
+  pos = (dlo_dot_t){ 120, 620 };
+  CHECK_RET(dlo_segment_copy_host_bmp(seg, &surf, flags, &fbuf, &pos), dlo_ok);
+  pos = (dlo_dot_t){ 500, 700 };
+  CHECK_RET(dlo_segment_copy_host_bmp(seg, &surf, flags, &lbuf, &pos), dlo_ok);
+  CHECK_RET(dlo_flush_segments(uid), dlo_ok);
+  dlo_free_segment(seg);
+  dlo_free_segment(early);
+
+  CHECK_RET(dlo_record_trace(NULL), dlo_ok);
+
+  size   = (size_t)mode->view.width * mode->view.height * 3;
+  before = malloc(size);
+  after  = malloc(size);
+  if (!before || !after)
+  {
+    printf("test_sim: ERROR: out of memory\n");
+    exit(1);
+  }
+  memset(&screen, 0, sizeof(screen));
+  screen.width  = mode->view.width;
+  screen.height = mode->view.height;
+  screen.stride = mode->view.width;
+  screen.fmt    = dlo_pixfmt_rgb888;
+  screen.base   = before;
+  CHECK_RET(dlo_read_host_bmp(uid, &screen, NULL, NULL), dlo_ok);
+
+  /* The segment's paletted bitmap was drawn through its own palette */
+  i = ((700 * mode->view.width) + 500) * 3;
+  CHECK(DLO_RGB(before[i + 2], before[i + 1], before[i]) == lut[lut_pix[0]]);
+
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  CHECK_RET(dlo_replay_trace(uid, path, NULL, false), dlo_ok);
+  screen.base = after;
+  CHECK_RET(dlo_read_host_bmp(uid, &screen, NULL, NULL), dlo_ok);
+  CHECK(!memcmp(before, after, size));
+
+  /* Anything else is turned down, as is a trace for an adapter which isn't there */
+  CHECK_RET(dlo_replay_trace(uid, write_file("not.trace", src, 256), NULL, false), dlo_err_bad_fmt);
+  CHECK_RET(dlo_replay_trace(uid, path_of("missing.trace"), NULL, false), dlo_err_open);
+  CHECK(dlo_replay_trace(uid, path, "no such serial", false) != dlo_ok);
+  CHECK_RET(dlo_set_mode(uid, &orig), dlo_ok);
+
+  free(before);
+  free(after);
+}
+
+
+/** Check that two rectangles are the same.
+ *
+ *  @param  a  Struct pointer: the first rectangle.
+ *  @param  b  Struct pointer: the second rectangle.
+ *
+ *  @return  true if they are the same, false if not.
+ */
+static bool same_rect(const dlo_rect_t * const a, const dlo_rect_t * const b)
+{
+  return a->origin.x == b->origin.x && a->origin.y == b->origin.y && a->width == b->width && a->height == b->height;
+}
+
+
+/** Check the colour of a pixel read back from the shadow.
+ *
+ *  @param  uid  Unique ID of the device.
+ *  @param  x    Horizontal co-ordinate of the pixel.
+ *  @param  y    Vertical co-ordinate of the pixel.
+ *
+ *  @return  Colour of the pixel.
+ */
+static dlo_col32_t pixel(const dlo_dev_t uid, const int32_t x, const int32_t y)
+{
+  uint8_t    rgb[3] = { 0 };
+  dlo_fbuf_t fbuf;
+  dlo_dot_t  pos = { x, y };
+
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = 1;
+  fbuf.height = 1;
+  fbuf.stride = 1;
+  fbuf.fmt    = dlo_pixfmt_rgb888;
+  fbuf.base   = rgb;
+  CHECK_RET(dlo_read_host_bmp(uid, &fbuf, NULL, &pos), dlo_ok);
+
+  return DLO_RGB(rgb[2], rgb[1], rgb[0]);
+}
+
+
+/** Check that moving a rectangle copies its pixels and reports what it uncovers.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void move_test(const dlo_dev_t uid)
+{
+  dlo_rect_t exposed[DLO_MOVE_MAX_EXPOSED];
+  dlo_rect_t rec;
+  dlo_rect_t want0;
+  dlo_rect_t want1;
+  uint32_t   num;
+
+  printf("test_sim: moving rectangles...\n");
+
+  /* A dragged window uncovers a strip above it and one to its left */
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  rec = (dlo_rect_t){ { 100, 100 }, 200, 100 };
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(255, 0, 0)), dlo_ok);
+  CHECK_RET(dlo_move_rect(uid, NULL, &rec, 50, 30, false, exposed, &num), dlo_ok);
+  want0 = (dlo_rect_t){ { 100, 100 }, 200, 30 };
+  want1 = (dlo_rect_t){ { 100, 130 }, 50, 70 };
+  CHECK(num == 2 && same_rect(&exposed[0], &want0) && same_rect(&exposed[1], &want1));
+  CHECK(pixel(uid, 349, 229) == DLO_RGB(255, 0, 0));
+  CHECK(pixel(uid, 350, 229) == BACKGROUND);
+
+  /* A list scrolled up exposes a strip at its bottom, and nothing outside it changes */
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  rec = (dlo_rect_t){ { 200, 420 }, 300, 20 };
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(0, 255, 0)), dlo_ok);
+  rec = (dlo_rect_t){ { 200, 400 }, 300, 200 };
+  CHECK_RET(dlo_move_rect(uid, NULL, &rec, 0, -20, true, exposed, &num), dlo_ok);
+  want0 = (dlo_rect_t){ { 200, 580 }, 300, 20 };
+  CHECK(num == 1 && same_rect(&exposed[0], &want0));
+  CHECK(pixel(uid, 200, 400) == DLO_RGB(0, 255, 0));
+  CHECK(pixel(uid, 200, 420) == BACKGROUND);
+  CHECK(pixel(uid, 200, 399) == BACKGROUND);
+
+  /* A window moved right off the screen uncovers all of where it was */
+  rec = (dlo_rect_t){ { 100, 100 }, 50, 50 };
+  CHECK_RET(dlo_move_rect(uid, NULL, &rec, 5000, 0, false, exposed, &num), dlo_ok);
+  CHECK(num == 1 && same_rect(&exposed[0], &rec));
+
+  /* A window dragged in from the left edge uncovers where its visible part was, and shows
+   * the part which was off the screen (the two may overlap)
+   */
+  rec = (dlo_rect_t){ { -50, 10 }, 100, 40 };
+  CHECK_RET(dlo_move_rect(uid, NULL, &rec, 60, 0, false, exposed, &num), dlo_ok);
+  want0 = (dlo_rect_t){ { 0, 10 }, 50, 40 };
+  want1 = (dlo_rect_t){ { 10, 10 }, 50, 40 };
+  CHECK(num == 2 && same_rect(&exposed[0], &want0) && same_rect(&exposed[1], &want1));
+
+  /* A rectangle entirely outside the viewport has nothing to move */
+  rec = (dlo_rect_t){ { -500, 10 }, 100, 40 };
+  CHECK_RET(dlo_move_rect(uid, NULL, &rec, 10, 0, false, exposed, &num), dlo_ok);
+  CHECK(num == 0);
+}
+
+
+/** Check that scenes are placed in device memory clear of the screen and each other.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void scene_test(const dlo_dev_t uid)
+{
+  dlo_mode_t *mode = dlo_get_mode(uid);
+  dlo_view_t  a, b, c, d, e, again;
+  dlo_ptr_t   size;
+
+  printf("test_sim: scene placement...\n");
+
+  /* A 24 bpp view takes two bytes per pixel for the 16 bpp plane and one for the 8 bpp plane */
+  size = (dlo_ptr_t)mode->view.width * mode->view.height * 3;
+  CHECK(mode->view.base == 0 && mode->view.bpp == 24);
+
+  /* Scenes fill the slots after the screen in turn, until the memory runs out */
+  CHECK_RET(dlo_new_scene(uid, "a", &a), dlo_ok);
+  CHECK_RET(dlo_new_scene(uid, "b", &b), dlo_ok);
+  CHECK_RET(dlo_new_scene(uid, "c", &c), dlo_ok);
+  CHECK(a.base == size && b.base == 2 * size && c.base == 3 * size);
+  CHECK(a.width == mode->view.width && a.height == mode->view.height && a.bpp == mode->view.bpp);
+  CHECK_RET(dlo_new_scene(uid, "d", &d), dlo_err_memory);
+
+  /* Asking for a scene again gives the same one */
+  CHECK_RET(dlo_new_scene(uid, "b", &again), dlo_ok);
+  CHECK(again.base == b.base);
+
+  /* A freed scene's slot is used again */
+  CHECK_RET(dlo_free_scene(uid, "b"), dlo_ok);
+  CHECK_RET(dlo_free_scene(uid, "b"), dlo_err_bad_view);
+  CHECK_RET(dlo_new_scene(uid, "d", &d), dlo_ok);
+  CHECK(d.base == b.base);
+
+  /* Once the screen shows another scene, its old slot is free */
+  CHECK_RET(dlo_show_scene(uid, "nope"), dlo_err_bad_view);
+  CHECK_RET(dlo_show_scene(uid, "a"), dlo_ok);
+  CHECK(dlo_get_mode(uid)->view.base == a.base);
+  CHECK_RET(dlo_new_scene(uid, "e", &e), dlo_ok);
+  CHECK(e.base == 0);
+
+  CHECK_RET(dlo_show_scene(uid, "e"), dlo_ok);
+  CHECK_RET(dlo_free_scene(uid, "a"), dlo_ok);
+  CHECK_RET(dlo_free_scene(uid, "c"), dlo_ok);
+  CHECK_RET(dlo_free_scene(uid, "d"), dlo_ok);
+  CHECK_RET(dlo_free_scene(uid, "e"), dlo_ok);
+}
+
+
+/** Look for a command in the part of the command stream which has been captured.
+ *
+ *  @param  cmd  Pointer to the bytes of the command.
+ *  @param  len  Number of bytes to look for.
+ *
+ *  @return  One more than the offset of the first copy of the command, or zero if it wasn't sent.
+ */
+static size_t sent(const uint8_t * const cmd, const size_t len)
+{
+  size_t end = usbsim_captured() < sizeof(stream) ? usbsim_captured() : sizeof(stream);
+  size_t i;
+
+  for (i = 0; i + len <= end; i++)
+  {
+    if (!memcmp(&stream[i], cmd, len))
+      return i + 1;
+  }
+  return 0;
+}
+
+
+/** Build the run length command which fills part of a screen line at 16 bpp.
+ *
+ *  @param  uid  Unique ID of the device.
+ *  @param  cmd  Pointer to where to build the nine byte command.
+ *  @param  x    Horizontal co-ordinate of the start of the line.
+ *  @param  y    Vertical co-ordinate of the line.
+ *  @param  len  Length of the line (1 to 256 pixels).
+ *  @param  col  Colour of the line.
+ */
+static void hline16(const dlo_dev_t uid, uint8_t * const cmd, const int32_t x, const int32_t y, const uint32_t len, const dlo_col32_t col)
+{
+  uint32_t addr  = 2u * (((uint32_t)y * dlo_get_mode(uid)->view.width) + (uint32_t)x);
+  uint32_t col16 = ((col & 0xF8) << 8) | (((col >> 8) & 0xFC) << 3) | ((col >> 16) & 0xFF) >> 3;
+
+  cmd[0] = 0xAF;
+  cmd[1] = 0x69;
+  cmd[2] = (uint8_t)(addr >> 16);
+  cmd[3] = (uint8_t)(addr >> 8);
+  cmd[4] = (uint8_t)addr;
+  cmd[5] = (uint8_t)len;
+  cmd[6] = (uint8_t)len;
+  cmd[7] = (uint8_t)(col16 >> 8);
+  cmd[8] = (uint8_t)col16;
+}
+
+
+/** Release the device and claim it again with different flags (and a shadow), in the usual mode.
+ *
+ *  @param  uid    Unique ID of the device.
+ *  @param  flags  Flags to claim it with.
+ */
+static void reclaim(const dlo_dev_t uid, dlo_claim_t flags)
+{
+  dlo_mode_t mode = { { 1280, 1024, 24, 0 }, 60 };
+
+  flags.shadow = 1;
+  CHECK_RET(dlo_release_device(uid), dlo_ok);
+  CHECK(dlo_claim_device(uid, flags, 0) == uid);
+  CHECK_RET(dlo_set_mode(uid, &mode), dlo_ok);
+}
+
+
+/** Note how much of the command stream had been sent when a fence was signalled.
+ *
+ *  @param  uid    Unique ID of the device.
+ *  @param  fence  The fence.
+ *  @param  pw     Pointer to where to store the number of bytes sent.
+ */
+static void fence_done(const dlo_dev_t uid, const dlo_fence_t fence, void * const pw)
+{
+  (void) uid;
+  (void) fence;
+  *(size_t *)pw = usbsim_captured();
+}
+
+
+/** Check that a fence is signalled once the commands before it have been sent.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void fence_test(const dlo_dev_t uid)
+{
+  /* Run length command for ten 16 bpp pixels at (20, 30) */
+  static const uint8_t hline[] = { 0xAF, 0x69, 0x01, 0x2C, 0x28, 10, 10 };
+  dlo_rect_t           rec     = { { 20, 30 }, 10, 1 };
+  dlo_fence_t          fence;
+  size_t               at      = 0;
+
+  printf("test_sim: fences...\n");
+
+  /* A blocking device has sent the fill by the time the call returns, so its fence is signalled */
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(0x80, 0x40, 0x20)), dlo_ok);
+  CHECK_RET(dlo_insert_fence(uid, &fence), dlo_ok);
+  CHECK(sent(hline, sizeof(hline)));
+  CHECK_RET(dlo_poll_fence(uid, fence), dlo_ok);
+  CHECK_RET(dlo_wait_fence(uid, fence, 1000), dlo_ok);
+
+  /* So a callback is made straight away, after the fill has gone */
+  CHECK_RET(dlo_notify_fence(uid, fence, fence_done, &at), dlo_ok);
+  CHECK(at != 0 && at == usbsim_captured());
+
+  /* A fence which was never handed out isn't signalled */
+  CHECK_RET(dlo_poll_fence(uid, fence + 1000), dlo_warn_fence_pending);
+  usbsim_capture(NULL, 0);
+}
+
+
+/** Check that a non-blocking device queues its commands until the event loop sends them.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void nonblock_test(const dlo_dev_t uid)
+{
+  /* Run length command for ten 16 bpp pixels at (20, 30) */
+  static const uint8_t hline[] = { 0xAF, 0x69, 0x01, 0x2C, 0x28, 10, 10 };
+  dlo_claim_t          flags   = { 0 };
+  dlo_xfer_t           xfer    = { 4096, 3, 0, 0 };
+  dlo_rect_t           rec     = { { 20, 30 }, 10, 1 };
+  dlo_pollfd_t         pfd;
+  dlo_fence_t          fence;
+  int32_t              timeout;
+  size_t               at      = 0;
+  uint32_t             i;
+
+  printf("test_sim: non-blocking queue...\n");
+
+  flags.nonblock = 1;
+  reclaim(uid, flags);
+  CHECK_RET(dlo_set_xfer(uid, &xfer), dlo_ok);
+
+  /* Nothing is sent by the drawing calls, and a USB device has no descriptor to watch */
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(0x20, 0x40, 0x80)), dlo_ok);
+  CHECK_RET(dlo_insert_fence(uid, &fence), dlo_ok);
+  CHECK_RET(dlo_notify_fence(uid, fence, fence_done, &at), dlo_ok);
+  CHECK_RET(dlo_get_poll(uid, &pfd, &timeout), dlo_ok);
+  CHECK(pfd.fd == -1 && timeout == 0);
+  CHECK_RET(dlo_poll_fence(uid, fence), dlo_warn_fence_pending);
+  CHECK(usbsim_captured() == 0 && at == 0);
+
+  /* A call which starts queues all of its commands, but then the queue is too full */
+  CHECK_RET(dlo_fill_rect(uid, NULL, NULL, BACKGROUND), dlo_ok);
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, BACKGROUND), dlo_err_would_block);
+
+  /* The event loop sends it all, signalling the fence once the first fill has gone */
+  for (i = 0; i < 10000 && dlo_get_poll(uid, &pfd, &timeout) == dlo_ok && timeout == 0; i++)
+    CHECK_RET(dlo_handle_events(uid), dlo_ok);
+  CHECK(timeout == -1);
+  CHECK(sent(hline, sizeof(hline)));
+  CHECK(at != 0 && at < usbsim_captured());
+  CHECK_RET(dlo_poll_fence(uid, fence), dlo_ok);
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, BACKGROUND), dlo_ok);
+  usbsim_capture(NULL, 0);
+
+  flags.nonblock = 0;
+  reclaim(uid, flags);
+}
+
+
+/** Check that only what a failed write would have drawn is sent again, from the shadow.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void repair_test(const dlo_dev_t uid)
+{
+  /* Raw write of twenty 16 bpp pixels at (100, 101) */
+  static const uint8_t raw[] = { 0xAF, 0x68, 0x03, 0xF2, 0xC8, 20 };
+  dlo_rect_t           rec   = { { 100, 100 }, 20, 2 };
+  dlo_col32_t          col   = DLO_RGB(0x11, 0x88, 0xEE);
+
+  printf("test_sim: repair after a failed write...\n");
+
+  usbsim_capture(stream, sizeof(stream));
+  usbsim_fail_bulk(1);
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, col), dlo_ok);
+
+  /* The lost fill is replaced by raw writes of just its pixels (three bytes each, plus headers) */
+  CHECK(sent(raw, sizeof(raw)));
+  CHECK(usbsim_captured() < 2u * 3u * rec.width * rec.height);
+  CHECK(pixel(uid, 119, 101) == col);
+  usbsim_capture(NULL, 0);
+}
+
+
+/** Check that a device's colour-correction table is applied to the colours it is sent.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void ctable_test(const dlo_dev_t uid)
+{
+  static uint8_t     red[256];
+  static uint8_t     blu[256];
+  static dlo_col32_t cube[8];
+  dlo_clut_t         clut;
+  dlo_rect_t         rec = { { 40, 60 }, 16, 1 };
+  dlo_col32_t        col = DLO_RGB(0x30, 0x50, 0x70);
+  dlo_col32_t        out = DLO_RGB(0xCF, 0x50, 0x38);
+  uint8_t            cmd[9];
+  uint32_t           i;
+
+  printf("test_sim: colour correction...\n");
+
+  /* Curves: red is turned upside down, green is left alone and blue is halved */
+  for (i = 0; i < 256; i++)
+  {
+    red[i] = (uint8_t)(255 - i);
+    blu[i] = (uint8_t)(i / 2);
+  }
+  memset(&clut, 0, sizeof(clut));
+  clut.red = red;
+  clut.blu = blu;
+  CHECK_RET(dlo_set_colour_lut(uid, &clut), dlo_ok);
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, col), dlo_ok);
+  hline16(uid, cmd, rec.origin.x, rec.origin.y, rec.width, out);
+  CHECK(sent(cmd, sizeof(cmd)));
+  CHECK(pixel(uid, rec.origin.x, rec.origin.y) == out);
+  usbsim_capture(NULL, 0);
+
+  /* A 3D table which inverts every component, falling exactly between its two samples */
+  for (i = 0; i < 8; i++)
+    cube[i] = DLO_RGB(i & 1 ? 0 : 255, i & 2 ? 0 : 255, i & 4 ? 0 : 255);
+  memset(&clut, 0, sizeof(clut));
+  clut.size = 2;
+  clut.cube = cube;
+  CHECK_RET(dlo_set_colour_lut(uid, &clut), dlo_ok);
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, BACKGROUND), dlo_ok);
+  CHECK(pixel(uid, rec.origin.x, rec.origin.y) == (DLO_RGB(0xFF, 0xFF, 0xFF) ^ BACKGROUND));
+
+  /* Without a table, colours are sent as they are */
+  clut.size = 1;
+  CHECK_RET(dlo_set_colour_lut(uid, &clut), dlo_err_bad_col);
+  CHECK_RET(dlo_set_colour_lut(uid, NULL), dlo_ok);
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, col), dlo_ok);
+  CHECK(pixel(uid, rec.origin.x, rec.origin.y) == col);
+}
+
+
+/** Check that blending a bitmap over the screen only sends the pixels which change.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void blend_test(const dlo_dev_t uid)
+{
+  /* Transparent, opaque, half and transparent red pixels (0xAARRGGBB) */
+  static const uint32_t pix[4] = { 0x00FF0000, 0xFFFF0000, 0x80FF0000, 0x00FF0000 };
+  /* Raw write of the middle two 16 bpp pixels at (201, 300) */
+  static const uint8_t  raw[]  = { 0xAF, 0x68, 0x0B, 0xB9, 0x92, 2 };
+  dlo_bmpflags_t        flags  = { 0 };
+  dlo_rect_t            rec    = { { 200, 300 }, 4, 1 };
+  dlo_dot_t             pos    = { 200, 300 };
+  dlo_col32_t           under  = DLO_RGB(0x00, 0x80, 0xFF);
+  dlo_fbuf_t            fbuf;
+
+  printf("test_sim: alpha blending...\n");
+
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = 4;
+  fbuf.height = 1;
+  fbuf.stride = 4;
+  fbuf.fmt    = dlo_pixfmt_argb8888;
+  fbuf.base   = (void *)pix;
+  flags.blend = 1;
+
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, under), dlo_ok);
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(sent(raw, sizeof(raw)));
+  CHECK(pixel(uid, 200, 300) == under);
+  CHECK(pixel(uid, 201, 300) == DLO_RGB(0xFF, 0x00, 0x00));
+  CHECK(pixel(uid, 202, 300) == DLO_RGB(0x80, 0x40, 0x7F));
+  CHECK(pixel(uid, 203, 300) == under);
+  usbsim_capture(NULL, 0);
+
+  /* Only bitmaps with an alpha channel can be blended */
+  fbuf.fmt = dlo_pixfmt_rgb888;
+  CHECK(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos) != dlo_ok);
+}
+
+
+/** Check reading the screen back into other pixel formats, and at its edges.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void readback_test(const dlo_dev_t uid)
+{
+  dlo_claim_t flags = { 0 };
+  dlo_rect_t  rec   = { { 1278, 500 }, 2, 1 };
+  dlo_dot_t   pos   = { 1278, 500 };
+  dlo_col32_t col   = DLO_RGB(0x12, 0x34, 0x56);
+  dlo_fbuf_t  fbuf;
+  uint32_t    argb[4];
+  uint16_t    rgb565[2];
+  uint8_t     idx[2] = { 0x99, 0x99 };
+  dlo_col32_t pal[BMP_PAL_ENTRIES] = { 0 };
+
+  printf("test_sim: read back...\n");
+
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, col), dlo_ok);
+
+  /* Reading comes from the shadow, so nothing is sent to the device */
+  usbsim_capture(stream, sizeof(stream));
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = 2;
+  fbuf.height = 1;
+  fbuf.stride = 2;
+  fbuf.fmt    = dlo_pixfmt_rgb565;
+  fbuf.base   = rgb565;
+  CHECK_RET(dlo_read_host_bmp(uid, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(rgb565[0] == ((0x12 & 0xF8) << 8 | (0x34 & 0xFC) << 3 | 0x56 >> 3) && rgb565[1] == rgb565[0]);
+
+  /* Alpha comes back opaque, and pixels beyond the right-hand edge are left alone */
+  argb[2]     = 0xDEADBEEF;
+  argb[3]     = 0xDEADBEEF;
+  fbuf.width  = 4;
+  fbuf.stride = 4;
+  fbuf.fmt    = dlo_pixfmt_argb8888;
+  fbuf.base   = argb;
+  CHECK_RET(dlo_read_host_bmp(uid, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(argb[0] == 0xFF123456 && argb[1] == 0xFF123456 && argb[2] == 0xDEADBEEF && argb[3] == 0xDEADBEEF);
+
+  /* Palette formats can't be read into */
+  fbuf.width  = 2;
+  fbuf.stride = 2;
+  fbuf.fmt    = dlo_pixfmt_lut8;
+  fbuf.lut    = pal;
+  fbuf.base   = idx;
+  CHECK(dlo_read_host_bmp(uid, &fbuf, NULL, &pos) != dlo_ok);
+  CHECK(idx[0] == 0x99 && idx[1] == 0x99);
+  CHECK(usbsim_captured() == 0);
+  usbsim_capture(NULL, 0);
+
+  /* Once claimed afresh, nothing is known about the screen until it is drawn on */
+  reclaim(uid, flags);
+  fbuf.fmt  = dlo_pixfmt_argb8888;
+  fbuf.base = argb;
+  argb[0]   = 0;
+  CHECK_RET(dlo_read_host_bmp(uid, &fbuf, NULL, &pos), dlo_err_unsupported);
+  CHECK(argb[0] == 0);
+}
+
+
+/** Check that bitmaps are sent according to the encoding policy of the region they're in.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void policy_test(const dlo_dev_t uid)
+{
+  /* Raw writes of eight pixels at (400, 400) in the 16 bpp and 8 bpp planes */
+  static const uint8_t raw16[] = { 0xAF, 0x68, 0x0F, 0xA3, 0x20, 8 };
+  static const uint8_t raw8[]  = { 0xAF, 0x60, 0x2F, 0xD1, 0x90, 8 };
+  static uint8_t       pix[8 * 3];
+  dlo_bmpflags_t       flags   = { 0 };
+  dlo_policy_t         policy;
+  dlo_rect_t           rec     = { { 400, 400 }, 8, 1 };
+  dlo_rect_t           off     = { { 1280, 0 }, 8, 8 };
+  dlo_dot_t            pos     = { 400, 400 };
+  dlo_fbuf_t           fbuf;
+
+  printf("test_sim: encoding policies...\n");
+
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = 8;
+  fbuf.height = 1;
+  fbuf.stride = 8;
+  fbuf.fmt    = dlo_pixfmt_rgb888;
+  fbuf.base   = pix;
+
+  /* A coarse region only gets the 16 bpp plane */
+  memset(&policy, 0, sizeof(policy));
+  policy.coarse   = true;
+  policy.priority = DLO_PRIORITY_MAX;
+  CHECK_RET(dlo_set_policy(uid, &rec, &policy), dlo_ok);
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(0, 0, 0)), dlo_ok);
+  memset(pix, 0x81, sizeof(pix));
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(sent(raw16, sizeof(raw16)) && !sent(raw8, sizeof(raw8)));
+
+  /* Small changes in a region with a threshold aren't sent, but bigger ones are */
+  policy.coarse    = false;
+  policy.threshold = 8;
+  CHECK_RET(dlo_set_policy(uid, &rec, &policy), dlo_ok);
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(0x80, 0x80, 0x80)), dlo_ok);
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(!sent(raw16, sizeof(raw16)) && !sent(raw8, sizeof(raw8)));
+  CHECK(pixel(uid, 400, 400) == DLO_RGB(0x80, 0x80, 0x80));
+  memset(pix, 0xC0, sizeof(pix));
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(sent(raw16, sizeof(raw16)) && sent(raw8, sizeof(raw8)));
+  CHECK(pixel(uid, 400, 400) == DLO_RGB(0xC0, 0xC0, 0xC0));
+
+  /* An update which comes too soon after the last one is dropped (start afresh, because the
+   * region remembers when it was last sent)
+   */
+  policy.threshold = 0;
+  policy.max_rate  = 1;
+  CHECK_RET(dlo_set_policy(uid, NULL, NULL), dlo_ok);
+  CHECK_RET(dlo_set_policy(uid, &rec, &policy), dlo_ok);
+  memset(pix, 0x40, sizeof(pix));
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(pixel(uid, 400, 400) == DLO_RGB(0x40, 0x40, 0x40));
+  memset(pix, 0x20, sizeof(pix));
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(!sent(raw16, sizeof(raw16)));
+  CHECK(pixel(uid, 400, 400) == DLO_RGB(0x40, 0x40, 0x40));
+
+  /* Once the policies have gone, every change is sent again */
+  CHECK_RET(dlo_set_policy(uid, NULL, NULL), dlo_ok);
+  CHECK_RET(dlo_set_policy(uid, &off, &policy), dlo_err_bad_area);
+  CHECK_RET(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &pos), dlo_ok);
+  CHECK(sent(raw16, sizeof(raw16)) && sent(raw8, sizeof(raw8)));
+  CHECK(pixel(uid, 400, 400) == DLO_RGB(0x20, 0x20, 0x20));
+  usbsim_capture(NULL, 0);
+}
+
+
+/** Check that command segments are sent in order when they're flushed, and not before.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void segment_test(const dlo_dev_t uid)
+{
+  static uint32_t pix[4];
+  dlo_bmpflags_t  flags = { 0 };
+  dlo_rect_t      rec   = { { 600, 800 }, 10, 1 };
+  dlo_dot_t       pos   = { 600, 800 };
+  dlo_surface_t   surf;
+  dlo_segment_t   late;
+  dlo_segment_t   early;
+  dlo_segment_t   next;
+  dlo_fbuf_t      fbuf;
+  uint8_t         red[9];
+  uint8_t         green[9];
+  uint8_t         blue[9];
+
+  printf("test_sim: command segments...\n");
+
+  CHECK_RET(dlo_prepare_surface(uid, NULL, &surf), dlo_ok);
+  CHECK_RET(dlo_new_segment(uid, 2, &late), dlo_ok);
+  CHECK_RET(dlo_new_segment(uid, 1, &early), dlo_ok);
+  CHECK_RET(dlo_new_segment(uid, 1, &next), dlo_ok);
+  hline16(uid, red,   600, 800, 10, DLO_RGB(0xFF, 0, 0));
+  hline16(uid, green, 600, 800, 10, DLO_RGB(0, 0xFF, 0));
+  hline16(uid, blue,  600, 800, 10, DLO_RGB(0, 0, 0xFF));
+
+  /* Nothing is sent until the segments are flushed */
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_segment_fill(late,  &surf, &rec, DLO_RGB(0xFF, 0, 0)), dlo_ok);
+  CHECK_RET(dlo_segment_fill(next,  &surf, &rec, DLO_RGB(0, 0, 0xFF)), dlo_ok);
+  CHECK_RET(dlo_segment_fill(early, &surf, &rec, DLO_RGB(0, 0xFF, 0)), dlo_ok);
+  CHECK(usbsim_captured() == 0);
+
+  /* Lower orders go first, then segments with the same order go in the order they were made */
+  CHECK_RET(dlo_flush_segments(uid), dlo_ok);
+  CHECK(sent(green, sizeof(green)) && sent(green, sizeof(green)) < sent(blue, sizeof(blue)));
+  CHECK(sent(blue, sizeof(blue)) && sent(blue, sizeof(blue)) < sent(red, sizeof(red)));
+  CHECK(pixel(uid, 605, 800) == DLO_RGB(0xFF, 0, 0));
+
+  /* The segments were left empty */
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_flush_segments(uid), dlo_ok);
+  CHECK(usbsim_captured() == 0);
+
+  /* Blending and paletted bitmaps without a palette are turned down */
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = 4;
+  fbuf.height = 1;
+  fbuf.stride = 4;
+  fbuf.fmt    = dlo_pixfmt_lut8;
+  fbuf.base   = pix;
+  CHECK_RET(dlo_segment_copy_host_bmp(early, &surf, flags, &fbuf, &pos), dlo_err_bad_fbuf);
+  fbuf.fmt    = dlo_pixfmt_argb8888;
+  flags.blend = 1;
+  CHECK_RET(dlo_segment_copy_host_bmp(early, &surf, flags, &fbuf, &pos), dlo_err_unsupported);
+  CHECK_RET(dlo_flush_segments(uid), dlo_ok);
+  CHECK(usbsim_captured() == 0);
+  usbsim_capture(NULL, 0);
+
+  dlo_free_segment(late);
+  dlo_free_segment(early);
+  dlo_free_segment(next);
+}
+
+
+/** Check the commands sent to fill and copy a line which is longer than one command can cover.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void line_test(const dlo_dev_t uid)
+{
+  /* Pairs of 16 bpp and 8 bpp run length commands for 256, 256 and 88 white pixels at (0, 300) */
+  static const uint8_t fill[] =
+  {
+    0xAF, 0x69, 0x0B, 0xB8, 0x00, 0x00, 0x00, 0xFF, 0xFF,  0xAF, 0x61, 0x2D, 0xDC, 0x00, 0x00, 0x00, 0xFF,
+    0xAF, 0x69, 0x0B, 0xBA, 0x00, 0x00, 0x00, 0xFF, 0xFF,  0xAF, 0x61, 0x2D, 0xDD, 0x00, 0x00, 0x00, 0xFF,
+    0xAF, 0x69, 0x0B, 0xBC, 0x00, 0x58, 0x58, 0xFF, 0xFF,  0xAF, 0x61, 0x2D, 0xDE, 0x00, 0x58, 0x58, 0xFF
+  };
+  /* Pairs of 16 bpp and 8 bpp copy commands for the same line, to (0, 310) */
+  static const uint8_t copy[] =
+  {
+    0xAF, 0x6A, 0x0C, 0x1C, 0x00, 0x00, 0x0B, 0xB8, 0x00,  0xAF, 0x62, 0x2E, 0x0E, 0x00, 0x00, 0x2D, 0xDC, 0x00,
+    0xAF, 0x6A, 0x0C, 0x1E, 0x00, 0x00, 0x0B, 0xBA, 0x00,  0xAF, 0x62, 0x2E, 0x0F, 0x00, 0x00, 0x2D, 0xDD, 0x00,
+    0xAF, 0x6A, 0x0C, 0x20, 0x00, 0x58, 0x0B, 0xBC, 0x00,  0xAF, 0x62, 0x2E, 0x10, 0x00, 0x58, 0x2D, 0xDE, 0x00
+  };
+  dlo_rect_t rec = { { 0, 300 }, 600, 1 };
+  dlo_dot_t  pos = { 0, 310 };
+
+  printf("test_sim: long lines...\n");
+
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(0xFF, 0xFF, 0xFF)), dlo_ok);
+  CHECK(usbsim_captured() == sizeof(fill) && sent(fill, sizeof(fill)));
+
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_copy_rect(uid, NULL, &rec, NULL, &pos), dlo_ok);
+  CHECK(usbsim_captured() == sizeof(copy) && sent(copy, sizeof(copy)));
+  CHECK(pixel(uid, 599, 310) == DLO_RGB(0xFF, 0xFF, 0xFF));
+  usbsim_capture(NULL, 0);
+}
+
+
+/** Check that a device claimed for real-time use allocates its buffers up front, and gives
+ *  them all back when it's released.
+ *
+ *  @param  uid  Unique ID of the device.
+ */
+static void rt_test(const dlo_dev_t uid)
+{
+  static uint8_t pix[16 * 16 * 3];
+  dlo_claim_t    flags  = { 0 };
+  dlo_mode_t     mode   = { { 1280, 1024, 24, 0 }, 60 };
+  dlo_bmpflags_t bflags = { 0 };
+  dlo_rtstats_t  stats;
+  dlo_rect_t     rec    = { { 800, 100 }, 16, 16 };
+  dlo_dot_t      pos    = { 800, 100 };
+  dlo_fbuf_t     fbuf;
+  uint8_t        cmd[9];
+
+  printf("test_sim: real-time buffers...\n");
+
+  flags.realtime = 1;
+  reclaim(uid, flags);
+  CHECK_RET(dlo_get_rt_stats(uid, &stats), dlo_ok);
+  CHECK(stats.pinned + stats.unpinned >= (uint64_t)mode.view.width * mode.view.height * 3);
+  CHECK(stats.allocs == 0);
+
+  /* Drawing uses the buffers made when the device was claimed */
+  memset(&fbuf, 0, sizeof(fbuf));
+  fbuf.width  = 16;
+  fbuf.height = 16;
+  fbuf.stride = 16;
+  fbuf.fmt    = dlo_pixfmt_rgb888;
+  fbuf.base   = pix;
+  memset(pix, 0x60, sizeof(pix));
+  hline16(uid, cmd, 800, 100, 16, DLO_RGB(0x10, 0x20, 0x30));
+  usbsim_capture(stream, sizeof(stream));
+  CHECK_RET(dlo_fill_rect(uid, NULL, &rec, DLO_RGB(0x10, 0x20, 0x30)), dlo_ok);
+  CHECK(sent(cmd, sizeof(cmd)));
+  CHECK_RET(dlo_copy_host_bmp(uid, bflags, &fbuf, NULL, &pos), dlo_ok);
+  pos.x = 900;
+  CHECK_RET(dlo_copy_rect(uid, NULL, &rec, NULL, &pos), dlo_ok);
+  CHECK(pixel(uid, 915, 115) == DLO_RGB(0x60, 0x60, 0x60));
+  usbsim_capture(NULL, 0);
+  CHECK_RET(dlo_get_rt_stats(uid, &stats), dlo_ok);
+  CHECK(stats.allocs == 0);
+
+  /* Nothing is left behind once the device is released, or claimed again without the flag */
+  CHECK_RET(dlo_release_device(uid), dlo_ok);
+  CHECK_RET(dlo_get_rt_stats(uid, &stats), dlo_ok);
+  CHECK(stats.pinned + stats.unpinned == 0);
+  flags.realtime = 0;
+  flags.shadow   = 1;
+  CHECK(dlo_claim_device(uid, flags, 0) == uid);
+  CHECK_RET(dlo_set_mode(uid, &mode), dlo_ok);
+  CHECK_RET(dlo_get_rt_stats(uid, &stats), dlo_ok);
+  CHECK(stats.pinned + stats.unpinned == 0);
+}
+
+
+int main(int argc, char *argv[])
+{
+  dlo_init_t        ini_flags = { 0 };
+  dlo_final_t       fin_flags = { 0 };
+  dlo_claim_t       cnf_flags = { 0 };
+  usbsim_profile_t  prof;
+  dlo_devlist_t    *list;
+  dlo_dev_t         uid;
+  dlo_mode_t        mode = { { 1280, 1024, 24, 0 }, 60 };
+
+  (void) argc;
+  (void) argv;
+
+  srand(1);
+  if (!mkdtemp(dir))
+  {
+    printf("test_sim: ERROR: can't make a directory for the test files\n");
+    return 1;
+  }
+
+  /* One simulated adapter, as fast as the host can drive it */
+  usbsim_default_profile(&prof);
+  prof.bulk_us   = 0;
+  prof.bulk_kbps = 0;
+
+  /* No EDID, so every predefined mode is offered (including those which warn on a DL120)
+   * and the tests have to pick the mode themselves
+   */
+  memset(prof.edid, 0, sizeof(prof.edid));
+  usbsim_reset();
+  usbsim_add_device(&prof);
+
+  if (dlo_init(ini_flags) != dlo_ok)
+    return 1;
+  list = dlo_enumerate_devices();
+  if (!list)
+  {
+    printf("test_sim: ERROR: the simulated adapter wasn't found\n");
+    return 1;
+  }
+  cnf_flags.shadow = 1;
+  uid = dlo_claim_device(list->dev.uid, cnf_flags, 0);
+  if (!uid)
+  {
+    printf("test_sim: ERROR: the simulated adapter couldn't be claimed\n");
+    return 1;
+  }
+  CHECK_RET(dlo_set_mode(uid, &mode), dlo_ok);
+
+  bmp_test(uid);
+  trace_test(uid);
+  move_test(uid);
+  scene_test(uid);
+  fence_test(uid);
+  nonblock_test(uid);
+  repair_test(uid);
+  ctable_test(uid);
+  blend_test(uid);
+  readback_test(uid);
+  policy_test(uid);
+  segment_test(uid);
+  line_test(uid);
+  rt_test(uid);
+
+  dlo_release_device(uid);
+  dlo_final(fin_flags);
+
+  /* Leave the files behind if anything went wrong, to help find out why */
+  if (failures)
+  {
+    printf("test_sim: %u checks failed (files are in %s)\n", failures, dir);
+    return 1;
+  }
+  while (num_names)
+    (void) remove(path_of(names[--num_names]));
+  (void) rmdir(dir);
+  printf("test_sim: all checks passed.\n");
+  return 0;
+}
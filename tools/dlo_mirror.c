@@ -0,0 +1,431 @@
+/** @file dlo_mirror.c
+ *
+ *  @brief Mirror a memory-mapped framebuffer file onto a DisplayLink device.
+ *
+ *  The framebuffer file is typically a shared memory buffer in /dev/shm or the
+ *  XWD format screen file written by Xvfb when run with the -fbdir option. The
+ *  device is claimed with a shadow of its memory so that each tick only sends
+ *  the parts of the framebuffer which have changed since the previous tick.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../src/libdlo.h"
+#include "../src/dlo_defs.h"
+
+
+/** Default number of frames per second to mirror.
+ */
+#define DEFAULT_RATE (30)
+
+/** Size of the fixed part of an XWD file header (bytes).
+ */
+#define XWD_HEADER_SZ (100)
+
+/** XWD file format version number.
+ */
+#define XWD_FILE_VERSION (7)
+
+/** XWD pixmap format for ZPixmap images.
+ */
+#define XWD_ZPIXMAP (2)
+
+/** Size of each colour map entry following the XWD header (bytes).
+ */
+#define XWD_COLOUR_SZ (12)
+
+/** Number of nanoseconds in a second.
+ */
+#define NSEC_PER_SEC (1000000000ll)
+
+/** Note an error message and jump to the clean-up code (which releases the device).
+ */
+#define FAIL(str) do { msg = (str); goto error; } while (0)
+
+
+/** Association between a pixel format name on the command line and a @a dlo_pixfmt_t.
+ */
+typedef struct fmt_name_s
+{
+  const char  *name;       /**< Name of the pixel format. */
+  dlo_pixfmt_t fmt;        /**< Corresponding libdlo pixel format. */
+} fmt_name_t;              /**< A struct @a fmt_name_s. */
+
+
+/** Settings gathered from the command line.
+ */
+typedef struct mirror_s
+{
+  const char  *file;       /**< Name of the framebuffer file to mirror. */
+  bool         xwd;        /**< Read the geometry from an XWD header at the start of the file. */
+  uint32_t     width;      /**< Width of the framebuffer (pixels). */
+  uint32_t     height;     /**< Height of the framebuffer (pixels). */
+  uint32_t     stride;     /**< Stride of the framebuffer (pixels), zero for same as width. */
+  uint32_t     offset;     /**< Offset of the first pixel from the start of the file (bytes). */
+  dlo_pixfmt_t fmt;        /**< Pixel format of the framebuffer. */
+  dlo_rect_t   region;     /**< Region of the framebuffer to mirror (zero width for all of it). */
+  dlo_dot_t    pos;        /**< Position on the screen to mirror to. */
+  uint32_t     rate;       /**< Frames per second. */
+  bool         v_flip;     /**< The framebuffer is stored bottom row first. */
+  char         remote[256];/**< Host serving a remote device to mirror to (empty for a local device). */
+  uint32_t     port;       /**< TCP port of the remote device (zero for the default). */
+  bool         lz4;        /**< Compress the command stream sent to the remote device. */
+} mirror_t;                /**< A struct @a mirror_s. */
+
+
+/** Pixel formats which may be named on the command line.
+ */
+static const fmt_name_t fmt_names[] =
+{
+  { "bgr323",   dlo_pixfmt_bgr323   },
+  { "rgb323",   dlo_pixfmt_rgb323   },
+  { "bgr565",   dlo_pixfmt_bgr565   },
+  { "rgb565",   dlo_pixfmt_rgb565   },
+  { "sbgr1555", dlo_pixfmt_sbgr1555 },
+  { "srgb1555", dlo_pixfmt_srgb1555 },
+  { "bgr888",   dlo_pixfmt_bgr888   },
+  { "rgb888",   dlo_pixfmt_rgb888   },
+  { "abgr8888", dlo_pixfmt_abgr8888 },
+  { "argb8888", dlo_pixfmt_argb8888 }
+};
+
+
+/** Set by the signal handler when it's time to stop mirroring.
+ */
+static volatile sig_atomic_t stop = 0;
+
+
+/** Report an error and exit (only while parsing the command line, before libdlo is initialised).
+ *
+ *  @param  str  Pointer to the error message string.
+ */
+static void my_error(const char * const str)
+{
+  fprintf(stderr, "dlo_mirror: ERROR: %s\n", str);
+  exit(1);
+}
+
+
+/** Print the command line syntax and exit.
+ */
+static void usage(void)
+{
+  printf("Usage: dlo_mirror [options] <file>\n"
+         "\n"
+         "  --xwd              file is an XWD image (e.g. from Xvfb -fbdir); read geometry from it\n"
+         "  --size=WxH         framebuffer width and height (pixels)\n"
+         "  --stride=N         framebuffer stride (pixels, default is the width)\n"
+         "  --offset=N         offset of the first pixel in the file (bytes)\n"
+         "  --format=NAME      pixel format (e.g. rgb565, argb8888; default argb8888)\n"
+         "  --region=X,Y,W,H   only mirror this rectangle of the framebuffer\n"
+         "  --pos=X,Y          screen position to mirror to (default 0,0)\n"
+         "  --rate=N           frames per second (default %u)\n"
+         "  --flip             framebuffer is stored bottom row first\n"
+         "  --remote=HOST[:N]  mirror to the device served by dlo_netrecv on HOST (port N)\n"
+         "  --lz4              compress the command stream sent to a remote device\n"
+         "  --dlo:display=SER  serial number of the device to claim\n", DEFAULT_RATE);
+  exit(1);
+}
+
+
+/** Signal handler to request a clean exit.
+ *
+ *  @param  sig  Signal number.
+ */
+static void on_signal(int sig)
+{
+  IGNORE(sig);
+  stop = 1;
+}
+
+
+/** Read a 32 bit big-endian value from an XWD header.
+ *
+ *  @param  ptr  Pointer to the value.
+ *
+ *  @return  Value in host byte order.
+ */
+static uint32_t xwd_word(const uint8_t * const ptr)
+{
+  return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+}
+
+
+/** Fill in the framebuffer geometry from the XWD header at the start of a mapped file.
+ *
+ *  @param  mir   Pointer to the settings structure to update.
+ *  @param  base  Pointer to the start of the mapped file.
+ *  @param  size  Size of the mapped file (bytes).
+ *
+ *  @return  NULL if successful, else a pointer to an error message string.
+ */
+static const char *parse_xwd(mirror_t * const mir, const uint8_t * const base, const size_t size)
+{
+  uint32_t bpp, red_mask, lsb_first;
+
+  if (size < XWD_HEADER_SZ || xwd_word(base + 4) != XWD_FILE_VERSION)
+    return "Not an XWD file";
+  if (xwd_word(base + 8) != XWD_ZPIXMAP)
+    return "Unsupported XWD pixmap format";
+
+  mir->width  = xwd_word(base + 16);
+  mir->height = xwd_word(base + 20);
+  lsb_first   = xwd_word(base + 28) == 0;
+  bpp         = xwd_word(base + 44);
+  red_mask    = xwd_word(base + 56);
+  mir->offset = xwd_word(base + 0) + (XWD_COLOUR_SZ * xwd_word(base + 76));
+
+  if (!lsb_first)
+    return "Only little-endian XWD pixel data is supported";
+  if (!bpp || xwd_word(base + 48) % (bpp / 8))
+    return "XWD line length is not a whole number of pixels";
+  mir->stride = xwd_word(base + 48) / (bpp / 8);
+
+  switch (bpp)
+  {
+    case 16:
+      mir->fmt = red_mask == 0xF800 ? dlo_pixfmt_rgb565 : dlo_pixfmt_bgr565;
+      break;
+    case 24:
+      mir->fmt = red_mask == 0xFF0000 ? dlo_pixfmt_rgb888 : dlo_pixfmt_bgr888;
+      break;
+    case 32:
+      mir->fmt = red_mask == 0xFF0000 ? dlo_pixfmt_argb8888 : dlo_pixfmt_abgr8888;
+      break;
+    default:
+      return "Unsupported XWD colour depth";
+  }
+  return NULL;
+}
+
+
+/** Parse the command line into a settings structure.
+ *
+ *  @param  mir   Pointer to the settings structure to fill in.
+ *  @param  argc  Number of arguments.
+ *  @param  argv  Argument strings.
+ */
+static void parse_args(mirror_t * const mir, const int argc, char *argv[])
+{
+  int i;
+
+  memset(mir, 0, sizeof(*mir));
+  mir->fmt  = dlo_pixfmt_argb8888;
+  mir->rate = DEFAULT_RATE;
+
+  for (i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    int         x, y, w, h;
+
+    if (!strncmp(arg, "--dlo:", 6))
+      ;
+    else if (!strcmp(arg, "--xwd"))
+      mir->xwd = true;
+    else if (!strcmp(arg, "--lz4"))
+      mir->lz4 = true;
+    else if (sscanf(arg, "--remote=%255[^:]:%u", mir->remote, &mir->port) >= 1)
+      ;
+    else if (!strcmp(arg, "--flip"))
+      mir->v_flip = true;
+    else if (sscanf(arg, "--size=%ux%u", &mir->width, &mir->height) == 2)
+      ;
+    else if (sscanf(arg, "--stride=%u", &mir->stride) == 1)
+      ;
+    else if (sscanf(arg, "--offset=%u", &mir->offset) == 1)
+      ;
+    else if (sscanf(arg, "--rate=%u", &mir->rate) == 1)
+      ;
+    else if (sscanf(arg, "--pos=%d,%d", &x, &y) == 2)
+    {
+      mir->pos.x = x;
+      mir->pos.y = y;
+    }
+    else if (sscanf(arg, "--region=%d,%d,%d,%d", &x, &y, &w, &h) == 4)
+    {
+      if (x < 0 || y < 0 || w <= 0 || h <= 0)
+        my_error("Bad region");
+      mir->region.origin.x = x;
+      mir->region.origin.y = y;
+      mir->region.width    = w;
+      mir->region.height   = h;
+    }
+    else if (!strncmp(arg, "--format=", 9))
+    {
+      uint32_t n;
+
+      for (n = 0; n < sizeof(fmt_names) / sizeof(fmt_names[0]); n++)
+        if (!strcmp(arg + 9, fmt_names[n].name))
+          break;
+      if (n == sizeof(fmt_names) / sizeof(fmt_names[0]))
+        my_error("Unknown pixel format");
+      mir->fmt = fmt_names[n].fmt;
+    }
+    else if (arg[0] == '-')
+      usage();
+    else
+      mir->file = arg;
+  }
+
+  if (!mir->file || !mir->rate)
+    usage();
+}
+
+
+/** Add a number of nanoseconds to a time.
+ *
+ *  @param  ts    Pointer to the time to update.
+ *  @param  nsec  Number of nanoseconds to add.
+ */
+static void add_nsec(struct timespec * const ts, const int64_t nsec)
+{
+  int64_t t = ts->tv_nsec + nsec;
+
+  ts->tv_sec  += t / NSEC_PER_SEC;
+  ts->tv_nsec  = t % NSEC_PER_SEC;
+}
+
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+  dlo_init_t      ini_flags = { 0 };
+  dlo_final_t     fin_flags = { 0 };
+  dlo_claim_t     cnf_flags = { 0 };
+  dlo_netflags_t  net_flags = { 0 };
+  dlo_bmpflags_t  flags     = { 0 };
+  dlo_retcode_t   err       = dlo_ok;
+  dlo_dev_t       uid       = 0;
+  const char     *msg       = NULL;
+  uint8_t        *map       = MAP_FAILED;
+  dlo_fbuf_t      fbuf;
+  mirror_t        mir;
+  struct stat     st;
+  struct timespec tick;
+  uint32_t        bypp;
+  uint32_t        frames    = 0;
+  uint32_t        skipped   = 0;
+  int             fd        = -1;
+
+  /* Initialise libdlo and claim the device (local, or served by another machine) */
+  parse_args(&mir, argc, argv);
+  ERR_GOTO(dlo_init(ini_flags));
+  cnf_flags.shadow = 1;
+  if (mir.remote[0])
+  {
+    net_flags.compress = mir.lz4;
+    uid = dlo_add_net_device(mir.remote, mir.port, net_flags);
+    if (uid)
+      uid = dlo_claim_device(uid, cnf_flags, 0);
+  }
+  else
+    uid = dlo_claim_default_device(&argc, argv, cnf_flags, 0);
+  if (!uid)
+    FAIL("No DisplayLink device could be claimed");
+
+  /* Map the framebuffer file */
+  fd = open(mir.file, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st))
+    FAIL("Unable to open the framebuffer file");
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    FAIL("Unable to map the framebuffer file");
+  if (mir.xwd && (msg = parse_xwd(&mir, map, st.st_size)) != NULL)
+    goto error;
+  if (!mir.width || !mir.height)
+    FAIL("Framebuffer size must be given (--size or --xwd)");
+  if (!mir.stride)
+    mir.stride = mir.width;
+
+  /* Check that the framebuffer fits inside the file */
+  bypp = FORMAT_TO_BYTES_PER_PIXEL(mir.fmt);
+  if ((uint64_t)mir.offset + ((uint64_t)mir.stride * (mir.height - 1) + mir.width) * bypp > (uint64_t)st.st_size)
+    FAIL("Framebuffer file is too small for the specified geometry");
+
+  /* Describe the region to mirror */
+  if (!mir.region.width)
+  {
+    mir.region.width  = mir.width;
+    mir.region.height = mir.height;
+  }
+  if (mir.region.origin.x < 0 || mir.region.origin.y < 0 ||
+      (uint32_t)mir.region.origin.x + mir.region.width > mir.width ||
+      (uint32_t)mir.region.origin.y + mir.region.height > mir.height)
+    FAIL("Region lies outside of the framebuffer");
+  fbuf.width   = mir.region.width;
+  fbuf.height  = mir.region.height;
+  fbuf.fmt     = mir.fmt;
+  fbuf.stride  = mir.stride;
+  fbuf.base    = map + mir.offset + (bypp * (mir.region.origin.x + (mir.stride * mir.region.origin.y)));
+  flags.v_flip = mir.v_flip;
+  if (mir.v_flip)
+    fbuf.base  = map + mir.offset + (bypp * (mir.region.origin.x + (mir.stride * (mir.height - mir.region.origin.y - mir.region.height))));
+
+  signal(SIGINT,  on_signal);
+  signal(SIGTERM, on_signal);
+  printf("dlo_mirror: %ux%u region of '%s' at %u fps\n", fbuf.width, fbuf.height, mir.file, mir.rate);
+
+  /* Send a frame at every tick. Because the device is shadowed, only the rows and spans
+   * which changed since the previous frame are actually sent. If we fall behind, skip
+   * ticks rather than trying to catch up with a burst of frames.
+   */
+  clock_gettime(CLOCK_MONOTONIC, &tick);
+  while (!stop)
+  {
+    struct timespec now;
+
+    ERR_GOTO(dlo_copy_host_bmp(uid, flags, &fbuf, NULL, &mir.pos));
+    frames++;
+
+    add_nsec(&tick, NSEC_PER_SEC / mir.rate);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (now.tv_sec > tick.tv_sec || (now.tv_sec == tick.tv_sec && now.tv_nsec > tick.tv_nsec))
+    {
+      add_nsec(&tick, NSEC_PER_SEC / mir.rate);
+      skipped++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, NULL) == EINTR && !stop)
+      ;
+  }
+  printf("dlo_mirror: %u frames sent, %u ticks skipped\n", frames, skipped);
+
+error:
+  if (msg)
+    fprintf(stderr, "dlo_mirror: ERROR: %s\n", msg);
+  if (err != dlo_ok)
+    fprintf(stderr, "dlo_mirror: error %u '%s'\n", (int)err, dlo_strerror(err));
+  if (map != MAP_FAILED)
+    (void) munmap(map, st.st_size);
+  if (fd >= 0)
+    (void) close(fd);
+  if (uid)
+    dlo_release_device(uid);
+  (void) dlo_final(fin_flags);
+
+  return (err == dlo_ok && !msg) ? 0 : 1;
+}
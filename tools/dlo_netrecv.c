@@ -0,0 +1,87 @@
+/** @file dlo_netrecv.c
+ *
+ *  @brief Serve a local DisplayLink device to a render host over the network.
+ *
+ *  The render host adds the device with dlo_add_net_device() and does all of the
+ *  drawing and encoding itself. This receiver just writes the command stream that
+ *  arrives over TCP to the device (and answers channel selection and EDID requests).
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/libdlo.h"
+
+
+/** Report an error and exit.
+ *
+ *  @param  str  Pointer to the error message string.
+ */
+static void my_error(const char * const str)
+{
+  fprintf(stderr, "dlo_netrecv: ERROR: %s\n", str);
+  exit(1);
+}
+
+
+/** Print the command line syntax and exit.
+ */
+static void usage(void)
+{
+  printf("Usage: dlo_netrecv [options]\n"
+         "\n"
+         "  --port=N           TCP port to listen on (default %u)\n"
+         "  --dlo:display=SER  serial number of the device to serve\n", DLO_NET_PORT);
+  exit(1);
+}
+
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+  dlo_init_t    ini_flags = { 0 };
+  dlo_final_t   fin_flags = { 0 };
+  dlo_claim_t   cnf_flags = { 0 };
+  dlo_retcode_t err;
+  dlo_dev_t     uid;
+  unsigned int  port      = DLO_NET_PORT;
+  int           i;
+
+  err = dlo_init(ini_flags);
+  if (err != dlo_ok)
+    my_error(dlo_strerror(err));
+
+  /* Claim the device (this also strips any --dlo: options) */
+  uid = dlo_claim_default_device(&argc, argv, cnf_flags, 0);
+  for (i = 1; i < argc; i++)
+    if (sscanf(argv[i], "--port=%u", &port) != 1 || !port || port > 0xFFFF)
+      usage();
+  if (!uid)
+    my_error("No DisplayLink device could be claimed");
+
+  printf("dlo_netrecv: serving '%s' on port %u\n", dlo_device_info(uid)->serial, port);
+  err = dlo_serve_device(uid, port);
+  fprintf(stderr, "dlo_netrecv: error %u '%s'\n", (int)err, dlo_strerror(err));
+
+  (void) dlo_release_device(uid);
+  (void) dlo_final(fin_flags);
+
+  return 1;
+}
@@ -0,0 +1,225 @@
+/** @file dlo_usbbench.c
+ *
+ *  @brief Time device start-up against simulated USB adapters.
+ *
+ *  The program is linked with usbsim.c, so libdlo talks to simulated adapters rather
+ *  than the real USB bus and no hardware (or root access) is needed. For each number of
+ *  adapters from one up to the maximum, it times the initialisation of libdlo (which
+ *  enumerates the bus), a further enumeration, claiming every adapter (which reads its
+ *  EDID and sets the native mode) and an explicit mode set on every adapter.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/libdlo.h"
+#include "usbsim.h"
+
+
+/** Default largest number of simulated adapters.
+ */
+#define DEFAULT_MAX (16)
+
+/** Number of stages timed for each number of adapters.
+ */
+#define NUM_STAGES (4)
+
+
+/** Names of the stages, as printed in the results table.
+ */
+static const char * const stage_name[NUM_STAGES] = { "init", "enum", "claim", "mode" };
+
+
+/** Report an error and exit.
+ *
+ *  @param  str  Pointer to the error message string.
+ */
+static void my_error(const char * const str)
+{
+  fprintf(stderr, "dlo_usbbench: ERROR: %s\n", str);
+  exit(1);
+}
+
+
+/** Print the command line syntax and exit.
+ */
+static void usage(void)
+{
+  printf("Usage: dlo_usbbench [options]\n"
+         "\n"
+         "  --max=N            largest number of simulated adapters, 1 to %u (default %u)\n"
+         "  --runs=N           number of times to repeat each measurement (default 1)\n"
+         "  --profiles=FILE    adapter profiles, one per line (used in turn)\n", USBSIM_MAX_DEVICES, DEFAULT_MAX);
+  exit(1);
+}
+
+
+/** Return the number of milliseconds elapsed since a given time.
+ *
+ *  @param  start  Pointer to the start time (updated to the current time).
+ *
+ *  @return  Elapsed time in milliseconds.
+ */
+static double lap_ms(struct timespec * const start)
+{
+  struct timespec now;
+  double          ms;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ms     = ((now.tv_sec - start->tv_sec) * 1000.0) + ((now.tv_nsec - start->tv_nsec) / 1000000.0);
+  *start = now;
+
+  return ms;
+}
+
+
+/** Bring up a set of simulated adapters and time each stage.
+ *
+ *  @param  prof   Array of profiles to use in turn.
+ *  @param  nprof  Number of entries in @a prof.
+ *  @param  num    Number of adapters to plug in.
+ *  @param  ms     Array of @c NUM_STAGES times to add the results to.
+ */
+static void bench(const usbsim_profile_t * const prof, const int nprof, const int num, double * const ms)
+{
+  dlo_init_t       ini_flags = { 0 };
+  dlo_final_t      fin_flags = { 0 };
+  dlo_claim_t      cnf_flags = { 0 };
+  dlo_dev_t        uid[USBSIM_MAX_DEVICES];
+  dlo_devlist_t   *list;
+  dlo_devlist_t   *node;
+  dlo_mode_t       mode;
+  dlo_retcode_t    err;
+  struct timespec  start;
+  int              claimed = 0;
+  int              i;
+
+  /* Plug in the adapters, giving each a serial number of its own */
+  usbsim_reset();
+  for (i = 0; i < num; i++)
+  {
+    usbsim_profile_t p = prof[i % nprof];
+
+    if (i >= nprof)
+      snprintf(p.serial + strlen(p.serial), sizeof(p.serial) - strlen(p.serial), "-%d", i);
+    (void) usbsim_add_device(&p);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  err = dlo_init(ini_flags);
+  if (err != dlo_ok)
+    my_error(dlo_strerror(err));
+  ms[0] += lap_ms(&start);
+
+  list = dlo_enumerate_devices();
+  ms[1] += lap_ms(&start);
+
+  for (node = list; node; node = node->next)
+    if (dlo_claim_device(node->dev.uid, cnf_flags, 0))
+      uid[claimed++] = node->dev.uid;
+  ms[2] += lap_ms(&start);
+  if (claimed != num)
+    my_error("Not all of the simulated adapters could be claimed");
+
+  mode.view.width  = 1024;
+  mode.view.height = 768;
+  mode.view.bpp    = 24;
+  mode.view.base   = 0;
+  mode.refresh     = 0;
+  for (i = 0; i < claimed; i++)
+  {
+    err = dlo_set_mode(uid[i], &mode);
+    if (err != dlo_ok)
+      my_error(dlo_strerror(err));
+  }
+  ms[3] += lap_ms(&start);
+
+  for (i = 0; i < claimed; i++)
+    (void) dlo_release_device(uid[i]);
+  while (list)
+  {
+    node = list->next;
+    dlo_free(list);
+    list = node;
+  }
+  (void) dlo_final(fin_flags);
+}
+
+
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+  static usbsim_profile_t prof[USBSIM_MAX_DEVICES];
+  const char             *file  = NULL;
+  unsigned int            max   = DEFAULT_MAX;
+  unsigned int            runs  = 1;
+  int                     nprof = 1;
+  int                     num;
+  int                     i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (sscanf(argv[i], "--max=%u", &max) == 1 && max && max <= USBSIM_MAX_DEVICES)
+      continue;
+    if (sscanf(argv[i], "--runs=%u", &runs) == 1 && runs)
+      continue;
+    if (!strncmp(argv[i], "--profiles=", 11) && argv[i][11])
+    {
+      file = argv[i] + 11;
+      continue;
+    }
+    usage();
+  }
+
+  if (file)
+  {
+    nprof = usbsim_load_profiles(file, prof, USBSIM_MAX_DEVICES);
+    if (nprof <= 0)
+      my_error("Unable to read any adapter profiles");
+  }
+  else
+    usbsim_default_profile(&prof[0]);
+
+  printf("%8s", "adapters");
+  for (i = 0; i < NUM_STAGES; i++)
+    printf(" %9s", stage_name[i]);
+  printf(" %9s   (ms, mean of %u)\n", "total", runs);
+
+  for (num = 1; num <= (int)max; num++)
+  {
+    double       ms[NUM_STAGES] = { 0 };
+    double       total          = 0;
+    unsigned int run;
+
+    for (run = 0; run < runs; run++)
+      bench(prof, nprof, num, ms);
+
+    printf("%8d", num);
+    for (i = 0; i < NUM_STAGES; i++)
+    {
+      printf(" %9.2f", ms[i] / runs);
+      total += ms[i] / runs;
+    }
+    printf(" %9.2f\n", total);
+  }
+
+  return 0;
+}
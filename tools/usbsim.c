@@ -0,0 +1,656 @@
+/** @file usbsim.c
+ *
+ *  @brief Simulated libusb 0.1 backend for benchmarking libdlo without hardware.
+ *
+ *  The functions in this file replace the libusb functions that libdlo calls. Because
+ *  they are defined by the executable, the dynamic linker uses them in preference to
+ *  the ones in libusb. Only the requests made by libdlo are understood; anything else
+ *  fails as if the device had stalled the request.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include "usb.h"
+#include "usbsim.h"
+
+
+/* File-scope defines ------------------------------------------------------------------*/
+
+
+#define NR_USB_REQUEST_STATUS_DW  (0x06)  /**< USB control message: request type. */
+#define NR_USB_REQUEST_CHANNEL    (0x12)  /**< USB control message: request type. */
+#define NR_USB_REQUEST_I2C_SUB_IO (0x02)  /**< USB control message: request type. */
+
+/** USB VendorID for a DisplayLink device.
+ */
+#define VENDORID_DISPLAYLINK (0x17E9)
+
+/** USB ProductID reported by the simulated adapters.
+ */
+#define PRODUCTID_SIM (0x01A0)
+
+/** String descriptor index of the serial number.
+ */
+#define SERIAL_INDEX (3)
+
+/** Number of interfaces in the simulated adapter's configuration.
+ */
+#define NUM_INTERFACES (1)
+
+/** Longest line accepted in a profile file.
+ */
+#define LINE_SZ (1024)
+
+
+/* File-scope types --------------------------------------------------------------------*/
+
+
+/** A simulated adapter plugged into the bus.
+ */
+typedef struct sim_dev_s
+{
+  usbsim_profile_t                   prof;     /**< Profile the adapter was created from. */
+  struct usb_device                  udev;     /**< Device structure returned by libusb calls. */
+  struct usb_config_descriptor       config;   /**< The adapter's only configuration. */
+  bool                               attached; /**< A kernel driver is bound to the adapter. */
+  bool                               claimed;  /**< Interface 0 has been claimed. */
+} sim_dev_t;                                   /**< A struct @a sim_dev_s. */
+
+
+/** Definition of the handle type which libusb leaves opaque.
+ */
+struct usb_dev_handle
+{
+  sim_dev_t *sim;                              /**< Adapter the handle refers to. */
+};
+
+
+/* File-scope variables ----------------------------------------------------------------*/
+
+
+/** The simulated adapters, in the order they were plugged in.
+ */
+static sim_dev_t devices[USBSIM_MAX_DEVICES];
+
+/** Number of entries in use in @a devices.
+ */
+static int num_devices = 0;
+
+/** Number of those adapters which libusb has been asked to find.
+ */
+static int num_found = 0;
+
+/** The single simulated bus.
+ */
+static struct usb_bus bus;
+
+/** Flag to indicate that @a bus has been reported by @c usb_find_busses().
+ */
+static bool bus_found = false;
+
+/** Message returned by @c usb_strerror().
+ */
+static char err_str[64] = "";
+
+/** Buffer which bulk transfers are copied into (or NULL if they aren't being kept).
+ */
+static uint8_t *capture_buf = NULL;
+
+/** Size of @a capture_buf (bytes).
+ */
+static size_t capture_size = 0;
+
+/** Number of bytes written to the bulk endpoint since capturing started.
+ */
+static size_t capture_len = 0;
+
+/** Number of bulk transfers still to fail.
+ */
+static uint32_t bulk_fails = 0;
+
+
+/* File-scope function declarations ----------------------------------------------------*/
+
+
+/** Spend the given amount of time inside a libusb call.
+ *
+ *  @param  us  Latency in microseconds.
+ */
+static void delay(const uint32_t us);
+
+
+/** Note an error for @c usb_strerror() to return.
+ *
+ *  @param  str  Pointer to the error message.
+ *  @param  ret  Negative errno value to return.
+ *
+ *  @return  @a ret.
+ */
+static int fail(const char * const str, const int ret);
+
+
+/** Fill in a default EDID for a 1280x1024 60 Hz monitor.
+ *
+ *  @param  edid  Buffer of @c USBSIM_EDID_SZ bytes.
+ */
+static void default_edid(uint8_t * const edid);
+
+
+/** Apply one @c key=value word from a profile file.
+ *
+ *  @param  prof  Profile to update.
+ *  @param  word  The word (modified).
+ *
+ *  @return  true if the word was understood, false if not.
+ */
+static bool parse_word(usbsim_profile_t * const prof, char * const word);
+
+
+/* Public function definitions ---------------------------------------------------------*/
+
+
+void usbsim_default_profile(usbsim_profile_t * const prof)
+{
+  memset(prof, 0, sizeof(*prof));
+  strcpy(prof->serial, "SIM00000");
+  prof->status    = 0xF0;
+  prof->driver    = false;
+  prof->open_us   = 2000;
+  prof->status_us = 250;
+  prof->string_us = 500;
+  prof->i2c_us    = 250;
+  prof->chan_us   = 250;
+  prof->detach_us = 1000;
+  prof->config_us = 2000;
+  prof->claim_us  = 200;
+  prof->bulk_us   = 125;
+  prof->bulk_kbps = 30000;
+  default_edid(prof->edid);
+}
+
+
+int usbsim_load_profiles(const char * const path, usbsim_profile_t * const prof, const int max)
+{
+  FILE *in = fopen(path, "r");
+  char  line[LINE_SZ];
+  int   num  = 0;
+  int   lnum = 0;
+
+  if (!in)
+    return -1;
+
+  while (num < max && fgets(line, sizeof(line), in))
+  {
+    char *hash = strchr(line, '#');
+    char *word;
+    bool  any  = false;
+
+    lnum++;
+    if (hash)
+      *hash = '\0';
+
+    for (word = strtok(line, " \t\r\n"); word; word = strtok(NULL, " \t\r\n"))
+    {
+      if (!any)
+        usbsim_default_profile(&prof[num]);
+      any = true;
+      if (!parse_word(&prof[num], word))
+      {
+        fprintf(stderr, "usbsim: %s:%d: bad setting '%s'\n", path, lnum, word);
+        fclose(in);
+        return -1;
+      }
+    }
+    if (any)
+      num++;
+  }
+  fclose(in);
+
+  return num;
+}
+
+
+void usbsim_reset(void)
+{
+  num_devices = 0;
+  num_found   = 0;
+  bus_found   = false;
+  memset(&bus, 0, sizeof(bus));
+}
+
+
+bool usbsim_add_device(const usbsim_profile_t * const prof)
+{
+  sim_dev_t *sim;
+
+  if (num_devices >= USBSIM_MAX_DEVICES)
+    return false;
+
+  sim = &devices[num_devices++];
+  memset(sim, 0, sizeof(*sim));
+  sim->prof     = *prof;
+  sim->attached = prof->driver;
+
+  sim->config.bLength             = USB_DT_CONFIG_SIZE;
+  sim->config.bDescriptorType     = USB_DT_CONFIG;
+  sim->config.bNumInterfaces      = NUM_INTERFACES;
+  sim->config.bConfigurationValue = 1;
+
+  sim->udev.descriptor.bLength            = USB_DT_DEVICE_SIZE;
+  sim->udev.descriptor.bDescriptorType    = USB_DT_DEVICE;
+  sim->udev.descriptor.idVendor           = VENDORID_DISPLAYLINK;
+  sim->udev.descriptor.idProduct          = PRODUCTID_SIM;
+  sim->udev.descriptor.iSerialNumber      = SERIAL_INDEX;
+  sim->udev.descriptor.bNumConfigurations = 1;
+  sim->udev.config = &sim->config;
+  sim->udev.bus    = &bus;
+  sim->udev.devnum = (uint8_t)num_devices;
+  snprintf(sim->udev.filename, sizeof(sim->udev.filename), "%03d", num_devices);
+
+  return true;
+}
+
+
+void usbsim_capture(uint8_t * const buf, const size_t size)
+{
+  capture_buf  = buf;
+  capture_size = buf ? size : 0;
+  capture_len  = 0;
+}
+
+
+size_t usbsim_captured(void)
+{
+  return capture_len;
+}
+
+
+void usbsim_fail_bulk(const uint32_t num)
+{
+  bulk_fails = num;
+}
+
+
+/* Replacement libusb function definitions ---------------------------------------------*/
+
+
+void usb_init(void)
+{
+  strcpy(bus.dirname, "sim");
+}
+
+
+int usb_find_busses(void)
+{
+  if (bus_found)
+    return 0;
+  bus_found = true;
+
+  return 1;
+}
+
+
+int usb_find_devices(void)
+{
+  int changes = num_devices - num_found;
+  int i;
+
+  /* Link up the device list, so that adapters plugged in since the last call appear */
+  bus.devices = num_devices ? &devices[0].udev : NULL;
+  for (i = 0; i < num_devices; i++)
+  {
+    devices[i].udev.prev = i ? &devices[i - 1].udev : NULL;
+    devices[i].udev.next = i + 1 < num_devices ? &devices[i + 1].udev : NULL;
+  }
+  num_found = num_devices;
+
+  return changes;
+}
+
+
+struct usb_bus *usb_get_busses(void)
+{
+  return bus_found ? &bus : NULL;
+}
+
+
+usb_dev_handle *usb_open(struct usb_device *dev)
+{
+  usb_dev_handle *hand = malloc(sizeof(usb_dev_handle));
+
+  if (!hand)
+    return NULL;
+
+  hand->sim = (sim_dev_t *)((char *)dev - offsetof(sim_dev_t, udev));
+  delay(hand->sim->prof.open_us);
+
+  return hand;
+}
+
+
+int usb_close(usb_dev_handle *dev)
+{
+  free(dev);
+
+  return 0;
+}
+
+
+int usb_control_msg(usb_dev_handle *dev, int requesttype, int request, int value, int index, char *bytes, int size, int timeout)
+{
+  const usbsim_profile_t *prof = &dev->sim->prof;
+
+  (void) index;
+  (void) timeout;
+
+  switch (request)
+  {
+    case NR_USB_REQUEST_STATUS_DW:
+      if (!(requesttype & USB_ENDPOINT_IN) || size < 4)
+        break;
+      delay(prof->status_us);
+      memset(bytes, 0, size);
+      bytes[3] = (char)prof->status;
+      return size;
+
+    case NR_USB_REQUEST_I2C_SUB_IO:
+      if (!(requesttype & USB_ENDPOINT_IN) || size < 2)
+        break;
+      delay(prof->i2c_us);
+      bytes[0] = 0;
+      bytes[1] = (char)prof->edid[((unsigned)value >> 8) % USBSIM_EDID_SZ];
+      return size;
+
+    case NR_USB_REQUEST_CHANNEL:
+      if (requesttype & USB_ENDPOINT_IN)
+        break;
+      delay(prof->chan_us);
+      return size;
+  }
+  return fail("usbsim: unsupported control request", -EPIPE);
+}
+
+
+int usb_get_string_simple(usb_dev_handle *dev, int index, char *buf, size_t buflen)
+{
+  size_t len;
+
+  delay(dev->sim->prof.string_us);
+  if (index != SERIAL_INDEX || !buflen)
+    return fail("usbsim: no such string descriptor", -EPIPE);
+
+  len = strlen(dev->sim->prof.serial);
+  if (len >= buflen)
+    len = buflen - 1;
+  memcpy(buf, dev->sim->prof.serial, len);
+  buf[len] = '\0';
+
+  return (int)len;
+}
+
+
+int usb_get_driver_np(usb_dev_handle *dev, int interface, char *name, unsigned int namelen)
+{
+  if (interface >= NUM_INTERFACES || !dev->sim->attached)
+    return fail("usbsim: no driver attached", -ENODATA);
+
+  snprintf(name, namelen, "usbhid");
+
+  return 0;
+}
+
+
+int usb_detach_kernel_driver_np(usb_dev_handle *dev, int interface)
+{
+  if (interface >= NUM_INTERFACES || !dev->sim->attached)
+    return fail("usbsim: no driver attached", -ENODATA);
+
+  delay(dev->sim->prof.detach_us);
+  dev->sim->attached = false;
+
+  return 0;
+}
+
+
+int usb_set_configuration(usb_dev_handle *dev, int configuration)
+{
+  if (configuration != 1)
+    return fail("usbsim: no such configuration", -EINVAL);
+  if (dev->sim->attached)
+    return fail("usbsim: device busy", -EBUSY);
+
+  delay(dev->sim->prof.config_us);
+
+  return 0;
+}
+
+
+int usb_claim_interface(usb_dev_handle *dev, int interface)
+{
+  if (interface >= NUM_INTERFACES)
+    return fail("usbsim: no such interface", -EINVAL);
+  if (dev->sim->claimed || dev->sim->attached)
+    return fail("usbsim: interface busy", -EBUSY);
+
+  delay(dev->sim->prof.claim_us);
+  dev->sim->claimed = true;
+
+  return 0;
+}
+
+
+int usb_release_interface(usb_dev_handle *dev, int interface)
+{
+  if (interface >= NUM_INTERFACES || !dev->sim->claimed)
+    return fail("usbsim: interface not claimed", -EINVAL);
+
+  delay(dev->sim->prof.claim_us);
+  dev->sim->claimed = false;
+
+  return 0;
+}
+
+
+int usb_bulk_write(usb_dev_handle *dev, int ep, const char *bytes, int size, int timeout)
+{
+  const usbsim_profile_t *prof = &dev->sim->prof;
+  uint64_t                us   = prof->bulk_us;
+
+  (void) timeout;
+
+  if (ep != 1 || !dev->sim->claimed)
+    return fail("usbsim: bad bulk endpoint", -EPIPE);
+
+  if (bulk_fails)
+  {
+    bulk_fails--;
+    return fail("usbsim: bulk transfer timed out", -ETIMEDOUT);
+  }
+
+  /* Keep as much of the transfer as there's room for */
+  if (capture_len < capture_size)
+    memcpy(capture_buf + capture_len, bytes,
+           (size_t)size < capture_size - capture_len ? (size_t)size : capture_size - capture_len);
+  capture_len += (size_t)size;
+
+  /* Bytes divided by kilobytes per second gives milliseconds */
+  if (prof->bulk_kbps)
+    us += ((uint64_t)size * 1000u) / prof->bulk_kbps;
+  delay((uint32_t)us);
+
+  return size;
+}
+
+
+char *usb_strerror(void)
+{
+  return err_str;
+}
+
+
+/* File-scope function definitions -----------------------------------------------------*/
+
+
+static void delay(const uint32_t us)
+{
+  struct timespec ts;
+
+  if (!us)
+    return;
+
+  ts.tv_sec  = us / 1000000u;
+  ts.tv_nsec = (us % 1000000u) * 1000u;
+  while (nanosleep(&ts, &ts) && errno == EINTR)
+    ;
+}
+
+
+static int fail(const char * const str, const int ret)
+{
+  snprintf(err_str, sizeof(err_str), "%s", str);
+
+  return ret;
+}
+
+
+static void default_edid(uint8_t * const edid)
+{
+  /* Header, vendor "DLS", product 0x0001, EDID 1.3, digital input, 38x30 cm */
+  static const uint8_t base[0x36] =
+  {
+    0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x11, 0x93, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x13, 0x01, 0x03, 0x80, 0x26, 0x1E, 0x78, 0x0A, 0xEE, 0x91, 0xA3, 0x54, 0x4C, 0x99, 0x26,
+    0x0F, 0x50, 0x54, 0x00, 0x08, 0x00, 0x81, 0x80, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01
+  };
+  /* Detailed timing: 108 MHz, 1280+408 x 1024+42, sync 48/112 and 1/3, 376x301 mm */
+  static const uint8_t timing[0x12] =
+  {
+    0x30, 0x2A, 0x00, 0x98, 0x51, 0x00, 0x2A, 0x40, 0x30, 0x70, 0x13, 0x00, 0x78, 0x2D, 0x11, 0x00,
+    0x00, 0x1E
+  };
+  uint8_t sum = 0;
+  int     i;
+
+  memset(edid, 0, USBSIM_EDID_SZ);
+  memcpy(edid, base, sizeof(base));
+  memcpy(edid + 0x36, timing, sizeof(timing));
+
+  /* The remaining descriptors are unused (dummy descriptor tag 0x10) */
+  for (i = 1; i < 4; i++)
+    edid[0x36 + (i * 0x12) + 3] = 0x10;
+
+  for (i = 0; i < USBSIM_EDID_SZ - 1; i++)
+    sum += edid[i];
+  edid[USBSIM_EDID_SZ - 1] = (uint8_t)(0x100 - sum);
+}
+
+
+static bool parse_word(usbsim_profile_t * const prof, char * const word)
+{
+  static const struct
+  {
+    const char *key;
+    size_t      offset;
+  } lat[] =
+  {
+    { "open_us",   offsetof(usbsim_profile_t, open_us)   },
+    { "status_us", offsetof(usbsim_profile_t, status_us) },
+    { "string_us", offsetof(usbsim_profile_t, string_us) },
+    { "i2c_us",    offsetof(usbsim_profile_t, i2c_us)    },
+    { "chan_us",   offsetof(usbsim_profile_t, chan_us)   },
+    { "detach_us", offsetof(usbsim_profile_t, detach_us) },
+    { "config_us", offsetof(usbsim_profile_t, config_us) },
+    { "claim_us",  offsetof(usbsim_profile_t, claim_us)  },
+    { "bulk_us",   offsetof(usbsim_profile_t, bulk_us)   },
+    { "bulk_kbps", offsetof(usbsim_profile_t, bulk_kbps) }
+  };
+  char  *val = strchr(word, '=');
+  char  *end;
+  size_t i;
+
+  if (!val)
+    return false;
+  *val++ = '\0';
+
+  if (!strcmp(word, "serial"))
+  {
+    if (strlen(val) >= sizeof(prof->serial))
+      return false;
+    strcpy(prof->serial, val);
+    return true;
+  }
+  if (!strcmp(word, "type"))
+  {
+    if (!strcmp(val, "base"))
+      prof->status = 0xB0;
+    else if (!strcmp(val, "alex"))
+      prof->status = 0xF0;
+    else if (!strcmp(val, "ollie"))
+      prof->status = 0xF1;
+    else
+    {
+      unsigned long num = strtoul(val, &end, 0);
+
+      if (*end || num > 0xFF)
+        return false;
+      prof->status = (uint8_t)num;
+    }
+    return true;
+  }
+  if (!strcmp(word, "edid"))
+  {
+    FILE *in = fopen(val, "rb");
+    bool  ok = in && fread(prof->edid, USBSIM_EDID_SZ, 1, in) == 1;
+
+    if (in)
+      fclose(in);
+    return ok;
+  }
+  if (!strcmp(word, "driver"))
+  {
+    if (strcmp(val, "0") && strcmp(val, "1"))
+      return false;
+    prof->driver = val[0] == '1';
+    return true;
+  }
+  for (i = 0; i < sizeof(lat) / sizeof(lat[0]); i++)
+  {
+    if (!strcmp(word, lat[i].key))
+    {
+      unsigned long num = strtoul(val, &end, 0);
+
+      if (!isdigit((unsigned char)*val) || *end || num > UINT32_MAX)
+        return false;
+      *(uint32_t *)((char *)prof + lat[i].offset) = (uint32_t)num;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/* End of file -------------------------------------------------------------------------*/
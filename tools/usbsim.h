@@ -0,0 +1,140 @@
+/** @file usbsim.h
+ *
+ *  @brief Simulated libusb 0.1 backend for benchmarking libdlo without hardware.
+ *
+ *  A program which links usbsim.c provides its own definitions of the libusb 0.1
+ *  functions used by libdlo, so the library talks to simulated adapters instead of
+ *  the real USB bus. Each adapter answers the control requests made while enumerating,
+ *  claiming and setting the mode of a device from a profile, which supplies its serial
+ *  number, device type, EDID and the latency of each kind of request.
+ *
+ *  DisplayLink Open Source Software (libdlo)
+ *  Copyright (C) 2009, DisplayLink
+ *  www.displaylink.com
+ *
+ *  This library is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU Library General Public License as published by the Free
+ *  Software Foundation; LGPL version 2, dated June 1991.
+ *
+ *  This library is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU Library General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU Library General Public License
+ *  along with this library; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef USBSIM_H
+#define USBSIM_H          /**< Avoid multiple inclusion. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/** Maximum number of simulated adapters. */
+#define USBSIM_MAX_DEVICES (64)
+
+/** Maximum length of a simulated serial number string (including terminator). */
+#define USBSIM_SERIAL_SZ (64)
+
+/** Size of a simulated EDID structure (bytes). */
+#define USBSIM_EDID_SZ (128)
+
+
+/** Description of a simulated adapter and the monitor attached to it.
+ *
+ *  All latencies are in microseconds and are spent sleeping in the libusb call which
+ *  makes the corresponding request.
+ */
+typedef struct usbsim_profile_s
+{
+  char     serial[USBSIM_SERIAL_SZ];  /**< Serial number string. */
+  uint8_t  status;                    /**< Last byte of the status request reply (device type). */
+  uint8_t  edid[USBSIM_EDID_SZ];      /**< EDID returned by the monitor. */
+  bool     driver;                    /**< A kernel driver has to be detached before claiming. */
+  uint32_t open_us;                   /**< Latency of opening a device handle. */
+  uint32_t status_us;                 /**< Latency of the status request. */
+  uint32_t string_us;                 /**< Latency of reading a string descriptor. */
+  uint32_t i2c_us;                    /**< Latency of each I2C (EDID byte) request. */
+  uint32_t chan_us;                   /**< Latency of a channel select request. */
+  uint32_t detach_us;                 /**< Latency of detaching a kernel driver. */
+  uint32_t config_us;                 /**< Latency of setting the configuration. */
+  uint32_t claim_us;                  /**< Latency of claiming (or releasing) the interface. */
+  uint32_t bulk_us;                   /**< Fixed latency of each bulk transfer. */
+  uint32_t bulk_kbps;                 /**< Bulk throughput in kilobytes per second (zero for unlimited). */
+} usbsim_profile_t;                   /**< A struct @a usbsim_profile_s. */
+
+
+/** Fill in a profile with the defaults: an "Alex" adapter with a 1280x1024 monitor and
+ *  latencies typical of a full speed control endpoint behind a hub.
+ *
+ *  @param  prof  Pointer to the profile to fill in.
+ */
+extern void usbsim_default_profile(usbsim_profile_t * const prof);
+
+
+/** Read adapter profiles from a text file.
+ *
+ *  @param  path  Name of the file to read.
+ *  @param  prof  Array of profiles to fill in.
+ *  @param  max   Number of entries in @a prof.
+ *
+ *  @return  Number of profiles read, or -1 if the file couldn't be read.
+ *
+ *  Each line describes one adapter as a list of @c key=value words, starting from the
+ *  default profile. The keys are @c serial, @c type (@c base, @c alex, @c ollie or a
+ *  number), @c edid (name of a file holding a 128 byte EDID), @c driver (0 or 1) and the
+ *  latencies @c open_us, @c status_us, @c string_us, @c i2c_us, @c chan_us, @c detach_us,
+ *  @c config_us, @c claim_us, @c bulk_us and @c bulk_kbps. Blank lines and anything after
+ *  a @c # are ignored.
+ */
+extern int usbsim_load_profiles(const char * const path, usbsim_profile_t * const prof, const int max);
+
+
+/** Remove all of the simulated adapters from the bus.
+ */
+extern void usbsim_reset(void);
+
+
+/** Plug a simulated adapter into the bus.
+ *
+ *  @param  prof  Pointer to the adapter's profile (copied).
+ *
+ *  @return  true if the adapter was added, false if the bus is full.
+ *
+ *  The adapter shows up the next time libusb is asked to find devices.
+ */
+extern bool usbsim_add_device(const usbsim_profile_t * const prof);
+
+
+/** Keep a copy of the bytes which are written to the simulated adapters' bulk endpoint.
+ *
+ *  @param  buf   Pointer to the buffer to copy them into (or NULL to stop keeping them).
+ *  @param  size  Size of the buffer (bytes).
+ *
+ *  The count of bytes written starts again from zero. Bytes which don't fit in the
+ *  buffer are counted, but not kept.
+ */
+extern void usbsim_capture(uint8_t * const buf, const size_t size);
+
+
+/** Find out how many bytes have been written to the bulk endpoint since @c usbsim_capture().
+ *
+ *  @return  Number of bytes written (including any which didn't fit in the buffer).
+ */
+extern size_t usbsim_captured(void);
+
+
+/** Make the next few bulk transfers fail, as if the adapter had stopped responding.
+ *
+ *  @param  num  Number of transfers to fail.
+ *
+ *  Failed transfers aren't captured (see @c usbsim_capture()).
+ */
+extern void usbsim_fail_bulk(const uint32_t num);
+
+
+#endif